@@ -0,0 +1,394 @@
+#include "AgniArchive.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <AgniProtocol.h>
+
+// ============================================================================
+// SAMPLE CONVERSION
+// ============================================================================
+static int32_t fixedPoint(double value, double scale) {
+  return (int32_t)lround(value * scale);
+}
+
+void archiveSampleFromRecord(const SoilRecord &record, ArchiveSample &sample) {
+  const GpsFix &fix = record.fix;
+  const SensorData &soil = record.soil;
+  int32_t* v = sample.values;
+  v[ARCHIVE_ID] = (int32_t)record.id;
+  v[ARCHIVE_TIME] = (int32_t)fixToUnixTime(fix);
+  v[ARCHIVE_FLAGS] = (fix.valid ? ARCHIVE_FLAG_FIX : 0) | (soil.basicValid ? ARCHIVE_FLAG_BASIC : 0) |
+                     (soil.npkValid ? ARCHIVE_FLAG_NPK : 0);
+  v[ARCHIVE_LATITUDE] = fix.valid ? fixedPoint(fix.latitude, 1e7) : 0;
+  v[ARCHIVE_LONGITUDE] = fix.valid ? fixedPoint(fix.longitude, 1e7) : 0;
+  v[ARCHIVE_ALTITUDE] = fix.valid ? fixedPoint(fix.altitude, 10) : 0;
+  v[ARCHIVE_SATELLITES] = fix.valid ? fix.satellites : 0;
+  v[ARCHIVE_SPEED] = fix.valid ? fixedPoint(fix.speedKmh, 100) : 0;
+  v[ARCHIVE_HDOP] = fix.valid ? fixedPoint(fix.hdop, 100) : 0;
+  v[ARCHIVE_PH] = fixedPoint(soil.ph, 100);
+  v[ARCHIVE_CONDUCTIVITY] = soil.conductivity;
+  v[ARCHIVE_NITROGEN] = soil.nitrogen;
+  v[ARCHIVE_PHOSPHORUS] = soil.phosphorus;
+  v[ARCHIVE_POTASSIUM] = soil.potassium;
+  v[ARCHIVE_MOISTURE] = fixedPoint(soil.moisture, 10);
+  v[ARCHIVE_TEMPERATURE] = fixedPoint(soil.temperature, 10);
+}
+
+void archiveSampleToRecord(const ArchiveSample &sample, SoilRecord &record) {
+  const int32_t* v = sample.values;
+  record = SoilRecord();
+  record.id = (uint32_t)v[ARCHIVE_ID];
+  GpsFix &fix = record.fix;
+  fix.valid = (v[ARCHIVE_FLAGS] & ARCHIVE_FLAG_FIX) != 0;
+  if (fix.valid) unixTimeToFix((uint32_t)v[ARCHIVE_TIME], fix);
+  fix.latitude = v[ARCHIVE_LATITUDE] / 1e7f;
+  fix.longitude = v[ARCHIVE_LONGITUDE] / 1e7f;
+  fix.altitude = v[ARCHIVE_ALTITUDE] / 10.0f;
+  fix.satellites = v[ARCHIVE_SATELLITES];
+  fix.speedKmh = v[ARCHIVE_SPEED] / 100.0;
+  fix.hdop = v[ARCHIVE_HDOP] / 100.0;
+  SensorData &soil = record.soil;
+  soil.ph = v[ARCHIVE_PH] / 100.0f;
+  soil.conductivity = (uint16_t)v[ARCHIVE_CONDUCTIVITY];
+  soil.nitrogen = (uint16_t)v[ARCHIVE_NITROGEN];
+  soil.phosphorus = (uint16_t)v[ARCHIVE_PHOSPHORUS];
+  soil.potassium = (uint16_t)v[ARCHIVE_POTASSIUM];
+  soil.moisture = v[ARCHIVE_MOISTURE] / 10.0f;
+  soil.temperature = v[ARCHIVE_TEMPERATURE] / 10.0f;
+  soil.basicValid = (v[ARCHIVE_FLAGS] & ARCHIVE_FLAG_BASIC) != 0;
+  soil.npkValid = (v[ARCHIVE_FLAGS] & ARCHIVE_FLAG_NPK) != 0;
+}
+
+// ============================================================================
+// BIT AND VARINT CODING
+// ============================================================================
+namespace {
+
+struct BitWriter {
+  BitWriter(uint8_t* out, size_t capacity) : out(out), capacity(capacity) {}
+  uint8_t* out;
+  size_t capacity;
+  size_t bits = 0;
+  bool overflow = false;
+
+  void put(uint32_t value, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+      size_t byte = bits >> 3;
+      if (byte >= capacity) {
+        overflow = true;
+        return;
+      }
+      if ((bits & 7) == 0) out[byte] = 0;
+      if (value & (1UL << i)) out[byte] |= 0x80 >> (bits & 7);
+      bits++;
+    }
+  }
+  size_t bytes() const { return (bits + 7) >> 3; }
+};
+
+struct BitReader {
+  BitReader(const uint8_t* in, size_t length) : in(in), length(length) {}
+  const uint8_t* in;
+  size_t length;
+  size_t bits = 0;
+  bool overrun = false;
+
+  uint32_t get(int count) {
+    uint32_t value = 0;
+    for (int i = 0; i < count; i++) {
+      size_t byte = bits >> 3;
+      if (byte >= length) {
+        overrun = true;
+        return 0;
+      }
+      value = (value << 1) | ((in[byte] >> (7 - (bits & 7))) & 1);
+      bits++;
+    }
+    return value;
+  }
+};
+
+uint32_t zigzag(uint32_t delta) {
+  int32_t v = (int32_t)delta;
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+uint32_t unzigzag(uint32_t z) {
+  return (z >> 1) ^ (0U - (z & 1));
+}
+
+// Delta-of-delta buckets: 0 | 10+7 | 110+9 | 1110+12 | 1111+32 bits
+void putDeltaOfDelta(BitWriter &w, uint32_t z) {
+  if (z == 0) w.put(0, 1);
+  else if (z < (1UL << 7)) { w.put(0x2, 2); w.put(z, 7); }
+  else if (z < (1UL << 9)) { w.put(0x6, 3); w.put(z, 9); }
+  else if (z < (1UL << 12)) { w.put(0xE, 4); w.put(z, 12); }
+  else { w.put(0xF, 4); w.put(z, 32); }
+}
+
+uint32_t getDeltaOfDelta(BitReader &r) {
+  if (r.get(1) == 0) return 0;
+  if (r.get(1) == 0) return r.get(7);
+  if (r.get(1) == 0) return r.get(9);
+  if (r.get(1) == 0) return r.get(12);
+  return r.get(32);
+}
+
+bool isDeltaOfDelta(int column) {
+  return column == ARCHIVE_ID || column == ARCHIVE_TIME;
+}
+
+/** @brief Encodes one column; returns its length, 0 on overflow. */
+size_t encodeColumn(const ArchiveSample* samples, size_t count, int column, uint8_t* out, size_t capacity) {
+  if (isDeltaOfDelta(column)) {
+    BitWriter w(out, capacity);
+    uint32_t previous = (uint32_t)samples[0].values[column];
+    uint32_t previousDelta = 0;
+    w.put(previous, 32);
+    for (size_t i = 1; i < count; i++) {
+      uint32_t value = (uint32_t)samples[i].values[column];
+      uint32_t delta = value - previous;
+      putDeltaOfDelta(w, zigzag(delta - previousDelta));
+      previous = value;
+      previousDelta = delta;
+    }
+    return w.overflow ? 0 : w.bytes();
+  }
+
+  size_t length = 0;
+  uint32_t previous = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t value = (uint32_t)samples[i].values[column];
+    uint32_t z = zigzag(value - previous);
+    previous = value;
+    do {
+      if (length >= capacity) return 0;
+      uint8_t byte = z & 0x7F;
+      z >>= 7;
+      out[length++] = byte | (z ? 0x80 : 0);
+    } while (z);
+  }
+  return length;
+}
+
+/** @brief Decodes one column into out[0], out[stride], ... */
+bool decodeColumn(const uint8_t* in, size_t length, int column, int32_t* out, size_t stride, size_t count) {
+  if (isDeltaOfDelta(column)) {
+    BitReader r(in, length);
+    uint32_t previous = r.get(32);
+    uint32_t previousDelta = 0;
+    out[0] = (int32_t)previous;
+    for (size_t i = 1; i < count; i++) {
+      uint32_t delta = previousDelta + unzigzag(getDeltaOfDelta(r));
+      previous += delta;
+      previousDelta = delta;
+      out[i * stride] = (int32_t)previous;
+    }
+    return !r.overrun;
+  }
+
+  size_t pos = 0;
+  uint32_t previous = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t z = 0;
+    for (int shift = 0;; shift += 7) {
+      if (pos >= length || shift > 28) return false;
+      uint8_t byte = in[pos++];
+      z |= (uint32_t)(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) break;
+    }
+    previous += unzigzag(z);
+    out[i * stride] = (int32_t)previous;
+  }
+  return pos == length;
+}
+
+void putU16(uint8_t* p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+void putU32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF; }
+uint16_t getU16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+uint32_t getU32(const uint8_t* p) { return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+}  // namespace
+
+// ============================================================================
+// BLOCKS
+// ============================================================================
+size_t encodeArchiveBlock(const ArchiveSample* samples, size_t count, uint8_t* out, size_t capacity) {
+  const size_t directoryBytes = 2 * ARCHIVE_COLUMNS;
+  if (count == 0 || count > ARCHIVE_BLOCK_SAMPLES || capacity < ARCHIVE_HEADER_BYTES + directoryBytes) return 0;
+
+  size_t length = ARCHIVE_HEADER_BYTES + directoryBytes;
+  for (int c = 0; c < ARCHIVE_COLUMNS; c++) {
+    size_t n = encodeColumn(samples, count, c, out + length, capacity - length);
+    if (n == 0 || n > 0xFFFF) return 0;
+    putU16(out + ARCHIVE_HEADER_BYTES + 2 * c, (uint16_t)n);
+    length += n;
+  }
+
+  memcpy(out, ARCHIVE_MAGIC, 4);
+  out[4] = ARCHIVE_VERSION;
+  out[5] = ARCHIVE_COLUMNS;
+  putU16(out + 6, (uint16_t)count);
+  putU32(out + 8, (uint32_t)samples[0].values[ARCHIVE_ID]);
+  putU32(out + 12, (uint32_t)samples[0].values[ARCHIVE_TIME]);
+  putU32(out + 16, (uint32_t)samples[count - 1].values[ARCHIVE_TIME]);
+  putU32(out + 20, crc32_update(0, out + ARCHIVE_HEADER_BYTES, length - ARCHIVE_HEADER_BYTES));
+  return length;
+}
+
+bool readArchiveHeader(const uint8_t* data, size_t length, ArchiveBlockInfo &info) {
+  if (length < ARCHIVE_HEADER_BYTES + 2 * ARCHIVE_COLUMNS) return false;
+  if (memcmp(data, ARCHIVE_MAGIC, 4) != 0 || data[4] != ARCHIVE_VERSION || data[5] != ARCHIVE_COLUMNS) return false;
+  if (getU32(data + 20) != crc32_update(0, data + ARCHIVE_HEADER_BYTES, length - ARCHIVE_HEADER_BYTES)) return false;
+  info.count = getU16(data + 6);
+  info.firstId = getU32(data + 8);
+  info.firstTime = getU32(data + 12);
+  info.lastTime = getU32(data + 16);
+  return info.count > 0 && info.count <= ARCHIVE_BLOCK_SAMPLES;
+}
+
+/** @brief Column c goes to base + c * columnStride, rows rowStride apart. */
+static size_t decodeBlock(const uint8_t* data, size_t length, int32_t* base, size_t columnStride, size_t rowStride,
+                          size_t maxSamples) {
+  ArchiveBlockInfo info;
+  if (!readArchiveHeader(data, length, info) || info.count > maxSamples) return 0;
+  size_t pos = ARCHIVE_HEADER_BYTES + 2 * ARCHIVE_COLUMNS;
+  for (int c = 0; c < ARCHIVE_COLUMNS; c++) {
+    size_t n = getU16(data + ARCHIVE_HEADER_BYTES + 2 * c);
+    if (pos + n > length || !decodeColumn(data + pos, n, c, base + c * columnStride, rowStride, info.count)) return 0;
+    pos += n;
+  }
+  return pos == length ? info.count : 0;
+}
+
+size_t decodeArchiveBlock(const uint8_t* data, size_t length, ArchiveSample* out, size_t maxSamples) {
+  return decodeBlock(data, length, out[0].values, 1, ARCHIVE_COLUMNS, maxSamples);
+}
+
+size_t decodeArchiveColumns(const uint8_t* data, size_t length, ArchiveColumns &out) {
+  out.count = decodeBlock(data, length, out.values[0], ARCHIVE_BLOCK_SAMPLES, 1, ARCHIVE_BLOCK_SAMPLES);
+  return out.count;
+}
+
+// ============================================================================
+// WRITER
+// ============================================================================
+void ArchiveWriter::blockPath(uint32_t number, char* out, size_t capacity) {
+  snprintf(out, capacity, ARCHIVE_DIR "/" ARCHIVE_FILE_PREFIX "%lu" ARCHIVE_FILE_SUFFIX, (unsigned long)number);
+}
+
+uint32_t ArchiveWriter::parseBlockNumber(const char* name) {
+  const size_t prefixLen = sizeof(ARCHIVE_FILE_PREFIX) - 1;
+  const size_t suffixLen = sizeof(ARCHIVE_FILE_SUFFIX) - 1;
+  size_t len = strlen(name);
+  if (len <= prefixLen + suffixLen) return 0;
+  if (strncmp(name, ARCHIVE_FILE_PREFIX, prefixLen) != 0) return 0;
+  if (strcmp(name + len - suffixLen, ARCHIVE_FILE_SUFFIX) != 0) return 0;
+  return (uint32_t)strtoul(name + prefixLen, nullptr, 10);
+}
+
+size_t ArchiveWriter::loadBlock(HalFileSystem &fs, uint32_t number, ArchiveColumns &out) {
+  out.count = 0;
+  char path[ARCHIVE_PATH_MAX];
+  blockPath(number, path, sizeof(path));
+  std::unique_ptr<HalFile> file = fs.open(path, HAL_FILE_READ);
+  if (!file) return 0;
+  uint32_t size = file->size();
+  std::unique_ptr<uint8_t[]> block(new uint8_t[size]);
+  bool read = file->read(block.get(), size) == size;
+  file->close();
+  return read ? decodeArchiveColumns(block.get(), size, out) : 0;
+}
+
+bool ArchiveWriter::begin() {
+  stagedCount = 0;
+  stagedSince = clock.millis();
+  lastId = 0;
+  nextBlock = 1;
+  if (!fs.exists(ARCHIVE_DIR) && !fs.mkdir(ARCHIVE_DIR)) return false;
+
+  uint32_t highest = 0;
+  std::unique_ptr<HalDir> dir = fs.openDir(ARCHIVE_DIR);
+  HalDirEntry entry;
+  while (dir && dir->next(entry)) {
+    uint32_t n = parseBlockNumber(entry.name);
+    if (n > highest) highest = n;
+  }
+  if (dir) dir->close();
+  nextBlock = highest + 1;
+
+  // The newest block's last id; the (still empty) staging area is the scratch
+  if (highest) {
+    char path[ARCHIVE_PATH_MAX];
+    blockPath(highest, path, sizeof(path));
+    std::unique_ptr<HalFile> file = fs.open(path, HAL_FILE_READ);
+    if (file) {
+      uint32_t size = file->size();
+      std::unique_ptr<uint8_t[]> block(new uint8_t[size]);
+      if (file->read(block.get(), size) == size) {
+        size_t count = decodeArchiveBlock(block.get(), size, staging, ARCHIVE_BLOCK_SAMPLES);
+        if (count) lastId = (uint32_t)staging[count - 1].values[ARCHIVE_ID];
+      }
+      file->close();
+    }
+  }
+
+  // Reload staged samples; ones already sealed (a crash between writing the
+  // block and clearing the staging file) are skipped
+  std::unique_ptr<HalFile> stagingFile = fs.open(ARCHIVE_STAGING_FILE, HAL_FILE_READ);
+  if (stagingFile) {
+    ArchiveSample sample;
+    while (stagedCount < ARCHIVE_BLOCK_SAMPLES &&
+           stagingFile->read((uint8_t*)&sample, sizeof(sample)) == sizeof(sample)) {
+      if ((uint32_t)sample.values[ARCHIVE_ID] > lastId) staging[stagedCount++] = sample;
+    }
+    stagingFile->close();
+  }
+  return true;
+}
+
+bool ArchiveWriter::add(const ArchiveSample &sample) {
+  if (stagedCount >= ARCHIVE_BLOCK_SAMPLES && !seal()) return false;
+
+  std::unique_ptr<HalFile> file = fs.open(ARCHIVE_STAGING_FILE, HAL_FILE_APPEND);
+  if (!file || file->write((const uint8_t*)&sample, sizeof(sample)) != sizeof(sample)) {
+    if (file) file->close();
+    counters.stagingFailures++;
+    return false;
+  }
+  file->close();
+  if (stagedCount == 0) stagedSince = clock.millis();
+  staging[stagedCount++] = sample;
+  counters.samples++;
+  return stagedCount < ARCHIVE_BLOCK_SAMPLES || seal();
+}
+
+bool ArchiveWriter::seal() {
+  if (stagedCount == 0) return true;
+  uint64_t startUs = clock.micros();
+  std::unique_ptr<uint8_t[]> block(new uint8_t[ARCHIVE_BLOCK_MAX_BYTES]);
+  size_t length = encodeArchiveBlock(staging, stagedCount, block.get(), ARCHIVE_BLOCK_MAX_BYTES);
+
+  char path[ARCHIVE_PATH_MAX];
+  blockPath(nextBlock, path, sizeof(path));
+  std::unique_ptr<HalFile> file = length ? fs.open(path, HAL_FILE_WRITE) : std::unique_ptr<HalFile>();
+  bool ok = file && file->write(block.get(), length) == length;
+  if (file) file->close();
+  if (!ok) {
+    fs.remove(path);
+    counters.sealFailures++;
+    return false;
+  }
+
+  fs.remove(ARCHIVE_STAGING_FILE);
+  lastId = (uint32_t)staging[stagedCount - 1].values[ARCHIVE_ID];
+  nextBlock++;
+  stagedCount = 0;
+  stagedSince = clock.millis();
+  counters.blocks++;
+  counters.blockBytes += length;
+  counters.sealUs.record((uint32_t)(clock.micros() - startUs));
+  return true;
+}
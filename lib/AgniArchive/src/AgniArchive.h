@@ -0,0 +1,169 @@
+#ifndef AGNI_ARCHIVE_H
+#define AGNI_ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniHal.h>
+#include <AgniMetrics.h>
+#include <AgniRecord.h>
+
+// ============================================================================
+// COLUMNAR ARCHIVE BLOCKS
+// ============================================================================
+// Long-term history: up to ARCHIVE_BLOCK_SAMPLES samples per sealed block,
+// one file per block (/archive/block_<n>.agb), stored column by column:
+//
+//   0   "AGBK"
+//   4   u8  version (1)
+//   5   u8  column count
+//   6   u16 sample count
+//   8   u32 first record id
+//   12  u32 first timestamp (unix s, 0 = no fix)
+//   16  u32 last timestamp
+//   20  u32 CRC-32 of everything after the header
+//   24  u16 encoded bytes per column
+//   ..  column payloads, in ArchiveColumn order
+//
+// id and time are delta-of-delta bit-packed Gorilla style; every other
+// column is a zigzag varint delta against the previous sample. Values are
+// fixed point at the sensor's own resolution, so nothing is lost against
+// what the ZTS-3002 reports.
+//
+// Samples wait in a staging file (raw ArchiveSample, appended on every
+// add()) until the block is full or the caller seals it, so a reboot
+// loses nothing. All multi-byte fields are little-endian.
+
+#define ARCHIVE_DIR            "/archive"
+#define ARCHIVE_FILE_PREFIX    "block_"
+#define ARCHIVE_FILE_SUFFIX    ".agb"
+#define ARCHIVE_STAGING_FILE   "/archive_staging.bin"   // outside ARCHIVE_DIR so transfers skip it
+#define ARCHIVE_MAGIC          "AGBK"
+#define ARCHIVE_VERSION        1
+#define ARCHIVE_HEADER_BYTES   24
+#define ARCHIVE_BLOCK_SAMPLES  128
+#define ARCHIVE_PATH_MAX       48
+
+enum ArchiveColumn {
+  ARCHIVE_ID,           // record id
+  ARCHIVE_TIME,         // unix seconds UTC, 0 without fix
+  ARCHIVE_FLAGS,        // ARCHIVE_FLAG_*
+  ARCHIVE_LATITUDE,     // degrees x 1e7
+  ARCHIVE_LONGITUDE,    // degrees x 1e7
+  ARCHIVE_ALTITUDE,     // metres x 10
+  ARCHIVE_SATELLITES,
+  ARCHIVE_SPEED,        // km/h x 100
+  ARCHIVE_HDOP,         // x 100
+  ARCHIVE_PH,           // x 100
+  ARCHIVE_CONDUCTIVITY, // uS/cm
+  ARCHIVE_NITROGEN,     // mg/kg
+  ARCHIVE_PHOSPHORUS,
+  ARCHIVE_POTASSIUM,
+  ARCHIVE_MOISTURE,     // % x 10
+  ARCHIVE_TEMPERATURE,  // degC x 10
+  ARCHIVE_COLUMNS
+};
+
+#define ARCHIVE_FLAG_FIX        0x01
+#define ARCHIVE_FLAG_BASIC      0x02
+#define ARCHIVE_FLAG_NPK        0x04
+
+// Worst case: 36 bits for each delta-of-delta column, 5-byte varints elsewhere
+#define ARCHIVE_BLOCK_MAX_BYTES \
+  (ARCHIVE_HEADER_BYTES + 2 * ARCHIVE_COLUMNS + ARCHIVE_BLOCK_SAMPLES * (2 * 5 + 5 * (ARCHIVE_COLUMNS - 2)) + 16)
+
+/** @brief One sample as a row of fixed-point columns. */
+struct ArchiveSample {
+  int32_t values[ARCHIVE_COLUMNS];
+};
+
+void archiveSampleFromRecord(const SoilRecord &record, ArchiveSample &sample);
+void archiveSampleToRecord(const ArchiveSample &sample, SoilRecord &record);
+
+struct ArchiveBlockInfo {
+  uint16_t count = 0;
+  uint32_t firstId = 0;
+  uint32_t firstTime = 0;
+  uint32_t lastTime = 0;
+};
+
+/**
+ * @brief Encodes samples (count <= ARCHIVE_BLOCK_SAMPLES) into one block.
+ * @return bytes written, 0 if out is too small
+ */
+size_t encodeArchiveBlock(const ArchiveSample* samples, size_t count, uint8_t* out, size_t capacity);
+
+/** @brief Checks magic, version and CRC and reads the header. */
+bool readArchiveHeader(const uint8_t* data, size_t length, ArchiveBlockInfo &info);
+
+/**
+ * @brief Decodes a block.
+ * @return samples written, 0 if the block is corrupt or maxSamples too small
+ */
+size_t decodeArchiveBlock(const uint8_t* data, size_t length, ArchiveSample* out, size_t maxSamples);
+
+/** @brief A block as plain columns, the shape the analytics kernels take. */
+struct ArchiveColumns {
+  int32_t values[ARCHIVE_COLUMNS][ARCHIVE_BLOCK_SAMPLES];
+  size_t count = 0;
+};
+
+/** @brief Like decodeArchiveBlock() but column-major; returns out.count. */
+size_t decodeArchiveColumns(const uint8_t* data, size_t length, ArchiveColumns &out);
+
+// ============================================================================
+// WRITER
+// ============================================================================
+struct ArchiveStats {
+  uint32_t samples = 0;          // added
+  uint32_t blocks = 0;           // sealed
+  uint32_t sealFailures = 0;
+  uint32_t stagingFailures = 0;
+  uint64_t blockBytes = 0;
+  LatencyHistogram sealUs;       // encode + write
+};
+
+class ArchiveWriter {
+public:
+  ArchiveWriter(HalFileSystem &fs, HalClock &clock) : fs(fs), clock(clock) {}
+
+  /**
+   * @brief Creates the archive directory, finds the last block and reloads
+   * samples staged before a reboot.
+   */
+  bool begin();
+
+  /**
+   * @brief Stages one sample; seals the block once it is full.
+   * @return false if the sample could not be staged or the seal failed
+   */
+  bool add(const ArchiveSample &sample);
+
+  /** @brief Writes the staged samples as a block. True if nothing is staged. */
+  bool seal();
+
+  size_t staged() const { return stagedCount; }
+  const ArchiveSample* stagedSamples() const { return staging; }
+  /** @brief millis() when the oldest staged sample arrived (or begin()). */
+  uint32_t stagedSinceMs() const { return stagedSince; }
+  uint32_t lastArchivedId() const { return lastId; }
+  uint32_t nextBlockNumber() const { return nextBlock; }
+  const ArchiveStats &stats() const { return counters; }
+
+  static void blockPath(uint32_t number, char* out, size_t capacity);
+  /** @brief Parses "block_<n>.agb"; returns 0 for any other name. */
+  static uint32_t parseBlockNumber(const char* baseName);
+  /** @brief Reads and decodes one sealed block; 0 if missing or corrupt. */
+  static size_t loadBlock(HalFileSystem &fs, uint32_t number, ArchiveColumns &out);
+
+private:
+  HalFileSystem &fs;
+  HalClock &clock;
+  ArchiveSample staging[ARCHIVE_BLOCK_SAMPLES];
+  size_t stagedCount = 0;
+  uint32_t stagedSince = 0;
+  uint32_t lastId = 0;
+  uint32_t nextBlock = 1;
+  ArchiveStats counters;
+};
+
+#endif
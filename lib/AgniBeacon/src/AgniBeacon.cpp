@@ -0,0 +1,109 @@
+#include "AgniBeacon.h"
+
+#include <string.h>
+#include <AgniProtocol.h>
+
+static void putU16(uint8_t* out, uint16_t value) {
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+}
+
+static uint16_t getU16(const uint8_t* in) {
+  return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static void putU32(uint8_t* out, uint32_t value) {
+  putU16(out, (uint16_t)value);
+  putU16(out + 2, (uint16_t)(value >> 16));
+}
+
+static uint32_t getU32(const uint8_t* in) {
+  return getU16(in) | ((uint32_t)getU16(in + 2) << 16);
+}
+
+static uint16_t saturateU16(int32_t value) {
+  return (uint16_t)(value < 0 ? 0 : value > UINT16_MAX ? UINT16_MAX : value);
+}
+
+void packSoilColumns(const ArchiveSample &sample, uint8_t* out) {
+  for (int f = 0; f < BEACON_FIELDS; f++) {
+    int32_t value = sample.values[ARCHIVE_PH + f];
+    if (ARCHIVE_PH + f == ARCHIVE_TEMPERATURE) {
+      value = value < INT16_MIN ? INT16_MIN : value > INT16_MAX ? INT16_MAX : value;
+      putU16(out + 2 * f, (uint16_t)(int16_t)value);
+    } else {
+      putU16(out + 2 * f, saturateU16(value));
+    }
+  }
+}
+
+void unpackSoilColumns(const uint8_t* in, ArchiveSample &sample) {
+  for (int f = 0; f < BEACON_FIELDS; f++) {
+    uint16_t raw = getU16(in + 2 * f);
+    sample.values[ARCHIVE_PH + f] = ARCHIVE_PH + f == ARCHIVE_TEMPERATURE ? (int16_t)raw : raw;
+  }
+}
+
+static uint16_t beaconTag(const uint8_t* data) {
+  return (uint16_t)crc32_update(0, data, BEACON_BYTES - 2);
+}
+
+size_t encodeBeacon(const ArchiveSample &sample, uint8_t* out, size_t capacity) {
+  if (capacity < BEACON_BYTES) return 0;
+  const int32_t* v = sample.values;
+  putU16(out, BEACON_COMPANY_ID);
+  out[2] = BEACON_VERSION;
+  out[3] = (uint8_t)v[ARCHIVE_FLAGS];
+  putU16(out + 4, (uint16_t)v[ARCHIVE_ID]);
+  packSoilColumns(sample, out + 6);
+  putU16(out + BEACON_BYTES - 2, beaconTag(out));
+  return BEACON_BYTES;
+}
+
+bool decodeBeacon(const uint8_t* data, size_t length, ArchiveSample &sample) {
+  if (length != BEACON_BYTES || getU16(data) != BEACON_COMPANY_ID || data[2] != BEACON_VERSION) return false;
+  if (getU16(data + BEACON_BYTES - 2) != beaconTag(data)) return false;
+  memset(&sample, 0, sizeof(sample));
+  int32_t* v = sample.values;
+  v[ARCHIVE_ID] = getU16(data + 4);
+  v[ARCHIVE_FLAGS] = data[3];
+  unpackSoilColumns(data + 6, sample);
+  return true;
+}
+
+size_t encodeSnapshot(const ArchiveSample &sample, uint8_t status, uint32_t ageMs, uint8_t* out, size_t capacity) {
+  if (capacity < SNAPSHOT_BYTES) return 0;
+  const int32_t* v = sample.values;
+  out[0] = SNAPSHOT_MARKER;
+  out[1] = SNAPSHOT_VERSION;
+  out[2] = (uint8_t)v[ARCHIVE_FLAGS];
+  out[3] = status;
+  putU32(out + 4, (uint32_t)v[ARCHIVE_ID]);
+  putU32(out + 8, (uint32_t)v[ARCHIVE_TIME]);
+  putU32(out + 12, (uint32_t)v[ARCHIVE_LATITUDE]);
+  putU32(out + 16, (uint32_t)v[ARCHIVE_LONGITUDE]);
+  putU32(out + 20, (uint32_t)v[ARCHIVE_ALTITUDE]);
+  putU16(out + 24, saturateU16(v[ARCHIVE_HDOP]));
+  putU16(out + 26, ageMs > UINT16_MAX ? UINT16_MAX : (uint16_t)ageMs);
+  out[28] = (uint8_t)(v[ARCHIVE_SATELLITES] > 255 ? 255 : v[ARCHIVE_SATELLITES]);
+  packSoilColumns(sample, out + 29);
+  return SNAPSHOT_BYTES;
+}
+
+bool decodeSnapshot(const uint8_t* data, size_t length, ArchiveSample &sample, uint8_t &status, uint16_t &ageMs) {
+  if (length != SNAPSHOT_BYTES || data[0] != SNAPSHOT_MARKER || data[1] != SNAPSHOT_VERSION) return false;
+  memset(&sample, 0, sizeof(sample));
+  int32_t* v = sample.values;
+  v[ARCHIVE_FLAGS] = data[2];
+  status = data[3];
+  v[ARCHIVE_ID] = (int32_t)getU32(data + 4);
+  v[ARCHIVE_TIME] = (int32_t)getU32(data + 8);
+  v[ARCHIVE_LATITUDE] = (int32_t)getU32(data + 12);
+  v[ARCHIVE_LONGITUDE] = (int32_t)getU32(data + 16);
+  v[ARCHIVE_ALTITUDE] = (int32_t)getU32(data + 20);
+  v[ARCHIVE_HDOP] = getU16(data + 24);
+  ageMs = getU16(data + 26);
+  v[ARCHIVE_SATELLITES] = data[28];
+  unpackSoilColumns(data + 29, sample);
+  return true;
+}
@@ -0,0 +1,107 @@
+#ifndef AGNI_BEACON_H
+#define AGNI_BEACON_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniArchive.h>
+
+// ============================================================================
+// ADVERTISED READING
+// ============================================================================
+// With broadcast on (BROADCAST_ON), the latest committed sample rides in
+// the manufacturer-specific AD structure of every advertisement, so a
+// gateway or phone harvests readings from many units by scanning alone,
+// without connecting. Layout, little-endian, after the AD length/type:
+//
+//    0  u16 company id (BEACON_COMPANY_ID)
+//    2  u8  format version (BEACON_VERSION)
+//    3  u8  ARCHIVE_FLAG_* of the sample
+//    4  u16 counter: low 16 bits of the record id; a new value means a
+//           new reading, a jump of more than one means readings were missed
+//    6  u16 pH x 100
+//    8  u16 conductivity uS/cm
+//   10  u16 nitrogen mg/kg
+//   12  u16 phosphorus mg/kg
+//   14  u16 potassium mg/kg
+//   16  u16 moisture % x 10
+//   18  s16 temperature degC x 10
+//   20  u16 tag: low 16 bits of the CRC-32 of bytes 0..19
+//
+// The soil values are the archive's fixed point, saturated to 16 bits.
+// With the flags AD structure this uses 27 of the 31 advertising bytes,
+// so the position is not broadcast; the service UUID and name move to the
+// scan response.
+
+#define BEACON_COMPANY_ID     0xFFFF   // Bluetooth SIG id reserved for testing
+#define BEACON_VERSION        1
+#define BEACON_BYTES          22
+#define BEACON_FIELDS         (ARCHIVE_TEMPERATURE - ARCHIVE_PH + 1)
+
+/**
+ * @brief Writes the BEACON_FIELDS soil columns as u16 LE (temperature
+ * s16), saturated: 2 * BEACON_FIELDS bytes. Shared by every compact
+ * reading format.
+ */
+void packSoilColumns(const ArchiveSample &sample, uint8_t* out);
+void unpackSoilColumns(const uint8_t* in, ArchiveSample &sample);
+
+/**
+ * @brief Packs the soil columns of a sample.
+ * @return BEACON_BYTES, 0 if out is too small
+ */
+size_t encodeBeacon(const ArchiveSample &sample, uint8_t* out, size_t capacity);
+
+/**
+ * @brief Unpacks manufacturer data (starting at the company id) into the
+ * ID (= counter), FLAGS and soil columns; the rest are zeroed.
+ * @return false for another company, version or length, or a bad tag
+ */
+bool decodeBeacon(const uint8_t* data, size_t length, ArchiveSample &sample);
+
+// ============================================================================
+// ON-DEMAND SNAPSHOT
+// ============================================================================
+// SNAPSHOT (or SNAPSHOT:COMMIT) on the command characteristic polls the
+// primary probe right away, outside the measuring cycle, and the reply is
+// one binary notification with the reading and the current fix. It starts
+// with a non-printable marker so it cannot be mistaken for the text
+// replies. Little-endian:
+//
+//    0  u8  SNAPSHOT_MARKER
+//    1  u8  format version (SNAPSHOT_VERSION)
+//    2  u8  ARCHIVE_FLAG_* of the sample
+//    3  u8  SNAPSHOT_FRESH | SNAPSHOT_COMMITTED
+//    4  u32 record id: the file it was logged as, or the next one
+//    8  u32 unix seconds UTC, 0 without fix
+//   12  s32 latitude degrees x 1e7
+//   16  s32 longitude degrees x 1e7
+//   20  s32 altitude metres x 10
+//   24  u16 HDOP x 100
+//   26  u16 age of the soil values in ms, saturated
+//   28  u8  satellites
+//   29  7 x u16 soil columns as in the advertised reading
+//
+// Without SNAPSHOT_FRESH the poll failed and the soil values are the last
+// good ones (or none, see the flags). Only fresh readings are committed.
+
+#define SNAPSHOT_COMMAND      "SNAPSHOT"
+#define SNAPSHOT_COMMIT       "SNAPSHOT:COMMIT"
+#define SNAPSHOT_MARKER       0x02
+#define SNAPSHOT_VERSION      1
+#define SNAPSHOT_BYTES        (29 + 2 * BEACON_FIELDS)
+#define SNAPSHOT_FRESH        0x01   // polled for this request
+#define SNAPSHOT_COMMITTED    0x02   // also logged as a record
+
+/**
+ * @brief Packs a sample, its status bits and the age of its soil values.
+ * @return SNAPSHOT_BYTES, 0 if out is too small
+ */
+size_t encodeSnapshot(const ArchiveSample &sample, uint8_t status, uint32_t ageMs, uint8_t* out, size_t capacity);
+
+/**
+ * @brief Unpacks a snapshot reply; speed is not sent and comes back 0.
+ * @return false for another marker, version or length
+ */
+bool decodeSnapshot(const uint8_t* data, size_t length, ArchiveSample &sample, uint8_t &status, uint16_t &ageMs);
+
+#endif
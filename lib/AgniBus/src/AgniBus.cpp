@@ -0,0 +1,209 @@
+#include "AgniBus.h"
+
+// ============================================================================
+// DEVICE TABLE
+// ============================================================================
+ModbusBus::ModbusBus(ModbusClient &modbus, HalClock &clock)
+  : modbus(modbus), clock(clock) {
+  statsSinceUs = clock.micros();
+}
+
+bool ModbusBus::planBlocks(Device &device) {
+  const RegisterMap &map = *device.config.map;
+  if (map.fieldCount == 0 || map.fieldCount > RECORD_DEVICE_FIELDS) return false;
+  device.blockCount = 0;
+  for (uint8_t f = 0; f < map.fieldCount; f++) {
+    uint16_t reg = map.fields[f].reg;
+    Block* block = device.blockCount ? &device.blocks[device.blockCount - 1] : nullptr;
+    uint16_t end = block ? block->start + block->registers : 0;
+    if (block && reg >= end && reg - end <= map.maxGap && reg - block->start < BUS_MAX_BLOCK_REGS) {
+      block->registers = (uint8_t)(reg - block->start + 1);
+      block->fieldCount++;
+      continue;
+    }
+    Block &next = device.blocks[device.blockCount++];
+    next.start = reg;
+    next.registers = 1;
+    next.firstField = f;
+    next.fieldCount = 1;
+  }
+  return true;
+}
+
+int ModbusBus::addDevice(const BusDeviceConfig &config) {
+  if (count >= BUS_MAX_DEVICES || !config.map || config.periodMs == 0) return -1;
+  Device &device = devices[count];
+  device = Device();
+  device.config = config;
+  if (!planBlocks(device)) return -1;
+  device.nextDueMs = clock.millis();
+  device.reading.address = config.address;
+  device.reading.map = config.map;
+  return (int)count++;
+}
+
+void ModbusBus::clearDevices() {
+  count = 0;
+}
+
+void ModbusBus::setPeriod(size_t index, uint32_t periodMs) {
+  if (index >= count || periodMs == 0 || devices[index].config.periodMs == periodMs) return;
+  Device &device = devices[index];
+  // Pull the next poll in if the new period is shorter
+  uint32_t now = clock.millis();
+  if ((int32_t)(device.nextDueMs - (now + periodMs)) > 0 && !isolated(index)) device.nextDueMs = now + periodMs;
+  device.config.periodMs = periodMs;
+}
+
+void ModbusBus::requestPoll(size_t index) {
+  if (index < count) devices[index].nextDueMs = clock.millis();
+}
+
+// ============================================================================
+// POLLING
+// ============================================================================
+size_t ModbusBus::poll() {
+  uint64_t startUs = clock.micros();
+  bool polled[BUS_MAX_DEVICES] = {false};
+  size_t n = 0;
+  for (;;) {
+    uint32_t now = clock.millis();
+    int next = -1;
+    for (size_t i = 0; i < count; i++) {
+      if (polled[i] || (int32_t)(now - devices[i].nextDueMs) < 0) continue;
+      if (next < 0 || (int32_t)(devices[i].nextDueMs - devices[next].nextDueMs) < 0) next = (int)i;
+    }
+    if (next < 0) break;
+    polled[next] = true;
+    pollDevice(devices[next]);
+    n++;
+  }
+  if (n) {
+    counters.cycles++;
+    counters.cycleUs.record((uint32_t)(clock.micros() - startUs));
+  }
+  return n;
+}
+
+uint32_t ModbusBus::replyTimeout(const Device &device, bool probing) const {
+  uint32_t configured = modbus.timeout();
+  uint32_t timeoutMs = configured;
+  if (device.slowestReplyUs) {
+    timeoutMs = 2 * device.slowestReplyUs / 1000 + BUS_TIMEOUT_MARGIN_MS;
+    if (timeoutMs < BUS_MIN_TIMEOUT_MS) timeoutMs = BUS_MIN_TIMEOUT_MS;
+    if (timeoutMs > configured) timeoutMs = configured;
+  }
+  if (probing && timeoutMs > BUS_PROBE_TIMEOUT_MS) timeoutMs = BUS_PROBE_TIMEOUT_MS;
+  return timeoutMs;
+}
+
+bool ModbusBus::pollDevice(Device &device) {
+  uint64_t startUs = clock.micros();
+  bool probing = device.failuresInRow >= BUS_ISOLATE_AFTER;
+  uint32_t timeoutMs = modbus.timeout();
+  if (probing) device.stats.probes++;
+  device.stats.polls++;
+  device.stats.timeoutMs = replyTimeout(device, probing);
+  modbus.setTimeout(device.stats.timeoutMs);
+
+  const RegisterMap &map = *device.config.map;
+  uint8_t valid = 0;
+  bool answered = false;
+  for (uint8_t b = 0; b < device.blockCount; b++) {
+    const Block &block = device.blocks[b];
+    uint16_t regs[BUS_MAX_BLOCK_REGS];
+    counters.reads++;
+    if (!modbus.readRegisters(device.config.address, block.start, block.registers, regs)) {
+      device.stats.lastError = modbus.lastError();
+      device.stats.errors[device.stats.lastError]++;
+      // Silent on the first read: the rest would only add timeouts
+      if (!answered && device.stats.lastError == MODBUS_ERR_TIMEOUT) break;
+      continue;
+    }
+    // Track the slowest reply, decaying by 1/16 per read so one slow
+    // answer doesn't pin the timeout high forever
+    uint32_t replyUs = modbus.lastReplyUs();
+    device.slowestReplyUs -= device.slowestReplyUs / 16;
+    if (replyUs > device.slowestReplyUs) device.slowestReplyUs = replyUs;
+    if (!answered && probing) modbus.setTimeout(replyTimeout(device, false));
+    answered = true;
+    for (uint8_t f = block.firstField; f < block.firstField + block.fieldCount; f++) {
+      uint16_t raw = regs[map.fields[f].reg - block.start];
+      device.reading.raw[f] = map.fields[f].isSigned ? (int32_t)(int16_t)raw : (int32_t)raw;
+      valid |= (uint8_t)(1u << f);
+    }
+  }
+  modbus.setTimeout(timeoutMs);
+
+  device.reading.validFields = valid;
+  if (valid) device.readAtMs = clock.millis();
+  uint64_t busyUs = clock.micros() - startUs;
+  device.stats.busyUs += busyUs;
+  counters.busyUs += busyUs;
+  reschedule(device, clock.millis(), answered);
+  return answered;
+}
+
+void ModbusBus::reschedule(Device &device, uint32_t now, bool answered) {
+  uint32_t period = device.config.periodMs;
+  if (answered) {
+    device.stats.ok++;
+    device.failuresInRow = 0;
+    device.backoffMs = 0;
+  } else {
+    device.stats.failures++;
+    if (device.failuresInRow < 255) device.failuresInRow++;
+    if (device.failuresInRow == BUS_ISOLATE_AFTER) device.stats.isolations++;
+    if (device.failuresInRow >= BUS_ISOLATE_AFTER) {
+      uint32_t backoff = device.backoffMs ? device.backoffMs * 2 : period * 2;
+      device.backoffMs = backoff > BUS_MAX_BACKOFF_MS ? BUS_MAX_BACKOFF_MS : backoff;
+      // Spread the probes so isolated devices don't all come due together
+      device.nextDueMs = now + device.backoffMs + modbus.jitterMs(device.backoffMs / 8);
+      return;
+    }
+  }
+  device.nextDueMs += period;
+  if ((int32_t)(now - device.nextDueMs) >= 0) {
+    // The bus could not keep up with this period; don't queue up catch-up polls
+    device.stats.overruns++;
+    device.nextDueMs = now + period;
+  }
+}
+
+uint32_t ModbusBus::msUntilDue() {
+  if (count == 0) return UINT32_MAX;
+  uint32_t now = clock.millis();
+  uint32_t soonest = UINT32_MAX;
+  for (size_t i = 0; i < count; i++) {
+    int32_t left = (int32_t)(devices[i].nextDueMs - now);
+    if (left <= 0) return 0;
+    if ((uint32_t)left < soonest) soonest = (uint32_t)left;
+  }
+  return soonest;
+}
+
+// ============================================================================
+// READINGS AND STATS
+// ============================================================================
+DeviceReading ModbusBus::reading(size_t index) {
+  DeviceReading out = devices[index].reading;
+  out.ageMs = out.validFields ? clock.millis() - devices[index].readAtMs : 0;
+  return out;
+}
+
+uint8_t ModbusBus::readings(DeviceReading* out, size_t capacity) {
+  uint8_t n = 0;
+  for (size_t i = 0; i < count && n < capacity; i++) out[n++] = reading(i);
+  return n;
+}
+
+double ModbusBus::utilization() {
+  uint64_t elapsedUs = clock.micros() - statsSinceUs;
+  return elapsedUs ? (double)counters.busyUs / elapsedUs : 0.0;
+}
+
+void ModbusBus::resetStats() {
+  counters = BusStats();
+  for (size_t i = 0; i < count; i++) devices[i].stats = BusDeviceStats();
+  statsSinceUs = clock.micros();
+}
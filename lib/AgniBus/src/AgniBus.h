@@ -0,0 +1,147 @@
+#ifndef AGNI_BUS_H
+#define AGNI_BUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniHal.h>
+#include <AgniMetrics.h>
+#include <AgniRecord.h>
+#include <AgniModbus.h>
+
+// ============================================================================
+// MULTI-DROP RS485 BUS SCHEDULER
+// ============================================================================
+// Several slaves (soil probes at different depths, a weather transmitter)
+// share one RS485 line. ModbusBus owns the ModbusClient for that line and
+// polls each device at its own period from its RegisterMap: contiguous
+// fields become one function 0x03 read, and all reads that are due go out
+// back to back, separated only by the Modbus inter-frame gap.
+//
+// A device that misses BUS_ISOLATE_AFTER polls in a row is isolated, a
+// circuit breaker: it is probed with one short-timeout read at a doubling,
+// jittered interval (up to BUS_MAX_BACKOFF_MS) instead of costing a full
+// timeout per block every period, and rejoins as soon as it answers. A
+// poll whose first read goes unanswered skips the device's remaining reads.
+//
+// Each device's reply timeout adapts to how fast it actually answers:
+// twice its slowest recent reply plus BUS_TIMEOUT_MARGIN_MS, never below
+// BUS_MIN_TIMEOUT_MS nor above the client's configured timeout. Garbled
+// replies are retried inside the client (ModbusRetryPolicy); the failure
+// cause of every unanswered read is counted per device.
+//
+// The cost of a poll is wire time plus the slave's turnaround, so the bus
+// utilization (busy time / elapsed time), not the number of devices, is
+// what bounds the sampling rate. A device that is due again before the
+// bus got to it counts as an overrun and is rescheduled from now.
+
+#define BUS_MAX_DEVICES       RECORD_MAX_DEVICES
+#define BUS_MAX_BLOCK_REGS    32       // registers per read
+#define BUS_ISOLATE_AFTER     3        // failed polls in a row
+#define BUS_PROBE_TIMEOUT_MS  200      // reply timeout while isolated
+#define BUS_MAX_BACKOFF_MS    300000   // isolated devices are probed at least this often
+#define BUS_MIN_TIMEOUT_MS    100
+#define BUS_TIMEOUT_MARGIN_MS 50
+
+struct BusDeviceConfig {
+  uint8_t address;
+  const RegisterMap* map;
+  uint32_t periodMs;
+};
+
+struct BusDeviceStats {
+  uint32_t polls = 0;
+  uint32_t ok = 0;               // at least the first read answered
+  uint32_t failures = 0;
+  uint32_t isolations = 0;
+  uint32_t probes = 0;           // polls made while isolated
+  uint32_t overruns = 0;
+  uint32_t errors[MODBUS_ERROR_COUNT] = {0};  // failed reads by cause
+  ModbusError lastError = MODBUS_OK;
+  uint32_t timeoutMs = 0;        // reply timeout the last poll used
+  uint64_t busyUs = 0;
+};
+
+struct BusStats {
+  uint32_t cycles = 0;           // poll() calls that polled at least one device
+  uint32_t reads = 0;            // function 0x03 transactions
+  uint64_t busyUs = 0;
+  LatencyHistogram cycleUs;      // one poll() from first to last frame
+};
+
+class ModbusBus {
+public:
+  ModbusBus(ModbusClient &modbus, HalClock &clock);
+
+  /**
+   * @brief Adds a device, first poll due now.
+   * @return its index, -1 if the bus is full, the period is 0 or the map
+   *         has too many fields
+   */
+  int addDevice(const BusDeviceConfig &device);
+  void clearDevices();
+  size_t deviceCount() const { return count; }
+  const BusDeviceConfig &device(size_t index) const { return devices[index].config; }
+  void setPeriod(size_t index, uint32_t periodMs);
+  /**
+   * @brief Makes a device due now, for an on-demand reading; the schedule
+   * continues one period after it. An isolated device gets one probe.
+   */
+  void requestPoll(size_t index);
+
+  /**
+   * @brief Polls every device that is due, earliest due first.
+   * @return devices polled
+   */
+  size_t poll();
+  /** @brief Milliseconds until the next device is due, 0 if one is due now. */
+  uint32_t msUntilDue();
+
+  bool isolated(size_t index) const { return devices[index].failuresInRow >= BUS_ISOLATE_AFTER; }
+  /** @brief Failed polls in a row, 0 once the device answers. */
+  uint8_t failureStreak(size_t index) const { return devices[index].failuresInRow; }
+  /** @brief Latest values of one device, ageMs measured now. */
+  DeviceReading reading(size_t index);
+  /** @brief Copies every device's reading; returns how many. */
+  uint8_t readings(DeviceReading* out, size_t capacity);
+
+  /** @brief Share of the time since resetStats() the line was busy, 0..1. */
+  double utilization();
+  void resetStats();
+  const BusStats &stats() const { return counters; }
+  const BusDeviceStats &deviceStats(size_t index) const { return devices[index].stats; }
+
+private:
+  struct Block {
+    uint16_t start;
+    uint8_t registers;
+    uint8_t firstField;
+    uint8_t fieldCount;
+  };
+
+  struct Device {
+    BusDeviceConfig config;
+    Block blocks[RECORD_DEVICE_FIELDS];
+    uint8_t blockCount;
+    uint32_t nextDueMs;
+    uint32_t readAtMs;
+    uint32_t backoffMs;
+    uint8_t failuresInRow;
+    uint32_t slowestReplyUs;     // decaying maximum, 0 until the first reply
+    DeviceReading reading;
+    BusDeviceStats stats;
+  };
+
+  bool planBlocks(Device &device);
+  bool pollDevice(Device &device);
+  uint32_t replyTimeout(const Device &device, bool probing) const;
+  void reschedule(Device &device, uint32_t now, bool answered);
+
+  ModbusClient &modbus;
+  HalClock &clock;
+  Device devices[BUS_MAX_DEVICES];
+  size_t count = 0;
+  uint64_t statsSinceUs = 0;
+  BusStats counters;
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include "AgniCompress.h"
+
+#include <string.h>
+
+// ============================================================================
+// DICTIONARIES
+// ============================================================================
+// The record dictionary is the encodeRecordJson() key skeleton with the
+// category strings and the no-fix placeholders. It must never change once
+// shipped: add a new id instead, the phone app keeps a copy of each.
+static const char RECORD_DICTIONARY[] =
+  "slightly_alkaline\"neutral\"acidic\",\"valid\":false,PM\"0000-00-00T00:00:00Z\",\"time_utc\":\"00:00:00\","
+  "\"date_ist\":\"0000-00-00\",\"time_ist\":\"00:00 AM\",\"location\":{\"latitude\":0,\"longitude\":0,"
+  "\"valid\":false,\"satellites\":0,\"altitude\":0,\"speed_kmh\":0,\"hdop\":0},"
+  "{\"id\":1,\"timestamp\":\"2026-01-01T00:00:00Z\",\"time_utc\":\"00:00:00\",\"date_ist\":\"2026-01-01\","
+  "\"time_ist\":\"05:30 AM\",\"location\":{\"latitude\":21.1,\"longitude\":79.0,\"valid\":true,\"satellites\":8,"
+  "\"altitude\":300.0,\"speed_kmh\":0.0,\"hdop\":1.0},\"ph_category\":\"slightly_acidic\",\"parameters\":{"
+  "\"ph_value\":6.5,\"conductivity\":400,\"nitrogen\":40,\"phosphorus\":20,\"potassium\":100,"
+  "\"moisture\":30.0,\"temperature\":25.0},\"sensor_valid\":true}";
+
+const uint8_t* lzDictionary(uint8_t id, size_t &length) {
+  switch (id) {
+    case LZ_DICTIONARY_RECORD:
+      length = sizeof(RECORD_DICTIONARY) - 1;
+      return (const uint8_t*)RECORD_DICTIONARY;
+    default:
+      length = 0;
+      return NULL;
+  }
+}
+
+// ============================================================================
+// ENCODER
+// ============================================================================
+void LzEncoder::begin(const uint8_t* dictionary, size_t length) {
+  memset(head, 0, sizeof(head));
+  memset(chain, 0, sizeof(chain));
+  if (length > LZ_WINDOW - 1) {
+    dictionary += length - (LZ_WINDOW - 1);
+    length = LZ_WINDOW - 1;
+  }
+  if (length) memcpy(history, dictionary, length);
+  end = (uint16_t)length;
+  for (uint16_t p = 0; p + LZ_MIN_MATCH <= end; p++) insertHash(p);
+  pos = end;
+  finishing = false;
+  groupLength = 0;
+  groupItems = 0;
+  groupFlushed = true;
+  outStart = 0;
+  outLength = 0;
+  consumed = 0;
+  produced = 0;
+}
+
+uint16_t LzEncoder::hashAt(uint16_t position) const {
+  uint32_t v = history[position] | (history[position + 1] << 8) | ((uint32_t)history[position + 2] << 16);
+  return (uint16_t)((v * 2654435761UL) >> (32 - LZ_HASH_BITS)) & ((1 << LZ_HASH_BITS) - 1);
+}
+
+void LzEncoder::insertHash(uint16_t position) {
+  uint16_t h = hashAt(position);
+  chain[position & (LZ_WINDOW - 1)] = head[h];
+  head[h] = position + 1;
+}
+
+/** @brief Drops the oldest window of history; positions are rebased. */
+void LzEncoder::slide() {
+  memmove(history, history + LZ_WINDOW, LZ_WINDOW);
+  pos -= LZ_WINDOW;
+  end -= LZ_WINDOW;
+  for (size_t i = 0; i < sizeof(head) / sizeof(head[0]); i++) head[i] = head[i] > LZ_WINDOW ? head[i] - LZ_WINDOW : 0;
+  for (size_t i = 0; i < LZ_WINDOW; i++) chain[i] = chain[i] > LZ_WINDOW ? chain[i] - LZ_WINDOW : 0;
+}
+
+uint8_t* LzEncoder::inputBuffer(size_t &space) {
+  if (end == sizeof(history) && pos >= LZ_WINDOW) slide();
+  space = sizeof(history) - end;
+  return history + end;
+}
+
+void LzEncoder::commitInput(size_t length) {
+  end += (uint16_t)length;
+  consumed += length;
+  run();
+}
+
+void LzEncoder::finish() {
+  finishing = true;
+  run();
+}
+
+size_t LzEncoder::read(uint8_t* out, size_t max) {
+  size_t n = available();
+  if (n > max) n = max;
+  memcpy(out, output + outStart, n);
+  outStart += n;
+  if (outStart == outLength) {
+    outStart = 0;
+    outLength = 0;
+  }
+  run();
+  return n;
+}
+
+void LzEncoder::flushGroup() {
+  if (groupItems == 0) return;
+  memcpy(output + outLength, group, groupLength);
+  outLength += groupLength;
+  produced += groupLength;
+  groupLength = 0;
+  groupItems = 0;
+}
+
+void LzEncoder::emitLiteral(uint8_t value) {
+  if (groupItems == 0) {
+    group[0] = 0;
+    groupLength = 1;
+  }
+  group[groupLength++] = value;
+  if (++groupItems == 8) flushGroup();
+}
+
+void LzEncoder::emitMatch(uint16_t offset, uint16_t length) {
+  if (groupItems == 0) {
+    group[0] = 0;
+    groupLength = 1;
+  }
+  group[0] |= 1 << groupItems;
+  uint16_t code = length - LZ_MIN_MATCH;
+  group[groupLength++] = offset & 0xFF;
+  if (code >= 63) {
+    group[groupLength++] = ((offset >> 8) & 0x03) | (63 << 2);
+    group[groupLength++] = (uint8_t)(length - 66);
+  } else {
+    group[groupLength++] = ((offset >> 8) & 0x03) | (code << 2);
+  }
+  if (++groupItems == 8) flushGroup();
+}
+
+/**
+ * @brief Encodes as much buffered input as the output space allows. Holds
+ * back the last LZ_MAX_MATCH bytes until finish() so matches aren't cut.
+ */
+void LzEncoder::run() {
+  if (outStart > 0 && outLength + LZ_GROUP_MAX > sizeof(output)) {
+    memmove(output, output + outStart, outLength - outStart);
+    outLength -= outStart;
+    outStart = 0;
+  }
+  while (outLength + LZ_GROUP_MAX <= sizeof(output)) {
+    uint16_t lookahead = end - pos;
+    if (lookahead == 0 || (!finishing && lookahead < LZ_MAX_MATCH)) break;
+    groupFlushed = false;
+
+    uint16_t bestLength = 0;
+    uint16_t bestOffset = 0;
+    if (lookahead >= LZ_MIN_MATCH) {
+      uint16_t limit = lookahead < LZ_MAX_MATCH ? lookahead : LZ_MAX_MATCH;
+      uint16_t candidate = head[hashAt(pos)];
+      for (int depth = 0; candidate && depth < LZ_CHAIN_DEPTH; depth++) {
+        uint16_t from = candidate - 1;
+        if (from >= pos || pos - from >= LZ_WINDOW) break;
+        if (history[from + bestLength] == history[pos + bestLength]) {
+          uint16_t n = 0;
+          while (n < limit && history[from + n] == history[pos + n]) n++;
+          if (n > bestLength) {
+            bestLength = n;
+            bestOffset = pos - from;
+            if (n == limit) break;
+          }
+        }
+        uint16_t next = chain[from & (LZ_WINDOW - 1)];
+        if (next >= candidate) break;
+        candidate = next;
+      }
+    }
+
+    if (bestLength >= LZ_MIN_MATCH) {
+      emitMatch(bestOffset, bestLength);
+      for (uint16_t i = 0; i < bestLength; i++, pos++) {
+        if (pos + LZ_MIN_MATCH <= end) insertHash(pos);
+      }
+    } else {
+      emitLiteral(history[pos]);
+      if (pos + LZ_MIN_MATCH <= end) insertHash(pos);
+      pos++;
+    }
+  }
+  if (finishing && pos >= end && !groupFlushed && outLength + LZ_GROUP_MAX <= sizeof(output)) {
+    flushGroup();
+    groupFlushed = true;
+  }
+}
+
+// ============================================================================
+// DECODER
+// ============================================================================
+size_t lzDecompress(const uint8_t* in, size_t length, const uint8_t* dictionary, size_t dictionaryLength,
+                    uint8_t* out, size_t capacity) {
+  const size_t corrupt = (size_t)-1;
+  size_t ip = 0;
+  size_t op = 0;
+  while (ip < length) {
+    uint8_t flags = in[ip++];
+    for (int bit = 0; bit < 8 && ip < length; bit++) {
+      if (!(flags & (1 << bit))) {
+        if (op >= capacity) return corrupt;
+        out[op++] = in[ip++];
+        continue;
+      }
+      if (ip + 2 > length) return corrupt;
+      uint16_t offset = in[ip] | ((in[ip + 1] & 0x03) << 8);
+      size_t matchLength = (in[ip + 1] >> 2) + LZ_MIN_MATCH;
+      ip += 2;
+      if (matchLength == 66) {
+        if (ip >= length) return corrupt;
+        matchLength = 66 + in[ip++];
+      }
+      if (offset == 0 || offset > op + dictionaryLength || op + matchLength > capacity) return corrupt;
+      for (size_t i = 0; i < matchLength; i++, op++) {
+        out[op] = offset > op ? dictionary[dictionaryLength - (offset - op)] : out[op - offset];
+      }
+    }
+  }
+  return op;
+}
@@ -0,0 +1,100 @@
+#ifndef AGNI_COMPRESS_H
+#define AGNI_COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ============================================================================
+// STREAMING LZ CODEC
+// ============================================================================
+// LZSS with a 1 KB window, sized for one record file plus a pre-shared
+// dictionary, so the encoder fits in about 6 KB of SRAM. Stream format:
+//
+//   <flags> <item> x up to 8, repeated; flag bit i (LSB first) set = match
+//   literal  1 byte
+//   match    2 bytes: offset[7:0], offset[9:8] | (len - 3) << 2
+//            (len - 3) == 63 adds a byte: len = 66 + extra
+//
+// Offsets count back from the current output position (1..1023) and may
+// reach into the dictionary, which acts as history preceding the data.
+// The stream simply ends after the last item.
+
+#define LZ_WINDOW_BITS      10
+#define LZ_WINDOW           (1 << LZ_WINDOW_BITS)
+#define LZ_MIN_MATCH        3
+#define LZ_MAX_MATCH        (66 + 255)
+#define LZ_HASH_BITS        8
+#define LZ_CHAIN_DEPTH      16
+#define LZ_GROUP_MAX        (1 + 8 * 3)
+#define LZ_OUTPUT_BYTES     1024
+
+// Dictionaries known to both ends, negotiated by id
+#define LZ_DICTIONARY_NONE    0
+#define LZ_DICTIONARY_RECORD  1   // farmland_<n>.json schema
+
+/**
+ * @brief Returns a pre-shared dictionary, or NULL (length 0) for an
+ * unknown id or LZ_DICTIONARY_NONE.
+ */
+const uint8_t* lzDictionary(uint8_t id, size_t &length);
+
+class LzEncoder {
+public:
+  /** @brief Starts a new stream; dictionary may be NULL. */
+  void begin(const uint8_t* dictionary, size_t length);
+
+  /**
+   * @brief Where to put the next input bytes (e.g. straight from a file
+   * read) and how many fit. Follow with commitInput().
+   */
+  uint8_t* inputBuffer(size_t &space);
+  void commitInput(size_t length);
+  /** @brief No more input; the rest is encoded as output is read. */
+  void finish();
+
+  /** @brief Takes up to max bytes of compressed output. */
+  size_t read(uint8_t* out, size_t max);
+  size_t available() const { return outLength - outStart; }
+  /** @brief True once finish() was called and every byte has been read. */
+  bool done() const { return finishing && pos >= end && groupFlushed && available() == 0; }
+
+  uint32_t inputBytes() const { return consumed; }
+  uint32_t outputBytes() const { return produced; }
+
+private:
+  void run();
+  void slide();
+  void insertHash(uint16_t position);
+  uint16_t hashAt(uint16_t position) const;
+  void emitLiteral(uint8_t value);
+  void emitMatch(uint16_t offset, uint16_t length);
+  void flushGroup();
+
+  uint8_t history[2 * LZ_WINDOW];
+  uint16_t head[1 << LZ_HASH_BITS];   // position + 1, 0 = empty
+  uint16_t chain[LZ_WINDOW];          // previous position + 1 with the same hash
+  uint16_t pos = 0;                   // next byte to encode
+  uint16_t end = 0;                   // bytes of history filled
+  bool finishing = false;
+
+  uint8_t group[LZ_GROUP_MAX];
+  uint8_t groupLength = 0;
+  uint8_t groupItems = 0;
+  bool groupFlushed = true;
+
+  uint8_t output[LZ_OUTPUT_BYTES];
+  size_t outStart = 0;
+  size_t outLength = 0;
+
+  uint32_t consumed = 0;
+  uint32_t produced = 0;
+};
+
+/**
+ * @brief Decodes a whole stream into out.
+ * @return bytes written, or (size_t)-1 on a corrupt stream or overflow
+ */
+size_t lzDecompress(const uint8_t* in, size_t length, const uint8_t* dictionary, size_t dictionaryLength,
+                    uint8_t* out, size_t capacity);
+
+#endif
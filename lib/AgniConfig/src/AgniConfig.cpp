@@ -0,0 +1,214 @@
+#include "AgniConfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <AgniProtocol.h>
+
+// ============================================================================
+// REGISTRY
+// ============================================================================
+// Defaults are the values the firmware shipped with as constants
+static const ConfigEntry ENTRIES[CONFIG_KEYS] = {
+  {"log_interval_ms",    45000, 5000, 3600000},
+  {"sensor_period_ms",    5000, 1000,  600000},
+  {"modbus_baud",         4800, 1200,  115200},
+  {"modbus_timeout_ms",    800,  100,    5000},
+  {"chunk_bytes",          256,   20,     512},
+  {"chunk_interval_ms",      5,    0,    1000},
+  {"status_interval_ms", 10000, 1000, 3600000},
+  {"health_interval_ms", 30000, 5000, 3600000},
+  {"broadcast",              0,    0,       1},
+  {"modbus_max_baud",     9600, 2400,  115200},
+  {"unattended",             0,    0,       1},
+  {"wake_interval_s",      300,   10,   86400},
+  {"wake_readings",          3,    1,      10},
+  {"sensor_warmup_ms",    1500,    0,   30000},
+  {"rtc_flush_at",          32,    1,      48},
+  {"advertise_every",       12,    0,    1000},
+  {"advertise_window_s",    30,    5,     600},
+  {"max_connections",        2,    1,       3},   // TRANSFER_MAX_SESSIONS
+};
+
+#define CONFIG_BLOB_MAX (4 + 4 * CONFIG_KEYS + 4)
+
+const ConfigEntry &configEntry(int key) {
+  return ENTRIES[key];
+}
+
+int configKeyByName(const char* name, size_t length) {
+  for (int k = 0; k < CONFIG_KEYS; k++) {
+    if (strlen(ENTRIES[k].name) == length && memcmp(ENTRIES[k].name, name, length) == 0) return k;
+  }
+  return -1;
+}
+
+static bool inRange(int key, uint32_t value) {
+  return value >= ENTRIES[key].minimum && value <= ENTRIES[key].maximum;
+}
+
+static void putU32(uint8_t* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint32_t getU32(const uint8_t* in) {
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+/** @brief Decimal value of text[0..length), false if it is not one. */
+static bool parseValue(const char* text, size_t length, uint32_t &value) {
+  if (length == 0 || length > 10) return false;
+  uint64_t v = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (text[i] < '0' || text[i] > '9') return false;
+    v = v * 10 + (uint32_t)(text[i] - '0');
+  }
+  if (v > UINT32_MAX) return false;
+  value = (uint32_t)v;
+  return true;
+}
+
+// ============================================================================
+// STORE
+// ============================================================================
+ConfigStore::ConfigStore(HalKeyValueStore &nvs) : nvs(nvs) {
+  for (int k = 0; k < CONFIG_KEYS; k++) values[k] = ENTRIES[k].defaultValue;
+}
+
+bool ConfigStore::begin() {
+  counters.loads++;
+  uint8_t blob[CONFIG_BLOB_MAX + 4 * 32];   // room for keys added by newer firmware
+  size_t length = nvs.read(CONFIG_NVS_KEY, blob, sizeof(blob));
+  bool valid = length >= 8 && (blob[0] | (blob[1] << 8)) == CONFIG_VERSION;
+  size_t count = valid ? (size_t)(blob[2] | (blob[3] << 8)) : 0;
+  valid = valid && length == 4 + 4 * count + 4 &&
+          getU32(blob + length - 4) == crc32_update(0, blob, length - 4);
+  for (int k = 0; k < CONFIG_KEYS; k++) {
+    uint32_t value = valid && (size_t)k < count ? getU32(blob + 4 + 4 * k) : ENTRIES[k].defaultValue;
+    values[k] = inRange(k, value) ? value : ENTRIES[k].defaultValue;
+  }
+  changes++;
+  if (!valid) counters.defaultsLoaded++;
+  return valid;
+}
+
+bool ConfigStore::save() {
+  uint8_t blob[CONFIG_BLOB_MAX];
+  blob[0] = (uint8_t)CONFIG_VERSION;
+  blob[1] = (uint8_t)(CONFIG_VERSION >> 8);
+  blob[2] = (uint8_t)CONFIG_KEYS;
+  blob[3] = 0;
+  for (int k = 0; k < CONFIG_KEYS; k++) putU32(blob + 4 + 4 * k, values[k]);
+  putU32(blob + CONFIG_BLOB_MAX - 4, crc32_update(0, blob, CONFIG_BLOB_MAX - 4));
+  if (!nvs.write(CONFIG_NVS_KEY, blob, sizeof(blob))) {
+    counters.saveFailures++;
+    return false;
+  }
+  counters.saves++;
+  return true;
+}
+
+bool ConfigStore::set(ConfigKey key, uint32_t value) {
+  if (!inRange(key, value)) return false;
+  if (values[key] == value) return true;
+  values[key] = value;
+  changes++;
+  return save();
+}
+
+bool ConfigStore::resetDefaults() {
+  for (int k = 0; k < CONFIG_KEYS; k++) values[k] = ENTRIES[k].defaultValue;
+  changes++;
+  return save();
+}
+
+size_t ConfigStore::formatValues(uint32_t mask, char* out, size_t capacity) const {
+  int written = snprintf(out, capacity, "CONFIG:");
+  if (written < 0 || (size_t)written >= capacity) return 0;
+  size_t length = (size_t)written;
+  bool first = true;
+  for (int k = 0; k < CONFIG_KEYS; k++) {
+    if (!(mask & (1UL << k))) continue;
+    written = snprintf(out + length, capacity - length, "%s%s=%lu", first ? "" : ",", ENTRIES[k].name,
+                       (unsigned long)values[k]);
+    if (written < 0 || (size_t)written >= capacity - length) break;
+    length += (size_t)written;
+    first = false;
+  }
+  out[length] = '\0';
+  return length;
+}
+
+static size_t formatRejected(const char* name, size_t nameLength, char* out, size_t capacity) {
+  int written = snprintf(out, capacity, CONFIG_REJECTED ":%.*s", (int)nameLength, name);
+  return written < 0 ? 0 : (size_t)written < capacity ? (size_t)written : capacity - 1;
+}
+
+size_t ConfigStore::handleCommand(const char* text, size_t length, char* out, size_t capacity, uint32_t &changed) {
+  const uint32_t all = (1UL << CONFIG_KEYS) - 1;
+  changed = 0;
+  const size_t getLen = strlen(CONFIG_GET_COMMAND);
+  const size_t setLen = strlen(CONFIG_SET_COMMAND);
+  const size_t resetLen = strlen(CONFIG_RESET_COMMAND);
+
+  if (length == resetLen && memcmp(text, CONFIG_RESET_COMMAND, resetLen) == 0) {
+    uint32_t before[CONFIG_KEYS];
+    for (int k = 0; k < CONFIG_KEYS; k++) before[k] = values[k];
+    resetDefaults();
+    for (int k = 0; k < CONFIG_KEYS; k++) {
+      if (values[k] != before[k]) changed |= 1UL << k;
+    }
+    return formatValues(all, out, capacity);
+  }
+
+  if (length >= getLen && memcmp(text, CONFIG_GET_COMMAND, getLen) == 0) {
+    if (length == getLen) return formatValues(all, out, capacity);
+    if (text[getLen] != ':') return 0;
+    const char* name = text + getLen + 1;
+    size_t nameLength = length - getLen - 1;
+    int key = configKeyByName(name, nameLength);
+    if (key < 0) {
+      counters.rejected++;
+      return formatRejected(name, nameLength, out, capacity);
+    }
+    return formatValues(1UL << key, out, capacity);
+  }
+
+  if (length < setLen || memcmp(text, CONFIG_SET_COMMAND, setLen) != 0) return 0;
+
+  // Validate every pair before touching anything
+  uint32_t pending[CONFIG_KEYS];
+  uint32_t mask = 0;
+  const char* p = text + setLen;
+  const char* end = text + length;
+  while (p < end) {
+    const char* comma = (const char*)memchr(p, ',', (size_t)(end - p));
+    const char* pairEnd = comma ? comma : end;
+    const char* equals = (const char*)memchr(p, '=', (size_t)(pairEnd - p));
+    int key = equals ? configKeyByName(p, (size_t)(equals - p)) : -1;
+    uint32_t value = 0;
+    if (key < 0 || !parseValue(equals + 1, (size_t)(pairEnd - equals - 1), value) || !inRange(key, value)) {
+      counters.rejected++;
+      return formatRejected(p, (size_t)((equals ? equals : pairEnd) - p), out, capacity);
+    }
+    pending[key] = value;
+    mask |= 1UL << key;
+    p = comma ? comma + 1 : end;
+  }
+  if (mask == 0) {
+    counters.rejected++;
+    return formatRejected("", 0, out, capacity);
+  }
+
+  for (int k = 0; k < CONFIG_KEYS; k++) {
+    if ((mask & (1UL << k)) && values[k] != pending[k]) {
+      values[k] = pending[k];
+      changed |= 1UL << k;
+    }
+  }
+  if (changed) {
+    changes++;
+    save();
+  }
+  return formatValues(mask, out, capacity);
+}
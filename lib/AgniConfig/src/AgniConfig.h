@@ -0,0 +1,127 @@
+#ifndef AGNI_CONFIG_H
+#define AGNI_CONFIG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniHal.h>
+
+// ============================================================================
+// RUNTIME CONFIGURATION
+// ============================================================================
+// The tunables that used to be compile-time constants, as a typed registry
+// (name, default, range) persisted in NVS and tunable over BLE:
+//
+//   CONFIG_GET                        all values
+//   CONFIG_GET:<name>                 one value
+//   CONFIG_SET:<name>=<value>[,...]   all or nothing, saved before replying
+//   CONFIG_RESET                      back to the defaults
+//
+// Every command answers CONFIG:<name>=<value>,... with the values now in
+// effect, or CONFIG_REJECTED:<name> naming the first unknown key or
+// out-of-range value. The values live in one flat array read with get()
+// from any task; each slot is a single aligned 32-bit word, so readers on
+// other cores never see a torn value, and generation() tells them cheaply
+// that something changed.
+//
+// NVS blob (key CONFIG_NVS_KEY), little-endian:
+//
+//   u16 CONFIG_VERSION   u16 key count   u32 value[count]   u32 CRC-32
+//
+// Keys are only ever appended, so a blob with fewer keys (older firmware)
+// keeps its values and the new keys take their defaults. Bump
+// CONFIG_VERSION only when an existing key changes meaning; blobs from
+// another version are then ignored. A value outside its range on load
+// falls back to the default.
+
+#define CONFIG_VERSION         1
+#define CONFIG_NVS_NAMESPACE   "agni"
+#define CONFIG_NVS_KEY         "config"
+#define CONFIG_GET_COMMAND     "CONFIG_GET"
+#define CONFIG_SET_COMMAND     "CONFIG_SET:"
+#define CONFIG_RESET_COMMAND   "CONFIG_RESET"
+#define CONFIG_REJECTED        "CONFIG_REJECTED"
+#define CONFIG_COMMAND_MAX     200
+#define CONFIG_RESPONSE_MAX    400
+
+// Append only; the order is the NVS layout
+enum ConfigKey {
+  CONFIG_LOG_INTERVAL_MS,       // analysing time before a record is logged
+  CONFIG_SENSOR_PERIOD_MS,      // soil sensor task period
+  CONFIG_MODBUS_BAUD,
+  CONFIG_MODBUS_TIMEOUT_MS,
+  CONFIG_CHUNK_BYTES,           // largest transfer notification payload
+  CONFIG_CHUNK_INTERVAL_MS,     // throttle between transfer notifications
+  CONFIG_STATUS_INTERVAL_MS,
+  CONFIG_HEALTH_INTERVAL_MS,
+  CONFIG_BROADCAST,             // 1 = latest reading in the advertising data
+  CONFIG_MODBUS_MAX_BAUD,       // ceiling for the link speed negotiation
+  CONFIG_UNATTENDED,            // 1 = duty-cycled capture from deep sleep (AgniSleep.h)
+  CONFIG_WAKE_INTERVAL_S,       // unattended: wake to wake
+  CONFIG_WAKE_READINGS,         // unattended: readings averaged per wake
+  CONFIG_SENSOR_WARMUP_MS,      // unattended: probe power-on to first reading
+  CONFIG_RTC_FLUSH_AT,          // unattended: buffered samples that trigger a card write
+  CONFIG_ADVERTISE_EVERY,       // unattended: every n-th wake advertises, 0 = never
+  CONFIG_ADVERTISE_WINDOW_S,    // unattended: how long it advertises
+  CONFIG_MAX_CONNECTIONS,       // clients served at once; advertising stops at this many
+  CONFIG_KEYS
+};
+
+struct ConfigEntry {
+  const char* name;
+  uint32_t defaultValue;
+  uint32_t minimum;
+  uint32_t maximum;
+};
+
+const ConfigEntry &configEntry(int key);
+/** @brief -1 for an unknown name. */
+int configKeyByName(const char* name, size_t length);
+
+struct ConfigStats {
+  uint32_t loads = 0;
+  uint32_t defaultsLoaded = 0;   // nothing valid in NVS at begin()
+  uint32_t saves = 0;
+  uint32_t saveFailures = 0;
+  uint32_t rejected = 0;         // CONFIG_SET/GET naming a bad key or value
+};
+
+class ConfigStore {
+public:
+  explicit ConfigStore(HalKeyValueStore &nvs);
+
+  /**
+   * @brief Loads the values from NVS.
+   * @return false if the defaults are in use because nothing valid was stored
+   */
+  bool begin();
+
+  uint32_t get(ConfigKey key) const { return values[key]; }
+  /** @brief Bumped on every change. */
+  uint32_t generation() const { return changes; }
+
+  /** @brief Range-checks, applies and saves one value. */
+  bool set(ConfigKey key, uint32_t value);
+  bool resetDefaults();
+
+  /**
+   * @brief Runs one CONFIG_* command (see the header comment).
+   * @param changed gets a bit per key whose value changed
+   * @return length of the response in out; 0 if text is not a config command
+   */
+  size_t handleCommand(const char* text, size_t length, char* out, size_t capacity, uint32_t &changed);
+
+  /** @brief "CONFIG:<name>=<value>,..." for the keys in mask. */
+  size_t formatValues(uint32_t mask, char* out, size_t capacity) const;
+
+  const ConfigStats &stats() const { return counters; }
+
+private:
+  bool save();
+
+  HalKeyValueStore &nvs;
+  volatile uint32_t values[CONFIG_KEYS];
+  volatile uint32_t changes = 0;
+  ConfigStats counters;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef AGNI_HAL_H
+#define AGNI_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+// ============================================================================
+// HARDWARE ABSTRACTION LAYER
+// ============================================================================
+// The sampling/storage/transfer pipeline only talks to these interfaces.
+// AgniHalEsp32.h maps them onto SD, HardwareSerial and BLE on the device;
+// the AgniSim library maps them onto a host directory and simulated
+// peripherals for the native build.
+
+/**
+ * @brief Monotonic time source. sleepMs() must yield on the device; the
+ * simulator may instead advance a virtual clock.
+ */
+class HalClock {
+public:
+  virtual ~HalClock() {}
+  virtual uint32_t millis() = 0;
+  virtual uint64_t micros() = 0;
+  virtual void sleepMs(uint32_t ms) = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Storage
+// ----------------------------------------------------------------------------
+enum HalFileMode {
+  HAL_FILE_READ,
+  HAL_FILE_WRITE,    // create or truncate
+  HAL_FILE_APPEND,   // create or append
+  HAL_FILE_UPDATE    // create if missing; read and write anywhere, no truncation
+};
+
+class HalFile {
+public:
+  virtual ~HalFile() {}
+  virtual size_t read(uint8_t* buffer, size_t length) = 0;
+  virtual size_t write(const uint8_t* data, size_t length) = 0;
+  virtual bool seek(uint32_t position) = 0;
+  virtual uint32_t position() = 0;
+  virtual uint32_t size() = 0;
+  virtual void close() = 0;
+};
+
+struct HalDirEntry {
+  char name[64];       // base name, no directory part
+  uint32_t size;
+  bool isDirectory;
+};
+
+/**
+ * @brief Forward-only directory iterator (maps to File::openNextFile()).
+ */
+class HalDir {
+public:
+  virtual ~HalDir() {}
+  virtual bool next(HalDirEntry &entry) = 0;
+  virtual void close() = 0;
+};
+
+class HalFileSystem {
+public:
+  virtual ~HalFileSystem() {}
+  virtual std::unique_ptr<HalFile> open(const char* path, HalFileMode mode) = 0;
+  virtual std::unique_ptr<HalDir> openDir(const char* path) = 0;
+  virtual bool exists(const char* path) = 0;
+  virtual bool mkdir(const char* path) = 0;
+  virtual bool remove(const char* path) = 0;
+  virtual bool rmdir(const char* path) = 0;
+  virtual uint64_t totalBytes() = 0;
+  virtual uint64_t usedBytes() = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Non-volatile settings (NVS on the device)
+// ----------------------------------------------------------------------------
+/**
+ * @brief Small named blobs that survive reboots and card swaps. Keys are
+ * at most 15 characters (the NVS limit).
+ */
+class HalKeyValueStore {
+public:
+  virtual ~HalKeyValueStore() {}
+  /** @return bytes read, 0 if the key is missing or larger than capacity */
+  virtual size_t read(const char* key, uint8_t* buffer, size_t capacity) = 0;
+  virtual bool write(const char* key, const uint8_t* data, size_t length) = 0;
+  virtual bool erase(const char* key) = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Serial links (RS485 Modbus, GPS UART)
+// ----------------------------------------------------------------------------
+class HalSerialPort {
+public:
+  virtual ~HalSerialPort() {}
+  virtual void begin(uint32_t baud) = 0;
+  virtual void end() = 0;
+  virtual uint32_t baud() = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual size_t write(const uint8_t* data, size_t length) = 0;
+  /** @brief Blocks until the TX FIFO has drained onto the wire. */
+  virtual void flush() = 0;
+  /** @brief RS485 driver enable (DE/RE). No-op on plain UARTs. */
+  virtual void setTransmit(bool enable) { (void)enable; }
+};
+
+// ----------------------------------------------------------------------------
+// BLE notifications
+// ----------------------------------------------------------------------------
+class HalNotifySink {
+public:
+  virtual ~HalNotifySink() {}
+  /** @brief Largest payload one notification can carry (ATT MTU - 3). */
+  virtual size_t maxPayload() = 0;
+  /**
+   * @brief Queues one notification.
+   * @return false if the link is congested and the caller should retry later
+   */
+  virtual bool notify(const uint8_t* data, size_t length) = 0;
+  virtual bool connected() = 0;
+};
+
+#endif
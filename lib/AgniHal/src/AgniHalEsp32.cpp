@@ -0,0 +1,148 @@
+#ifdef ARDUINO
+
+#include "AgniHalEsp32.h"
+
+#include <SD.h>
+#include <esp_gatts_api.h>
+
+// ============================================================================
+// FILE SYSTEM
+// ============================================================================
+class ArduinoFile : public HalFile {
+public:
+  explicit ArduinoFile(File f) : file(f) {}
+  ~ArduinoFile() override { close(); }
+  size_t read(uint8_t* buffer, size_t length) override { return file.read(buffer, length); }
+  size_t write(const uint8_t* data, size_t length) override { return file.write(data, length); }
+  bool seek(uint32_t position) override { return file.seek(position); }
+  uint32_t position() override { return file.position(); }
+  uint32_t size() override { return file.size(); }
+  void close() override {
+    if (file) file.close();
+  }
+
+private:
+  File file;
+};
+
+class ArduinoDir : public HalDir {
+public:
+  explicit ArduinoDir(File d) : dir(d) {}
+  ~ArduinoDir() override { close(); }
+
+  bool next(HalDirEntry &entry) override {
+    File f = dir.openNextFile();
+    if (!f) return false;
+    // name() is the base name on core 2.x but a full path on older cores
+    const char* name = f.name();
+    const char* slash = strrchr(name, '/');
+    strncpy(entry.name, slash ? slash + 1 : name, sizeof(entry.name) - 1);
+    entry.name[sizeof(entry.name) - 1] = '\0';
+    entry.size = f.size();
+    entry.isDirectory = f.isDirectory();
+    f.close();
+    return true;
+  }
+
+  void close() override {
+    if (dir) dir.close();
+  }
+
+private:
+  File dir;
+};
+
+std::unique_ptr<HalFile> ArduinoFileSystem::open(const char* path, HalFileMode mode) {
+  const char* fsMode = FILE_READ;
+  if (mode == HAL_FILE_WRITE) fsMode = FILE_WRITE;
+  else if (mode == HAL_FILE_APPEND) fsMode = FILE_APPEND;
+  else if (mode == HAL_FILE_UPDATE) {
+    // "r+" needs the file to exist
+    if (!fs.exists(path)) {
+      File created = fs.open(path, FILE_WRITE);
+      if (!created) return std::unique_ptr<HalFile>();
+      created.close();
+    }
+    fsMode = "r+";
+  }
+  File f = fs.open(path, fsMode);
+  if (!f) return std::unique_ptr<HalFile>();
+  return std::unique_ptr<HalFile>(new ArduinoFile(f));
+}
+
+std::unique_ptr<HalDir> ArduinoFileSystem::openDir(const char* path) {
+  File d = fs.open(path);
+  if (!d || !d.isDirectory()) return std::unique_ptr<HalDir>();
+  return std::unique_ptr<HalDir>(new ArduinoDir(d));
+}
+
+// fs::FS has no capacity API; the SD card is the only file system we mount
+uint64_t ArduinoFileSystem::totalBytes() {
+  return &fs == &SD ? SD.totalBytes() : 0;
+}
+
+uint64_t ArduinoFileSystem::usedBytes() {
+  return &fs == &SD ? SD.usedBytes() : 0;
+}
+
+// ============================================================================
+// NVS
+// ============================================================================
+size_t NvsStore::read(const char* key, uint8_t* buffer, size_t capacity) {
+  if (!opened || !preferences.isKey(key)) return 0;
+  size_t length = preferences.getBytesLength(key);
+  if (length == 0 || length > capacity) return 0;
+  return preferences.getBytes(key, buffer, length);
+}
+
+bool NvsStore::write(const char* key, const uint8_t* data, size_t length) {
+  return opened && preferences.putBytes(key, data, length) == length;
+}
+
+// ============================================================================
+// UART / RS485
+// ============================================================================
+void UartPort::begin(uint32_t baud) {
+  if (dePin >= 0) {
+    pinMode(dePin, OUTPUT);
+    digitalWrite(dePin, LOW);
+  }
+  if (rePin >= 0) {
+    pinMode(rePin, OUTPUT);
+    digitalWrite(rePin, LOW);
+  }
+  serial.begin(baud, SERIAL_8N1, rxPin, txPin);
+  currentBaud = baud;
+}
+
+void UartPort::setTransmit(bool enable) {
+  if (dePin >= 0) digitalWrite(dePin, enable ? HIGH : LOW);
+  if (rePin >= 0) digitalWrite(rePin, enable ? HIGH : LOW);
+}
+
+// ============================================================================
+// BLE NOTIFICATIONS
+// ============================================================================
+void BleNotifySink::attach(BLEServer* s, BLECharacteristic* c) {
+  server = s;
+  characteristic = c;
+}
+
+bool BleNotifySink::notify(const uint8_t* data, size_t length) {
+  if (!characteristic) return false;
+  if (connection >= 0) {
+    // BLECharacteristic::notify() goes to every peer; one session's chunks go to its own
+    return esp_ble_gatts_send_indicate(server->getGattsIf(), (uint16_t)connection, characteristic->getHandle(),
+                                       length, (uint8_t*)data, false) == ESP_OK;
+  }
+  characteristic->setValue((uint8_t*)data, length);
+  characteristic->notify();
+  return true;
+}
+
+bool BleNotifySink::connected() {
+  if (!server) return false;
+  return connection >= 0 || server->getConnectedCount() > 0;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef AGNI_HAL_ESP32_H
+#define AGNI_HAL_ESP32_H
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <FS.h>
+#include <Preferences.h>
+#include <BLEServer.h>
+#include <BLECharacteristic.h>
+#include "AgniHal.h"
+
+// ============================================================================
+// ESP32 HAL BINDINGS
+// ============================================================================
+class Esp32Clock : public HalClock {
+public:
+  uint32_t millis() override { return ::millis(); }
+  uint64_t micros() override { return (uint64_t)esp_timer_get_time(); }
+  void sleepMs(uint32_t ms) override { vTaskDelay(pdMS_TO_TICKS(ms)); }
+};
+
+/**
+ * @brief Any Arduino fs::FS (SD, SD_MMC, LittleFS).
+ */
+class ArduinoFileSystem : public HalFileSystem {
+public:
+  explicit ArduinoFileSystem(fs::FS &fs) : fs(fs) {}
+  std::unique_ptr<HalFile> open(const char* path, HalFileMode mode) override;
+  std::unique_ptr<HalDir> openDir(const char* path) override;
+  bool exists(const char* path) override { return fs.exists(path); }
+  bool mkdir(const char* path) override { return fs.mkdir(path); }
+  bool remove(const char* path) override { return fs.remove(path); }
+  bool rmdir(const char* path) override { return fs.rmdir(path); }
+  uint64_t totalBytes() override;
+  uint64_t usedBytes() override;
+
+private:
+  fs::FS &fs;
+};
+
+/**
+ * @brief One Preferences namespace in the default NVS partition.
+ * begin() once NVS is up (after initArduino()).
+ */
+class NvsStore : public HalKeyValueStore {
+public:
+  explicit NvsStore(const char* nameSpace) : nameSpace(nameSpace) {}
+  bool begin() { return opened = preferences.begin(nameSpace, false); }
+  size_t read(const char* key, uint8_t* buffer, size_t capacity) override;
+  bool write(const char* key, const uint8_t* data, size_t length) override;
+  bool erase(const char* key) override { return opened && preferences.remove(key); }
+
+private:
+  const char* nameSpace;
+  Preferences preferences;
+  bool opened = false;
+};
+
+/**
+ * @brief HardwareSerial, optionally driving RS485 DE/RE pins.
+ * Pass -1 for dePin/rePin on a plain UART.
+ */
+class UartPort : public HalSerialPort {
+public:
+  UartPort(HardwareSerial &serial, int8_t rxPin, int8_t txPin, int8_t dePin = -1, int8_t rePin = -1)
+    : serial(serial), rxPin(rxPin), txPin(txPin), dePin(dePin), rePin(rePin) {}
+
+  void begin(uint32_t baud) override;
+  void end() override { serial.end(); }
+  uint32_t baud() override { return currentBaud; }
+  int available() override { return serial.available(); }
+  int read() override { return serial.read(); }
+  size_t write(const uint8_t* data, size_t length) override { return serial.write(data, length); }
+  void flush() override { serial.flush(); }
+  void setTransmit(bool enable) override;
+
+  HardwareSerial &hardware() { return serial; }
+
+private:
+  HardwareSerial &serial;
+  int8_t rxPin;
+  int8_t txPin;
+  int8_t dePin;
+  int8_t rePin;
+  uint32_t currentBaud = 0;
+};
+
+/**
+ * @brief Notifications on one characteristic of the BLE server.
+ * attach() once the GATT table exists.
+ */
+class BleNotifySink : public HalNotifySink {
+public:
+  explicit BleNotifySink(size_t payloadBytes) : payloadBytes(payloadBytes) {}
+  void attach(BLEServer* server, BLECharacteristic* characteristic);
+  /** @brief Notifies only this connection; -1 (the default) notifies every client. */
+  void setConnection(int connId) { connection = connId; }
+  void setMaxPayload(size_t bytes) { payloadBytes = bytes; }
+  size_t maxPayload() override { return payloadBytes; }
+  bool notify(const uint8_t* data, size_t length) override;
+  bool connected() override;
+
+private:
+  BLEServer* server = NULL;
+  BLECharacteristic* characteristic = NULL;
+  size_t payloadBytes;
+  int connection = -1;
+};
+
+#endif
+#endif
@@ -0,0 +1,170 @@
+#include "AgniKernels.h"
+
+#include <string.h>
+
+// ============================================================================
+// SHARED
+// ============================================================================
+void kernelAccumulate(KernelMoments &moments, int32_t value) {
+  if (moments.count == 0 || value < moments.minimum) moments.minimum = value;
+  if (moments.count == 0 || value > moments.maximum) moments.maximum = value;
+  moments.count++;
+  moments.sum += value;
+  moments.sumSquares += (uint64_t)((int64_t)value * value);
+}
+
+void kernelMerge(KernelMoments &into, const KernelMoments &from) {
+  if (from.count == 0) return;
+  if (into.count == 0 || from.minimum < into.minimum) into.minimum = from.minimum;
+  if (into.count == 0 || from.maximum > into.maximum) into.maximum = from.maximum;
+  into.count += from.count;
+  into.sum += from.sum;
+  into.sumSquares += from.sumSquares;
+}
+
+void kernelMeanVariance(const KernelMoments &moments, double &mean, double &variance) {
+  if (moments.count == 0) {
+    mean = 0;
+    variance = 0;
+    return;
+  }
+  mean = (double)moments.sum / moments.count;
+  variance = (double)moments.sumSquares / moments.count - mean * mean;
+  if (variance < 0) variance = 0;   // rounding on a constant column
+}
+
+static size_t histogramBin(int32_t value, int32_t lowest, int32_t width, size_t binCount) {
+  int64_t offset = (int64_t)value - lowest;
+  if (offset < 0) return 0;
+  int64_t bin = offset / width;
+  return bin >= (int64_t)binCount ? binCount - 1 : (size_t)bin;
+}
+
+// ============================================================================
+// SCALAR BACKEND
+// ============================================================================
+static void scalarMoments(const int32_t* values, size_t count, KernelMoments &out) {
+  memset(&out, 0, sizeof(out));
+  for (size_t i = 0; i < count; i++) kernelAccumulate(out, values[i]);
+}
+
+static void scalarHistogram(const int32_t* values, size_t count, int32_t lowest, int32_t width,
+                            uint32_t* bins, size_t binCount) {
+  if (width <= 0 || binCount == 0) return;
+  for (size_t i = 0; i < count; i++) bins[histogramBin(values[i], lowest, width, binCount)]++;
+}
+
+static size_t scalarCountInRange(const int32_t* values, size_t count, int32_t low, int32_t high) {
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (values[i] >= low && values[i] <= high) n++;
+  }
+  return n;
+}
+
+static size_t scalarSelect(const int32_t* values, const int32_t* flags, int32_t mask, size_t count, int32_t* out) {
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (flags[i] & mask) out[n++] = values[i];
+  }
+  return n;
+}
+
+// ============================================================================
+// UNROLLED BACKEND
+// ============================================================================
+// Lane j handles elements j, j + KERNEL_LANES, ...; the lanes are combined
+// once at the end and the tail goes through the scalar code.
+
+static void unrolledMoments(const int32_t* values, size_t count, KernelMoments &out) {
+  int64_t sum[KERNEL_LANES] = {0};
+  uint64_t squares[KERNEL_LANES] = {0};
+  int32_t low[KERNEL_LANES];
+  int32_t high[KERNEL_LANES];
+  for (int j = 0; j < KERNEL_LANES; j++) {
+    low[j] = INT32_MAX;
+    high[j] = INT32_MIN;
+  }
+
+  size_t blocks = count / KERNEL_LANES;
+  for (size_t b = 0; b < blocks; b++) {
+    const int32_t* v = values + b * KERNEL_LANES;
+    for (int j = 0; j < KERNEL_LANES; j++) {
+      sum[j] += v[j];
+      squares[j] += (uint64_t)((int64_t)v[j] * v[j]);
+      low[j] = v[j] < low[j] ? v[j] : low[j];
+      high[j] = v[j] > high[j] ? v[j] : high[j];
+    }
+  }
+
+  memset(&out, 0, sizeof(out));
+  if (blocks) {
+    out.count = (uint32_t)(blocks * KERNEL_LANES);
+    out.minimum = low[0];
+    out.maximum = high[0];
+    for (int j = 0; j < KERNEL_LANES; j++) {
+      out.sum += sum[j];
+      out.sumSquares += squares[j];
+      if (low[j] < out.minimum) out.minimum = low[j];
+      if (high[j] > out.maximum) out.maximum = high[j];
+    }
+  }
+  for (size_t i = blocks * KERNEL_LANES; i < count; i++) kernelAccumulate(out, values[i]);
+}
+
+static void unrolledHistogram(const int32_t* values, size_t count, int32_t lowest, int32_t width,
+                              uint32_t* bins, size_t binCount) {
+  if (width <= 0 || binCount == 0) return;
+  if (binCount > KERNEL_HISTOGRAM_MAX_BINS) {
+    scalarHistogram(values, count, lowest, width, bins, binCount);
+    return;
+  }
+  // Four private histograms so neighbouring equal values don't serialise
+  // on the same counter
+  uint32_t partial[4][KERNEL_HISTOGRAM_MAX_BINS];
+  memset(partial, 0, sizeof(partial));
+  size_t blocks = count / 4;
+  for (size_t b = 0; b < blocks; b++) {
+    const int32_t* v = values + b * 4;
+    for (int j = 0; j < 4; j++) partial[j][histogramBin(v[j], lowest, width, binCount)]++;
+  }
+  for (size_t i = blocks * 4; i < count; i++) partial[0][histogramBin(values[i], lowest, width, binCount)]++;
+  for (size_t k = 0; k < binCount; k++) bins[k] += partial[0][k] + partial[1][k] + partial[2][k] + partial[3][k];
+}
+
+static size_t unrolledCountInRange(const int32_t* values, size_t count, int32_t low, int32_t high) {
+  if (high < low) return 0;
+  // One unsigned compare per element: v in [low, high] <=> v - low <= high - low
+  const uint32_t span = (uint32_t)high - (uint32_t)low;
+  uint32_t lanes[KERNEL_LANES] = {0};
+  size_t blocks = count / KERNEL_LANES;
+  for (size_t b = 0; b < blocks; b++) {
+    const int32_t* v = values + b * KERNEL_LANES;
+    for (int j = 0; j < KERNEL_LANES; j++) lanes[j] += ((uint32_t)v[j] - (uint32_t)low) <= span;
+  }
+  size_t n = 0;
+  for (int j = 0; j < KERNEL_LANES; j++) n += lanes[j];
+  return n + scalarCountInRange(values + blocks * KERNEL_LANES, count - blocks * KERNEL_LANES, low, high);
+}
+
+static size_t unrolledSelect(const int32_t* values, const int32_t* flags, int32_t mask, size_t count, int32_t* out) {
+  // Branch-free: always store, only advance on a match
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    out[n] = values[i];
+    n += (flags[i] & mask) != 0;
+  }
+  return n;
+}
+
+// ============================================================================
+// DISPATCH
+// ============================================================================
+static const KernelBackend BACKENDS[] = {
+  {"scalar", scalarMoments, scalarHistogram, scalarCountInRange, scalarSelect},
+  {"unrolled", unrolledMoments, unrolledHistogram, unrolledCountInRange, unrolledSelect},
+};
+
+const KernelBackend &kernelBackend(int backend) {
+  return backend == KERNEL_BACKEND_SCALAR ? BACKENDS[0] : BACKENDS[1];
+}
@@ -0,0 +1,84 @@
+#ifndef AGNI_KERNELS_H
+#define AGNI_KERNELS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ============================================================================
+// BATCH ANALYTICS KERNELS
+// ============================================================================
+// Loops over one fixed-point column at a time (structure of arrays, e.g. a
+// decoded archive block), never over SensorData structs. Everything is
+// integer arithmetic, so every backend gives bit-identical results; mean
+// and variance are derived from the integer moments afterwards.
+//
+// Backends:
+//   scalar    one element per iteration; the reference
+//   unrolled  KERNEL_LANES independent accumulators per iteration. GCC
+//             turns these into SSE/AVX on the host; on the S3 they keep
+//             both load/ALU slots busy without loop-carried stalls.
+//
+// AGNI_KERNEL_BACKEND picks the one behind the kernel*() functions; both
+// stay reachable through kernelBackend() for tests and the bench.
+
+#define KERNEL_BACKEND_SCALAR    0
+#define KERNEL_BACKEND_UNROLLED  1
+#ifndef AGNI_KERNEL_BACKEND
+#define AGNI_KERNEL_BACKEND      KERNEL_BACKEND_UNROLLED
+#endif
+
+#define KERNEL_LANES             8
+#define KERNEL_HISTOGRAM_MAX_BINS 64
+
+/**
+ * @brief Count, min, max, sum and sum of squares of a column slice. Merges
+ * by addition, so it is also the rollup bucket layout.
+ */
+struct KernelMoments {
+  int64_t sum;
+  uint64_t sumSquares;
+  uint32_t count;
+  int32_t minimum;   // undefined while count == 0
+  int32_t maximum;
+};
+
+struct KernelBackend {
+  const char* name;
+  /** @brief Fresh moments of values[0..count). */
+  void (*moments)(const int32_t* values, size_t count, KernelMoments &out);
+  /**
+   * @brief Adds values into bins of the given width starting at lowest;
+   * anything outside lands in the first or last bin. bins is not cleared.
+   */
+  void (*histogram)(const int32_t* values, size_t count, int32_t lowest, int32_t width,
+                    uint32_t* bins, size_t binCount);
+  /** @brief How many values lie in [low, high]. */
+  size_t (*countInRange)(const int32_t* values, size_t count, int32_t low, int32_t high);
+  /** @brief Copies values whose flag has any bit of mask set; returns how many. */
+  size_t (*select)(const int32_t* values, const int32_t* flags, int32_t mask, size_t count, int32_t* out);
+};
+
+const KernelBackend &kernelBackend(int backend);
+
+inline void kernelMoments(const int32_t* values, size_t count, KernelMoments &out) {
+  kernelBackend(AGNI_KERNEL_BACKEND).moments(values, count, out);
+}
+inline void kernelHistogram(const int32_t* values, size_t count, int32_t lowest, int32_t width,
+                            uint32_t* bins, size_t binCount) {
+  kernelBackend(AGNI_KERNEL_BACKEND).histogram(values, count, lowest, width, bins, binCount);
+}
+inline size_t kernelCountInRange(const int32_t* values, size_t count, int32_t low, int32_t high) {
+  return kernelBackend(AGNI_KERNEL_BACKEND).countInRange(values, count, low, high);
+}
+inline size_t kernelSelect(const int32_t* values, const int32_t* flags, int32_t mask, size_t count, int32_t* out) {
+  return kernelBackend(AGNI_KERNEL_BACKEND).select(values, flags, mask, count, out);
+}
+
+/** @brief Folds one value in (the incremental, per-sample path). */
+void kernelAccumulate(KernelMoments &moments, int32_t value);
+/** @brief into += from. */
+void kernelMerge(KernelMoments &into, const KernelMoments &from);
+/** @brief Mean and population variance in fixed-point units; 0 for an empty slice. */
+void kernelMeanVariance(const KernelMoments &moments, double &mean, double &variance);
+
+#endif
@@ -0,0 +1,93 @@
+#include "AgniLive.h"
+
+#include <string.h>
+
+// ============================================================================
+// FRAME
+// ============================================================================
+size_t encodeLiveFrame(const ArchiveSample &sample, uint16_t sequence, uint32_t ageMs, uint8_t* out, size_t capacity) {
+  if (capacity < LIVE_FRAME_BYTES) return 0;
+  uint16_t age = ageMs > UINT16_MAX ? UINT16_MAX : (uint16_t)ageMs;
+  out[0] = LIVE_MARKER;
+  out[1] = (uint8_t)sample.values[ARCHIVE_FLAGS];
+  out[2] = (uint8_t)sequence;
+  out[3] = (uint8_t)(sequence >> 8);
+  out[4] = (uint8_t)age;
+  out[5] = (uint8_t)(age >> 8);
+  packSoilColumns(sample, out + 6);
+  return LIVE_FRAME_BYTES;
+}
+
+bool decodeLiveFrame(const uint8_t* data, size_t length, ArchiveSample &sample, uint16_t &sequence, uint16_t &ageMs) {
+  if (length != LIVE_FRAME_BYTES || data[0] != LIVE_MARKER) return false;
+  memset(&sample, 0, sizeof(sample));
+  sample.values[ARCHIVE_FLAGS] = data[1];
+  sequence = (uint16_t)(data[2] | (data[3] << 8));
+  ageMs = (uint16_t)(data[4] | (data[5] << 8));
+  unpackSoilColumns(data + 6, sample);
+  return true;
+}
+
+// ============================================================================
+// STREAM
+// ============================================================================
+void LiveStream::setInterval(uint32_t ms) {
+  if (ms && ms < LIVE_MIN_INTERVAL_MS) ms = LIVE_MIN_INTERVAL_MS;
+  if (ms == 0 || intervalMs == 0) {
+    // Starting or stopping: the next sample goes out right away
+    hasPending = false;
+    sentAny = false;
+    retrying = false;
+  }
+  intervalMs = ms;
+}
+
+void LiveStream::offer(const ArchiveSample &sample) {
+  if (!active()) return;
+  if (hasPending) counters.coalesced++;
+  pending = sample;
+  hasPending = true;
+  pendingAtUs = (uint32_t)clock.micros();
+  sequence++;
+  counters.samples++;
+}
+
+uint32_t LiveStream::dueAtMs(bool bulkActive) const {
+  uint32_t now = clock.millis();
+  uint32_t due = now;
+  if (sentAny) {
+    uint32_t gap = bulkActive && intervalMs < LIVE_BULK_INTERVAL_MS ? LIVE_BULK_INTERVAL_MS : intervalMs;
+    if ((int32_t)(lastSentMs + gap - due) > 0) due = lastSentMs + gap;
+  }
+  if (retrying && (int32_t)(retryAtMs - due) > 0) due = retryAtMs;
+  return due;
+}
+
+bool LiveStream::pump(bool bulkActive) {
+  if (!active() || !hasPending) return false;
+  uint32_t now = clock.millis();
+  if ((int32_t)(dueAtMs(bulkActive) - now) > 0) return false;
+
+  uint32_t delayUs = (uint32_t)clock.micros() - pendingAtUs;
+  uint8_t frame[LIVE_FRAME_BYTES];
+  size_t length = encodeLiveFrame(pending, sequence, delayUs / 1000, frame, sizeof(frame));
+  if (!sink.notify(frame, length)) {
+    counters.rejected++;
+    retrying = true;
+    retryAtMs = now + LIVE_RETRY_MS;
+    return false;
+  }
+  hasPending = false;
+  retrying = false;
+  sentAny = true;
+  lastSentMs = now;
+  counters.frames++;
+  counters.delayUs.record(delayUs);
+  return true;
+}
+
+uint32_t LiveStream::msUntilDue(bool bulkActive) const {
+  if (!active() || !hasPending) return UINT32_MAX;
+  int32_t left = (int32_t)(dueAtMs(bulkActive) - clock.millis());
+  return left > 0 ? (uint32_t)left : 0;
+}
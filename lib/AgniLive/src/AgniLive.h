@@ -0,0 +1,93 @@
+#ifndef AGNI_LIVE_H
+#define AGNI_LIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniHal.h>
+#include <AgniMetrics.h>
+#include <AgniArchive.h>
+#include <AgniBeacon.h>
+
+// ============================================================================
+// LIVE SAMPLE STREAM
+// ============================================================================
+// Pushes every new reading to a subscribed client as it is acquired, on its
+// own notify characteristic, for live charts and calibration rigs. The
+// client picks the fastest rate it wants on the command characteristic:
+//
+//   LIVE:<min interval ms>   e.g. LIVE:1000;  LIVE:0 stops the stream
+//
+// One sample waits at a time: a newer one replaces it (coalescing), so a
+// slow client or link only ever gets the latest value, never a backlog.
+// While a file transfer runs the stream yields to it, sending at most one
+// frame per LIVE_BULK_INTERVAL_MS. A frame the link refuses is retried
+// after LIVE_RETRY_MS. Frames are 20 bytes, one notification even at the
+// default ATT MTU; little-endian:
+//
+//    0  u8  LIVE_MARKER
+//    1  u8  ARCHIVE_FLAG_* of the sample
+//    2  u16 sequence, one per acquired sample: a jump of n means n - 1
+//           samples were coalesced away
+//    4  u16 ms between acquisition and sending, saturated
+//    6  7 x u16 soil columns as in the advertised reading (AgniBeacon.h)
+
+#define LIVE_COMMAND            "LIVE:"
+#define LIVE_MARKER             0x03
+#define LIVE_FRAME_BYTES        (6 + 2 * BEACON_FIELDS)
+#define LIVE_MIN_INTERVAL_MS    100
+#define LIVE_BULK_INTERVAL_MS   2000   // floor while a file transfer shares the link
+#define LIVE_RETRY_MS           50
+
+size_t encodeLiveFrame(const ArchiveSample &sample, uint16_t sequence, uint32_t ageMs, uint8_t* out, size_t capacity);
+/** @brief Soil columns and flags; the other columns come back 0. */
+bool decodeLiveFrame(const uint8_t* data, size_t length, ArchiveSample &sample, uint16_t &sequence, uint16_t &ageMs);
+
+struct LiveStats {
+  uint32_t samples = 0;          // offered while streaming
+  uint32_t frames = 0;           // sent
+  uint32_t coalesced = 0;        // replaced by a newer sample before sending
+  uint32_t rejected = 0;         // link refused the frame, retried
+  LatencyHistogram delayUs;      // acquisition -> frame sent
+};
+
+class LiveStream {
+public:
+  LiveStream(HalNotifySink &sink, HalClock &clock) : sink(sink), clock(clock) {}
+
+  /** @brief 0 stops the stream and drops the waiting sample; others are raised to LIVE_MIN_INTERVAL_MS. */
+  void setInterval(uint32_t ms);
+  uint32_t interval() const { return intervalMs; }
+  bool active() const { return intervalMs != 0; }
+
+  /** @brief Hands over the newest sample; ignored while stopped. */
+  void offer(const ArchiveSample &sample);
+
+  /**
+   * @brief Sends the waiting sample if the interval allows.
+   * @param bulkActive a file transfer is running; the stream yields to it
+   * @return true if a frame went out
+   */
+  bool pump(bool bulkActive);
+  /** @brief Milliseconds until pump() has work, UINT32_MAX if nothing waits. */
+  uint32_t msUntilDue(bool bulkActive) const;
+
+  const LiveStats &stats() const { return counters; }
+
+private:
+  uint32_t dueAtMs(bool bulkActive) const;
+
+  HalNotifySink &sink;
+  HalClock &clock;
+  uint32_t intervalMs = 0;
+  ArchiveSample pending;
+  bool hasPending = false;
+  uint32_t pendingAtUs = 0;
+  uint16_t sequence = 0;         // of the newest offered sample
+  bool sentAny = false;
+  uint32_t lastSentMs = 0;
+  uint32_t retryAtMs = 0;
+  bool retrying = false;
+  LiveStats counters;
+};
+
+#endif
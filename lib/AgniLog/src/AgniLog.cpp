@@ -0,0 +1,523 @@
+#include "AgniLog.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+// ============================================================================
+// RINGS
+// ============================================================================
+enum SlotRead { SLOT_OK, SLOT_PENDING, SLOT_LAPPED };
+
+/** @brief Copies the record with the given sequence if it is complete and still there. */
+static SlotRead readSlot(const LogRing &ring, uint32_t sequence, LogRecord &out) {
+  const LogSlot &slot = ring.slots[sequence % LOG_RING_RECORDS];
+  uint32_t before = slot.sequence.load(std::memory_order_acquire);
+  if (before != sequence + 1) {
+    // 0 = being written; an older sequence = not written yet
+    return (before == 0 || (int32_t)(before - (sequence + 1)) < 0) ? SLOT_PENDING : SLOT_LAPPED;
+  }
+  out = slot.record;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.sequence.load(std::memory_order_relaxed) == before ? SLOT_OK : SLOT_LAPPED;
+}
+
+bool Logger::begin(uint32_t buildId) {
+  bool kept = state.magic == LOG_STATE_MAGIC && state.buildId == buildId;
+  if (!kept) {
+    state.magic = LOG_STATE_MAGIC;
+    state.buildId = buildId;
+    state.boot = 0;
+    for (int c = 0; c < LOG_CORES; c++) {
+      state.rings[c].head.store(0, std::memory_order_relaxed);
+      for (size_t i = 0; i < LOG_RING_RECORDS; i++) state.rings[c].slots[i].sequence.store(0, std::memory_order_relaxed);
+    }
+  }
+  state.boot++;
+  for (int c = 0; c < LOG_CORES; c++) {
+    tails[c] = headsAtBegin[c] = state.rings[c].head.load(std::memory_order_relaxed);
+  }
+  counters = LogStats();
+  return kept;
+}
+
+void Logger::write(uint8_t core, uint8_t level, const char* format, const LogArg* args, uint8_t argCount,
+                   const char* text) {
+  LogRing &ring = state.rings[core < LOG_CORES ? core : LOG_CORES - 1];
+  uint32_t sequence = ring.head.fetch_add(1, std::memory_order_relaxed);
+  LogSlot &slot = ring.slots[sequence % LOG_RING_RECORDS];
+  slot.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  LogRecord &record = slot.record;
+  record.timeMs = clock.millis();
+  record.format = format;
+  record.level = level;
+  record.core = core;
+  record.boot = (uint8_t)state.boot;
+  record.argCount = argCount;
+  for (uint8_t i = 0; i < argCount; i++) record.args[i] = args[i];
+  record.text[0] = '\0';
+  if (text) {
+    size_t i = 0;
+    for (; i < LOG_TEXT_MAX - 1 && text[i]; i++) record.text[i] = text[i];
+    record.text[i] = '\0';
+  }
+  slot.sequence.store(sequence + 1, std::memory_order_release);
+}
+
+bool Logger::next(LogRecord &record) {
+  LogRecord candidates[LOG_CORES];
+  int best = -1;
+  for (int c = 0; c < LOG_CORES; c++) {
+    const LogRing &ring = state.rings[c];
+    uint32_t head = ring.head.load(std::memory_order_acquire);
+    for (;;) {
+      if (tails[c] == head) break;
+      if (head - tails[c] > LOG_RING_RECORDS) {
+        counters.dropped += head - LOG_RING_RECORDS - tails[c];
+        tails[c] = head - LOG_RING_RECORDS;
+      }
+      SlotRead read = readSlot(ring, tails[c], candidates[c]);
+      if (read == SLOT_PENDING) break;
+      if (read == SLOT_LAPPED) {
+        counters.dropped++;
+        tails[c]++;
+        continue;
+      }
+      if (best < 0 || (int32_t)(candidates[c].timeMs - candidates[best].timeMs) < 0) best = c;
+      break;
+    }
+  }
+  if (best < 0) return false;
+  record = candidates[best];
+  tails[best]++;
+  counters.drained++;
+  return true;
+}
+
+uint32_t Logger::backlog() const {
+  uint32_t waiting = 0;
+  for (int c = 0; c < LOG_CORES; c++) waiting += state.rings[c].head.load(std::memory_order_relaxed) - tails[c];
+  return waiting;
+}
+
+uint32_t Logger::written() const {
+  uint32_t total = 0;
+  for (int c = 0; c < LOG_CORES; c++) total += state.rings[c].head.load(std::memory_order_relaxed) - headsAtBegin[c];
+  return total;
+}
+
+size_t Logger::history(LogRecord* out, size_t capacity) const {
+  size_t count = 0;
+  for (int c = 0; c < LOG_CORES; c++) {
+    const LogRing &ring = state.rings[c];
+    uint32_t head = ring.head.load(std::memory_order_acquire);
+    uint32_t first = head > LOG_RING_RECORDS ? head - LOG_RING_RECORDS : 0;
+    for (uint32_t sequence = first; sequence != head && count < capacity; sequence++) {
+      if (readSlot(ring, sequence, out[count]) == SLOT_OK) count++;
+    }
+  }
+  // Boots wrap at 256, so compare them relative to the current one
+  uint8_t current = (uint8_t)state.boot;
+  std::stable_sort(out, out + count, [current](const LogRecord &a, const LogRecord &b) {
+    uint8_t ageA = (uint8_t)(current - a.boot);
+    uint8_t ageB = (uint8_t)(current - b.boot);
+    if (ageA != ageB) return ageA > ageB;
+    return (int32_t)(a.timeMs - b.timeMs) < 0;
+  });
+  return count;
+}
+
+// ============================================================================
+// FORMATTING
+// ============================================================================
+const char* logLevelName(uint8_t level) {
+  switch (level) {
+    case LOG_LEVEL_ERROR: return "E";
+    case LOG_LEVEL_WARN:  return "W";
+    case LOG_LEVEL_INFO:  return "I";
+    default:              return "D";
+  }
+}
+
+struct LogConversion {
+  const char* start;             // the '%'
+  size_t length;                 // through the conversion character
+  char conversion;
+  uint8_t longs;                 // 1 for l, 2 for ll
+};
+
+/**
+ * @brief Finds the next conversion from p on; "%%" is left to the caller.
+ * @return false if there is none
+ */
+static bool nextConversion(const char* p, LogConversion &spec) {
+  for (; *p; p++) {
+    if (*p != '%') continue;
+    const char* q = p + 1;
+    if (*q == '%') {
+      p = q;
+      continue;
+    }
+    while (*q && strchr("-+ #0", *q)) q++;
+    while (*q >= '0' && *q <= '9') q++;
+    if (*q == '.') {
+      q++;
+      while (*q >= '0' && *q <= '9') q++;
+    }
+    uint8_t longs = 0;
+    while (*q && strchr("hlzjt", *q)) {
+      if (*q == 'l') longs++;
+      q++;
+    }
+    if (!*q) return false;
+    spec.start = p;
+    spec.length = (size_t)(q - p) + 1;
+    spec.conversion = *q;
+    spec.longs = longs;
+    return true;
+  }
+  return false;
+}
+
+/** @brief Argument words a conversion consumes. */
+static uint8_t conversionWords(const LogConversion &spec) {
+  return (spec.longs >= 2 && strchr("diuxXo", spec.conversion)) ? 2 : 1;
+}
+
+static size_t appendText(char* out, size_t capacity, size_t length, const char* text, size_t count) {
+  if (length + 1 >= capacity) return length;
+  size_t room = capacity - 1 - length;
+  if (count > room) count = room;
+  memcpy(out + length, text, count);
+  return length + count;
+}
+
+/** @brief Formats one conversion with the given words into out + length. */
+static size_t appendConversion(char* out, size_t capacity, size_t length, const LogConversion &spec,
+                               const LogArg* words, const char* text) {
+  if (length + 1 >= capacity) return length;
+  char format[24];
+  if (spec.length >= sizeof(format)) return appendText(out, capacity, length, spec.start, spec.length);
+  // Rebuild the spec without length modifiers; the value is passed at its own width
+  size_t n = 0;
+  for (size_t i = 0; i < spec.length - 1; i++) {
+    if (!strchr("hlzjt", spec.start[i])) format[n++] = spec.start[i];
+  }
+  char conversion = spec.conversion;
+  size_t room = capacity - length;
+  int written;
+  switch (conversion) {
+    case 'd': case 'i':
+      if (spec.longs >= 2) {
+        format[n++] = 'l';
+        format[n++] = 'l';
+        format[n++] = conversion;
+        format[n] = '\0';
+        written = snprintf(out + length, room, format, (long long)((uint64_t)words[1].u << 32 | words[0].u));
+      } else {
+        format[n++] = conversion;
+        format[n] = '\0';
+        written = snprintf(out + length, room, format, (int)(int32_t)words[0].u);
+      }
+      break;
+    case 'u': case 'x': case 'X': case 'o':
+      if (spec.longs >= 2) {
+        format[n++] = 'l';
+        format[n++] = 'l';
+        format[n++] = conversion;
+        format[n] = '\0';
+        written = snprintf(out + length, room, format, (unsigned long long)((uint64_t)words[1].u << 32 | words[0].u));
+      } else {
+        format[n++] = conversion;
+        format[n] = '\0';
+        written = snprintf(out + length, room, format, (unsigned)words[0].u);
+      }
+      break;
+    case 'c':
+      format[n++] = 'c';
+      format[n] = '\0';
+      written = snprintf(out + length, room, format, (int)words[0].u);
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+      format[n++] = conversion;
+      format[n] = '\0';
+      written = snprintf(out + length, room, format, (double)words[0].f);
+      break;
+    case 's': {
+      const char* value = words[0].s ? words[0].s : (text && text[0] ? text : "(null)");
+      format[n++] = 's';
+      format[n] = '\0';
+      written = snprintf(out + length, room, format, value);
+      break;
+    }
+    default:
+      return appendText(out, capacity, length, spec.start, spec.length);
+  }
+  if (written < 0) return length;
+  return (size_t)written < room ? length + (size_t)written : capacity - 1;
+}
+
+/** @brief The message alone, with the text of the record's first null %s. */
+static size_t formatMessage(const char* format, const LogArg* args, uint8_t argCount, const char* text,
+                            char* out, size_t capacity, size_t length) {
+  const char* p = format ? format : "(no format)";
+  uint8_t used = 0;
+  bool textUsed = false;
+  LogConversion spec;
+  while (nextConversion(p, spec)) {
+    // Literal text before the conversion, "%%" collapsed
+    for (const char* q = p; q < spec.start; q++) {
+      if (*q == '%' && q[1] == '%') q++;
+      length = appendText(out, capacity, length, q, 1);
+    }
+    uint8_t words = conversionWords(spec);
+    if (used + words > argCount) {
+      length = appendText(out, capacity, length, "?", 1);
+    } else {
+      length = appendConversion(out, capacity, length, spec, args + used, textUsed ? NULL : text);
+      if (spec.conversion == 's' && !args[used].s) textUsed = true;
+    }
+    used += words;
+    p = spec.start + spec.length;
+  }
+  for (const char* q = p; *q; q++) {
+    if (*q == '%' && q[1] == '%') q++;
+    length = appendText(out, capacity, length, q, 1);
+  }
+  // A trailing newline is the drain's job
+  while (length > 0 && out[length - 1] == '\n') length--;
+  return length;
+}
+
+size_t formatLogRecord(const LogRecord &record, char* out, size_t capacity) {
+  if (capacity == 0) return 0;
+  int written = snprintf(out, capacity, "[%4lu.%03lu] %s ", (unsigned long)(record.timeMs / 1000),
+                         (unsigned long)(record.timeMs % 1000), logLevelName(record.level));
+  size_t length = written < 0 ? 0 : (size_t)written < capacity ? (size_t)written : capacity - 1;
+  length = formatMessage(record.format, record.args, record.argCount, record.text, out, capacity, length);
+  out[length] = '\0';
+  return length;
+}
+
+// ============================================================================
+// DUMP
+// ============================================================================
+namespace {
+
+struct DumpWriter {
+  HalFile &file;
+  uint8_t buffer[256];
+  size_t used = 0;
+  bool ok = true;
+  const char* strings[LOG_DUMP_MAX_STRINGS];
+  size_t stringCount = 0;
+
+  explicit DumpWriter(HalFile &file) : file(file) {}
+
+  void flush() {
+    if (used && file.write(buffer, used) != used) ok = false;
+    used = 0;
+  }
+  void put(const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (length) {
+      if (used == sizeof(buffer)) flush();
+      size_t take = std::min(length, sizeof(buffer) - used);
+      memcpy(buffer + used, bytes, take);
+      used += take;
+      bytes += take;
+      length -= take;
+    }
+  }
+  void u8(uint8_t v) { put(&v, 1); }
+  void u16(uint16_t v) {
+    uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    put(b, 2);
+  }
+  void u32(uint32_t v) {
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    put(b, 4);
+  }
+  void bytesWithLength(const char* s) {
+    size_t length = strnlen(s, 0xFFFF);
+    u16((uint16_t)length);
+    put(s, length);
+  }
+  /** @brief Remembered strings are written once, by address; copies inline. */
+  void string(const char* s, bool remember) {
+    if (!s) s = "(null)";
+    if (remember) {
+      for (size_t i = 0; i < stringCount; i++) {
+        if (strings[i] == s) {
+          u16((uint16_t)i);
+          return;
+        }
+      }
+      if (stringCount < LOG_DUMP_MAX_STRINGS) {
+        u16((uint16_t)stringCount);
+        strings[stringCount++] = s;
+        bytesWithLength(s);
+        return;
+      }
+    }
+    u16(LOG_STRING_INLINE);
+    bytesWithLength(s);
+  }
+};
+
+}  // namespace
+
+bool writeLogDump(HalFile &file, const LogRecord* records, size_t count, uint32_t boot, uint32_t dropped) {
+  DumpWriter w(file);
+  w.put(LOG_DUMP_MAGIC, 4);
+  w.u8(LOG_DUMP_VERSION);
+  w.u8(0);
+  w.u16((uint16_t)std::min(count, (size_t)0xFFFF));
+  w.u32(boot);
+  w.u32(dropped);
+  for (size_t r = 0; r < count && r < 0xFFFF; r++) {
+    const LogRecord &record = records[r];
+    w.u32(record.timeMs);
+    w.u8(record.level);
+    w.u8(record.core);
+    w.u8(record.boot);
+    w.u8(record.argCount);
+    w.string(record.format, true);
+    // Walk the format so every %s goes out as its text, not its address
+    const char* p = record.format ? record.format : "";
+    uint8_t used = 0;
+    bool textUsed = false;
+    LogConversion spec;
+    while (used < record.argCount && nextConversion(p, spec)) {
+      uint8_t words = conversionWords(spec);
+      for (uint8_t i = 0; i < words && used < record.argCount; i++, used++) {
+        if (spec.conversion == 's' && record.args[used].s) {
+          w.string(record.args[used].s, true);
+        } else if (spec.conversion == 's') {
+          w.string(textUsed ? "(null)" : record.text, false);
+          textUsed = true;
+        } else {
+          w.u32(record.args[used].u);
+        }
+      }
+      p = spec.start + spec.length;
+    }
+    // Words the format does not mention
+    for (; used < record.argCount; used++) w.u32(record.args[used].u);
+  }
+  w.flush();
+  return w.ok;
+}
+
+namespace {
+
+struct DumpReader {
+  const uint8_t* data;
+  size_t length;
+  size_t offset = 0;
+  bool ok = true;
+  std::vector<std::string> strings;
+
+  bool need(size_t n) {
+    if (offset + n > length) ok = false;
+    return ok;
+  }
+  uint8_t u8() { return need(1) ? data[offset++] : 0; }
+  uint16_t u16() {
+    if (!need(2)) return 0;
+    uint16_t v = (uint16_t)(data[offset] | (data[offset + 1] << 8));
+    offset += 2;
+    return v;
+  }
+  uint32_t u32() {
+    if (!need(4)) return 0;
+    uint32_t v = (uint32_t)data[offset] | ((uint32_t)data[offset + 1] << 8) |
+                 ((uint32_t)data[offset + 2] << 16) | ((uint32_t)data[offset + 3] << 24);
+    offset += 4;
+    return v;
+  }
+  std::string text() {
+    uint16_t n = u16();
+    if (!need(n)) return std::string();
+    std::string s((const char*)data + offset, n);
+    offset += n;
+    return s;
+  }
+  /** @brief Index into strings, or -1 for an inline one stored in inlineText. */
+  int string(std::string &inlineText) {
+    uint16_t index = u16();
+    if (index == LOG_STRING_INLINE) {
+      inlineText = text();
+      return -1;
+    }
+    if (index == strings.size()) strings.push_back(text());
+    else if (index > strings.size()) ok = false;
+    return ok ? index : -1;
+  }
+};
+
+}  // namespace
+
+bool decodeLogDump(const uint8_t* data, size_t length, std::vector<std::string> &lines) {
+  if (length < LOG_DUMP_HEADER_BYTES || memcmp(data, LOG_DUMP_MAGIC, 4) != 0 || data[4] != LOG_DUMP_VERSION) return false;
+  DumpReader r;
+  r.data = data;
+  r.length = length;
+  r.offset = 8;
+  uint16_t count = (uint16_t)(data[6] | (data[7] << 8));
+  r.u32();   // boot
+  r.u32();   // dropped
+  char line[LOG_LINE_MAX];
+  for (uint16_t i = 0; i < count && r.ok; i++) {
+    LogRecord record;
+    memset(&record, 0, sizeof(record));
+    record.timeMs = r.u32();
+    record.level = r.u8();
+    record.core = r.u8();
+    record.boot = r.u8();
+    record.argCount = r.u8();
+    if (record.argCount > LOG_MAX_ARGS) return false;
+    std::string inlineFormat;
+    int formatIndex = r.string(inlineFormat);
+    if (!r.ok) return false;
+    // The strings vector may grow below, so keep the format by value
+    std::string format = formatIndex < 0 ? inlineFormat : r.strings[formatIndex];
+    std::vector<std::string> texts;
+    std::vector<int> textIndex(record.argCount, -2);
+    const char* p = format.c_str();
+    uint8_t used = 0;
+    LogConversion spec;
+    while (used < record.argCount && nextConversion(p, spec)) {
+      uint8_t words = conversionWords(spec);
+      for (uint8_t w = 0; w < words && used < record.argCount; w++, used++) {
+        if (spec.conversion == 's') {
+          std::string inlineText;
+          int index = r.string(inlineText);
+          if (index < 0) {
+            texts.push_back(inlineText);
+            textIndex[used] = -1 - (int)(texts.size() - 1);
+          } else {
+            textIndex[used] = index;
+          }
+        } else {
+          record.args[used].u = r.u32();
+        }
+      }
+      p = spec.start + spec.length;
+    }
+    for (; used < record.argCount; used++) record.args[used].u = r.u32();
+    if (!r.ok) return false;
+    // Every string is in place now; point the %s arguments at them
+    for (uint8_t a = 0; a < record.argCount; a++) {
+      if (textIndex[a] >= 0) record.args[a].s = r.strings[textIndex[a]].c_str();
+      else if (textIndex[a] != -2) record.args[a].s = texts[-1 - textIndex[a]].c_str();
+    }
+    record.format = format.c_str();
+    int prefix = snprintf(line, sizeof(line), "#%u ", (unsigned)record.boot);
+    formatLogRecord(record, line + prefix, sizeof(line) - prefix);
+    lines.push_back(line);
+  }
+  return r.ok;
+}
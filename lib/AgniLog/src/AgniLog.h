@@ -0,0 +1,227 @@
+#ifndef AGNI_LOG_H
+#define AGNI_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <AgniHal.h>
+
+// ============================================================================
+// DEFERRED BINARY LOG
+// ============================================================================
+// Hot paths (the sensor task, the transfer pump, the status table) used to
+// printf straight to the 115200-baud UART; once its TX buffer was full the
+// caller blocked until the bytes were on the wire. A log call now only
+// stores the format string's address, its arguments and a timestamp in a
+// ring, a few dozen cycles; the text is produced later by a low-priority
+// drain task, or on the host from a dump.
+//
+// There is one ring per core, so the two cores never contend. Writers on a
+// core claim a slot with one atomic increment, which also makes the ring
+// safe for tasks that preempt each other and for interrupts; a reader
+// checks the slot's sequence before and after copying it. When a ring
+// laps, the oldest records are overwritten and the drain counts them as
+// dropped: logging never waits.
+//
+// Arguments are 32-bit words (long long takes two) and are interpreted
+// through the format, so %s must point to a string that outlives the
+// record (literals, names in tables). A string that changes, such as a
+// file name, is passed as logCopy(text): the first LOG_TEXT_MAX - 1 bytes
+// are copied into the record and take the place of the first null %s.
+//
+// LogState is plain memory: the firmware keeps it in a section that
+// survives a panic or watchdog reset, so the records leading up to a fault
+// can still be dumped afterwards. A dump (writeLogDump) is
+// self-describing, the format strings go inline the first time they
+// appear, little-endian:
+//
+//   "AGLG"  u8 LOG_DUMP_VERSION  u8 0  u16 records  u32 boot  u32 dropped
+//   per record: u32 ms since its boot, u8 level, u8 core, u8 boot,
+//               u8 argument words, string format, then per argument a
+//               string for %s, otherwise a u32 word
+//   string: u16 index; index == strings so far means a new string
+//           follows as u16 length + bytes, LOG_STRING_INLINE one that
+//           is not remembered
+//
+// Levels at or below AGNI_LOG_LEVEL are compiled in; the others cost
+// nothing, not even argument evaluation.
+
+#define LOG_LEVEL_ERROR        1
+#define LOG_LEVEL_WARN         2
+#define LOG_LEVEL_INFO         3
+#define LOG_LEVEL_DEBUG        4
+#ifndef AGNI_LOG_LEVEL
+#define AGNI_LOG_LEVEL         LOG_LEVEL_INFO
+#endif
+
+#define LOG_CORES              2
+#define LOG_RING_RECORDS       128      // per core
+#define LOG_MAX_ARGS           6        // argument words per record
+#define LOG_TEXT_MAX           20       // logCopy() bytes, terminator included
+#define LOG_LINE_MAX           256
+#define LOG_STATE_MAGIC        0x474C4741
+#define LOG_DIR                "/logs"
+#define LOG_FILE_PREFIX        "log_"      // log_<boot>.agl
+#define LOG_FILE_SUFFIX        ".agl"
+#define LOG_DUMP_COMMAND       "LOG_DUMP"  // writes one now; LOG_DUMP:<path>,<records>
+#define LOG_DUMP_MAGIC         "AGLG"
+#define LOG_DUMP_VERSION       1
+#define LOG_DUMP_HEADER_BYTES  16
+#define LOG_DUMP_MAX_STRINGS   256
+#define LOG_STRING_INLINE      0xFFFF
+
+union LogArg {
+  uint32_t u;
+  float f;
+  const char* s;
+};
+
+struct LogRecord {
+  uint32_t timeMs;
+  const char* format;
+  uint8_t level;
+  uint8_t core;
+  uint8_t boot;                  // low byte of the boot count
+  uint8_t argCount;
+  LogArg args[LOG_MAX_ARGS];
+  char text[LOG_TEXT_MAX];       // logCopy() text, empty if none
+};
+
+struct LogSlot {
+  std::atomic<uint32_t> sequence;  // claimed sequence + 1 once written, 0 while being written
+  LogRecord record;
+};
+
+struct LogRing {
+  std::atomic<uint32_t> head;    // next sequence to claim
+  LogSlot slots[LOG_RING_RECORDS];
+};
+
+/** @brief Everything the log keeps; no constructor, see Logger::begin(). */
+struct LogState {
+  uint32_t magic;
+  uint32_t buildId;
+  uint32_t boot;
+  LogRing rings[LOG_CORES];
+};
+
+struct LogStats {
+  uint32_t drained = 0;          // records handed out by next()
+  uint32_t dropped = 0;          // overwritten before the drain got to them
+};
+
+/** @brief A string copied into the record; see the header comment. */
+struct LogText {
+  const char* text;
+};
+inline LogText logCopy(const char* text) { return LogText{text}; }
+
+// Argument packing: one word per argument, two for long long
+struct LogPacker {
+  LogArg* args;
+  uint8_t count;
+  const char* text;
+};
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+logPut(LogPacker &p, T value) {
+  if (p.count >= LOG_MAX_ARGS) return;
+  if (std::is_same<T, long long>::value || std::is_same<T, unsigned long long>::value) {
+    p.args[p.count++].u = (uint32_t)(uint64_t)value;
+    if (p.count < LOG_MAX_ARGS) p.args[p.count++].u = (uint32_t)((uint64_t)value >> 32);
+  } else {
+    p.args[p.count++].u = (uint32_t)value;
+  }
+}
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type logPut(LogPacker &p, T value) {
+  if (p.count < LOG_MAX_ARGS) p.args[p.count++].f = (float)value;
+}
+inline void logPut(LogPacker &p, const char* value) {
+  if (p.count < LOG_MAX_ARGS) p.args[p.count++].s = value;
+}
+inline void logPut(LogPacker &p, LogText value) {
+  p.text = value.text;
+  if (p.count < LOG_MAX_ARGS) p.args[p.count++].s = NULL;
+}
+
+inline void logPack(LogPacker &) {}
+template <typename T, typename... Rest>
+inline void logPack(LogPacker &p, T value, Rest... rest) {
+  logPut(p, value);
+  logPack(p, rest...);
+}
+
+class Logger {
+public:
+  Logger(LogState &state, HalClock &clock) : state(state), clock(clock) {}
+
+  /**
+   * @brief Adopts the state left by the previous boot if it was written by
+   * the same build, otherwise clears it. Records from before are kept for
+   * history() but not drained again.
+   * @return true if earlier records were kept
+   */
+  bool begin(uint32_t buildId);
+  uint32_t boot() const { return state.boot; }
+
+  template <typename... Args>
+  void log(uint8_t core, uint8_t level, const char* format, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    LogArg packed[LOG_MAX_ARGS];
+    LogPacker packer = {packed, 0, NULL};
+    logPack(packer, args...);
+    write(core, level, format, packed, packer.count, packer.text);
+  }
+  /** @brief Stores one record; any task, either core, interrupts included. */
+  void write(uint8_t core, uint8_t level, const char* format, const LogArg* args, uint8_t argCount,
+             const char* text = NULL);
+
+  /**
+   * @brief Drain side, a single reader: the oldest record not handed out
+   * yet, across both rings.
+   * @return false if there is none (or it is still being written)
+   */
+  bool next(LogRecord &record);
+  /** @brief Records not handed out by next() yet, dropped ones included. */
+  uint32_t backlog() const;
+
+  /** @brief Every record still in the rings, this boot's and earlier, oldest first. */
+  size_t history(LogRecord* out, size_t capacity) const;
+  /** @brief Records written since begin(). */
+  uint32_t written() const;
+  const LogStats &stats() const { return counters; }
+
+private:
+  LogState &state;
+  HalClock &clock;
+  uint32_t tails[LOG_CORES] = {0};
+  uint32_t headsAtBegin[LOG_CORES] = {0};
+  LogStats counters;
+};
+
+/** @brief Call sites: AGNI_LOG(logger, core, LOG_LEVEL_INFO, "x=%d", x). */
+#define AGNI_LOG(logger, core, level, format, ...) \
+  do { if ((level) <= AGNI_LOG_LEVEL) (logger).log((core), (level), format, ##__VA_ARGS__); } while (0)
+
+/** @brief "E", "W", "I" or "D". */
+const char* logLevelName(uint8_t level);
+/**
+ * @brief "[  12.345] W <message>", the message formatted like printf
+ * would have; always terminated. Returns the length.
+ */
+size_t formatLogRecord(const LogRecord &record, char* out, size_t capacity);
+
+/** @brief Writes a dump of the given records; false on a short write. */
+bool writeLogDump(HalFile &file, const LogRecord* records, size_t count, uint32_t boot, uint32_t dropped);
+/**
+ * @brief Formats a dump back into lines, each prefixed with "#<boot> ".
+ * @return false if it is truncated or not a dump
+ */
+bool decodeLogDump(const uint8_t* data, size_t length, std::vector<std::string> &lines);
+
+#endif
@@ -0,0 +1,107 @@
+#include "AgniMetrics.h"
+
+#include <stdio.h>
+
+// ============================================================================
+// LATENCY HISTOGRAM
+// ============================================================================
+static uint8_t bucketFor(uint32_t value) {
+  if (value == 0) return 0;
+  uint8_t bucket = 32 - __builtin_clz(value);
+  return bucket < LatencyHistogram::BUCKETS ? bucket : LatencyHistogram::BUCKETS - 1;
+}
+
+uint32_t LatencyHistogram::bucketUpperBound(uint8_t bucket) {
+  if (bucket == 0) return 0;
+  if (bucket >= BUCKETS - 1) return UINT32_MAX;
+  return (1UL << bucket) - 1;
+}
+
+void LatencyHistogram::record(uint32_t value) {
+  counts[bucketFor(value)]++;
+  if (total == 0 || value < minValue) minValue = value;
+  if (value > maxValue) maxValue = value;
+  sum += value;
+  total++;
+}
+
+void LatencyHistogram::reset() {
+  for (uint8_t i = 0; i < BUCKETS; i++) counts[i] = 0;
+  total = 0;
+  minValue = 0;
+  maxValue = 0;
+  sum = 0;
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t pct) const {
+  if (total == 0) return 0;
+  if (pct > 100) pct = 100;
+  // Rank of the wanted sample, 1-based
+  uint64_t rank = ((uint64_t)total * pct + 99) / 100;
+  if (rank == 0) rank = 1;
+
+  uint64_t seen = 0;
+  for (uint8_t i = 0; i < BUCKETS; i++) {
+    if (counts[i] == 0) continue;
+    if (seen + counts[i] >= rank) {
+      uint32_t low = (i == 0) ? 0 : (1UL << (i - 1));
+      uint32_t high = (i >= BUCKETS - 1) ? maxValue : bucketUpperBound(i);
+      if (low < minValue) low = minValue;
+      if (high > maxValue) high = maxValue;
+      if (high <= low) return low;
+      uint64_t offset = (uint64_t)(high - low) * (rank - seen) / counts[i];
+      return low + (uint32_t)offset;
+    }
+    seen += counts[i];
+  }
+  return maxValue;
+}
+
+// ============================================================================
+// RATE METER
+// ============================================================================
+void RateMeter::roll(uint32_t nowMs) {
+  uint32_t elapsed = nowMs - windowStartMs;
+  if (elapsed < 1000) return;
+  // A gap of more than one window means the last second saw nothing
+  lastRate = (elapsed < 2000) ? windowAmount : 0;
+  if (lastRate > peak) peak = lastRate;
+  windowAmount = 0;
+  windowStartMs = nowMs - (elapsed % 1000);
+}
+
+void RateMeter::add(uint32_t amount, uint32_t nowMs) {
+  roll(nowMs);
+  windowAmount += amount;
+  totalAmount += amount;
+}
+
+uint32_t RateMeter::ratePerSecond(uint32_t nowMs) {
+  roll(nowMs);
+  return lastRate;
+}
+
+void RateMeter::reset() {
+  windowAmount = 0;
+  lastRate = 0;
+  peak = 0;
+  totalAmount = 0;
+}
+
+// ============================================================================
+// FORMATTING
+// ============================================================================
+size_t formatHistogram(char* out, size_t cap, const char* name, const LatencyHistogram &h) {
+  if (cap == 0) return 0;
+  int n = snprintf(out, cap, "%s=%lu,%lu,%lu,%lu,%lu", name,
+                   (unsigned long)h.count(),
+                   (unsigned long)h.percentile(50),
+                   (unsigned long)h.percentile(90),
+                   (unsigned long)h.percentile(99),
+                   (unsigned long)h.maximum());
+  if (n < 0) {
+    out[0] = '\0';
+    return 0;
+  }
+  return (size_t)n < cap ? (size_t)n : cap - 1;
+}
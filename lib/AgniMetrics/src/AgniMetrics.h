@@ -0,0 +1,80 @@
+#ifndef AGNI_METRICS_H
+#define AGNI_METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ============================================================================
+// LIGHTWEIGHT METRICS
+// ============================================================================
+// Allocation-free building blocks for runtime telemetry. Every primitive is
+// meant to have a single writer (one task); readers take a best-effort
+// snapshot, which is fine for statistics.
+
+/**
+ * @brief Fixed log2-bucket histogram. Bucket 0 holds 0, bucket i holds values
+ * in [2^(i-1), 2^i). The last bucket also absorbs everything larger.
+ * Recording is O(1): one count-leading-zeros and a few adds.
+ */
+class LatencyHistogram {
+public:
+  static const uint8_t BUCKETS = 24;   // up to ~8.4 s when recording microseconds
+
+  LatencyHistogram() { reset(); }
+
+  void record(uint32_t value);
+  void reset();
+
+  uint32_t count() const { return total; }
+  uint32_t minimum() const { return total ? minValue : 0; }
+  uint32_t maximum() const { return maxValue; }
+  uint32_t mean() const { return total ? (uint32_t)(sum / total) : 0; }
+
+  /**
+   * @brief Approximate percentile, interpolated inside the matching bucket
+   * and clamped to the observed min/max.
+   * @param pct 0-100
+   */
+  uint32_t percentile(uint8_t pct) const;
+
+  uint32_t bucketCount(uint8_t bucket) const { return bucket < BUCKETS ? counts[bucket] : 0; }
+  static uint32_t bucketUpperBound(uint8_t bucket);
+
+private:
+  uint32_t counts[BUCKETS];
+  uint32_t total;
+  uint32_t minValue;
+  uint32_t maxValue;
+  uint64_t sum;
+};
+
+/**
+ * @brief Counts events per one-second window. ratePerSecond() returns the
+ * last complete window, so a burst shows up one second later but never as
+ * a partial, misleading number.
+ */
+class RateMeter {
+public:
+  void add(uint32_t amount, uint32_t nowMs);
+  uint32_t ratePerSecond(uint32_t nowMs);
+  uint32_t peakPerSecond() const { return peak; }
+  uint64_t total() const { return totalAmount; }
+  void reset();
+
+private:
+  void roll(uint32_t nowMs);
+
+  uint32_t windowStartMs = 0;
+  uint32_t windowAmount = 0;
+  uint32_t lastRate = 0;
+  uint32_t peak = 0;
+  uint64_t totalAmount = 0;
+};
+
+/**
+ * @brief Writes "name=count,p50,p90,p99,max" into out (always terminated).
+ * @return Characters written, excluding the terminator
+ */
+size_t formatHistogram(char* out, size_t cap, const char* name, const LatencyHistogram &h);
+
+#endif
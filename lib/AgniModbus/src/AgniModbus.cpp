@@ -0,0 +1,332 @@
+#include "AgniModbus.h"
+
+#include <string.h>
+
+// ============================================================================
+// MODBUS/RS485 FUNCTIONS
+// ============================================================================
+uint16_t crc16_modbus(const uint8_t *buf, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int j = 0; j < 8; j++) {
+      if (crc & 1) {
+        crc = (crc >> 1) ^ 0xA001;
+      } else {
+        crc >>= 1;
+      }
+    }
+  }
+  return crc;
+}
+
+uint32_t modbusFrameGapUs(uint32_t baud) {
+  if (baud == 0 || baud > 19200) return MODBUS_MIN_GAP_US;
+  return (uint32_t)((7ULL * 11 * 1000000 + 2 * baud - 1) / (2 * baud));
+}
+
+// An exception is 5 bytes, a write is answered with its 8-byte echo and a
+// read with a byte count; needs the first three bytes
+static size_t expectedFrameLength(const uint8_t *rx) {
+  if(rx[1] & 0x80) return 5;
+  return rx[1] == 0x06 ? 8 : (size_t)(3 + rx[2] + 2);
+}
+
+ModbusFrameStatus checkModbusResponse(const uint8_t *rx, size_t len) {
+  if(len == 0) return MODBUS_FRAME_NO_RESPONSE;
+  if(len < 5 || len < expectedFrameLength(rx)) return MODBUS_FRAME_SHORT;
+  uint16_t receivedCrc = (rx[len-1] << 8) | rx[len-2];
+  uint16_t calculatedCrc = crc16_modbus(rx, len - 2);
+  if(receivedCrc != calculatedCrc) return MODBUS_FRAME_CRC_ERROR;
+  return MODBUS_FRAME_OK;
+}
+
+static const char* const ERROR_NAMES[MODBUS_ERROR_COUNT] = {
+  "ok", "timeout", "short", "crc", "wrong_slave", "wrong_function", "bad_length", "exception", "bad_echo"
+};
+
+const char* modbusErrorName(ModbusError error) {
+  return error < MODBUS_ERROR_COUNT ? ERROR_NAMES[error] : "unknown";
+}
+
+size_t ModbusClient::transact(const uint8_t *tx, size_t txLen, uint8_t *rx, size_t capacity) {
+  uint64_t transactionStartUs = clock.micros();
+  while(port.available()) port.read();
+  // Only the silence the protocol requires, so polls can run back to back
+  uint32_t baud = port.baud();
+  uint64_t quietUs = lastFrameEndUs + modbusFrameGapUs(baud);
+  if(quietUs > transactionStartUs) clock.sleepMs((uint32_t)((quietUs - transactionStartUs + 999) / 1000));
+  port.setTransmit(true);
+  port.write(tx, txLen);
+  port.flush();
+  port.setTransmit(false);
+  uint64_t requestEndUs = clock.micros();
+  uint32_t startTime = clock.millis();
+  uint32_t lastByteTime = startTime;
+  uint32_t quietMs = baud ? (4 * 11 * 1000 + baud - 1) / baud : 0;
+  if(quietMs < MODBUS_INTERCHAR_MIN_MS) quietMs = MODBUS_INTERCHAR_MIN_MS;
+  size_t rxLen = 0;
+  replyUs = 0;
+  while(rxLen < capacity) {
+    uint32_t now = clock.millis();
+    if(rxLen == 0 ? now - startTime >= timeoutMs : now - lastByteTime >= quietMs) break;
+    if(port.available()) {
+      if(rxLen == 0) {
+        replyUs = (uint32_t)(clock.micros() - requestEndUs);
+        counters.replyUs.record(replyUs);
+      }
+      rx[rxLen++] = port.read();
+      lastByteTime = clock.millis();
+      if(rxLen >= 5 && rxLen >= expectedFrameLength(rx)) break;
+    } else {
+      // A byte takes ~2 ms at 4800 baud; sleep instead of spinning the core
+      clock.sleepMs(1);
+    }
+  }
+  lastFrameEndUs = clock.micros();
+  counters.transactionUs.record((uint32_t)(lastFrameEndUs - transactionStartUs));
+  return rxLen;
+}
+
+ModbusError ModbusClient::classify(const uint8_t *tx, const uint8_t *rx, size_t rxLen, uint16_t regCount) {
+  switch(checkModbusResponse(rx, rxLen)) {
+    case MODBUS_FRAME_NO_RESPONSE: return MODBUS_ERR_TIMEOUT;
+    case MODBUS_FRAME_SHORT:       return MODBUS_ERR_SHORT;
+    case MODBUS_FRAME_CRC_ERROR:   return MODBUS_ERR_CRC;
+    case MODBUS_FRAME_OK:          break;
+  }
+  if(rx[0] != tx[0]) return MODBUS_ERR_WRONG_SLAVE;
+  if(rx[1] == (tx[1] | 0x80)) {
+    lastExceptionCode = rx[2];
+    return MODBUS_ERR_EXCEPTION;
+  }
+  if(rx[1] != tx[1]) return MODBUS_ERR_WRONG_FUNCTION;
+  if(tx[1] == 0x03 && (rx[2] != regCount * 2 || rxLen != (size_t)(3 + rx[2] + 2))) return MODBUS_ERR_BAD_LENGTH;
+  if(tx[1] == 0x06 && (rxLen != 8 || memcmp(rx, tx, 8) != 0)) return MODBUS_ERR_BAD_ECHO;
+  return MODBUS_OK;
+}
+
+void ModbusClient::count(ModbusError error) {
+  switch(error) {
+    case MODBUS_OK:                 counters.ok++; break;
+    case MODBUS_ERR_TIMEOUT:        counters.noResponse++; break;
+    case MODBUS_ERR_SHORT:          counters.shortFrame++; break;
+    case MODBUS_ERR_CRC:            counters.crcError++; break;
+    case MODBUS_ERR_WRONG_SLAVE:    counters.wrongSlave++; break;
+    case MODBUS_ERR_WRONG_FUNCTION: counters.wrongFunction++; break;
+    case MODBUS_ERR_BAD_LENGTH:     counters.badLength++; break;
+    case MODBUS_ERR_EXCEPTION:      counters.exceptions++; break;
+    case MODBUS_ERR_BAD_ECHO:       counters.writeRejected++; break;
+    default: break;
+  }
+}
+
+uint32_t ModbusClient::jitterMs(uint32_t maxMs) {
+  if(maxMs == 0) return 0;
+  // xorshift32, seeded from the clock on first use
+  if(jitterState == 0) jitterState = (uint32_t)clock.micros() | 1;
+  jitterState ^= jitterState << 13;
+  jitterState ^= jitterState >> 17;
+  jitterState ^= jitterState << 5;
+  return jitterState % (maxMs + 1);
+}
+
+ModbusError ModbusClient::request(const uint8_t *tx, size_t txLen, uint8_t *rx, size_t capacity, uint16_t regCount) {
+  uint32_t startTime = clock.millis();
+  ModbusError error;
+  for(uint8_t attempt = 0; ; attempt++) {
+    size_t rxLen = transact(tx, txLen, rx, capacity);
+    error = classify(tx, rx, rxLen, regCount);
+    count(error);
+    if(error == MODBUS_OK) {
+      if(attempt) counters.recovered++;
+      break;
+    }
+    bool garbled = error != MODBUS_ERR_TIMEOUT && error != MODBUS_ERR_EXCEPTION && error != MODBUS_ERR_BAD_ECHO;
+    if(!garbled && !(error == MODBUS_ERR_TIMEOUT && policy.retryTimeouts)) break;
+    if(attempt >= policy.maxRetries || clock.millis() - startTime >= policy.budgetMs) break;
+    counters.retries++;
+    uint32_t waitMs = (uint32_t)policy.backoffMs << attempt;
+    clock.sleepMs(waitMs + jitterMs(waitMs));
+  }
+  lastErr = error;
+  return error;
+}
+
+static size_t buildRequest(uint8_t *txBuf, uint8_t addr, uint8_t function, uint16_t reg, uint16_t value) {
+  int pos = 0;
+  txBuf[pos++] = addr;
+  txBuf[pos++] = function;
+  txBuf[pos++] = (reg >> 8);
+  txBuf[pos++] = (reg & 0xFF);
+  txBuf[pos++] = (value >> 8);
+  txBuf[pos++] = (value & 0xFF);
+  uint16_t crc = crc16_modbus(txBuf, pos);
+  txBuf[pos++] = (crc & 0xFF);
+  txBuf[pos++] = (crc >> 8);
+  return pos;
+}
+
+bool ModbusClient::readRegisters(uint8_t addr, uint16_t startReg, uint16_t regCount, uint16_t *result) {
+  uint8_t txBuf[8];
+  uint8_t rxBuf[256];
+  size_t txLen = buildRequest(txBuf, addr, 0x03, startReg, regCount);
+  if(request(txBuf, txLen, rxBuf, sizeof(rxBuf), regCount) != MODBUS_OK) return false;
+  for(int i = 0; i < regCount; i++) {
+    result[i] = (rxBuf[3 + i*2] << 8) | rxBuf[4 + i*2];
+  }
+  return true;
+}
+
+bool ModbusClient::writeRegister(uint8_t addr, uint16_t reg, uint16_t value) {
+  uint8_t txBuf[8];
+  uint8_t rxBuf[16];
+  size_t txLen = buildRequest(txBuf, addr, 0x06, reg, value);
+  return request(txBuf, txLen, rxBuf, sizeof(rxBuf), 0) == MODBUS_OK;
+}
+
+bool readSoilSensor(ModbusClient &modbus, uint8_t addr, SensorData &soilData) {
+  uint16_t regs[4];
+  if(!modbus.readRegisters(addr, REG_MOISTURE, 4, regs)) {
+    soilData.basicValid = false;
+    return false;
+  }
+  
+  soilData.moisture = regs[0] / 10.0f;
+  int16_t tempRaw = (int16_t)regs[1];
+  soilData.temperature = tempRaw / 10.0f;
+  soilData.conductivity = regs[2];
+  soilData.ph = regs[3] / 10.0f;
+  soilData.basicValid = true;
+  
+  uint16_t npkRegs[3];
+  if(modbus.readRegisters(addr, REG_NITROGEN, 3, npkRegs)) {
+    soilData.nitrogen = npkRegs[0];
+    soilData.phosphorus = npkRegs[1];
+    soilData.potassium = npkRegs[2];
+    soilData.npkValid = true;
+  } else {
+    soilData.npkValid = false;
+  }
+  return soilData.basicValid;
+}
+
+// ============================================================================
+// REGISTER MAPS
+// ============================================================================
+static const RegisterField ZTS3002_FIELDS[] = {
+  {"moisture",     REG_MOISTURE,     10, false},
+  {"temperature",  REG_TEMPERATURE,  10, true},
+  {"conductivity", REG_CONDUCTIVITY,  1, false},
+  {"ph",           REG_PH,           10, false},
+  {"nitrogen",     REG_NITROGEN,      1, false},
+  {"phosphorus",   REG_PHOSPHORUS,    1, false},
+  {"potassium",    REG_POTASSIUM,     1, false},
+};
+
+static const RegisterField WEATHER_FIELDS[] = {
+  {"humidity",     0x0000, 10, false},
+  {"temperature",  0x0001, 10, true},
+  {"pressure_hpa", 0x0002, 10, false},
+};
+
+const RegisterMap ZTS3002_MAP = {"zts3002", ZTS3002_FIELDS, 7, 0};
+const RegisterMap WEATHER_MAP = {"weather", WEATHER_FIELDS, 3, 0};
+
+const RegisterMap* registerMapByType(const char* type) {
+  if (strcmp(type, ZTS3002_MAP.type) == 0) return &ZTS3002_MAP;
+  if (strcmp(type, WEATHER_MAP.type) == 0) return &WEATHER_MAP;
+  return nullptr;
+}
+
+bool soilFromReading(const DeviceReading &reading, SensorData &soilData) {
+  if (reading.map != &ZTS3002_MAP) return false;
+  // Field order of ZTS3002_FIELDS: the first four are one block, N/P/K the other
+  soilData.basicValid = (reading.validFields & 0x0F) == 0x0F;
+  soilData.npkValid = (reading.validFields & 0x70) == 0x70;
+  if (soilData.basicValid) {
+    soilData.moisture = reading.raw[0] / 10.0f;
+    soilData.temperature = reading.raw[1] / 10.0f;
+    soilData.conductivity = (uint16_t)reading.raw[2];
+    soilData.ph = reading.raw[3] / 10.0f;
+  }
+  if (soilData.npkValid) {
+    soilData.nitrogen = (uint16_t)reading.raw[4];
+    soilData.phosphorus = (uint16_t)reading.raw[5];
+    soilData.potassium = (uint16_t)reading.raw[6];
+  }
+  return true;
+}
+
+// ============================================================================
+// LINK SPEED
+// ============================================================================
+static const uint32_t BAUD_RATES[MODBUS_BAUD_COUNT] = MODBUS_BAUD_CODES;
+
+int modbusBaudCode(uint32_t baud) {
+  for (int code = 0; code < MODBUS_BAUD_COUNT; code++) {
+    if (BAUD_RATES[code] == baud) return code;
+  }
+  return -1;
+}
+
+/** @brief Reads REG_BAUD_RATE at the port's current rate. */
+static bool probeBaud(ModbusClient &modbus, uint8_t addr, uint16_t &code) {
+  for (int attempt = 0; attempt < MODBUS_PROBE_ATTEMPTS; attempt++) {
+    if (modbus.readRegisters(addr, REG_BAUD_RATE, 1, &code)) return true;
+  }
+  return false;
+}
+
+uint32_t findSensorBaud(ModbusClient &modbus, uint8_t addr, uint32_t hint) {
+  HalSerialPort &port = modbus.serialPort();
+  uint16_t code;
+  for (int i = -1; i < MODBUS_BAUD_COUNT; i++) {
+    uint32_t baud = i < 0 ? hint : BAUD_RATES[i];
+    if (i >= 0 && baud == hint) continue;
+    if (port.baud() != baud) {
+      port.end();
+      port.begin(baud);
+    }
+    modbus.counters.baudProbes++;
+    if (probeBaud(modbus, addr, code)) return baud;
+  }
+  port.end();
+  port.begin(hint);
+  return 0;
+}
+
+uint32_t moveSensorBaud(ModbusClient &modbus, uint8_t addr, uint32_t target) {
+  HalSerialPort &port = modbus.serialPort();
+  uint32_t current = port.baud();
+  int code = modbusBaudCode(target);
+  if (target == current) return current;
+  if (code < 0 || !modbus.writeRegister(addr, REG_BAUD_RATE, (uint16_t)code)) return current;
+
+  // The echo still comes at the old rate; everything after it at the new one
+  port.end();
+  port.begin(target);
+  uint16_t readBack;
+  if (probeBaud(modbus, addr, readBack) && readBack == code) {
+    modbus.counters.baudChanges++;
+    return target;
+  }
+
+  modbus.counters.baudFallbacks++;
+  port.end();
+  port.begin(current);
+  if (probeBaud(modbus, addr, readBack)) return current;
+  return findSensorBaud(modbus, addr, current);
+}
+
+uint32_t negotiateSensorBaud(ModbusClient &modbus, uint8_t addr, uint32_t maxBaud) {
+  uint32_t current = modbus.serialPort().baud();
+  for (int code = MODBUS_BAUD_COUNT - 1; code >= 0; code--) {
+    uint32_t baud = BAUD_RATES[code];
+    if (baud > maxBaud || baud <= current) continue;
+    uint32_t reached = moveSensorBaud(modbus, addr, baud);
+    if (reached == baud || reached == 0) return reached;
+    current = reached;
+  }
+  return current;
+}
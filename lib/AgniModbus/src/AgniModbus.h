@@ -0,0 +1,234 @@
+#ifndef AGNI_MODBUS_H
+#define AGNI_MODBUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniHal.h>
+#include <AgniMetrics.h>
+#include <AgniRecord.h>
+
+// ============================================================================
+// MODBUS RTU CLIENT
+// ============================================================================
+// Frames are separated by at least 3.5 character times of silence (11-bit
+// RTU characters), fixed at 1750 us above 19200 baud
+#define MODBUS_MIN_GAP_US    1750
+// A reply is over once the line has been quiet this long (or four
+// character times, if longer); a cut-off frame fails fast instead of
+// running into the response timeout
+#define MODBUS_INTERCHAR_MIN_MS 20
+
+// ZTS-3002 register map
+#define REG_MOISTURE       0x0000
+#define REG_TEMPERATURE    0x0001
+#define REG_CONDUCTIVITY   0x0002
+#define REG_PH             0x0003
+#define REG_NITROGEN       0x0006
+#define REG_PHOSPHORUS     0x0007
+#define REG_POTASSIUM      0x0008
+#define REG_DEVICE_ADDRESS 0x07D0
+#define REG_BAUD_RATE      0x07D1   // MODBUS_BAUD_CODES index
+
+// Line rates the sensor can be programmed to, by REG_BAUD_RATE code
+#define MODBUS_BAUD_CODES    {2400, 4800, 9600}
+#define MODBUS_BAUD_COUNT    3
+#define MODBUS_PROBE_ATTEMPTS 2     // the first frame after a rate switch may be lost
+
+uint16_t crc16_modbus(const uint8_t *buf, size_t len);
+/** @brief Minimum silence between two frames at a line rate. */
+uint32_t modbusFrameGapUs(uint32_t baud);
+
+enum ModbusFrameStatus {
+  MODBUS_FRAME_OK,
+  MODBUS_FRAME_NO_RESPONSE,
+  MODBUS_FRAME_SHORT,
+  MODBUS_FRAME_CRC_ERROR
+};
+
+/**
+ * @brief Classifies the bytes received for one function 0x03 request, or
+ * the 8-byte echo of a function 0x06 write. Shared by the live client and
+ * the trace replay tool.
+ */
+ModbusFrameStatus checkModbusResponse(const uint8_t *rx, size_t len);
+
+/** @brief Why one request failed. */
+enum ModbusError {
+  MODBUS_OK,
+  MODBUS_ERR_TIMEOUT,            // nothing came back
+  MODBUS_ERR_SHORT,              // the reply stopped mid-frame
+  MODBUS_ERR_CRC,
+  MODBUS_ERR_WRONG_SLAVE,        // a valid frame from another address
+  MODBUS_ERR_WRONG_FUNCTION,
+  MODBUS_ERR_BAD_LENGTH,         // byte count does not match the request
+  MODBUS_ERR_EXCEPTION,          // the slave refused, see lastException()
+  MODBUS_ERR_BAD_ECHO,           // a write answered with something else
+  MODBUS_ERROR_COUNT
+};
+
+/** @brief Short name for logs and metrics ("timeout", "crc", ...). */
+const char* modbusErrorName(ModbusError error);
+
+/**
+ * @brief Immediate retries of one request. Garbled replies (short, CRC,
+ * wrong slave/function/length) mean the sensor is alive, so they are
+ * retried after backoffMs << attempt plus up to as much random jitter.
+ * Silence is only retried with retryTimeouts; a dead sensor is the bus
+ * breaker's job. No retry starts more than budgetMs into the call.
+ */
+struct ModbusRetryPolicy {
+  uint8_t maxRetries = 2;
+  uint16_t backoffMs = 4;
+  uint16_t budgetMs = 250;
+  bool retryTimeouts = false;
+};
+
+struct ModbusStats {
+  uint32_t ok = 0;
+  uint32_t noResponse = 0;
+  uint32_t shortFrame = 0;
+  uint32_t crcError = 0;
+  uint32_t wrongSlave = 0;
+  uint32_t wrongFunction = 0;
+  uint32_t badLength = 0;
+  uint32_t exceptions = 0;       // well-formed exception replies (function | 0x80)
+  uint32_t writeRejected = 0;    // 0x06 answered with something other than the echo
+  uint32_t retries = 0;
+  uint32_t recovered = 0;        // requests that succeeded on a retry
+  uint32_t baudProbes = 0;       // REG_BAUD_RATE reads while looking for the sensor
+  uint32_t baudChanges = 0;      // verified moves to a new line rate
+  uint32_t baudFallbacks = 0;    // moves that failed and went back (or rescanned)
+  LatencyHistogram transactionUs;
+  LatencyHistogram replyUs;      // request end -> first reply byte
+};
+
+/**
+ * @brief Half-duplex Modbus RTU master over an RS485 HalSerialPort.
+ * Not thread-safe: use it from one task (the sensor task on the device).
+ */
+class ModbusClient {
+public:
+  ModbusClient(HalSerialPort &port, HalClock &clock, uint32_t timeoutMs)
+    : port(port), clock(clock), timeoutMs(timeoutMs) {}
+
+  /**
+   * @brief Function 0x03, read holding registers, with retries.
+   * @return true if a complete, CRC-valid response was decoded into
+   *         result; lastError() says why not
+   */
+  bool readRegisters(uint8_t addr, uint16_t startReg, uint16_t regCount, uint16_t *result);
+
+  /**
+   * @brief Function 0x06, write single register, with retries.
+   * @return true if the slave echoed the request
+   */
+  bool writeRegister(uint8_t addr, uint16_t reg, uint16_t value);
+
+  /** @brief Response timeout: how long to wait for the first reply byte. */
+  void setTimeout(uint32_t ms) { timeoutMs = ms; }
+  uint32_t timeout() const { return timeoutMs; }
+  void setRetryPolicy(const ModbusRetryPolicy &retry) { policy = retry; }
+  const ModbusRetryPolicy &retryPolicy() const { return policy; }
+
+  /** @brief Outcome of the latest request (after its retries). */
+  ModbusError lastError() const { return lastErr; }
+  /** @brief Exception code of the latest MODBUS_ERR_EXCEPTION. */
+  uint8_t lastException() const { return lastExceptionCode; }
+  /** @brief Request end to first reply byte of the latest transaction, 0 if silent. */
+  uint32_t lastReplyUs() const { return replyUs; }
+  /** @brief Random 0..maxMs, so retries and probes of several devices don't line up. */
+  uint32_t jitterMs(uint32_t maxMs);
+  HalSerialPort &serialPort() { return port; }
+  const ModbusStats &stats() const { return counters; }
+
+private:
+  // The link functions below keep the baud counters
+  friend uint32_t findSensorBaud(ModbusClient &modbus, uint8_t addr, uint32_t hint);
+  friend uint32_t moveSensorBaud(ModbusClient &modbus, uint8_t addr, uint32_t target);
+
+  /**
+   * @brief Sends one request frame, as soon as the inter-frame gap after
+   * the previous one allows, and collects the reply into rx.
+   */
+  size_t transact(const uint8_t *tx, size_t txLen, uint8_t *rx, size_t capacity);
+  /** @brief transact() plus classification and the retry policy. */
+  ModbusError request(const uint8_t *tx, size_t txLen, uint8_t *rx, size_t capacity, uint16_t regCount);
+  ModbusError classify(const uint8_t *tx, const uint8_t *rx, size_t rxLen, uint16_t regCount);
+  void count(ModbusError error);
+
+  HalSerialPort &port;
+  HalClock &clock;
+  uint32_t timeoutMs;
+  ModbusRetryPolicy policy;
+  uint64_t lastFrameEndUs = 0;
+  uint32_t replyUs = 0;
+  uint32_t jitterState = 0;
+  ModbusError lastErr = MODBUS_OK;
+  uint8_t lastExceptionCode = 0;
+  ModbusStats counters;
+};
+
+/**
+ * @brief Reads moisture/temperature/EC/pH and then N/P/K from a ZTS-3002.
+ * @return true if the basic block was read (npkValid reports the second read)
+ */
+bool readSoilSensor(ModbusClient &modbus, uint8_t addr, SensorData &soilData);
+
+// ----------------------------------------------------------------------------
+// Register maps
+// ----------------------------------------------------------------------------
+// For the ModbusBus scheduler. ZTS3002_MAP reads the same two blocks as
+// readSoilSensor(); WEATHER_MAP is a humidity/temperature/pressure
+// transmitter (registers 0..2, tenths).
+
+extern const RegisterMap ZTS3002_MAP;
+extern const RegisterMap WEATHER_MAP;
+
+/** @brief Built-in map by its type name, nullptr if unknown. */
+const RegisterMap* registerMapByType(const char* type);
+
+/**
+ * @brief Converts a ZTS3002_MAP reading to SensorData; basicValid and
+ * npkValid follow the fields of each block.
+ * @return false if the reading is not from a ZTS3002_MAP device
+ */
+bool soilFromReading(const DeviceReading &reading, SensorData &soilData);
+
+// ----------------------------------------------------------------------------
+// Link speed
+// ----------------------------------------------------------------------------
+// The sensor ships at 4800 baud, where one poll (two reads) is mostly wire
+// time. These move it to a faster rate and find it again after a reboot or
+// a sensor swap. All of them leave the port at the rate they return.
+
+/** @brief REG_BAUD_RATE code of a rate, -1 if the sensor has none. */
+int modbusBaudCode(uint32_t baud);
+
+/**
+ * @brief Finds the rate the sensor answers at, trying hint first and then
+ * every MODBUS_BAUD_CODES rate.
+ * @return the rate, 0 if it answered at none (port left at hint)
+ */
+uint32_t findSensorBaud(ModbusClient &modbus, uint8_t addr, uint32_t hint);
+
+/**
+ * @brief Reprograms the sensor from the port's current rate to target:
+ * writes REG_BAUD_RATE, switches the port and reads the register back at
+ * the new rate. If that fails the port returns to the old rate, and if
+ * the sensor is silent there too every rate is scanned.
+ *
+ * Sensors that only apply a new rate after a power cycle answer at the
+ * old rate with the new code; the old rate is kept and findSensorBaud()
+ * picks up the new one after the next restart.
+ * @return the rate the link ends up at, 0 if the sensor was lost
+ */
+uint32_t moveSensorBaud(ModbusClient &modbus, uint8_t addr, uint32_t target);
+
+/**
+ * @brief Moves to the fastest rate up to maxBaud the sensor accepts,
+ * trying each faster rate in turn.
+ * @return the rate the link ends up at, 0 if the sensor was lost
+ */
+uint32_t negotiateSensorBaud(ModbusClient &modbus, uint8_t addr, uint32_t maxBaud);
+
+#endif
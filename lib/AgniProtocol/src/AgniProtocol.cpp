@@ -0,0 +1,112 @@
+#include "AgniProtocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ============================================================================
+// CRC-32
+// ============================================================================
+// Nibble table: 64 bytes of flash instead of 1 KB, ~2x slower than the
+// byte table but still far below the SD read time per chunk.
+static const uint32_t CRC32_NIBBLE_TABLE[16] = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+  0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+  0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length) {
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ CRC32_NIBBLE_TABLE[crc & 0x0F];
+    crc = (crc >> 4) ^ CRC32_NIBBLE_TABLE[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+// ============================================================================
+// NACK
+// ============================================================================
+bool parseNack(const char* text, size_t length, char* name, size_t nameCapacity,
+               ChunkRange* ranges, size_t maxRanges, size_t &count) {
+  const size_t prefixLength = sizeof(PROTO_NACK) - 1;
+  count = 0;
+  if (length <= prefixLength || memcmp(text, PROTO_NACK, prefixLength) != 0) return false;
+
+  const char* p = text + prefixLength;
+  const char* end = text + length;
+  const char* bar = (const char*)memchr(p, '|', end - p);
+  if (!bar || bar == p || (size_t)(bar - p) >= nameCapacity) return false;
+  memcpy(name, p, bar - p);
+  name[bar - p] = '\0';
+
+  p = bar + 1;
+  while (p < end && count < maxRanges) {
+    char* next;
+    unsigned long first = strtoul(p, &next, 10);
+    if (next == p || first > 0xFFFF) return count > 0;
+    unsigned long last = first;
+    p = next;
+    if (p < end && *p == '-') {
+      last = strtoul(p + 1, &next, 10);
+      if (next == p + 1 || last < first || last > 0xFFFF) return count > 0;
+      p = next;
+    }
+    ranges[count].first = (uint16_t)first;
+    ranges[count].last = (uint16_t)last;
+    count++;
+    if (p < end && *p == ',') p++;
+    else break;
+  }
+  return count > 0;
+}
+
+// ============================================================================
+// RECORD RANGES
+// ============================================================================
+bool parseRecordRanges(const char* text, size_t length, RecordRange* ranges, size_t maxRanges, size_t &count) {
+  const char* p = text;
+  const char* end = text + length;
+  const char* bar = (const char*)memchr(p, '|', length);
+  if (bar) end = bar;
+  count = 0;
+  while (p < end && count < maxRanges) {
+    char* next;
+    unsigned long first = strtoul(p, &next, 10);
+    if (next == p || next > end || first == 0 || first > 0xFFFFFFFFUL) return count > 0;
+    unsigned long last = first;
+    p = next;
+    if (p < end && *p == '-') {
+      last = strtoul(p + 1, &next, 10);
+      if (next == p + 1 || next > end || last < first || last > 0xFFFFFFFFUL) return count > 0;
+      p = next;
+    }
+    ranges[count].first = (uint32_t)first;
+    ranges[count].last = (uint32_t)last;
+    count++;
+    if (p < end && *p == ',') p++;
+    else break;
+  }
+  return count > 0;
+}
+
+size_t formatNack(char* out, size_t capacity, const char* name, const ChunkRange* ranges, size_t count) {
+  int n = snprintf(out, capacity, PROTO_NACK "%s|", name);
+  if (n < 0 || (size_t)n >= capacity) return 0;
+  size_t length = (size_t)n;
+  size_t written = 0;
+  for (size_t i = 0; i < count; i++) {
+    char part[16];
+    int partLength = ranges[i].first == ranges[i].last
+      ? snprintf(part, sizeof(part), "%s%u", written ? "," : "", ranges[i].first)
+      : snprintf(part, sizeof(part), "%s%u-%u", written ? "," : "", ranges[i].first, ranges[i].last);
+    if (length + partLength >= capacity) break;
+    memcpy(out + length, part, partLength);
+    length += partLength;
+    written++;
+  }
+  out[length] = '\0';
+  return written ? length : 0;
+}
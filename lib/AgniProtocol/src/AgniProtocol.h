@@ -0,0 +1,134 @@
+#ifndef AGNI_PROTOCOL_H
+#define AGNI_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ============================================================================
+// TRANSFER WIRE PROTOCOL
+// ============================================================================
+// Shared by the firmware (AgniTransfer) and the host receiver
+// (AgniReceiver) so the two cannot drift apart. One transfer is:
+//
+//   FILE_START:<name>|SIZE:<bytes>
+//   <raw chunks, exactly <bytes> in total>
+//   FILE_END:<name>
+//   ... next file ...
+//   TRANSFER_COMPLETE|All files transferred!
+//
+// Each line above is one notification. While a file is open every
+// notification is file data until <bytes> have arrived, so file content
+// can never be mistaken for a control message.
+
+#define PROTO_FILE_START         "FILE_START:"
+#define PROTO_SIZE_SEPARATOR     "|SIZE:"
+#define PROTO_FILE_END           "FILE_END:"
+#define PROTO_TRANSFER_COMPLETE  "TRANSFER_COMPLETE"
+#define PROTO_COMPLETE_MESSAGE   PROTO_TRANSFER_COMPLETE "|All files transferred!"
+
+// ----------------------------------------------------------------------------
+// Version 2: sequenced chunks, CRC trailer, selective retransmission
+// ----------------------------------------------------------------------------
+// Requested with START_TRANSFER:2; plain START_TRANSFER stays version 1.
+//
+//   FILE_START:<name>|SIZE:<bytes>|CHUNK:<chunk bytes>
+//   0x01 <u16 seq LE> <data>          chunk seq covers [seq*chunk, +chunk)
+//   FILE_END:<name>|CRC:<crc32 hex>|CHUNKS:<count>
+//
+// Data notifications start with a non-printable marker, so a lost chunk
+// can never be confused with a control message. For chunks that never
+// arrived (or a CRC mismatch) the client writes
+//
+//   NACK:<name>|<first>[-<last>],...   e.g. NACK:farmland_7.json|0,3-5
+//
+// to the command characteristic and the device answers between files (or
+// once idle) with RESEND_START:<name>, the chunks read back from their SD
+// offsets, and RESEND_END:<name>.
+
+// Compression (START_TRANSFER:2|LZ:<dictionary id>, version 2 only) adds
+// |LZ:<id> to FILE_START. SIZE and CRC then describe the original file,
+// while chunks and CHUNKS count slices of the compressed stream (format in
+// AgniCompress.h); NACKs still name compressed chunks.
+//
+// START_TRANSFER:2|ARCHIVE sends the columnar archive blocks
+// (block_<n>.agb, format in AgniArchive.h) instead of the record files.
+// START_TRANSFER:2|LOGS sends the log dumps (log_<boot>.agl, format in
+// AgniLog.h) written by LOG_DUMP or after a crash.
+//
+// The record files go out in directory order unless the client asks for
+// an order, so the readings it most likely wants arrive first:
+//
+//   START_TRANSFER:2|ORDER:NEWEST      newest record first
+//   START_TRANSFER:2|ORDER:PRIORITY    flagged records (no reading, pH out
+//                                      of range, dry, saline; see
+//                                      recordPriority()) newest first, then
+//                                      the rest newest first
+//   START_TRANSFER:2|RECORDS:40-45,12  those record numbers, in that order
+//
+// An ordered transfer starts with TRANSFER_PLAN:<records>|BYTES:<bytes>,
+// the totals it is about to send, so the client can show progress.
+//
+// Up to max_connections clients can be connected at once. Each has its own
+// transfer: START_TRANSFER and NACK apply to the client that wrote them, and
+// its notifications go to that client only.
+
+#define PROTO_VERSION_LEGACY     1
+#define PROTO_VERSION_SEQUENCED  2
+#define PROTO_DATA_MARKER        0x01
+#define PROTO_DATA_HEADER        3      // marker + u16 sequence number
+#define PROTO_CHUNK_SEPARATOR    "|CHUNK:"
+#define PROTO_CRC_SEPARATOR      "|CRC:"
+#define PROTO_CHUNKS_SEPARATOR   "|CHUNKS:"
+#define PROTO_LZ_SEPARATOR       "|LZ:"
+#define PROTO_ARCHIVE_OPTION     "|ARCHIVE"
+#define PROTO_LOG_OPTION         "|LOGS"
+#define PROTO_ORDER_OPTION       "|ORDER:"
+#define PROTO_ORDER_NEWEST       "NEWEST"
+#define PROTO_ORDER_PRIORITY     "PRIORITY"
+#define PROTO_RECORDS_OPTION     "|RECORDS:"
+#define PROTO_PLAN               "TRANSFER_PLAN:"
+#define PROTO_BYTES_SEPARATOR    "|BYTES:"
+#define PROTO_MAX_RECORD_RANGES  8
+#define PROTO_RESEND_START       "RESEND_START:"
+#define PROTO_RESEND_END         "RESEND_END:"
+#define PROTO_NACK               "NACK:"
+#define PROTO_MAX_NACK_RANGES    16
+#define PROTO_NAME_MAX           64
+
+struct ChunkRange {
+  uint16_t first;
+  uint16_t last;     // inclusive
+};
+
+struct RecordRange {
+  uint32_t first;
+  uint32_t last;     // inclusive
+};
+
+/**
+ * @brief Parses the list after |RECORDS:, "<first>[-<last>],...", up to
+ * the end or the next '|'. Record numbers start at 1.
+ * @return false if there is no valid range
+ */
+bool parseRecordRanges(const char* text, size_t length, RecordRange* ranges, size_t maxRanges, size_t &count);
+
+/**
+ * @brief Parses "NACK:<name>|<ranges>".
+ * @return false if the text is not a NACK or has no valid range
+ */
+bool parseNack(const char* text, size_t length, char* name, size_t nameCapacity,
+               ChunkRange* ranges, size_t maxRanges, size_t &count);
+
+/**
+ * @brief Builds a NACK, dropping trailing ranges that don't fit capacity.
+ * @return length written (0 if not even one range fits)
+ */
+size_t formatNack(char* out, size_t capacity, const char* name, const ChunkRange* ranges, size_t count);
+
+/**
+ * @brief CRC-32 (IEEE 802.3, reflected, as used by zlib). Pass the previous
+ * result as crc to continue over several buffers; start with 0.
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length);
+
+#endif
@@ -0,0 +1,479 @@
+#include "AgniReceiver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool startsWith(const char* text, size_t length, const char* prefix) {
+  size_t prefixLength = strlen(prefix);
+  return length >= prefixLength && memcmp(text, prefix, prefixLength) == 0;
+}
+
+// ============================================================================
+// REASSEMBLY
+// ============================================================================
+void TransferReceiver::reset() {
+  current = ReceivedFile();
+  inFile = false;
+  awaitingEnd = false;
+}
+
+ReceiverEvent TransferReceiver::fail(const char* message) {
+  error = message;
+  counters.protocolErrors++;
+  return RECEIVER_PROTOCOL_ERROR;
+}
+
+ReceiverEvent TransferReceiver::push(const uint8_t* data, size_t length) {
+  counters.notifications++;
+  counters.bytes += length;
+  const char* text = (const char*)data;
+
+  if (inFile && !awaitingEnd && current.version == PROTO_VERSION_LEGACY) {
+    // A lost chunk would otherwise make us swallow the control messages
+    // that follow; both are unambiguous enough to accept mid-file.
+    bool endOfThisFile = length == strlen(PROTO_FILE_END) + current.name.size() &&
+                         startsWith(text, length, PROTO_FILE_END) &&
+                         memcmp(text + strlen(PROTO_FILE_END), current.name.data(), current.name.size()) == 0;
+    bool nextFile = startsWith(text, length, PROTO_FILE_START) &&
+                    memchr(text, '|', length) != NULL;
+    if (!endOfThisFile && !nextFile) {
+      size_t remaining = current.declaredSize - current.data.size();
+      size_t take = length > remaining ? remaining : length;
+      current.data.insert(current.data.end(), data, data + take);
+      current.crc32 = crc32_update(current.crc32, data, take);
+      counters.payloadBytes += take;
+      if (current.data.size() == current.declaredSize) awaitingEnd = true;
+      if (take < length) return fail("chunk overruns the announced file size");
+      return RECEIVER_NONE;
+    }
+  }
+  if (length >= PROTO_DATA_HEADER && data[0] == PROTO_DATA_MARKER) return handleChunk(data, length);
+  return handleControl(text, length);
+}
+
+// ============================================================================
+// VERSION 2: SEQUENCED CHUNKS
+// ============================================================================
+size_t ReceivedFile::missingRanges(ChunkRange* out, size_t maxRanges) const {
+  size_t count = 0;
+  for (size_t i = 0; i < chunks.size() && count < maxRanges; i++) {
+    if (chunks[i]) continue;
+    size_t last = i;
+    while (last + 1 < chunks.size() && !chunks[last + 1]) last++;
+    out[count].first = (uint16_t)i;
+    out[count].last = (uint16_t)last;
+    count++;
+    i = last;
+  }
+  return count;
+}
+
+size_t TransferReceiver::buildNack(const std::string &name, char* out, size_t capacity) const {
+  std::map<std::string, ReceivedFile>::const_iterator it = repairs.find(name);
+  if (it == repairs.end()) return 0;
+  ChunkRange ranges[PROTO_MAX_NACK_RANGES];
+  size_t count = it->second.missingRanges(ranges, PROTO_MAX_NACK_RANGES);
+  return formatNack(out, capacity, name.c_str(), ranges, count);
+}
+
+ReceiverEvent TransferReceiver::handleChunk(const uint8_t* data, size_t length) {
+  ReceivedFile* file = NULL;
+  if (!resendName.empty()) {
+    std::map<std::string, ReceivedFile>::iterator it = repairs.find(resendName);
+    if (it != repairs.end()) file = &it->second;
+  } else if (inFile && current.version == PROTO_VERSION_SEQUENCED) {
+    file = &current;
+  }
+  if (!file) return fail("sequenced chunk outside a file");
+
+  uint16_t sequence = data[1] | (data[2] << 8);
+  size_t bytes = length - PROTO_DATA_HEADER;
+  size_t offset = (size_t)sequence * file->chunkBytes;
+  if (file->compressed && sequence >= file->chunks.size() && bytes <= file->chunkBytes) {
+    // The compressed length is only known from FILE_END; grow as chunks come
+    file->chunks.resize(sequence + 1, false);
+    if (file->data.size() < offset + bytes) file->data.resize(offset + bytes);
+  }
+  if (sequence >= file->chunks.size() || bytes > file->chunkBytes || offset + bytes > file->data.size()) {
+    return fail("chunk outside the announced file");
+  }
+  if (file->compressed && offset + bytes > file->wireBytes) file->wireBytes = offset + bytes;
+  if (file->chunks[sequence]) {
+    counters.duplicateChunks++;
+    return RECEIVER_NONE;
+  }
+  memcpy(&file->data[offset], data + PROTO_DATA_HEADER, bytes);
+  file->chunks[sequence] = true;
+  file->chunksReceived++;
+  counters.payloadBytes += bytes;
+  return RECEIVER_NONE;
+}
+
+/**
+ * @brief Verifies a version 2 file once its FILE_END or RESEND_END is in.
+ * Complete files end up in current; the rest are held in repairs.
+ */
+ReceiverEvent TransferReceiver::finishSequenced(ReceivedFile &file) {
+  if (file.chunksReceived == file.chunks.size() && file.compressed) {
+    size_t dictionaryLength = 0;
+    const uint8_t* dictionary = lzDictionary(file.dictionary, dictionaryLength);
+    std::vector<uint8_t> expanded(file.declaredSize);
+    size_t produced = lzDecompress(file.data.data(), file.wireBytes, dictionary, dictionaryLength,
+                                   expanded.data(), expanded.size());
+    if (produced == file.declaredSize) {
+      counters.compressedFiles++;
+      counters.compressedBytes += file.wireBytes;
+      counters.expandedBytes += produced;
+      file.data.swap(expanded);
+      file.compressed = false;
+    } else {
+      counters.decompressErrors++;
+      file.crc32 = 0;
+      file.chunks.assign(file.chunks.size(), false);
+      file.chunksReceived = 0;
+      file.wireBytes = 0;
+    }
+  }
+  if (file.chunksReceived == file.chunks.size()) {
+    file.crc32 = crc32_update(0, file.data.data(), file.data.size());
+    file.crcOk = file.crc32 == file.expectedCrc;
+    file.sizeOk = file.crcOk;
+    if (file.crcOk) {
+      bool repaired = &file != &current;
+      if (repaired) {
+        current = file;
+        repairs.erase(current.name);
+        counters.repairedFiles++;
+      }
+      counters.files++;
+      return RECEIVER_FILE_DONE;
+    }
+    // Every chunk arrived yet the digest is wrong: ask for all of it again
+    counters.crcMismatches++;
+    file.chunks.assign(file.chunks.size(), false);
+    file.chunksReceived = 0;
+  }
+  counters.incompleteFiles++;
+  incompleteName = file.name;
+  if (&file == &current) repairs[current.name] = current;
+  return RECEIVER_FILE_INCOMPLETE;
+}
+
+ReceiverEvent TransferReceiver::handleControl(const char* text, size_t length) {
+  if (startsWith(text, length, PROTO_FILE_START)) {
+    bool interrupted = inFile;
+    std::string header(text + strlen(PROTO_FILE_START), length - strlen(PROTO_FILE_START));
+    size_t separator = header.rfind(PROTO_SIZE_SEPARATOR);
+    if (separator == std::string::npos) return fail("FILE_START without size");
+
+    reset();
+    current.name = header.substr(0, separator);
+    current.declaredSize = (uint32_t)strtoul(header.c_str() + separator + strlen(PROTO_SIZE_SEPARATOR), NULL, 10);
+    size_t chunkField = header.find(PROTO_CHUNK_SEPARATOR, separator);
+    if (chunkField != std::string::npos) {
+      current.version = PROTO_VERSION_SEQUENCED;
+      current.chunkBytes = (uint16_t)strtoul(header.c_str() + chunkField + strlen(PROTO_CHUNK_SEPARATOR), NULL, 10);
+      if (current.chunkBytes == 0) return fail("FILE_START with zero chunk size");
+      size_t lzField = header.find(PROTO_LZ_SEPARATOR, separator);
+      if (lzField != std::string::npos) {
+        current.compressed = true;
+        current.dictionary = (uint8_t)strtoul(header.c_str() + lzField + strlen(PROTO_LZ_SEPARATOR), NULL, 10);
+        size_t dictionaryLength = 0;
+        if (current.dictionary != LZ_DICTIONARY_NONE && !lzDictionary(current.dictionary, dictionaryLength)) {
+          return fail("FILE_START with an unknown dictionary");
+        }
+      } else {
+        current.chunks.assign((current.declaredSize + current.chunkBytes - 1) / current.chunkBytes, false);
+        current.data.resize(current.declaredSize);
+      }
+    } else {
+      current.data.reserve(current.declaredSize);
+    }
+    inFile = true;
+    awaitingEnd = current.declaredSize == 0;
+    if (interrupted) {
+      counters.sizeMismatches++;
+      fail("FILE_START before the previous FILE_END");
+    }
+    return RECEIVER_FILE_STARTED;
+  }
+
+  if (startsWith(text, length, PROTO_FILE_END)) {
+    std::string trailer(text + strlen(PROTO_FILE_END), length - strlen(PROTO_FILE_END));
+    if (!inFile) return fail("FILE_END without FILE_START");
+    if (current.version == PROTO_VERSION_SEQUENCED) {
+      size_t crcField = trailer.find(PROTO_CRC_SEPARATOR);
+      if (crcField == std::string::npos) return fail("FILE_END without CRC");
+      if (trailer.compare(0, crcField, current.name) != 0) return fail("FILE_END names a different file");
+      current.expectedCrc = (uint32_t)strtoul(trailer.c_str() + crcField + strlen(PROTO_CRC_SEPARATOR), NULL, 16);
+      if (current.compressed) {
+        // Now the compressed length is known: a lost tail shows up as holes
+        size_t chunksField = trailer.find(PROTO_CHUNKS_SEPARATOR);
+        if (chunksField == std::string::npos) return fail("compressed FILE_END without chunk count");
+        size_t count = strtoul(trailer.c_str() + chunksField + strlen(PROTO_CHUNKS_SEPARATOR), NULL, 10);
+        if (count < current.chunks.size()) return fail("chunk beyond the announced count");
+        current.chunks.resize(count, false);
+        if (current.data.size() < count * current.chunkBytes) current.data.resize(count * current.chunkBytes);
+      }
+      inFile = false;
+      return finishSequenced(current);
+    }
+    const std::string &name = trailer;
+    if (name != current.name) return fail("FILE_END names a different file");
+    current.sizeOk = current.data.size() == current.declaredSize;
+    if (!current.sizeOk) counters.sizeMismatches++;
+    counters.files++;
+    inFile = false;
+    awaitingEnd = false;
+    return RECEIVER_FILE_DONE;
+  }
+
+  if (startsWith(text, length, PROTO_RESEND_START)) {
+    resendName.assign(text + strlen(PROTO_RESEND_START), length - strlen(PROTO_RESEND_START));
+    if (repairs.find(resendName) == repairs.end()) {
+      resendName.clear();
+      return fail("RESEND_START for a file not awaiting repair");
+    }
+    return RECEIVER_NONE;
+  }
+
+  if (startsWith(text, length, PROTO_RESEND_END)) {
+    std::string name(text + strlen(PROTO_RESEND_END), length - strlen(PROTO_RESEND_END));
+    resendName.clear();
+    std::map<std::string, ReceivedFile>::iterator it = repairs.find(name);
+    if (it == repairs.end()) return RECEIVER_NONE;   // answer to a duplicate NACK
+    return finishSequenced(it->second);
+  }
+
+  if (startsWith(text, length, PROTO_PLAN)) {
+    if (inFile) return fail("TRANSFER_PLAN inside a file");
+    std::string plan(text + strlen(PROTO_PLAN), length - strlen(PROTO_PLAN));
+    size_t bytesField = plan.find(PROTO_BYTES_SEPARATOR);
+    if (bytesField == std::string::npos) return fail("TRANSFER_PLAN without bytes");
+    planFiles = (uint32_t)strtoul(plan.c_str(), NULL, 10);
+    planBytes = strtoull(plan.c_str() + bytesField + strlen(PROTO_BYTES_SEPARATOR), NULL, 10);
+    return RECEIVER_PLAN;
+  }
+
+  if (startsWith(text, length, PROTO_TRANSFER_COMPLETE)) {
+    bool partial = inFile;
+    inFile = false;
+    awaitingEnd = false;
+    counters.transfers++;
+    if (partial) {
+      counters.sizeMismatches++;
+      fail("TRANSFER_COMPLETE inside a file");
+    }
+    return RECEIVER_TRANSFER_COMPLETE;
+  }
+
+  return fail(inFile ? "data after the announced file size" : "unexpected data outside a file");
+}
+
+// ============================================================================
+// RECORD DECODING
+// ============================================================================
+// A small JSON reader for the record schema: no allocation, no DOM, keys
+// are matched as "object.key" paths while scanning.
+namespace {
+
+struct JsonCursor {
+  const char* p;
+  const char* end;
+};
+
+void skipSpace(JsonCursor &c) {
+  while (c.p < c.end && (*c.p == ' ' || *c.p == '\n' || *c.p == '\r' || *c.p == '\t')) c.p++;
+}
+
+/** @brief Reads a string token into out (truncating); cursor ends past the quote. */
+bool readString(JsonCursor &c, char* out, size_t capacity) {
+  if (c.p >= c.end || *c.p != '"') return false;
+  c.p++;
+  size_t n = 0;
+  while (c.p < c.end && *c.p != '"') {
+    char ch = *c.p++;
+    if (ch == '\\' && c.p < c.end) {
+      char esc = *c.p++;
+      switch (esc) {
+        case 'n': ch = '\n'; break;
+        case 't': ch = '\t'; break;
+        case 'r': ch = '\r'; break;
+        case 'b': ch = '\b'; break;
+        case 'f': ch = '\f'; break;
+        case 'u': ch = '?'; c.p += (c.end - c.p >= 4) ? 4 : (c.end - c.p); break;
+        default: ch = esc; break;
+      }
+    }
+    if (n + 1 < capacity) out[n++] = ch;
+  }
+  if (capacity) out[n] = '\0';
+  if (c.p >= c.end) return false;
+  c.p++;
+  return true;
+}
+
+void assignField(DecodedRecord &r, const char* path, const char* text, bool isString) {
+  // Strings
+  if (isString) {
+    struct { const char* key; char* dest; size_t size; } strings[] = {
+      {"timestamp", r.timestamp, sizeof(r.timestamp)},
+      {"time_utc", r.timeUtc, sizeof(r.timeUtc)},
+      {"date_ist", r.dateIst, sizeof(r.dateIst)},
+      {"time_ist", r.timeIst, sizeof(r.timeIst)},
+      {"ph_category", r.phCategory, sizeof(r.phCategory)},
+    };
+    for (const auto &s : strings) {
+      if (strcmp(path, s.key) == 0) {
+        strncpy(s.dest, text, s.size - 1);
+        s.dest[s.size - 1] = '\0';
+        return;
+      }
+    }
+    return;
+  }
+
+  bool truth = strcmp(text, "true") == 0;
+  double number = atof(text);
+  if (strcmp(path, "id") == 0) r.id = (uint32_t)number;
+  else if (strcmp(path, "location.latitude") == 0) r.latitude = number;
+  else if (strcmp(path, "location.longitude") == 0) r.longitude = number;
+  else if (strcmp(path, "location.valid") == 0) r.locationValid = truth;
+  else if (strcmp(path, "location.satellites") == 0) r.satellites = (int)number;
+  else if (strcmp(path, "location.altitude") == 0) r.altitude = number;
+  else if (strcmp(path, "location.speed_kmh") == 0) r.speedKmh = number;
+  else if (strcmp(path, "location.hdop") == 0) r.hdop = number;
+  else if (strcmp(path, "parameters.ph_value") == 0) r.ph = number;
+  else if (strcmp(path, "parameters.conductivity") == 0) r.conductivity = (uint32_t)number;
+  else if (strcmp(path, "parameters.nitrogen") == 0) r.nitrogen = (uint32_t)number;
+  else if (strcmp(path, "parameters.phosphorus") == 0) r.phosphorus = (uint32_t)number;
+  else if (strcmp(path, "parameters.potassium") == 0) r.potassium = (uint32_t)number;
+  else if (strcmp(path, "parameters.moisture") == 0) r.moisture = number;
+  else if (strcmp(path, "parameters.temperature") == 0) r.temperature = number;
+  else if (strcmp(path, "sensor_valid") == 0) r.sensorValid = truth;
+}
+
+bool parseObject(JsonCursor &c, DecodedRecord &r, const char* prefix, bool &sawId, int depth);
+
+/** @brief Skips any value we don't map (arrays, unknown nesting). */
+bool skipValue(JsonCursor &c, int depth) {
+  skipSpace(c);
+  if (c.p >= c.end) return false;
+  if (*c.p == '"') {
+    char scratch[1];
+    return readString(c, scratch, sizeof(scratch));
+  }
+  if (*c.p == '{' || *c.p == '[') {
+    if (depth > 8) return false;
+    char close = *c.p == '{' ? '}' : ']';
+    c.p++;
+    skipSpace(c);
+    if (c.p < c.end && *c.p == close) { c.p++; return true; }
+    while (c.p < c.end) {
+      if (close == '}') {
+        char key[2];
+        skipSpace(c);
+        if (!readString(c, key, sizeof(key))) return false;
+        skipSpace(c);
+        if (c.p >= c.end || *c.p != ':') return false;
+        c.p++;
+      }
+      if (!skipValue(c, depth + 1)) return false;
+      skipSpace(c);
+      if (c.p < c.end && *c.p == ',') { c.p++; continue; }
+      if (c.p < c.end && *c.p == close) { c.p++; return true; }
+      return false;
+    }
+    return false;
+  }
+  while (c.p < c.end && *c.p != ',' && *c.p != '}' && *c.p != ']') c.p++;
+  return true;
+}
+
+bool parseObject(JsonCursor &c, DecodedRecord &r, const char* prefix, bool &sawId, int depth) {
+  skipSpace(c);
+  if (c.p >= c.end || *c.p != '{') return false;
+  c.p++;
+  skipSpace(c);
+  if (c.p < c.end && *c.p == '}') { c.p++; return true; }
+
+  while (c.p < c.end) {
+    char key[32];
+    skipSpace(c);
+    if (!readString(c, key, sizeof(key))) return false;
+    skipSpace(c);
+    if (c.p >= c.end || *c.p != ':') return false;
+    c.p++;
+    skipSpace(c);
+    if (c.p >= c.end) return false;
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s%s%s", prefix, prefix[0] ? "." : "", key);
+    if (*c.p == '{' && depth == 0) {
+      if (!parseObject(c, r, path, sawId, depth + 1)) return false;
+    } else if (*c.p == '{' || *c.p == '[') {
+      if (!skipValue(c, depth + 1)) return false;
+    } else if (*c.p == '"') {
+      char value[32];
+      if (!readString(c, value, sizeof(value))) return false;
+      assignField(r, path, value, true);
+    } else {
+      const char* start = c.p;
+      while (c.p < c.end && *c.p != ',' && *c.p != '}' && *c.p != ' ' && *c.p != '\n') c.p++;
+      char value[32];
+      size_t n = (size_t)(c.p - start) < sizeof(value) - 1 ? (size_t)(c.p - start) : sizeof(value) - 1;
+      memcpy(value, start, n);
+      value[n] = '\0';
+      if (strcmp(path, "id") == 0) sawId = true;
+      assignField(r, path, value, false);
+    }
+
+    skipSpace(c);
+    if (c.p < c.end && *c.p == ',') { c.p++; continue; }
+    if (c.p < c.end && *c.p == '}') { c.p++; return true; }
+    return false;
+  }
+  return false;
+}
+
+}  // namespace
+
+bool decodeRecordJson(const char* json, size_t length, DecodedRecord &record) {
+  record = DecodedRecord();
+  JsonCursor cursor = {json, json + length};
+  bool sawId = false;
+  return parseObject(cursor, record, "", sawId, 0) && sawId;
+}
+
+const char* recordCsvHeader() {
+  return "id,timestamp,time_utc,date_ist,time_ist,latitude,longitude,location_valid,satellites,"
+         "altitude,speed_kmh,hdop,ph_category,ph_value,conductivity,nitrogen,phosphorus,potassium,"
+         "moisture,temperature,sensor_valid";
+}
+
+size_t formatRecordCsv(const DecodedRecord &r, char* out, size_t capacity) {
+  int n = snprintf(out, capacity,
+    "%lu,%s,%s,%s,%s,%.7f,%.7f,%d,%d,%.1f,%.2f,%.2f,%s,%.1f,%lu,%lu,%lu,%lu,%.1f,%.1f,%d",
+    (unsigned long)r.id, r.timestamp, r.timeUtc, r.dateIst, r.timeIst,
+    r.latitude, r.longitude, r.locationValid ? 1 : 0, r.satellites,
+    r.altitude, r.speedKmh, r.hdop, r.phCategory, r.ph,
+    (unsigned long)r.conductivity, (unsigned long)r.nitrogen, (unsigned long)r.phosphorus,
+    (unsigned long)r.potassium, r.moisture, r.temperature, r.sensorValid ? 1 : 0);
+  return (n > 0 && (size_t)n < capacity) ? (size_t)n : 0;
+}
+
+size_t formatRecordJson(const DecodedRecord &r, char* out, size_t capacity) {
+  int n = snprintf(out, capacity,
+    "{\"id\":%lu,\"timestamp\":\"%s\",\"time_utc\":\"%s\",\"date_ist\":\"%s\",\"time_ist\":\"%s\","
+    "\"location\":{\"latitude\":%.9g,\"longitude\":%.9g,\"valid\":%s,\"satellites\":%d,"
+    "\"altitude\":%.9g,\"speed_kmh\":%.9g,\"hdop\":%.9g},\"ph_category\":\"%s\","
+    "\"parameters\":{\"ph_value\":%.9g,\"conductivity\":%lu,\"nitrogen\":%lu,\"phosphorus\":%lu,"
+    "\"potassium\":%lu,\"moisture\":%.9g,\"temperature\":%.9g},\"sensor_valid\":%s}",
+    (unsigned long)r.id, r.timestamp, r.timeUtc, r.dateIst, r.timeIst,
+    r.latitude, r.longitude, r.locationValid ? "true" : "false", r.satellites,
+    r.altitude, r.speedKmh, r.hdop, r.phCategory, r.ph,
+    (unsigned long)r.conductivity, (unsigned long)r.nitrogen, (unsigned long)r.phosphorus,
+    (unsigned long)r.potassium, r.moisture, r.temperature, r.sensorValid ? "true" : "false");
+  return (n > 0 && (size_t)n < capacity) ? (size_t)n : 0;
+}
@@ -0,0 +1,163 @@
+#ifndef AGNI_RECEIVER_H
+#define AGNI_RECEIVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <AgniCompress.h>
+#include <AgniProtocol.h>
+
+// ============================================================================
+// TRANSFER RECEIVER (host / gateway side)
+// ============================================================================
+// Reference implementation of the phone side of the BLE file transfer:
+// feed it every notification from the transfer characteristic in order,
+// it reassembles the files and checks them against the announced sizes.
+// Version 2 transfers are placed by chunk sequence number and checked
+// against the CRC trailer; files with holes are held for repair until the
+// RESEND_END that answers buildNack(). Plain C++11, no platform dependencies.
+
+enum ReceiverEvent {
+  RECEIVER_NONE,              // data chunk absorbed
+  RECEIVER_FILE_STARTED,      // FILE_START parsed
+  RECEIVER_FILE_DONE,         // FILE_END matched; file() is complete
+  RECEIVER_TRANSFER_COMPLETE, // TRANSFER_COMPLETE seen
+  RECEIVER_PROTOCOL_ERROR,    // out-of-order or malformed message, see lastError()
+  RECEIVER_FILE_INCOMPLETE,   // version 2 file has missing chunks; see lastIncomplete()
+  RECEIVER_PLAN               // TRANSFER_PLAN parsed; see plannedFiles()
+};
+
+struct ReceivedFile {
+  std::string name;
+  uint32_t declaredSize = 0;
+  std::vector<uint8_t> data;
+  uint32_t crc32 = 0;         // of data, for comparison with the sender
+  bool sizeOk = false;
+
+  // Version 2 only
+  uint8_t version = PROTO_VERSION_LEGACY;
+  uint16_t chunkBytes = 0;
+  std::vector<bool> chunks;   // which sequence numbers have arrived
+  uint32_t chunksReceived = 0;
+  uint32_t expectedCrc = 0;   // from the FILE_END trailer
+  bool crcOk = false;
+  bool compressed = false;    // chunks are LZ stream slices until FILE_DONE
+  uint8_t dictionary = LZ_DICTIONARY_NONE;
+  uint32_t wireBytes = 0;     // compressed size as sent
+
+  /** @brief Missing chunks as ranges; returns how many were written. */
+  size_t missingRanges(ChunkRange* out, size_t maxRanges) const;
+};
+
+struct ReceiverStats {
+  uint64_t notifications = 0;
+  uint64_t bytes = 0;         // everything received, control messages included
+  uint64_t payloadBytes = 0;  // file content only
+  uint32_t files = 0;
+  uint32_t sizeMismatches = 0;
+  uint32_t protocolErrors = 0;
+  uint32_t transfers = 0;
+  uint32_t duplicateChunks = 0;   // version 2: resent chunk that had already arrived
+  uint32_t crcMismatches = 0;
+  uint32_t incompleteFiles = 0;   // FILE_END / RESEND_END with holes left
+  uint32_t repairedFiles = 0;
+  uint32_t compressedFiles = 0;
+  uint32_t decompressErrors = 0;
+  uint64_t compressedBytes = 0;   // LZ stream bytes of compressed files
+  uint64_t expandedBytes = 0;     // the same files after decoding
+};
+
+class TransferReceiver {
+public:
+  /** @brief Consumes one notification payload. */
+  ReceiverEvent push(const uint8_t* data, size_t length);
+
+  /** @brief The file being received, or the one just finished. */
+  const ReceivedFile &file() const { return current; }
+  bool receivingFile() const { return inFile; }
+  const std::string &lastError() const { return error; }
+  const ReceiverStats &stats() const { return counters; }
+
+  /** @brief Totals of the last TRANSFER_PLAN; 0 for transfers in directory order. */
+  uint32_t plannedFiles() const { return planFiles; }
+  uint64_t plannedBytes() const { return planBytes; }
+
+  /** @brief Name of the file behind the last RECEIVER_FILE_INCOMPLETE. */
+  const std::string &lastIncomplete() const { return incompleteName; }
+  /** @brief Files waiting for retransmitted chunks. */
+  size_t pendingRepairs() const { return repairs.size(); }
+  /**
+   * @brief Builds the NACK to write to the command characteristic for a file
+   * held for repair. Ranges that don't fit capacity are asked for next round.
+   * @return length, 0 if the file isn't waiting for chunks
+   */
+  size_t buildNack(const std::string &name, char* out, size_t capacity) const;
+
+  /** @brief Drops any partial file, e.g. after a disconnect. */
+  void reset();
+
+private:
+  ReceiverEvent fail(const char* message);
+  ReceiverEvent handleControl(const char* text, size_t length);
+  ReceiverEvent handleChunk(const uint8_t* data, size_t length);
+  ReceiverEvent finishSequenced(ReceivedFile &file);
+
+  ReceivedFile current;
+  bool inFile = false;
+  bool awaitingEnd = false;
+  std::map<std::string, ReceivedFile> repairs;
+  std::string resendName;       // non-empty between RESEND_START and RESEND_END
+  std::string incompleteName;
+  std::string error;
+  uint32_t planFiles = 0;
+  uint64_t planBytes = 0;
+  ReceiverStats counters;
+};
+
+// ============================================================================
+// RECORD DECODING
+// ============================================================================
+/**
+ * @brief One farmland_<n>.json record, flattened. Field names follow the
+ * JSON keys (see encodeRecordJson() in the firmware).
+ */
+struct DecodedRecord {
+  uint32_t id = 0;
+  char timestamp[24] = {0};
+  char timeUtc[12] = {0};
+  char dateIst[12] = {0};
+  char timeIst[12] = {0};
+  double latitude = 0;
+  double longitude = 0;
+  bool locationValid = false;
+  int satellites = 0;
+  double altitude = 0;
+  double speedKmh = 0;
+  double hdop = 0;
+  char phCategory[20] = {0};
+  double ph = 0;
+  uint32_t conductivity = 0;
+  uint32_t nitrogen = 0;
+  uint32_t phosphorus = 0;
+  uint32_t potassium = 0;
+  double moisture = 0;
+  double temperature = 0;
+  bool sensorValid = false;
+};
+
+/**
+ * @brief Parses one record file.
+ * @return false if the text is not a JSON object or lacks the "id" key
+ */
+bool decodeRecordJson(const char* json, size_t length, DecodedRecord &record);
+
+/** @brief Column names matching formatRecordCsv(), without newline. */
+const char* recordCsvHeader();
+/** @brief One CSV row without newline; returns the length, 0 if cap is too small. */
+size_t formatRecordCsv(const DecodedRecord &record, char* out, size_t capacity);
+/** @brief Compact JSON in the firmware's key order; 0 if cap is too small. */
+size_t formatRecordJson(const DecodedRecord &record, char* out, size_t capacity);
+
+#endif
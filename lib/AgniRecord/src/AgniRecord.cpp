@@ -0,0 +1,159 @@
+#include "AgniRecord.h"
+
+#include <stdio.h>
+#include <ArduinoJson.h>
+
+// ============================================================================
+// TIME CONVERSION HELPER
+// ============================================================================
+// Days since 1970-01-01 for a proleptic Gregorian date (H. Hinnant's algorithm)
+static long daysFromCivil(int y, int m, int d) {
+  y -= m <= 2;
+  const long era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (long)doe - 719468;
+}
+
+static void civilFromDays(long z, int &y, int &m, int &d) {
+  z += 719468;
+  const long era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = (unsigned)(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  d = (int)(doy - (153 * mp + 2) / 5 + 1);
+  m = (int)(mp < 10 ? mp + 3 : mp - 9);
+  y = (int)(yoe + era * 400 + (m <= 2));
+}
+
+void utcToIst(int year, int month, int day, int hour, int minute,
+              int &ist_year, int &ist_month, int &ist_day, int &ist_hour, int &ist_minute) {
+  const long IST_OFFSET_MINUTES = RECORD_IST_OFFSET_SECONDS / 60;
+  long minutes = daysFromCivil(year, month, day) * 1440L + hour * 60L + minute + IST_OFFSET_MINUTES;
+  long days = minutes / 1440;
+  long minuteOfDay = minutes % 1440;
+  if (minuteOfDay < 0) {
+    minuteOfDay += 1440;
+    days--;
+  }
+  civilFromDays(days, ist_year, ist_month, ist_day);
+  ist_hour = (int)(minuteOfDay / 60);
+  ist_minute = (int)(minuteOfDay % 60);
+}
+
+uint32_t fixToUnixTime(const GpsFix &fix) {
+  if (!fix.valid || fix.year < 1970) return 0;
+  long days = daysFromCivil(fix.year, fix.month, fix.day);
+  return (uint32_t)days * 86400UL + fix.hour * 3600UL + fix.minute * 60UL + fix.second;
+}
+
+void unixTimeToFix(uint32_t seconds, GpsFix &fix) {
+  civilFromDays((long)(seconds / 86400), fix.year, fix.month, fix.day);
+  uint32_t secondOfDay = seconds % 86400;
+  fix.hour = (int)(secondOfDay / 3600);
+  fix.minute = (int)(secondOfDay / 60 % 60);
+  fix.second = (int)(secondOfDay % 60);
+}
+
+const char* phCategory(float ph) {
+  if(ph < 5.5) return "acidic";
+  else if(ph < 6.5) return "slightly_acidic";
+  else if(ph < 7.5) return "neutral";
+  else if(ph < 8.5) return "slightly_alkaline";
+  else return "alkaline";
+}
+
+uint8_t recordPriority(const SoilRecord &record) {
+  const SensorData &soil = record.soil;
+  if (!soil.basicValid) return RECORD_PRIORITY_NO_READING;
+  uint8_t flags = 0;
+  if (soil.ph < 5.5 || soil.ph >= 8.5) flags |= RECORD_PRIORITY_PH;
+  if (soil.moisture < RECORD_DRY_MOISTURE) flags |= RECORD_PRIORITY_DRY;
+  if (soil.conductivity > RECORD_SALINE_EC) flags |= RECORD_PRIORITY_SALINE;
+  return flags;
+}
+
+// ============================================================================
+// JSON ENCODING
+// ============================================================================
+size_t encodeRecordJson(const SoilRecord &record, char* out, size_t capacity) {
+  const GpsFix &fix = record.fix;
+  const SensorData &soil = record.soil;
+  JsonDocument doc;
+  doc["id"] = record.id;
+  
+  if(fix.valid) {
+    // --- Log UTC Data ---
+    char timestamp[30];
+    snprintf(timestamp, sizeof(timestamp), "%04d-%02d-%02dT%02d:%02d:%02dZ",
+      fix.year, fix.month, fix.day, fix.hour, fix.minute, fix.second);
+    doc["timestamp"] = timestamp;
+    
+    char time_utc[10];
+    snprintf(time_utc, sizeof(time_utc), "%02d:%02d:%02d", fix.hour, fix.minute, fix.second);
+    doc["time_utc"] = time_utc;
+    int ist_year, ist_month, ist_day, ist_hour, ist_minute;
+    utcToIst(fix.year, fix.month, fix.day, fix.hour, fix.minute,
+             ist_year, ist_month, ist_day, ist_hour, ist_minute);
+    char date_ist[12];
+    snprintf(date_ist, sizeof(date_ist), "%04d-%02d-%02d", ist_year, ist_month, ist_day);
+    doc["date_ist"] = date_ist;
+    char time_ist[20];
+    int ist_hour_12 = ist_hour % 12;
+    if (ist_hour_12 == 0) ist_hour_12 = 12;
+    
+    snprintf(time_ist, sizeof(time_ist), "%02d:%02d %s", ist_hour_12, ist_minute, ist_hour >= 12 ? "PM" : "AM");
+    doc["time_ist"] = time_ist;
+
+  } else {
+    doc["timestamp"] = "0000-00-00T00:00:00Z";
+    doc["time_utc"] = "00:00:00";
+    doc["date_ist"] = "0000-00-00";
+    doc["time_ist"] = "00:00 AM";
+  }
+  JsonObject location = doc["location"].to<JsonObject>();
+  location["latitude"] = fix.valid ? fix.latitude : 0.0;
+  location["longitude"] = fix.valid ? fix.longitude : 0.0;
+  location["valid"] = fix.valid;
+  location["satellites"] = fix.valid ? fix.satellites : 0;
+  location["altitude"] = fix.valid ? fix.altitude : 0.0;
+  location["speed_kmh"] = fix.valid ? fix.speedKmh : 0.0;
+  location["hdop"] = fix.valid ? fix.hdop : 0.0;
+  
+  doc["ph_category"] = phCategory(soil.ph);
+  
+  JsonObject params = doc["parameters"].to<JsonObject>();
+  params["ph_value"] = soil.ph;
+  params["conductivity"] = soil.conductivity;
+  params["nitrogen"] = soil.nitrogen;
+  params["phosphorus"] = soil.phosphorus;
+  params["potassium"] = soil.potassium;
+  params["moisture"] = soil.moisture;
+  params["temperature"] = soil.temperature;
+  doc["sensor_valid"] = soil.basicValid && soil.npkValid;
+
+  if (record.deviceCount) {
+    JsonArray devices = doc["devices"].to<JsonArray>();
+    for (uint8_t d = 0; d < record.deviceCount && d < RECORD_MAX_DEVICES; d++) {
+      const DeviceReading &reading = record.devices[d];
+      if (!reading.map) continue;
+      JsonObject device = devices.add<JsonObject>();
+      device["address"] = reading.address;
+      device["type"] = reading.map->type;
+      device["valid"] = reading.allValid();
+      device["age_ms"] = reading.ageMs;
+      // Only fields from the latest read; a stale value is left out
+      for (uint8_t f = 0; f < reading.map->fieldCount; f++) {
+        if (!(reading.validFields & (1u << f))) continue;
+        const RegisterField &field = reading.map->fields[f];
+        if (field.scale > 1) device[field.name] = (float)reading.raw[f] / field.scale;
+        else device[field.name] = reading.raw[f];
+      }
+    }
+  }
+
+  if (measureJson(doc) >= capacity) return 0;
+  return serializeJson(doc, out, capacity);
+}
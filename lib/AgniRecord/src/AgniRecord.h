@@ -0,0 +1,128 @@
+#ifndef AGNI_RECORD_H
+#define AGNI_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ============================================================================
+// RECORD MODEL
+// ============================================================================
+#define RECORD_IST_OFFSET_SECONDS  (5 * 3600 + 30 * 60)   // date_ist / time_ist
+
+struct SensorData {
+  float moisture = 0;
+  float temperature = 0;
+  uint16_t conductivity = 0;
+  float ph = 0;
+  uint16_t nitrogen = 0;
+  uint16_t phosphorus = 0;
+  uint16_t potassium = 0;
+  bool basicValid = false;
+  bool npkValid = false;
+};
+
+// ----------------------------------------------------------------------------
+// Per-device readings (multi-drop RS485 bus)
+// ----------------------------------------------------------------------------
+#define RECORD_MAX_DEVICES    4
+#define RECORD_DEVICE_FIELDS  8
+
+/** @brief One value in a device's register map: value = raw / scale. */
+struct RegisterField {
+  const char* name;
+  uint16_t reg;
+  uint16_t scale;
+  bool isSigned;
+};
+
+/**
+ * @brief What to read from one kind of Modbus device. Fields are sorted
+ * by register; a single read may span at most maxGap unused registers.
+ */
+struct RegisterMap {
+  const char* type;                // "zts3002", "weather"
+  const RegisterField* fields;
+  uint8_t fieldCount;              // at most RECORD_DEVICE_FIELDS
+  uint8_t maxGap;
+};
+
+/**
+ * @brief Latest values of one bus device. map points at a static table,
+ * so readings can be copied through queues.
+ */
+struct DeviceReading {
+  uint8_t address = 0;
+  const RegisterMap* map = nullptr;
+  uint8_t validFields = 0;         // bit i: raw[i] is from the latest read
+  uint32_t ageMs = 0;              // since the device was read
+  int32_t raw[RECORD_DEVICE_FIELDS] = {0};
+
+  bool allValid() const { return map && validFields == (uint8_t)((1u << map->fieldCount) - 1); }
+};
+
+/**
+ * @brief GPS position and UTC time as captured for one record.
+ */
+struct GpsFix {
+  bool valid = false;
+  float latitude = 0;
+  float longitude = 0;
+  float altitude = 0;
+  int satellites = 0;
+  double speedKmh = 0;
+  double hdop = 0;
+  int year = 0;
+  int month = 0;
+  int day = 0;
+  int hour = 0;
+  int minute = 0;
+  int second = 0;
+};
+
+/**
+ * @brief One logged sample: what ends up in farmland_<id>.json.
+ */
+struct SoilRecord {
+  uint32_t id = 0;
+  SensorData soil;                 // the primary probe
+  GpsFix fix;
+  uint8_t deviceCount = 0;         // 0 on a single-sensor bus
+  DeviceReading devices[RECORD_MAX_DEVICES];
+};
+
+#define RECORD_JSON_MAX 2048
+
+/**
+ * @brief Converts a UTC date/time to IST (UTC+5:30), handling day, month
+ * and year rollovers. Pure calendar arithmetic, no dependence on TZ.
+ */
+void utcToIst(int year, int month, int day, int hour, int minute,
+              int &ist_year, int &ist_month, int &ist_day, int &ist_hour, int &ist_minute);
+
+/** @brief Seconds since 1970-01-01 UTC for a fix's date/time; 0 without a fix. */
+uint32_t fixToUnixTime(const GpsFix &fix);
+/** @brief Inverse of fixToUnixTime(); fills only the date/time fields. */
+void unixTimeToFix(uint32_t seconds, GpsFix &fix);
+
+const char* phCategory(float ph);
+
+// Anomaly flags a record is indexed with (RecordStore), so a priority
+// transfer can send the records worth looking at first
+#define RECORD_PRIORITY_NO_READING   0x01   // the probe did not answer
+#define RECORD_PRIORITY_PH           0x02   // the "acidic" or "alkaline" category
+#define RECORD_PRIORITY_DRY          0x04   // moisture below RECORD_DRY_MOISTURE
+#define RECORD_PRIORITY_SALINE       0x08   // conductivity above RECORD_SALINE_EC
+#define RECORD_DRY_MOISTURE          10.0f  // %
+#define RECORD_SALINE_EC             4000   // uS/cm, the usual saline-soil line
+
+/** @brief RECORD_PRIORITY_* bits for a record; 0 if nothing stands out. */
+uint8_t recordPriority(const SoilRecord &record);
+
+/**
+ * @brief Serializes a record in the farmland_<id>.json schema, plus a
+ * "devices" array when it carries per-device readings.
+ * @return Bytes written (without terminator), 0 if out is too small
+ */
+size_t encodeRecordJson(const SoilRecord &record, char* out, size_t capacity);
+
+#endif
@@ -0,0 +1,330 @@
+#include "AgniRollup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ============================================================================
+// FIELDS
+// ============================================================================
+static const char* const FIELD_NAMES[ROLLUP_FIELDS] = {
+  "ph", "conductivity", "nitrogen", "phosphorus", "potassium", "moisture", "temperature"
+};
+static const int32_t FIELD_SCALES[ROLLUP_FIELDS] = {100, 1, 1, 1, 1, 10, 10};
+
+const char* rollupFieldName(int field) {
+  return field >= 0 && field < ROLLUP_FIELDS ? FIELD_NAMES[field] : "";
+}
+
+int32_t rollupFieldScale(int field) {
+  return field >= 0 && field < ROLLUP_FIELDS ? FIELD_SCALES[field] : 1;
+}
+
+int rollupFieldByName(const char* name, size_t length) {
+  for (int f = 0; f < ROLLUP_FIELDS; f++) {
+    if (strlen(FIELD_NAMES[f]) == length && strncmp(FIELD_NAMES[f], name, length) == 0) return f;
+  }
+  return -1;
+}
+
+/** @brief pH, EC, moisture and temperature come from the basic read, N/P/K from the NPK one. */
+static int32_t fieldFlag(int field) {
+  bool npk = field == ROLLUP_NITROGEN || field == ROLLUP_PHOSPHORUS || field == ROLLUP_POTASSIUM;
+  return npk ? ARCHIVE_FLAG_NPK : ARCHIVE_FLAG_BASIC;
+}
+
+// ============================================================================
+// QUERY
+// ============================================================================
+bool parseRollupQuery(const char* text, size_t length, RollupQuery &query) {
+  const size_t prefixLen = sizeof(ROLLUP_COMMAND) - 1;
+  if (length < prefixLen + 2 || strncmp(text, ROLLUP_COMMAND, prefixLen) != 0) return false;
+  const char* p = text + prefixLen;
+  const char* end = text + length;
+
+  if (*p == 'H') query.period = ROLLUP_HOUR;
+  else if (*p == 'D') query.period = ROLLUP_DAY;
+  else return false;
+  if (++p >= end || *p++ != '|') return false;
+
+  const char* bar = (const char*)memchr(p, '|', end - p);
+  if (!bar) return false;
+  query.field = rollupFieldByName(p, bar - p);
+  if (query.field < 0) return false;
+  p = bar + 1;
+
+  char number[12];
+  bar = (const char*)memchr(p, '|', end - p);
+  size_t n = (bar ? bar : end) - p;
+  if (n == 0 || n >= sizeof(number)) return false;
+  memcpy(number, p, n);
+  number[n] = '\0';
+  long count = strtol(number, NULL, 10);
+  if (count <= 0) return false;
+  query.count = count > ROLLUP_DAILY_SLOTS ? ROLLUP_DAILY_SLOTS : (uint16_t)count;
+
+  query.endKey = 0;
+  if (bar) {
+    p = bar + 1;
+    n = end - p;
+    if (n == 0 || n >= sizeof(number)) return false;
+    memcpy(number, p, n);
+    number[n] = '\0';
+    query.endKey = (uint32_t)strtoul(number, NULL, 10);
+  }
+  return true;
+}
+
+// ============================================================================
+// STORE
+// ============================================================================
+static const char* periodPath(RollupPeriod period) {
+  return period == ROLLUP_HOUR ? ROLLUP_HOURLY_FILE : ROLLUP_DAILY_FILE;
+}
+
+uint16_t RollupStore::slots(RollupPeriod period) {
+  return period == ROLLUP_HOUR ? ROLLUP_HOURLY_SLOTS : ROLLUP_DAILY_SLOTS;
+}
+
+uint32_t RollupStore::keyFor(RollupPeriod period, uint32_t unixTime) const {
+  uint32_t local = unixTime + (uint32_t)offset;
+  return period == ROLLUP_HOUR ? local / 3600 : local / 86400;
+}
+
+static bool readBucketAt(HalFile &file, RollupPeriod period, uint32_t key, RollupBucket &out) {
+  uint32_t position = (key % RollupStore::slots(period)) * sizeof(RollupBucket);
+  if (!file.seek(position) || file.read((uint8_t*)&out, sizeof(out)) != sizeof(out)) return false;
+  return out.key == key;
+}
+
+bool RollupStore::resetRing(RollupPeriod period) {
+  std::unique_ptr<HalFile> file = fs.open(periodPath(period), HAL_FILE_WRITE);
+  if (!file) return false;
+  RollupBucket empty;
+  memset(&empty, 0, sizeof(empty));
+  for (uint16_t i = 0; i < slots(period); i++) {
+    if (file->write((const uint8_t*)&empty, sizeof(empty)) != sizeof(empty)) {
+      file->close();
+      return false;
+    }
+  }
+  file->close();
+  return true;
+}
+
+bool RollupStore::begin() {
+  for (int p = 0; p < ROLLUP_PERIODS; p++) {
+    memset(&current[p], 0, sizeof(current[p]));
+    newest[p] = 0;
+  }
+  emptyOnBegin = false;
+  if (!fs.exists(ROLLUP_DIR) && !fs.mkdir(ROLLUP_DIR)) return false;
+
+  for (int p = 0; p < ROLLUP_PERIODS; p++) {
+    RollupPeriod period = (RollupPeriod)p;
+    const uint32_t expected = slots(period) * sizeof(RollupBucket);
+    std::unique_ptr<HalFile> file = fs.open(periodPath(period), HAL_FILE_READ);
+    bool intact = file && file->size() == expected;
+
+    // A missing or truncated ring starts over empty
+    if (!intact) {
+      if (file) file->close();
+      if (!resetRing(period)) return false;
+      emptyOnBegin = true;
+      continue;
+    }
+
+    RollupBucket bucket;
+    while (file->read((uint8_t*)&bucket, sizeof(bucket)) == sizeof(bucket)) {
+      if (bucket.key > newest[p]) newest[p] = bucket.key;
+    }
+    file->close();
+  }
+  return true;
+}
+
+bool RollupStore::readSlot(RollupPeriod period, uint32_t key, RollupBucket &out) {
+  std::unique_ptr<HalFile> file = fs.open(periodPath(period), HAL_FILE_READ);
+  if (!file) return false;
+  bool found = readBucketAt(*file, period, key, out);
+  file->close();
+  return found;
+}
+
+bool RollupStore::writeSlot(RollupPeriod period, const RollupBucket &bucket) {
+  std::unique_ptr<HalFile> file = fs.open(periodPath(period), HAL_FILE_UPDATE);
+  uint32_t position = (bucket.key % slots(period)) * sizeof(RollupBucket);
+  bool ok = file && file->seek(position) &&
+            file->write((const uint8_t*)&bucket, sizeof(bucket)) == sizeof(bucket);
+  if (file) file->close();
+  return ok;
+}
+
+bool RollupStore::add(const ArchiveSample &sample) {
+  uint32_t time = (uint32_t)sample.values[ARCHIVE_TIME];
+  if (time == 0) {
+    counters.untimed++;
+    return false;
+  }
+  uint64_t startUs = clock.micros();
+  bool ok = true;
+  for (int p = 0; p < ROLLUP_PERIODS; p++) {
+    RollupPeriod period = (RollupPeriod)p;
+    uint32_t key = keyFor(period, time);
+    // Its slot already belongs to a newer bucket
+    if (key + slots(period) <= newest[p]) {
+      counters.stale++;
+      continue;
+    }
+    RollupBucket &bucket = current[p];
+    if (bucket.key != key && !readSlot(period, key, bucket)) {
+      memset(&bucket, 0, sizeof(bucket));
+      bucket.key = key;
+    }
+    for (int f = 0; f < ROLLUP_FIELDS; f++) {
+      if (sample.values[ARCHIVE_FLAGS] & fieldFlag(f)) {
+        kernelAccumulate(bucket.fields[f], sample.values[ROLLUP_FIRST_COLUMN + f]);
+      }
+    }
+    if (!writeSlot(period, bucket)) {
+      counters.writeFailures++;
+      bucket.key = 0;   // reload from the card next time
+      ok = false;
+      continue;
+    }
+    if (key > newest[p]) newest[p] = key;
+  }
+  counters.samples++;
+  counters.updateUs.record((uint32_t)(clock.micros() - startUs));
+  return ok;
+}
+
+/**
+ * @brief Folds a block into the buckets, one run of equal keys at a time.
+ * A bucket is written when the run moves on to the next key.
+ */
+size_t RollupStore::foldColumns(const ArchiveColumns &columns, bool dirty[ROLLUP_PERIODS], bool &ok) {
+  const int32_t* times = columns.values[ARCHIVE_TIME];
+  const int32_t* flags = columns.values[ARCHIVE_FLAGS];
+  int32_t selected[ARCHIVE_BLOCK_SAMPLES];
+  size_t folded = 0;
+
+  for (int p = 0; p < ROLLUP_PERIODS; p++) {
+    RollupPeriod period = (RollupPeriod)p;
+    size_t i = 0;
+    while (i < columns.count) {
+      if (times[i] == 0) {
+        if (p == 0) counters.untimed++;
+        i++;
+        continue;
+      }
+      uint32_t key = keyFor(period, (uint32_t)times[i]);
+      size_t end = i + 1;
+      while (end < columns.count && times[end] != 0 && keyFor(period, (uint32_t)times[end]) == key) end++;
+      if (p == 0) folded += end - i;
+
+      if (key + slots(period) <= newest[p]) {
+        counters.stale++;
+        i = end;
+        continue;
+      }
+      RollupBucket &bucket = current[p];
+      if (bucket.key != key) {
+        if (dirty[p] && !writeSlot(period, bucket)) ok = false;
+        if (!readSlot(period, key, bucket)) {
+          memset(&bucket, 0, sizeof(bucket));
+          bucket.key = key;
+        }
+      }
+      for (int f = 0; f < ROLLUP_FIELDS; f++) {
+        const int32_t* values = columns.values[ROLLUP_FIRST_COLUMN + f];
+        size_t n = kernelSelect(values + i, flags + i, fieldFlag(f), end - i, selected);
+        KernelMoments moments;
+        kernelMoments(selected, n, moments);
+        kernelMerge(bucket.fields[f], moments);
+      }
+      dirty[p] = true;
+      if (key > newest[p]) newest[p] = key;
+      i = end;
+    }
+  }
+  return folded;
+}
+
+long RollupStore::rebuild(const ArchiveWriter &archive) {
+  uint64_t startUs = clock.micros();
+  for (int p = 0; p < ROLLUP_PERIODS; p++) {
+    if (!resetRing((RollupPeriod)p)) return -1;
+    memset(&current[p], 0, sizeof(current[p]));
+    newest[p] = 0;
+  }
+
+  // Column buffers are too big for a task stack
+  std::unique_ptr<ArchiveColumns> columns(new ArchiveColumns());
+  bool dirty[ROLLUP_PERIODS] = {false, false};
+  bool ok = true;
+  long samples = 0;
+  for (uint32_t number = 1; number < archive.nextBlockNumber(); number++) {
+    // Blocks removed by a retention sweep are simply skipped
+    if (ArchiveWriter::loadBlock(fs, number, *columns) == 0) continue;
+    samples += foldColumns(*columns, dirty, ok);
+  }
+
+  // The samples not sealed yet, transposed into the same shape
+  columns->count = archive.staged();
+  for (size_t i = 0; i < columns->count; i++) {
+    for (int c = 0; c < ARCHIVE_COLUMNS; c++) columns->values[c][i] = archive.stagedSamples()[i].values[c];
+  }
+  samples += foldColumns(*columns, dirty, ok);
+
+  for (int p = 0; p < ROLLUP_PERIODS; p++) {
+    if (dirty[p] && !writeSlot((RollupPeriod)p, current[p])) ok = false;
+  }
+  counters.rebuilds++;
+  counters.rebuildUs.record((uint32_t)(clock.micros() - startUs));
+  if (!ok) {
+    counters.writeFailures++;
+    return -1;
+  }
+  return samples;
+}
+
+bool RollupStore::bucket(RollupPeriod period, uint32_t key, RollupBucket &out) {
+  if (key == 0) return false;
+  if (current[period].key == key) {
+    out = current[period];
+    return true;
+  }
+  return readSlot(period, key, out);
+}
+
+size_t RollupStore::formatResponse(const RollupQuery &query, char* out, size_t capacity) {
+  int n = snprintf(out, capacity, ROLLUP_COMMAND "%c|%s|%ld|", query.period == ROLLUP_HOUR ? 'H' : 'D',
+                   rollupFieldName(query.field), (long)rollupFieldScale(query.field));
+  if (n < 0 || (size_t)n >= capacity) return 0;
+  size_t length = n;
+
+  uint32_t end = query.endKey ? query.endKey : newest[query.period];
+  std::unique_ptr<HalFile> file = fs.open(periodPath(query.period), HAL_FILE_READ);
+  bool first = true;
+  for (uint16_t i = 0; file && i < query.count && i < slots(query.period) && end > i; i++) {
+    uint32_t key = end - i;
+    RollupBucket b;
+    bool found = true;
+    if (current[query.period].key == key) b = current[query.period];
+    else found = readBucketAt(*file, query.period, key, b);
+    if (!found || b.fields[query.field].count == 0) continue;
+    const RollupAccumulator &acc = b.fields[query.field];
+    char entry[96];
+    int e = snprintf(entry, sizeof(entry), "%s%lu:%lu,%ld,%ld,%lld,%llu", first ? "" : ";", (unsigned long)key,
+                     (unsigned long)acc.count, (long)acc.minimum, (long)acc.maximum, (long long)acc.sum,
+                     (unsigned long long)acc.sumSquares);
+    // Whole buckets only; the oldest ones are dropped when it doesn't fit
+    if (e < 0 || length + e >= capacity) break;
+    memcpy(out + length, entry, e + 1);
+    length += e;
+    first = false;
+  }
+  if (file) file->close();
+  return length;
+}
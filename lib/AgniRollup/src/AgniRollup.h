@@ -0,0 +1,160 @@
+#ifndef AGNI_ROLLUP_H
+#define AGNI_ROLLUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniHal.h>
+#include <AgniMetrics.h>
+#include <AgniArchive.h>
+#include <AgniKernels.h>
+
+// ============================================================================
+// ROLLUP INDEX
+// ============================================================================
+// Hourly and daily summaries (count, min, max, sum, sum of squares per
+// field) kept up to date on every logged sample, so trends never need a
+// bulk transfer. Each period is a fixed ring of RollupBucket slots on the
+// card, slot = key % slots, written raw:
+//
+//   /rollup/hourly.bin   ROLLUP_HOURLY_SLOTS buckets (one week)
+//   /rollup/daily.bin    ROLLUP_DAILY_SLOTS buckets (one year)
+//
+// A key is hours (or days) since the epoch in local time (unix seconds +
+// the store's offset), 0 = empty slot. Values are the archive's fixed
+// point (ArchiveSample), so min/max/sum are exact and buckets merge by
+// simple addition. An update touches two slots: O(1) per sample.
+//
+// Over BLE the phone asks for one field at a time:
+//
+//   ROLLUP:<H|D>|<field>|<count>[|<end key>]   e.g. ROLLUP:D|moisture|7
+//
+// and gets one text response, newest bucket first, empty buckets skipped:
+//
+//   ROLLUP:D|moisture|10|<key>:<n>,<min>,<max>,<sum>,<sum sq>;...
+//
+// where 10 is the field's fixed-point scale. The end key defaults to the
+// newest bucket seen.
+//
+// rebuild() recomputes both rings from the archive blocks (after a
+// retention sweep, a card import or lost ring files): whole columns go
+// through the AgniKernels batch kernels and each bucket is written once.
+
+#define ROLLUP_DIR            "/rollup"
+#define ROLLUP_HOURLY_FILE    ROLLUP_DIR "/hourly.bin"
+#define ROLLUP_DAILY_FILE     ROLLUP_DIR "/daily.bin"
+#define ROLLUP_HOURLY_SLOTS   168
+#define ROLLUP_DAILY_SLOTS    366
+#define ROLLUP_COMMAND        "ROLLUP:"
+#define ROLLUP_RESPONSE_MAX   512
+
+enum RollupPeriod {
+  ROLLUP_HOUR,
+  ROLLUP_DAY,
+  ROLLUP_PERIODS
+};
+
+// The soil columns of ArchiveSample, in the same order
+enum RollupField {
+  ROLLUP_PH,
+  ROLLUP_CONDUCTIVITY,
+  ROLLUP_NITROGEN,
+  ROLLUP_PHOSPHORUS,
+  ROLLUP_POTASSIUM,
+  ROLLUP_MOISTURE,
+  ROLLUP_TEMPERATURE,
+  ROLLUP_FIELDS
+};
+
+#define ROLLUP_FIRST_COLUMN ARCHIVE_PH
+
+typedef KernelMoments RollupAccumulator;
+
+struct RollupBucket {
+  uint32_t key;
+  RollupAccumulator fields[ROLLUP_FIELDS];
+};
+
+/** @brief Query name ("ph", "moisture", ...) and fixed-point scale of a field. */
+const char* rollupFieldName(int field);
+int32_t rollupFieldScale(int field);
+/** @brief -1 for an unknown name. */
+int rollupFieldByName(const char* name, size_t length);
+
+struct RollupQuery {
+  RollupPeriod period = ROLLUP_DAY;
+  int field = ROLLUP_PH;
+  uint16_t count = 0;
+  uint32_t endKey = 0;      // 0 = newest
+};
+
+/** @brief Parses "ROLLUP:<H|D>|<field>|<count>[|<end key>]". */
+bool parseRollupQuery(const char* text, size_t length, RollupQuery &query);
+
+struct RollupStats {
+  uint32_t samples = 0;
+  uint32_t untimed = 0;          // no GPS time yet, not bucketed
+  uint32_t stale = 0;            // older than the ring, dropped for that period
+  uint32_t writeFailures = 0;
+  uint32_t rebuilds = 0;
+  LatencyHistogram updateUs;     // both periods, including the slot writes
+  LatencyHistogram rebuildUs;
+};
+
+class RollupStore {
+public:
+  /**
+   * @param offsetSeconds added to unix time before bucketing, e.g. 19800
+   *        so days and hours follow IST
+   */
+  RollupStore(HalFileSystem &fs, HalClock &clock, int32_t offsetSeconds = 0)
+    : fs(fs), clock(clock), offset(offsetSeconds) {}
+
+  /** @brief Creates the ring files if needed and finds the newest keys. */
+  bool begin();
+  /** @brief True if begin() had to create empty rings (nothing to resume). */
+  bool startedEmpty() const { return emptyOnBegin; }
+
+  /**
+   * @brief Folds one sample into its hour and day.
+   * @return false if it has no timestamp or a slot write failed
+   */
+  bool add(const ArchiveSample &sample);
+
+  /**
+   * @brief Replaces both rings with buckets recomputed from every sealed
+   * block plus the samples still staged.
+   * @return samples folded in, or -1 if a ring could not be written
+   */
+  long rebuild(const ArchiveWriter &archive);
+
+  /** @brief Reads one bucket; false if the slot holds another key or nothing. */
+  bool bucket(RollupPeriod period, uint32_t key, RollupBucket &out);
+
+  uint32_t newestKey(RollupPeriod period) const { return newest[period]; }
+  uint32_t keyFor(RollupPeriod period, uint32_t unixTime) const;
+  static uint16_t slots(RollupPeriod period);
+
+  /**
+   * @brief Formats the response to a query (see the header comment).
+   * @return length, 0 if out cannot hold even the prefix
+   */
+  size_t formatResponse(const RollupQuery &query, char* out, size_t capacity);
+
+  const RollupStats &stats() const { return counters; }
+
+private:
+  bool readSlot(RollupPeriod period, uint32_t key, RollupBucket &out);
+  bool writeSlot(RollupPeriod period, const RollupBucket &bucket);
+  bool resetRing(RollupPeriod period);
+  size_t foldColumns(const ArchiveColumns &columns, bool dirty[ROLLUP_PERIODS], bool &ok);
+
+  HalFileSystem &fs;
+  HalClock &clock;
+  int32_t offset;
+  RollupBucket current[ROLLUP_PERIODS];   // the bucket each period last wrote
+  uint32_t newest[ROLLUP_PERIODS] = {0, 0};
+  bool emptyOnBegin = false;
+  RollupStats counters;
+};
+
+#endif
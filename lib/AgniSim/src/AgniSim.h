@@ -0,0 +1,351 @@
+#ifndef AGNI_SIM_H
+#define AGNI_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include <AgniHal.h>
+#include <AgniProtocol.h>
+#include <AgniRecord.h>
+
+// ============================================================================
+// SIMULATED PERIPHERALS (native build only)
+// ============================================================================
+// Host implementations of the AgniHal interfaces. Everything runs on a
+// virtual clock so a run is deterministic for a given seed and finishes as
+// fast as the host can compute it; the timing the firmware would see on
+// the wire is still modelled (UART byte time, sensor turnaround, BLE
+// connection events).
+
+/**
+ * @brief Virtual time. sleepMs() advances the clock instead of sleeping.
+ */
+class SimClock : public HalClock {
+public:
+  uint32_t millis() override { return (uint32_t)(nowUs / 1000); }
+  uint64_t micros() override { return nowUs; }
+  void sleepMs(uint32_t ms) override { nowUs += (uint64_t)ms * 1000; }
+
+  void advanceUs(uint64_t us) { nowUs += us; }
+  /** @brief Moves the clock forward to t (never backwards). */
+  void advanceTo(uint64_t us) { if (us > nowUs) nowUs = us; }
+
+private:
+  uint64_t nowUs = 0;
+};
+
+/**
+ * @brief Wall-clock time on the host, for timing the code itself rather
+ * than the simulated wire.
+ */
+class HostClock : public HalClock {
+public:
+  HostClock();
+  uint32_t millis() override { return (uint32_t)(micros() / 1000); }
+  uint64_t micros() override;
+  void sleepMs(uint32_t ms) override;
+
+private:
+  uint64_t originNs;
+};
+
+// ----------------------------------------------------------------------------
+// SD card
+// ----------------------------------------------------------------------------
+/**
+ * @brief Maps the card onto a host directory: "/farmland_data/x" becomes
+ * "<root>/farmland_data/x". totalBytes() is a configurable card size.
+ */
+class HostFileSystem : public HalFileSystem {
+public:
+  explicit HostFileSystem(const std::string &rootDir, uint64_t cardBytes = 8ULL * 1024 * 1024 * 1024);
+
+  std::unique_ptr<HalFile> open(const char* path, HalFileMode mode) override;
+  std::unique_ptr<HalDir> openDir(const char* path) override;
+  bool exists(const char* path) override;
+  bool mkdir(const char* path) override;
+  bool remove(const char* path) override;
+  bool rmdir(const char* path) override;
+  uint64_t totalBytes() override { return cardBytes; }
+  uint64_t usedBytes() override;
+
+  const std::string &root() const { return rootDir; }
+
+private:
+  std::string hostPath(const char* path) const;
+
+  std::string rootDir;
+  uint64_t cardBytes;
+};
+
+// ----------------------------------------------------------------------------
+// NVS
+// ----------------------------------------------------------------------------
+/**
+ * @brief One file per key in a host directory, standing in for the NVS
+ * partition (which survives a card wipe, so keep it outside the card).
+ */
+class HostKeyValueStore : public HalKeyValueStore {
+public:
+  explicit HostKeyValueStore(const std::string &dir);
+  size_t read(const char* key, uint8_t* buffer, size_t capacity) override;
+  bool write(const char* key, const uint8_t* data, size_t length) override;
+  bool erase(const char* key) override;
+
+private:
+  std::string dir;
+};
+
+// ----------------------------------------------------------------------------
+// RS485: scripted ZTS-3002 soil sensor
+// ----------------------------------------------------------------------------
+struct SimModbusConfig {
+  uint8_t address = 1;
+  uint32_t turnaroundUs = 20000;   // request end -> first response byte
+  double noResponseRate = 0;       // 0..1, sensor stays silent
+  double crcErrorRate = 0;         // 0..1, one response byte is corrupted
+  double shortFrameRate = 0;       // 0..1, response is cut off mid-frame
+  uint32_t seed = 1;
+  uint32_t lineBaud = 4800;        // rate the sensor is programmed to at power-up
+  uint32_t maxBaud = 9600;         // fastest REG_BAUD_RATE setting it accepts
+  bool baudNeedsRestart = false;   // a new rate only applies after powerCycle()
+};
+
+struct SimModbusSlaveStats {
+  uint32_t requests = 0;
+  uint32_t responses = 0;
+  uint32_t injectedNoResponse = 0;
+  uint32_t injectedCrcErrors = 0;
+  uint32_t injectedShortFrames = 0;
+  uint32_t garbled = 0;            // sent at a rate the sensor is not listening at
+  uint32_t baudWrites = 0;
+};
+
+/**
+ * @brief HalSerialPort with a ZTS-3002 on the other end of the bus.
+ *
+ * Answers function 0x03 for its address from a 16-register table plus
+ * REG_BAUD_RATE, and function 0x06 on REG_BAUD_RATE (exception 3 above
+ * maxBaud). The response becomes readable byte by byte at the configured
+ * baud rate after the turnaround delay, measured on the SimClock. Frames
+ * sent at another rate than the sensor's are lost, as on a real bus.
+ */
+class SimModbusSlave : public HalSerialPort {
+public:
+  SimModbusSlave(SimClock &clock, const SimModbusConfig &config);
+
+  void begin(uint32_t baud) override;
+  void end() override { rx.clear(); }
+  uint32_t baud() override { return baudRate; }
+  int available() override;
+  int read() override;
+  size_t write(const uint8_t* data, size_t length) override;
+  void flush() override { clock.advanceTo(txDoneUs); }
+  void setTransmit(bool enable) override { transmitting = enable; }
+
+  /** @brief Raw register value, same scaling as the real sensor. */
+  void setRegister(uint16_t reg, uint16_t value);
+  /** @brief Convenience: writes all seven measurement registers. */
+  void setReading(const SensorData &reading);
+  void setConfig(const SimModbusConfig &config);
+  /** @brief Applies a REG_BAUD_RATE write that was waiting for a restart. */
+  void powerCycle();
+  /** @brief Rate the sensor currently listens and answers at. */
+  uint32_t sensorBaud() const { return lineBaud; }
+  uint8_t address() const { return config.address; }
+  const SimModbusSlaveStats &stats() const { return counters; }
+
+  /** @brief When the first queued response byte is readable, UINT64_MAX if none. */
+  uint64_t nextReadyUs() const { return rx.empty() ? UINT64_MAX : rx.front().readyUs; }
+  /** @brief When the last byte of the latest response is on the wire. */
+  uint64_t responseEndUs() const { return lastResponseUs; }
+
+  /** @brief Wire time of one 8N1 character in microseconds. */
+  uint32_t byteTimeUs() const { return 10000000UL / baudRate; }
+
+private:
+  struct TimedByte {
+    uint64_t readyUs;
+    uint8_t value;
+  };
+
+  void respond(const uint8_t* frame, size_t length, uint64_t requestEndUs);
+  void queueResponse(uint8_t* response, size_t length, uint64_t requestEndUs, bool injectFaults);
+  bool chance(double rate);
+
+  SimClock &clock;
+  SimModbusConfig config;
+  SimModbusSlaveStats counters;
+  std::mt19937 rng;
+  uint16_t registers[16];
+  uint32_t baudRate = 4800;
+  uint32_t lineBaud;
+  uint16_t baudCode;               // REG_BAUD_RATE as last written
+  bool transmitting = false;
+  uint64_t txDoneUs = 0;
+  uint64_t lastResponseUs = 0;
+  std::vector<uint8_t> request;
+  std::deque<TimedByte> rx;
+};
+
+struct SimModbusBusStats {
+  uint32_t requests = 0;
+  uint32_t gapViolations = 0;      // request started inside the 3.5 character gap
+};
+
+/**
+ * @brief Several SimModbusSlaves on one RS485 line (multi-drop). Every
+ * request reaches every slave; only the addressed one answers. A request
+ * that starts before the previous frame's inter-frame gap has passed is
+ * lost, as real slaves would read it as the tail of that frame.
+ */
+class SimModbusBus : public HalSerialPort {
+public:
+  explicit SimModbusBus(SimClock &clock) : clock(clock) {}
+
+  void attach(SimModbusSlave &slave) { slaves.push_back(&slave); }
+
+  void begin(uint32_t baud) override;
+  void end() override;
+  uint32_t baud() override { return baudRate; }
+  int available() override;
+  int read() override;
+  size_t write(const uint8_t* data, size_t length) override;
+  void flush() override;
+  void setTransmit(bool enable) override;
+
+  const SimModbusBusStats &stats() const { return counters; }
+
+private:
+  SimClock &clock;
+  std::vector<SimModbusSlave*> slaves;
+  uint32_t baudRate = 4800;
+  bool transmitting = false;
+  uint64_t lastRequestEndUs = 0;
+  SimModbusBusStats counters;
+};
+
+// ----------------------------------------------------------------------------
+// GPS: NMEA replay
+// ----------------------------------------------------------------------------
+/**
+ * @brief HalSerialPort that replays an NMEA log at the configured baud
+ * rate, starting when begin() is called. Loops back to the start at EOF.
+ */
+class NmeaReplayPort : public HalSerialPort {
+public:
+  NmeaReplayPort(SimClock &clock, const std::string &path);
+
+  /** @brief False if the file could not be read or is empty. */
+  bool loaded() const { return !data.empty(); }
+
+  void begin(uint32_t baud) override;
+  void end() override { started = false; }
+  uint32_t baud() override { return baudRate; }
+  int available() override;
+  int read() override;
+  size_t write(const uint8_t* buf, size_t length) override { (void)buf; return length; }
+  void flush() override {}
+
+private:
+  uint64_t bytesArrived();
+
+  SimClock &clock;
+  std::vector<uint8_t> data;
+  uint32_t baudRate = 9600;
+  bool started = false;
+  uint64_t startUs = 0;
+  uint64_t consumed = 0;
+};
+
+/**
+ * @brief Minimal GGA/RMC decoder for the host build (TinyGPSPlus stays on
+ * the device). Fills the same GpsFix the record encoder consumes.
+ */
+class NmeaParser {
+public:
+  /** @brief Feeds one character. @return true when a sentence updated the fix. */
+  bool encode(char c);
+
+  const GpsFix &fix() const { return current; }
+  uint32_t passedChecksum() const { return passed; }
+  uint32_t failedChecksum() const { return failed; }
+
+private:
+  bool parseSentence();
+
+  char sentence[96];
+  size_t length = 0;
+  bool collecting = false;
+  GpsFix current;
+  uint32_t passed = 0;
+  uint32_t failed = 0;
+};
+
+// ----------------------------------------------------------------------------
+// BLE: notification sink with link-layer limits
+// ----------------------------------------------------------------------------
+struct SimBleConfig {
+  uint16_t mtu = 247;                  // negotiated ATT MTU
+  uint32_t connectionIntervalUs = 30000;
+  uint8_t packetsPerEvent = 4;         // notifications the link drains per connection event
+  uint16_t queueDepth = 12;            // controller buffers before notify() reports congestion
+  double dataLossRate = 0;             // 0..1, a sequenced data chunk never reaches the phone
+  uint32_t seed = 1;
+};
+
+struct SimBleStats {
+  uint32_t notifications = 0;
+  uint32_t rejected = 0;      // queue full, caller retried later
+  uint32_t truncated = 0;     // payload larger than MTU - 3, cut like the stack does
+  uint32_t lost = 0;          // dropped by dataLossRate after leaving the queue
+  uint64_t bytes = 0;
+  uint64_t lastDeliveryUs = 0;
+};
+
+/**
+ * @brief HalNotifySink that delivers at most packetsPerEvent notifications
+ * per connection interval. Delivered payloads can be written to a capture
+ * file as <u16 length LE><payload> records for the receiver tools.
+ * dataLossRate only hits version 2 data chunks (PROTO_DATA_MARKER), the
+ * case selective retransmission repairs; lost chunks are not captured.
+ */
+class SimBleSink : public HalNotifySink {
+public:
+  SimBleSink(SimClock &clock, const SimBleConfig &config);
+  ~SimBleSink();
+
+  size_t maxPayload() override { return config.mtu - 3; }
+  bool notify(const uint8_t* data, size_t length) override;
+  bool connected() override { return linkUp; }
+
+  void setConnected(bool up) { linkUp = up; }
+  bool openCapture(const std::string &path);
+  /** @brief Advances the clock until every queued notification is delivered. */
+  void drain();
+  /** @brief Hook for the device->phone direction, called per delivered payload. */
+  void setReceiver(void (*callback)(const uint8_t* data, size_t length, void* context), void* context);
+
+  const SimBleConfig &settings() const { return config; }
+  const SimBleStats &stats() const { return counters; }
+
+private:
+  void deliverDue();
+
+  SimClock &clock;
+  SimBleConfig config;
+  SimBleStats counters;
+  bool linkUp = true;
+  uint64_t nextEventUs = 0;
+  std::deque<std::vector<uint8_t> > queue;
+  FILE* capture = nullptr;
+  void (*receiver)(const uint8_t*, size_t, void*) = nullptr;
+  void* receiverContext = nullptr;
+  std::mt19937 rng;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "AgniSim.h"
+
+// ============================================================================
+// BLE NOTIFICATION SINK
+// ============================================================================
+SimBleSink::SimBleSink(SimClock &clock, const SimBleConfig &config)
+  : clock(clock), config(config), rng(config.seed) {
+  if (this->config.mtu < 23) this->config.mtu = 23;
+  if (this->config.packetsPerEvent == 0) this->config.packetsPerEvent = 1;
+  if (this->config.queueDepth == 0) this->config.queueDepth = 1;
+}
+
+SimBleSink::~SimBleSink() {
+  if (capture) fclose(capture);
+}
+
+bool SimBleSink::openCapture(const std::string &path) {
+  if (capture) fclose(capture);
+  capture = fopen(path.c_str(), "wb");
+  return capture != nullptr;
+}
+
+void SimBleSink::setReceiver(void (*callback)(const uint8_t*, size_t, void*), void* context) {
+  receiver = callback;
+  receiverContext = context;
+}
+
+/**
+ * @brief Empties the controller queue for every connection event that has
+ * passed since the last call.
+ */
+void SimBleSink::deliverDue() {
+  uint64_t now = clock.micros();
+  while (nextEventUs <= now) {
+    for (uint8_t i = 0; i < config.packetsPerEvent && !queue.empty(); i++) {
+      const std::vector<uint8_t> &payload = queue.front();
+      bool dataChunk = payload.size() > PROTO_DATA_HEADER && payload[0] == PROTO_DATA_MARKER;
+      if (dataChunk && config.dataLossRate > 0 &&
+          std::uniform_real_distribution<double>(0.0, 1.0)(rng) < config.dataLossRate) {
+        counters.lost++;
+        queue.pop_front();
+        continue;
+      }
+      counters.notifications++;
+      counters.bytes += payload.size();
+      counters.lastDeliveryUs = nextEventUs;
+      if (capture) {
+        uint8_t header[2] = {(uint8_t)(payload.size() & 0xFF), (uint8_t)(payload.size() >> 8)};
+        fwrite(header, 1, 2, capture);
+        fwrite(payload.data(), 1, payload.size(), capture);
+      }
+      if (receiver) receiver(payload.data(), payload.size(), receiverContext);
+      queue.pop_front();
+    }
+    if (queue.empty()) {
+      // Idle link: next event is the next interval boundary after now
+      uint64_t missed = (now - nextEventUs) / config.connectionIntervalUs + 1;
+      nextEventUs += missed * config.connectionIntervalUs;
+      break;
+    }
+    nextEventUs += config.connectionIntervalUs;
+  }
+}
+
+bool SimBleSink::notify(const uint8_t* data, size_t length) {
+  if (!linkUp) return false;
+  deliverDue();
+  if (queue.size() >= config.queueDepth) {
+    counters.rejected++;
+    return false;
+  }
+  if (length > maxPayload()) {
+    counters.truncated++;
+    length = maxPayload();
+  }
+  queue.push_back(std::vector<uint8_t>(data, data + length));
+  return true;
+}
+
+void SimBleSink::drain() {
+  while (!queue.empty()) {
+    clock.advanceTo(nextEventUs);
+    deliverDue();
+  }
+}
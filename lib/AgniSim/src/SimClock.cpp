@@ -0,0 +1,21 @@
+#include "AgniSim.h"
+#include <chrono>
+#include <thread>
+
+// ============================================================================
+// HOST WALL CLOCK
+// ============================================================================
+static uint64_t steadyNowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+HostClock::HostClock() : originNs(steadyNowNs()) {}
+
+uint64_t HostClock::micros() {
+  return (steadyNowNs() - originNs) / 1000;
+}
+
+void HostClock::sleepMs(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
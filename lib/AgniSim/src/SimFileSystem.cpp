@@ -0,0 +1,190 @@
+#include "AgniSim.h"
+#include <string.h>
+#include <filesystem>
+#include <system_error>
+
+namespace stdfs = std::filesystem;
+
+// ============================================================================
+// HOST DIRECTORY AS SD CARD
+// ============================================================================
+namespace {
+
+class HostFile : public HalFile {
+public:
+  explicit HostFile(FILE* handle) : handle(handle) {}
+  ~HostFile() override { close(); }
+
+  size_t read(uint8_t* buffer, size_t length) override {
+    return handle ? fread(buffer, 1, length, handle) : 0;
+  }
+  size_t write(const uint8_t* data, size_t length) override {
+    return handle ? fwrite(data, 1, length, handle) : 0;
+  }
+  bool seek(uint32_t position) override {
+    return handle && fseek(handle, (long)position, SEEK_SET) == 0;
+  }
+  uint32_t position() override {
+    return handle ? (uint32_t)ftell(handle) : 0;
+  }
+  uint32_t size() override {
+    if (!handle) return 0;
+    long here = ftell(handle);
+    fseek(handle, 0, SEEK_END);
+    long end = ftell(handle);
+    fseek(handle, here, SEEK_SET);
+    return (uint32_t)end;
+  }
+  void close() override {
+    if (handle) {
+      fclose(handle);
+      handle = nullptr;
+    }
+  }
+
+private:
+  FILE* handle;
+};
+
+class HostDir : public HalDir {
+public:
+  explicit HostDir(const stdfs::path &path) {
+    std::error_code ec;
+    it = stdfs::directory_iterator(path, ec);
+  }
+
+  bool next(HalDirEntry &entry) override {
+    std::error_code ec;
+    while (it != stdfs::directory_iterator()) {
+      const stdfs::directory_entry &dirEntry = *it;
+      std::string name = dirEntry.path().filename().string();
+      bool isDirectory = dirEntry.is_directory(ec);
+      uint32_t size = isDirectory ? 0 : (uint32_t)dirEntry.file_size(ec);
+      it.increment(ec);
+      if (name.size() >= sizeof(entry.name)) continue;   // FAT LFN limit on the card side
+      memcpy(entry.name, name.c_str(), name.size() + 1);
+      entry.size = size;
+      entry.isDirectory = isDirectory;
+      return true;
+    }
+    return false;
+  }
+  void close() override { it = stdfs::directory_iterator(); }
+
+private:
+  stdfs::directory_iterator it;
+};
+
+}  // namespace
+
+HostFileSystem::HostFileSystem(const std::string &rootDir, uint64_t cardBytes)
+  : rootDir(rootDir), cardBytes(cardBytes) {
+  std::error_code ec;
+  stdfs::create_directories(rootDir, ec);
+}
+
+std::string HostFileSystem::hostPath(const char* path) const {
+  std::string full = rootDir;
+  if (path[0] != '/') full += '/';
+  full += path;
+  return full;
+}
+
+std::unique_ptr<HalFile> HostFileSystem::open(const char* path, HalFileMode mode) {
+  const char* fopenMode = mode == HAL_FILE_READ ? "rb" : (mode == HAL_FILE_WRITE ? "wb" : "ab");
+  std::string full = hostPath(path);
+  std::error_code ec;
+  if (stdfs::is_directory(full, ec)) return nullptr;
+  if (mode == HAL_FILE_UPDATE) {
+    // "r+b" needs the file to exist
+    if (!stdfs::exists(full, ec)) {
+      FILE* created = fopen(full.c_str(), "wb");
+      if (!created) return nullptr;
+      fclose(created);
+    }
+    fopenMode = "r+b";
+  }
+  FILE* handle = fopen(full.c_str(), fopenMode);
+  if (!handle) return nullptr;
+  return std::unique_ptr<HalFile>(new HostFile(handle));
+}
+
+std::unique_ptr<HalDir> HostFileSystem::openDir(const char* path) {
+  std::string full = hostPath(path);
+  std::error_code ec;
+  if (!stdfs::is_directory(full, ec)) return nullptr;
+  return std::unique_ptr<HalDir>(new HostDir(full));
+}
+
+bool HostFileSystem::exists(const char* path) {
+  std::error_code ec;
+  return stdfs::exists(hostPath(path), ec);
+}
+
+bool HostFileSystem::mkdir(const char* path) {
+  std::error_code ec;
+  stdfs::create_directory(hostPath(path), ec);
+  return !ec;
+}
+
+bool HostFileSystem::remove(const char* path) {
+  std::string full = hostPath(path);
+  std::error_code ec;
+  if (stdfs::is_directory(full, ec)) return false;
+  return stdfs::remove(full, ec);
+}
+
+bool HostFileSystem::rmdir(const char* path) {
+  std::string full = hostPath(path);
+  std::error_code ec;
+  if (!stdfs::is_directory(full, ec)) return false;
+  // Like FAT, only empty directories can be removed; the root never is
+  if (full == rootDir || full == rootDir + "/") return false;
+  return stdfs::remove(full, ec);
+}
+
+uint64_t HostFileSystem::usedBytes() {
+  uint64_t used = 0;
+  std::error_code ec;
+  for (stdfs::recursive_directory_iterator it(rootDir, ec), end; it != end; it.increment(ec)) {
+    if (ec) break;
+    if (it->is_regular_file(ec)) used += it->file_size(ec);
+  }
+  return used;
+}
+
+// ============================================================================
+// HOST DIRECTORY AS NVS
+// ============================================================================
+HostKeyValueStore::HostKeyValueStore(const std::string &dir) : dir(dir) {
+  std::error_code ec;
+  stdfs::create_directories(dir, ec);
+}
+
+size_t HostKeyValueStore::read(const char* key, uint8_t* buffer, size_t capacity) {
+  FILE* f = fopen((dir + "/" + key).c_str(), "rb");
+  if (!f) return 0;
+  fseek(f, 0, SEEK_END);
+  long length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  size_t got = length > 0 && (size_t)length <= capacity ? fread(buffer, 1, (size_t)length, f) : 0;
+  fclose(f);
+  return got;
+}
+
+bool HostKeyValueStore::write(const char* key, const uint8_t* data, size_t length) {
+  // Whole-value replace, like nvs_set_blob
+  std::string path = dir + "/" + key;
+  FILE* f = fopen((path + ".tmp").c_str(), "wb");
+  if (!f) return false;
+  bool ok = fwrite(data, 1, length, f) == length;
+  ok &= fclose(f) == 0;
+  std::error_code ec;
+  if (ok) stdfs::rename(path + ".tmp", path, ec);
+  return ok && !ec;
+}
+
+bool HostKeyValueStore::erase(const char* key) {
+  std::error_code ec;
+  return stdfs::remove(dir + "/" + key, ec);
+}
@@ -0,0 +1,228 @@
+#include "AgniSim.h"
+#include <string.h>
+#include <AgniModbus.h>
+
+// ============================================================================
+// SCRIPTED ZTS-3002 SOIL SENSOR
+// ============================================================================
+static const uint32_t BAUD_RATES[MODBUS_BAUD_COUNT] = MODBUS_BAUD_CODES;
+
+SimModbusSlave::SimModbusSlave(SimClock &clock, const SimModbusConfig &config)
+  : clock(clock), config(config), rng(config.seed), lineBaud(config.lineBaud) {
+  memset(registers, 0, sizeof(registers));
+  int code = modbusBaudCode(lineBaud);
+  baudCode = code < 0 ? 1 : (uint16_t)code;
+  // A plausible loam reading so an unscripted run still produces records
+  SensorData reading;
+  reading.moisture = 31.4f;
+  reading.temperature = 24.6f;
+  reading.conductivity = 412;
+  reading.ph = 6.8f;
+  reading.nitrogen = 38;
+  reading.phosphorus = 21;
+  reading.potassium = 115;
+  setReading(reading);
+}
+
+void SimModbusSlave::begin(uint32_t baud) {
+  baudRate = baud ? baud : 4800;
+  rx.clear();
+  request.clear();
+}
+
+void SimModbusSlave::setConfig(const SimModbusConfig &newConfig) {
+  bool reseed = newConfig.seed != config.seed;
+  config = newConfig;
+  if (reseed) rng.seed(config.seed);
+}
+
+void SimModbusSlave::powerCycle() {
+  lineBaud = BAUD_RATES[baudCode];
+  rx.clear();
+  request.clear();
+}
+
+void SimModbusSlave::setRegister(uint16_t reg, uint16_t value) {
+  if (reg < sizeof(registers) / sizeof(registers[0])) registers[reg] = value;
+}
+
+void SimModbusSlave::setReading(const SensorData &reading) {
+  setRegister(REG_MOISTURE, (uint16_t)(reading.moisture * 10.0f + 0.5f));
+  setRegister(REG_TEMPERATURE, (uint16_t)(int16_t)(reading.temperature * 10.0f + (reading.temperature < 0 ? -0.5f : 0.5f)));
+  setRegister(REG_CONDUCTIVITY, reading.conductivity);
+  setRegister(REG_PH, (uint16_t)(reading.ph * 10.0f + 0.5f));
+  setRegister(REG_NITROGEN, reading.nitrogen);
+  setRegister(REG_PHOSPHORUS, reading.phosphorus);
+  setRegister(REG_POTASSIUM, reading.potassium);
+}
+
+bool SimModbusSlave::chance(double rate) {
+  if (rate <= 0) return false;
+  return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < rate;
+}
+
+int SimModbusSlave::available() {
+  uint64_t now = clock.micros();
+  int ready = 0;
+  for (const TimedByte &b : rx) {
+    if (b.readyUs > now) break;
+    ready++;
+  }
+  return ready;
+}
+
+int SimModbusSlave::read() {
+  if (rx.empty() || rx.front().readyUs > clock.micros()) return -1;
+  uint8_t value = rx.front().value;
+  rx.pop_front();
+  return value;
+}
+
+size_t SimModbusSlave::write(const uint8_t* data, size_t length) {
+  uint64_t now = clock.micros();
+  uint64_t startUs = txDoneUs > now ? txDoneUs : now;
+  txDoneUs = startUs + (uint64_t)length * byteTimeUs();
+  if (!transmitting) return length;   // DE low: nothing reaches the bus
+
+  request.insert(request.end(), data, data + length);
+  // Every request we send is a fixed 8-byte frame (0x03 read or 0x06 write)
+  while (request.size() >= 8) {
+    respond(request.data(), 8, txDoneUs);
+    request.erase(request.begin(), request.begin() + 8);
+  }
+  return length;
+}
+
+void SimModbusSlave::respond(const uint8_t* frame, size_t length, uint64_t requestEndUs) {
+  counters.requests++;
+  if (baudRate != lineBaud) {
+    counters.garbled++;
+    return;
+  }
+  if (frame[0] != config.address || (frame[1] != 0x03 && frame[1] != 0x06)) return;
+  uint16_t crc = crc16_modbus(frame, length - 2);
+  if (frame[length - 2] != (crc & 0xFF) || frame[length - 1] != (crc >> 8)) return;
+
+  uint16_t reg = (frame[2] << 8) | frame[3];
+  uint16_t value = (frame[4] << 8) | frame[5];
+  uint8_t response[3 + 2 * 16 + 2];
+  size_t pos = 0;
+
+  if (frame[1] == 0x06) {
+    if (reg != REG_BAUD_RATE) return;
+    counters.baudWrites++;
+    if (value >= MODBUS_BAUD_COUNT || BAUD_RATES[value] > config.maxBaud) {
+      // Exception 3, illegal data value
+      response[pos++] = config.address;
+      response[pos++] = 0x86;
+      response[pos++] = 0x03;
+      crc = crc16_modbus(response, pos);
+      response[pos++] = crc & 0xFF;
+      response[pos++] = crc >> 8;
+      queueResponse(response, pos, requestEndUs, false);
+      return;
+    }
+    // The echo goes out at the old rate, then the sensor switches
+    memcpy(response, frame, length);
+    queueResponse(response, length, requestEndUs, false);
+    baudCode = value;
+    if (!config.baudNeedsRestart) lineBaud = BAUD_RATES[value];
+    return;
+  }
+
+  uint16_t regCount = value;
+  bool baudRegister = reg == REG_BAUD_RATE && regCount == 1;
+  if (!baudRegister && (regCount == 0 || reg + regCount > sizeof(registers) / sizeof(registers[0]))) return;
+
+  if (chance(config.noResponseRate)) {
+    counters.injectedNoResponse++;
+    return;
+  }
+
+  response[pos++] = config.address;
+  response[pos++] = 0x03;
+  response[pos++] = (uint8_t)(regCount * 2);
+  for (uint16_t i = 0; i < regCount; i++) {
+    uint16_t v = baudRegister ? baudCode : registers[reg + i];
+    response[pos++] = v >> 8;
+    response[pos++] = v & 0xFF;
+  }
+  crc = crc16_modbus(response, pos);
+  response[pos++] = crc & 0xFF;
+  response[pos++] = crc >> 8;
+  queueResponse(response, pos, requestEndUs, true);
+}
+
+void SimModbusSlave::queueResponse(uint8_t* response, size_t pos, uint64_t requestEndUs, bool injectFaults) {
+  if (injectFaults && chance(config.crcErrorRate)) {
+    counters.injectedCrcErrors++;
+    response[3] ^= 0x5A;
+  }
+  if (injectFaults && chance(config.shortFrameRate)) {
+    counters.injectedShortFrames++;
+    pos = 3 + std::uniform_int_distribution<size_t>(0, pos - 4)(rng);
+  }
+
+  counters.responses++;
+  uint64_t readyUs = requestEndUs + config.turnaroundUs;
+  for (size_t i = 0; i < pos; i++) {
+    readyUs += byteTimeUs();
+    rx.push_back({readyUs, response[i]});
+  }
+  lastResponseUs = readyUs;
+}
+
+// ============================================================================
+// MULTI-DROP BUS
+// ============================================================================
+void SimModbusBus::begin(uint32_t baud) {
+  baudRate = baud ? baud : 4800;
+  for (SimModbusSlave* slave : slaves) slave->begin(baudRate);
+}
+
+void SimModbusBus::end() {
+  for (SimModbusSlave* slave : slaves) slave->end();
+}
+
+int SimModbusBus::available() {
+  int ready = 0;
+  for (SimModbusSlave* slave : slaves) ready += slave->available();
+  return ready;
+}
+
+int SimModbusBus::read() {
+  // Bytes come off the wire in time order, whichever slave sent them
+  SimModbusSlave* first = nullptr;
+  for (SimModbusSlave* slave : slaves) {
+    if (!first || slave->nextReadyUs() < first->nextReadyUs()) first = slave;
+  }
+  return first ? first->read() : -1;
+}
+
+size_t SimModbusBus::write(const uint8_t* data, size_t length) {
+  if (!transmitting) return length;   // DE low: nothing reaches the bus
+  uint64_t quietUs = lastRequestEndUs;
+  for (SimModbusSlave* slave : slaves) {
+    if (slave->responseEndUs() > quietUs) quietUs = slave->responseEndUs();
+  }
+  counters.requests++;
+  bool heard = clock.micros() >= quietUs + modbusFrameGapUs(baudRate);
+  if (!heard) counters.gapViolations++;
+  for (SimModbusSlave* slave : slaves) {
+    // Still takes wire time, but no slave parses it
+    if (!heard) slave->setTransmit(false);
+    slave->write(data, length);
+    if (!heard) slave->setTransmit(true);
+  }
+  lastRequestEndUs = clock.micros() + (uint64_t)length * (10000000UL / baudRate);
+  return length;
+}
+
+void SimModbusBus::flush() {
+  for (SimModbusSlave* slave : slaves) slave->flush();
+}
+
+void SimModbusBus::setTransmit(bool enable) {
+  transmitting = enable;
+  for (SimModbusSlave* slave : slaves) slave->setTransmit(enable);
+}
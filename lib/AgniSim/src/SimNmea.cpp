@@ -0,0 +1,159 @@
+#include "AgniSim.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ============================================================================
+// NMEA REPLAY
+// ============================================================================
+NmeaReplayPort::NmeaReplayPort(SimClock &clock, const std::string &path) : clock(clock) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return;
+  uint8_t buf[512];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(f);
+}
+
+void NmeaReplayPort::begin(uint32_t baud) {
+  baudRate = baud ? baud : 9600;
+  started = true;
+  startUs = clock.micros();
+  consumed = 0;
+}
+
+uint64_t NmeaReplayPort::bytesArrived() {
+  if (!started || data.empty()) return 0;
+  return (clock.micros() - startUs) * baudRate / 10000000ULL;
+}
+
+int NmeaReplayPort::available() {
+  uint64_t arrived = bytesArrived();
+  if (arrived <= consumed) return 0;
+  uint64_t ready = arrived - consumed;
+  // Same as the 256-byte UART RX buffer on the device: older bytes are lost
+  const uint64_t rxBuffer = 256;
+  if (ready > rxBuffer) {
+    consumed = arrived - rxBuffer;
+    ready = rxBuffer;
+  }
+  return (int)ready;
+}
+
+int NmeaReplayPort::read() {
+  if (available() == 0) return -1;
+  return data[(size_t)(consumed++ % data.size())];
+}
+
+// ============================================================================
+// MINIMAL NMEA DECODER (GGA + RMC)
+// ============================================================================
+namespace {
+
+/** @brief Splits a sentence body in place; returns the field count. */
+int splitFields(char* body, char** fields, int maxFields) {
+  int count = 0;
+  fields[count++] = body;
+  for (char* p = body; *p && count < maxFields; p++) {
+    if (*p == ',') {
+      *p = '\0';
+      fields[count++] = p + 1;
+    }
+  }
+  return count;
+}
+
+/** @brief ddmm.mmmm + hemisphere -> signed decimal degrees. */
+double parseCoordinate(const char* value, const char* hemisphere) {
+  if (!value[0]) return 0;
+  double raw = atof(value);
+  int degrees = (int)(raw / 100);
+  double result = degrees + (raw - degrees * 100) / 60.0;
+  if (hemisphere[0] == 'S' || hemisphere[0] == 'W') result = -result;
+  return result;
+}
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+}  // namespace
+
+bool NmeaParser::encode(char c) {
+  if (c == '$') {
+    collecting = true;
+    length = 0;
+    return false;
+  }
+  if (!collecting) return false;
+  if (c == '\r' || c == '\n') {
+    collecting = false;
+    sentence[length] = '\0';
+    return parseSentence();
+  }
+  if (length >= sizeof(sentence) - 1) {
+    collecting = false;   // overlong, not NMEA 0183
+    return false;
+  }
+  sentence[length++] = c;
+  return false;
+}
+
+bool NmeaParser::parseSentence() {
+  char* star = strchr(sentence, '*');
+  if (!star || strlen(star) < 3) {
+    failed++;
+    return false;
+  }
+  uint8_t checksum = 0;
+  for (char* p = sentence; p < star; p++) checksum ^= (uint8_t)*p;
+  int hi = hexValue(star[1]);
+  int lo = hexValue(star[2]);
+  if (hi < 0 || lo < 0 || checksum != (uint8_t)((hi << 4) | lo)) {
+    failed++;
+    return false;
+  }
+  passed++;
+  *star = '\0';
+
+  char* fields[20];
+  int count = splitFields(sentence, fields, 20);
+  if (strlen(fields[0]) != 5) return false;
+  const char* type = fields[0] + 2;   // skip talker ID (GP, GN, ...)
+
+  if (strcmp(type, "GGA") == 0 && count >= 10) {
+    int quality = atoi(fields[6]);
+    current.valid = quality > 0;
+    if (current.valid) {
+      current.latitude = (float)parseCoordinate(fields[2], fields[3]);
+      current.longitude = (float)parseCoordinate(fields[4], fields[5]);
+      current.altitude = (float)atof(fields[9]);
+    }
+    current.satellites = atoi(fields[7]);
+    current.hdop = atof(fields[8]);
+    if (strlen(fields[1]) >= 6) {
+      current.hour = (fields[1][0] - '0') * 10 + (fields[1][1] - '0');
+      current.minute = (fields[1][2] - '0') * 10 + (fields[1][3] - '0');
+      current.second = (fields[1][4] - '0') * 10 + (fields[1][5] - '0');
+    }
+    return true;
+  }
+  if (strcmp(type, "RMC") == 0 && count >= 10) {
+    if (fields[2][0] == 'A') {
+      current.latitude = (float)parseCoordinate(fields[3], fields[4]);
+      current.longitude = (float)parseCoordinate(fields[5], fields[6]);
+    }
+    current.speedKmh = atof(fields[7]) * 1.852;
+    if (strlen(fields[9]) == 6) {
+      current.day = (fields[9][0] - '0') * 10 + (fields[9][1] - '0');
+      current.month = (fields[9][2] - '0') * 10 + (fields[9][3] - '0');
+      current.year = 2000 + (fields[9][4] - '0') * 10 + (fields[9][5] - '0');
+    }
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,86 @@
+#include "AgniSleep.h"
+
+#include <string.h>
+#include <AgniProtocol.h>
+
+// ============================================================================
+// ENERGY MODEL
+// ============================================================================
+uint64_t wakeChargeNah(const WakePhases &phases, const PowerModel &model) {
+  uint32_t lightSleepMs = phases.lightSleepMs < phases.awakeMs ? phases.lightSleepMs : phases.awakeMs;
+  uint64_t maMs = (uint64_t)(phases.awakeMs - lightSleepMs) * model.activeMa +
+                  (uint64_t)phases.sensorMs * model.sensorMa +
+                  (uint64_t)phases.storageMs * model.storageMa +
+                  (uint64_t)phases.radioMs * model.radioMa;
+  return maMs * 10 / 36 + (uint64_t)lightSleepMs * model.lightSleepUa / 3600;
+}
+
+uint64_t sleepChargeNah(uint64_t sleepMs, const PowerModel &model) {
+  return sleepMs * model.sleepUa / 3600;
+}
+
+// ============================================================================
+// RTC BUFFER
+// ============================================================================
+uint32_t RtcSampleBuffer::checksum() const {
+  const uint8_t* start = (const uint8_t*)&state.count;
+  return crc32_update(0, start, sizeof(RtcState) - offsetof(RtcState, count));
+}
+
+bool RtcSampleBuffer::begin() {
+  if (state.magic == RTC_STATE_MAGIC && state.count <= RTC_BUFFER_SAMPLES && state.crc == checksum()) return true;
+  memset(&state, 0, sizeof(state));
+  state.magic = RTC_STATE_MAGIC;
+  seal();
+  return false;
+}
+
+bool RtcSampleBuffer::add(const ArchiveSample &sample) {
+  if (full()) return false;
+  state.samples[state.count++] = sample;
+  state.ledger.samples++;
+  seal();
+  return true;
+}
+
+void RtcSampleBuffer::drop(size_t n) {
+  if (n >= state.count) {
+    state.count = 0;
+  } else {
+    memmove(state.samples, state.samples + n, (state.count - n) * sizeof(ArchiveSample));
+    state.count -= (uint32_t)n;
+  }
+  seal();
+}
+
+void RtcSampleBuffer::seal() {
+  state.crc = checksum();
+}
+
+// ============================================================================
+// AGGREGATION
+// ============================================================================
+bool averageSamples(const ArchiveSample* samples, size_t count, ArchiveSample &out) {
+  if (count == 0) return false;
+  ArchiveSample result = samples[count - 1];
+  int32_t flags = 0;
+  for (int c = ARCHIVE_PH; c <= ARCHIVE_TEMPERATURE; c++) {
+    bool npk = c >= ARCHIVE_NITROGEN && c <= ARCHIVE_POTASSIUM;
+    int32_t needed = npk ? ARCHIVE_FLAG_NPK : ARCHIVE_FLAG_BASIC;
+    int64_t sum = 0;
+    int64_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (!(samples[i].values[ARCHIVE_FLAGS] & needed)) continue;
+      sum += samples[i].values[c];
+      used++;
+    }
+    if (used == 0) continue;
+    flags |= needed;
+    // Rounded half away from zero
+    result.values[c] = (int32_t)((sum >= 0 ? sum + used / 2 : sum - used / 2) / used);
+  }
+  if (!(flags & ARCHIVE_FLAG_BASIC)) return false;
+  result.values[ARCHIVE_FLAGS] = (result.values[ARCHIVE_FLAGS] & ~(ARCHIVE_FLAG_BASIC | ARCHIVE_FLAG_NPK)) | flags;
+  out = result;
+  return true;
+}
@@ -0,0 +1,115 @@
+#ifndef AGNI_SLEEP_H
+#define AGNI_SLEEP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniArchive.h>
+
+// ============================================================================
+// UNATTENDED (DUTY-CYCLED) CAPTURE
+// ============================================================================
+// With unattended on, the unit spends its life in deep sleep. Each timer
+// wake powers the probe, averages a few readings into one sample, appends
+// it to a buffer in RTC slow memory (which survives deep sleep) and goes
+// back to sleep; the card is only mounted to flush once the buffer holds
+// rtc_flush_at samples. Every advertise_every-th wake instead boots fully
+// and advertises for advertise_window_s, so a phone can connect, pull
+// files or turn the mode off.
+//
+// RtcState is a plain struct the firmware places in RTC memory; a magic
+// and CRC-32 tell a buffer that survived deep sleep from one left over by
+// a cold boot or a brown-out. The ledger in it accumulates wake counts and
+// an energy estimate across wakes: time in each phase times the modelled
+// current of that phase (PowerModel), plus the sleep current. There is no
+// current sensor, so the estimate is only as good as the model.
+
+#define RTC_STATE_MAGIC       0x41475231   // "AGR1"
+#define RTC_BUFFER_SAMPLES    48           // 3 KB of the S3's 8 KB RTC slow memory
+
+/** @brief Modelled supply current per phase, at the battery. */
+struct PowerModel {
+  uint16_t activeMa = 40;        // CPU awake, radio off
+  uint16_t sensorMa = 35;        // probe powered, on top of active
+  uint16_t storageMa = 50;       // card mounted and writing, on top of active
+  uint16_t radioMa = 80;         // BLE up, on top of active
+  uint16_t lightSleepUa = 800;   // light sleep instead of active, e.g. the probe warm-up
+  uint16_t sleepUa = 150;        // deep sleep, regulator quiescent included
+};
+
+/** @brief Where one wake spent its time; phases overlap the awake time. */
+struct WakePhases {
+  uint32_t awakeMs = 0;          // reset to deep sleep, light sleep included
+  uint32_t lightSleepMs = 0;
+  uint32_t sensorMs = 0;
+  uint32_t storageMs = 0;
+  uint32_t radioMs = 0;
+};
+
+/** @brief Charge in nAh (1 mA for 3.6 ms = 1 nAh). */
+uint64_t wakeChargeNah(const WakePhases &phases, const PowerModel &model);
+uint64_t sleepChargeNah(uint64_t sleepMs, const PowerModel &model);
+
+struct WakeLedger {
+  uint32_t wakes;
+  uint32_t samples;              // buffered readings
+  uint32_t failedReadings;       // wakes where the probe never answered
+  uint32_t flushes;              // card mounts that wrote the buffer out
+  uint32_t flushFailures;
+  uint32_t lost;                 // samples dropped with the buffer full and the card failing
+  uint32_t windows;              // wakes that advertised
+  uint64_t awakeMs;
+  uint64_t sleptMs;
+  uint64_t chargeNah;            // awake and asleep
+  uint32_t lastWakeMs;
+  uint32_t lastWakeNah;
+  int32_t fix[3];                // ARCHIVE_LATITUDE..ALTITUDE of the last GPS fix (the unit doesn't move)
+  uint32_t fixValid;
+};
+
+struct RtcState {
+  uint32_t magic;
+  uint32_t crc;                  // of everything after this field
+  uint32_t count;
+  WakeLedger ledger;
+  ArchiveSample samples[RTC_BUFFER_SAMPLES];
+};
+
+class RtcSampleBuffer {
+public:
+  explicit RtcSampleBuffer(RtcState &state) : state(state) {}
+
+  /**
+   * @brief Checks the state left in RTC memory.
+   * @return false if it did not verify and was reset (cold boot, brown-out)
+   */
+  bool begin();
+
+  /** @brief Appends one sample; false if the buffer is full. */
+  bool add(const ArchiveSample &sample);
+  /** @brief Drops the oldest n samples, once they are on the card. */
+  void drop(size_t n);
+
+  size_t count() const { return state.count; }
+  bool full() const { return state.count >= RTC_BUFFER_SAMPLES; }
+  const ArchiveSample &sample(size_t index) const { return state.samples[index]; }
+
+  WakeLedger &ledger() { return state.ledger; }
+  const WakeLedger &ledger() const { return state.ledger; }
+  /** @brief Re-seals the CRC; call after changing the ledger, before sleeping. */
+  void seal();
+
+private:
+  uint32_t checksum() const;
+
+  RtcState &state;
+};
+
+/**
+ * @brief One sample from several readings of a wake: the soil columns are
+ * the rounded means over the readings that had them (ARCHIVE_FLAG_BASIC,
+ * ARCHIVE_FLAG_NPK), everything else comes from the last reading.
+ * @return false if no reading had basic values
+ */
+bool averageSamples(const ArchiveSample* samples, size_t count, ArchiveSample &out);
+
+#endif
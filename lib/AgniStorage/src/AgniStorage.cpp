@@ -0,0 +1,265 @@
+#include "AgniStorage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool RecordStore::begin() {
+  if (!fs.exists(RECORD_DIR) && !fs.mkdir(RECORD_DIR)) {
+    return false;
+  }
+  scanFileCounter();
+  loadIndex();
+  return true;
+}
+
+void RecordStore::recordPath(int fileNumber, char* out, size_t capacity) {
+  snprintf(out, capacity, RECORD_DIR "/" RECORD_FILE_PREFIX "%d" RECORD_FILE_SUFFIX, fileNumber);
+}
+
+int RecordStore::parseFileNumber(const char* baseName) {
+  const size_t prefixLen = sizeof(RECORD_FILE_PREFIX) - 1;
+  const size_t suffixLen = sizeof(RECORD_FILE_SUFFIX) - 1;
+  size_t len = strlen(baseName);
+  if (len <= prefixLen + suffixLen) return 0;
+  if (strncmp(baseName, RECORD_FILE_PREFIX, prefixLen) != 0) return 0;
+  if (strcmp(baseName + len - suffixLen, RECORD_FILE_SUFFIX) != 0) return 0;
+  return atoi(baseName + prefixLen);
+}
+
+/**
+ * @brief Scans the record directory to find the highest file number.
+ * Sets fileCounter to the next available number.
+ */
+void RecordStore::scanFileCounter() {
+  fileCounter = 1;
+  std::unique_ptr<HalDir> dir = fs.openDir(RECORD_DIR);
+  if (!dir) return;
+
+  int maxFileNum = 0;
+  HalDirEntry entry;
+  while (dir->next(entry)) {
+    if (entry.isDirectory) continue;
+    int fileNum = parseFileNumber(entry.name);
+    if (fileNum > maxFileNum) {
+      maxFileNum = fileNum;
+    }
+  }
+  dir->close();
+  fileCounter = maxFileNum + 1; // Start at the next number
+}
+
+bool RecordStore::append(const char* data, size_t length, uint32_t time, uint8_t priority) {
+  char path[RECORD_PATH_MAX];
+  recordPath(fileCounter, path, sizeof(path));
+
+  uint64_t startUs = clock.micros();
+  std::unique_ptr<HalFile> file = fs.open(path, HAL_FILE_WRITE);
+  if (!file) {
+    counters.appendFailures++;
+    return false;
+  }
+  size_t written = file->write((const uint8_t*)data, length);
+  file->close();
+  counters.appendUs.record((uint32_t)(clock.micros() - startUs));
+
+  if (written != length) {
+    counters.appendFailures++;
+    fs.remove(path);
+    return false;
+  }
+  counters.appends++;
+
+  RecordIndexEntry entry;
+  entry.time = time;
+  entry.bytes = length > UINT16_MAX ? UINT16_MAX : (uint16_t)length;
+  entry.priority = priority;
+  entry.present = true;
+  if (writeIndexEntry(fileCounter, entry)) {
+    addToSummary(entry);
+  } else {
+    counters.indexFailures++;
+  }
+  fileCounter++;
+  return true;
+}
+
+// ============================================================================
+// RECORD INDEX
+// ============================================================================
+static void encodeIndexEntry(const RecordIndexEntry &entry, uint8_t* out) {
+  out[0] = (uint8_t)entry.time;
+  out[1] = (uint8_t)(entry.time >> 8);
+  out[2] = (uint8_t)(entry.time >> 16);
+  out[3] = (uint8_t)(entry.time >> 24);
+  out[4] = (uint8_t)entry.bytes;
+  out[5] = (uint8_t)(entry.bytes >> 8);
+  out[6] = entry.priority;
+  out[7] = entry.present ? 1 : 0;
+}
+
+static void decodeIndexEntry(const uint8_t* in, RecordIndexEntry &entry) {
+  entry.time = (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+  entry.bytes = (uint16_t)(in[4] | (in[5] << 8));
+  entry.priority = in[6];
+  entry.present = in[7] == 1;
+}
+
+void RecordStore::addToSummary(const RecordIndexEntry &entry) {
+  if (!entry.present) return;
+  summary.records++;
+  summary.bytes += entry.bytes;
+  if (entry.priority) summary.flagged++;
+}
+
+/**
+ * @brief Sums the index if its length matches the file counter, otherwise
+ * rebuilds it.
+ */
+void RecordStore::loadIndex() {
+  summary = RecordIndexSummary();
+  uint32_t expected = (uint32_t)recordCount() * RECORD_INDEX_ENTRY_BYTES;
+  std::unique_ptr<HalFile> file = fs.open(RECORD_INDEX_FILE, HAL_FILE_READ);
+  bool matches = file ? file->size() == expected : expected == 0;
+  if (file) file->close();
+  if (!matches) {
+    if (!rebuildIndex()) counters.indexFailures++;
+    return;
+  }
+
+  RecordIndexEntry entries[RECORD_INDEX_BATCH];
+  for (int first = 1; first <= recordCount(); first += RECORD_INDEX_BATCH) {
+    size_t count = readIndex(first, entries, RECORD_INDEX_BATCH);
+    if (count == 0) break;
+    for (size_t i = 0; i < count; i++) addToSummary(entries[i]);
+  }
+}
+
+/**
+ * @brief Writes a fresh index from the directory listing: a zero-filled
+ * entry per file number, then the size of each file found.
+ */
+bool RecordStore::rebuildIndex() {
+  counters.indexRebuilds++;
+  summary = RecordIndexSummary();
+  fs.remove(RECORD_INDEX_FILE);
+  std::unique_ptr<HalFile> file = fs.open(RECORD_INDEX_FILE, HAL_FILE_WRITE);
+  if (!file) return false;
+
+  uint8_t zeros[RECORD_INDEX_BATCH * RECORD_INDEX_ENTRY_BYTES] = {0};
+  bool ok = true;
+  for (int left = recordCount(); ok && left > 0; left -= RECORD_INDEX_BATCH) {
+    size_t bytes = (size_t)(left < RECORD_INDEX_BATCH ? left : RECORD_INDEX_BATCH) * RECORD_INDEX_ENTRY_BYTES;
+    ok = file->write(zeros, bytes) == bytes;
+  }
+  file->close();
+  if (!ok) return false;
+
+  std::unique_ptr<HalDir> dir = fs.openDir(RECORD_DIR);
+  if (!dir) return false;
+  HalDirEntry found;
+  while (dir->next(found)) {
+    if (found.isDirectory) continue;
+    int fileNum = parseFileNumber(found.name);
+    if (fileNum < 1 || fileNum >= fileCounter) continue;
+    RecordIndexEntry entry;
+    entry.bytes = found.size > UINT16_MAX ? UINT16_MAX : (uint16_t)found.size;
+    entry.present = true;
+    if (!writeIndexEntry(fileNum, entry)) {
+      ok = false;
+      break;
+    }
+    addToSummary(entry);
+  }
+  dir->close();
+  return ok;
+}
+
+/**
+ * @brief Writes the entry for one file number, zero-filling any entries
+ * before it that were never written.
+ */
+bool RecordStore::writeIndexEntry(int fileNumber, const RecordIndexEntry &entry) {
+  std::unique_ptr<HalFile> file = fs.open(RECORD_INDEX_FILE, HAL_FILE_UPDATE);
+  if (!file) return false;
+
+  uint32_t offset = (uint32_t)(fileNumber - 1) * RECORD_INDEX_ENTRY_BYTES;
+  uint32_t end = file->size();
+  uint8_t raw[RECORD_INDEX_ENTRY_BYTES] = {0};
+  bool ok = file->seek(end);
+  for (; ok && end < offset; end += RECORD_INDEX_ENTRY_BYTES) {
+    ok = file->write(raw, sizeof(raw)) == sizeof(raw);
+  }
+  encodeIndexEntry(entry, raw);
+  ok = ok && file->seek(offset) && file->write(raw, sizeof(raw)) == sizeof(raw);
+  file->close();
+  return ok;
+}
+
+size_t RecordStore::readIndex(int first, RecordIndexEntry* out, size_t count) {
+  if (first < 1 || first > recordCount() || count == 0) return 0;
+  size_t available = (size_t)(recordCount() - first + 1);
+  if (count > available) count = available;
+
+  std::unique_ptr<HalFile> file = fs.open(RECORD_INDEX_FILE, HAL_FILE_READ);
+  if (!file || !file->seek((uint32_t)(first - 1) * RECORD_INDEX_ENTRY_BYTES)) {
+    counters.indexFailures++;
+    return 0;
+  }
+  uint8_t raw[RECORD_INDEX_BATCH * RECORD_INDEX_ENTRY_BYTES];
+  size_t done = 0;
+  while (done < count) {
+    size_t entries = count - done < RECORD_INDEX_BATCH ? count - done : RECORD_INDEX_BATCH;
+    size_t bytes = entries * RECORD_INDEX_ENTRY_BYTES;
+    if (file->read(raw, bytes) != bytes) {
+      counters.indexFailures++;
+      break;
+    }
+    for (size_t i = 0; i < entries; i++) decodeIndexEntry(raw + i * RECORD_INDEX_ENTRY_BYTES, out[done + i]);
+    done += entries;
+  }
+  file->close();
+  return done;
+}
+
+bool RecordStore::hasSpace(uint64_t minFreeBytes) {
+  uint64_t total = fs.totalBytes();
+  uint64_t used = fs.usedBytes();
+  return total > used && total - used >= minFreeBytes;
+}
+
+/**
+ * @brief Recursively deletes all files and sub-folders below path.
+ */
+bool RecordStore::removeRecursive(const char* path) {
+  std::unique_ptr<HalDir> dir = fs.openDir(path);
+  if (!dir) return false;
+
+  bool ok = true;
+  HalDirEntry entry;
+  char child[RECORD_PATH_MAX * 2];
+  while (dir->next(entry)) {
+    size_t baseLen = strlen(path);
+    snprintf(child, sizeof(child), "%s%s%s", path, (baseLen > 0 && path[baseLen - 1] == '/') ? "" : "/", entry.name);
+    if (entry.isDirectory) {
+      // Empty the directory first, then remove it
+      ok &= removeRecursive(child);
+      ok &= fs.rmdir(child);
+    } else {
+      ok &= fs.remove(child);
+    }
+  }
+  dir->close();
+  return ok;
+}
+
+bool RecordStore::wipe() {
+  bool ok = removeRecursive("/");
+  fileCounter = 1;
+  summary = RecordIndexSummary();
+  // Re-create the data directory since we just deleted it
+  if (!fs.exists(RECORD_DIR)) {
+    ok &= fs.mkdir(RECORD_DIR);
+  }
+  return ok;
+}
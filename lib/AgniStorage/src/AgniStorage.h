@@ -0,0 +1,111 @@
+#ifndef AGNI_STORAGE_H
+#define AGNI_STORAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniHal.h>
+#include <AgniMetrics.h>
+
+// ============================================================================
+// RECORD STORE
+// ============================================================================
+// One JSON document per sample: /farmland_data/farmland_<n>.json, n from 1.
+#define RECORD_DIR          "/farmland_data"
+#define RECORD_FILE_PREFIX  "farmland_"
+#define RECORD_FILE_SUFFIX  ".json"
+#define RECORD_PATH_MAX     64
+
+// Next to the files, an index holds one fixed-width entry per file number,
+// so a transfer can pick records by age or priority without listing the
+// directory (thousands of entries on FAT). Entry n - 1 describes
+// farmland_<n>.json, little-endian:
+//
+//   u32 time (unix s, 0 without a fix)  u16 file bytes
+//   u8 RECORD_PRIORITY_* bits  u8 1 if the file was written
+//
+// begin() rebuilds it from a directory listing when it does not match the
+// files (first boot with an older card, files copied on a PC); the times
+// and priorities of those records are then unknown (0).
+#define RECORD_INDEX_FILE         "/record_index.bin"   // outside RECORD_DIR, so transfers skip it
+#define RECORD_INDEX_ENTRY_BYTES  8
+#define RECORD_INDEX_BATCH        32                    // entries per read or fill write
+
+struct RecordIndexEntry {
+  uint32_t time = 0;
+  uint16_t bytes = 0;
+  uint8_t priority = 0;
+  bool present = false;
+};
+
+/** @brief Totals over the index, kept current by append(). */
+struct RecordIndexSummary {
+  uint32_t records = 0;        // present entries
+  uint32_t flagged = 0;        // present entries with a priority
+  uint64_t bytes = 0;
+};
+
+struct StorageStats {
+  uint32_t appends = 0;
+  uint32_t appendFailures = 0;
+  uint32_t indexFailures = 0;  // entries that could not be written or read
+  uint32_t indexRebuilds = 0;
+  LatencyHistogram appendUs;   // open + write + close
+};
+
+class RecordStore {
+public:
+  RecordStore(HalFileSystem &fs, HalClock &clock) : fs(fs), clock(clock) {}
+
+  /**
+   * @brief Creates the record directory if needed, scans it for the
+   * highest existing file number and checks the index against it.
+   */
+  bool begin();
+
+  /**
+   * @brief Writes one record as the next farmland_<n>.json and its index
+   * entry. A failed index write is counted but does not fail the append.
+   * @return true on success; the file number only advances on success
+   */
+  bool append(const char* data, size_t length, uint32_t time = 0, uint8_t priority = 0);
+
+  /**
+   * @brief Reads up to count index entries from file number first on.
+   * @return entries read; 0 past the last record or on a read error
+   */
+  size_t readIndex(int first, RecordIndexEntry* out, size_t count);
+  const RecordIndexSummary &indexSummary() const { return summary; }
+
+  /**
+   * @brief Deletes everything on the card and re-creates the record directory.
+   */
+  bool wipe();
+
+  /** @brief True if at least minFreeBytes are left on the card. */
+  bool hasSpace(uint64_t minFreeBytes);
+
+  int nextFileNumber() const { return fileCounter; }
+  int recordCount() const { return fileCounter - 1; }
+  static void recordPath(int fileNumber, char* out, size_t capacity);
+  /** @brief Parses "farmland_<n>.json"; returns 0 for any other name. */
+  static int parseFileNumber(const char* baseName);
+
+  HalFileSystem &fileSystem() { return fs; }
+  const StorageStats &stats() const { return counters; }
+
+private:
+  void scanFileCounter();
+  void loadIndex();
+  bool rebuildIndex();
+  bool writeIndexEntry(int fileNumber, const RecordIndexEntry &entry);
+  void addToSummary(const RecordIndexEntry &entry);
+  bool removeRecursive(const char* path);
+
+  HalFileSystem &fs;
+  HalClock &clock;
+  int fileCounter = 1;
+  StorageStats counters;
+  RecordIndexSummary summary;
+};
+
+#endif
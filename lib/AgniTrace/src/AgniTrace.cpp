@@ -0,0 +1,319 @@
+#include "AgniTrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static const uint8_t TRACE_MAGIC[4] = {'A', 'G', 'T', 'R'};
+
+const char* traceChannelName(uint8_t channel) {
+  switch (channel) {
+    case TRACE_RS485_RX: return "rs485_rx";
+    case TRACE_RS485_TX: return "rs485_tx";
+    case TRACE_GPS_RX: return "gps_rx";
+    case TRACE_BLE_COMMAND: return "ble_cmd";
+    default: return "unknown";
+  }
+}
+
+static void segmentPath(const char* dir, uint32_t number, char* out, size_t capacity) {
+  snprintf(out, capacity, "%s/" TRACE_FILE_PREFIX "%lu" TRACE_FILE_SUFFIX, dir, (unsigned long)number);
+}
+
+/** @brief Parses "trace_<n>.bin"; returns 0 for any other name. */
+static uint32_t parseSegmentNumber(const char* name) {
+  const size_t prefixLen = sizeof(TRACE_FILE_PREFIX) - 1;
+  const size_t suffixLen = sizeof(TRACE_FILE_SUFFIX) - 1;
+  size_t len = strlen(name);
+  if (len <= prefixLen + suffixLen) return 0;
+  if (strncmp(name, TRACE_FILE_PREFIX, prefixLen) != 0) return 0;
+  if (strcmp(name + len - suffixLen, TRACE_FILE_SUFFIX) != 0) return 0;
+  return (uint32_t)strtoul(name + prefixLen, nullptr, 10);
+}
+
+// ============================================================================
+// WRITER
+// ============================================================================
+TraceWriter::TraceWriter(HalFileSystem &fs, uint32_t budgetBytes, uint32_t segmentBytes)
+  : fs(fs), segmentBytes(segmentBytes) {
+  if (this->segmentBytes < TRACE_HEADER_BYTES + TRACE_BUFFER_BYTES) {
+    this->segmentBytes = TRACE_HEADER_BYTES + TRACE_BUFFER_BYTES;
+  }
+  maxSegments = budgetBytes / this->segmentBytes;
+  if (maxSegments < 2) maxSegments = 2;
+}
+
+bool TraceWriter::begin() {
+  if (!fs.exists(TRACE_DIR) && !fs.mkdir(TRACE_DIR)) return false;
+
+  uint32_t lowest = 0;
+  uint32_t highest = 0;
+  std::unique_ptr<HalDir> dir = fs.openDir(TRACE_DIR);
+  if (!dir) return false;
+  HalDirEntry entry;
+  while (dir->next(entry)) {
+    if (entry.isDirectory) continue;
+    uint32_t number = parseSegmentNumber(entry.name);
+    if (number == 0) continue;
+    if (lowest == 0 || number < lowest) lowest = number;
+    if (number > highest) highest = number;
+  }
+  dir->close();
+
+  // Timestamps restart with every boot, so a new run always gets a new segment
+  newestSegment = highest;
+  oldestSegment = lowest ? lowest : highest + 1;
+  segmentLength = 0;
+  return true;
+}
+
+static size_t putVarint(uint8_t* out, uint64_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+bool TraceWriter::record(uint8_t channel, uint64_t timestampUs, const uint8_t* data, size_t length) {
+  if (length == 0) return true;
+  if (timestampUs < lastRecordUs) timestampUs = lastRecordUs;
+
+  // Extend the previous record if this is the same burst
+  if (active->length > 0 && channel == lastChannel &&
+      timestampUs - lastByteUs <= TRACE_COALESCE_US) {
+    uint8_t* lengthField = active->data + lastRecordOffset;
+    size_t recordLength = lengthField[0] | (lengthField[1] << 8);
+    if (recordLength + length <= TRACE_MAX_PAYLOAD && active->length + length <= TRACE_BUFFER_BYTES) {
+      memcpy(active->data + active->length, data, length);
+      active->length += length;
+      recordLength += length;
+      lengthField[0] = recordLength & 0xFF;
+      lengthField[1] = recordLength >> 8;
+      lastByteUs = timestampUs;
+      return true;
+    }
+  }
+
+  while (length > 0) {
+    size_t part = length > TRACE_MAX_PAYLOAD ? TRACE_MAX_PAYLOAD : length;
+    uint8_t header[1 + 10 + 2];
+    size_t headerLength = 0;
+    header[headerLength++] = channel;
+    headerLength += putVarint(header + headerLength, timestampUs - lastRecordUs);
+    if (active->length + headerLength + 2 + part > TRACE_BUFFER_BYTES) {
+      counters.droppedBytes += length;
+      return false;
+    }
+    if (active->length == 0) active->baseUs = lastRecordUs;
+
+    memcpy(active->data + active->length, header, headerLength);
+    active->length += headerLength;
+    lastRecordOffset = active->length;
+    active->data[active->length++] = part & 0xFF;
+    active->data[active->length++] = part >> 8;
+    memcpy(active->data + active->length, data, part);
+    active->length += part;
+
+    counters.records++;
+    lastRecordUs = timestampUs;
+    lastByteUs = timestampUs;
+    lastChannel = channel;
+    data += part;
+    length -= part;
+  }
+  return true;
+}
+
+bool TraceWriter::swapBuffers() {
+  if (flushPending || active->length == 0) return false;
+  Buffer* full = active;
+  active = flushing;
+  flushing = full;
+  active->length = 0;
+  lastChannel = 0;   // never coalesce into a buffer that is being written out
+  flushPending = true;
+  return true;
+}
+
+bool TraceWriter::openSegment(uint64_t baseUs) {
+  char path[48];
+  segmentPath(TRACE_DIR, newestSegment + 1, path, sizeof(path));
+  std::unique_ptr<HalFile> file = fs.open(path, HAL_FILE_WRITE);
+  if (!file) return false;
+
+  uint8_t header[TRACE_HEADER_BYTES] = {0};
+  memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header[4] = TRACE_VERSION;
+  for (int i = 0; i < 8; i++) header[8 + i] = (uint8_t)(baseUs >> (8 * i));
+  size_t written = file->write(header, sizeof(header));
+  file->close();
+  if (written != sizeof(header)) {
+    fs.remove(path);
+    return false;
+  }
+  newestSegment++;
+  segmentLength = TRACE_HEADER_BYTES;
+  enforceBudget();
+  return true;
+}
+
+void TraceWriter::enforceBudget() {
+  char path[48];
+  while (newestSegment - oldestSegment + 1 > maxSegments) {
+    segmentPath(TRACE_DIR, oldestSegment, path, sizeof(path));
+    if (fs.remove(path)) counters.segmentsRemoved++;
+    oldestSegment++;
+  }
+}
+
+bool TraceWriter::flush() {
+  if (!flushPending) return true;
+  bool ok = true;
+  if (segmentLength == 0 || segmentLength + flushing->length > segmentBytes) {
+    ok = openSegment(flushing->baseUs);
+  }
+  if (ok) {
+    char path[48];
+    segmentPath(TRACE_DIR, newestSegment, path, sizeof(path));
+    std::unique_ptr<HalFile> file = fs.open(path, HAL_FILE_APPEND);
+    size_t written = file ? file->write(flushing->data, flushing->length) : 0;
+    if (file) file->close();
+    ok = written == flushing->length;
+    segmentLength += written;
+  }
+  if (ok) {
+    counters.bytesWritten += flushing->length;
+  } else {
+    // The delta chain is broken; restart it in a fresh segment
+    counters.writeFailures++;
+    segmentLength = 0;
+  }
+  flushing->length = 0;
+  flushPending = false;
+  return ok;
+}
+
+// ============================================================================
+// READER
+// ============================================================================
+TraceReader::TraceReader(HalFileSystem &fs, const char* dir) : fs(fs) {
+  strncpy(dirPath, dir, sizeof(dirPath) - 1);
+  dirPath[sizeof(dirPath) - 1] = '\0';
+}
+
+bool TraceReader::open() {
+  segments.clear();
+  segmentIndex = 0;
+  std::unique_ptr<HalDir> dir = fs.openDir(dirPath);
+  if (!dir) return false;
+  HalDirEntry entry;
+  while (dir->next(entry)) {
+    if (entry.isDirectory) continue;
+    uint32_t number = parseSegmentNumber(entry.name);
+    if (number) segments.push_back(number);
+  }
+  dir->close();
+  std::sort(segments.begin(), segments.end());
+  return !segments.empty();
+}
+
+bool TraceReader::openNextSegment() {
+  while (segmentIndex < segments.size()) {
+    char path[96];
+    segmentPath(dirPath, segments[segmentIndex++], path, sizeof(path));
+    file = fs.open(path, HAL_FILE_READ);
+    bufferLength = 0;
+    bufferPos = 0;
+    if (!file) continue;
+
+    uint8_t header[TRACE_HEADER_BYTES];
+    if (!readBytes(header, sizeof(header)) || memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+        header[4] != TRACE_VERSION) {
+      corrupt++;
+      file.reset();
+      continue;
+    }
+    lastUs = 0;
+    for (int i = 0; i < 8; i++) lastUs |= (uint64_t)header[8 + i] << (8 * i);
+    return true;
+  }
+  return false;
+}
+
+int TraceReader::readByte() {
+  if (bufferPos == bufferLength) {
+    bufferLength = file->read(buffer, sizeof(buffer));
+    bufferPos = 0;
+    if (bufferLength == 0) return -1;
+  }
+  return buffer[bufferPos++];
+}
+
+bool TraceReader::readBytes(uint8_t* out, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    int c = readByte();
+    if (c < 0) return false;
+    out[i] = (uint8_t)c;
+  }
+  return true;
+}
+
+bool TraceReader::next(TraceEvent &event) {
+  while (true) {
+    if (!file && !openNextSegment()) return false;
+
+    int channel = readByte();
+    if (channel < 0) {
+      file.reset();   // clean end of segment
+      continue;
+    }
+
+    uint64_t delta = 0;
+    int shift = 0;
+    int c;
+    do {
+      c = readByte();
+      if (c < 0 || shift > 63) break;
+      delta |= (uint64_t)(c & 0x7F) << shift;
+      shift += 7;
+    } while (c & 0x80);
+
+    uint8_t lengthBytes[2];
+    bool ok = c >= 0 && !(c & 0x80) && readBytes(lengthBytes, 2);
+    uint16_t length = ok ? (uint16_t)(lengthBytes[0] | (lengthBytes[1] << 8)) : 0;
+    ok = ok && length <= TRACE_MAX_PAYLOAD && readBytes(event.data, length);
+    if (!ok) {
+      // Torn write at power loss: drop the rest of this segment
+      corrupt++;
+      file.reset();
+      continue;
+    }
+
+    lastUs += delta;
+    event.channel = (uint8_t)channel;
+    event.timestampUs = lastUs;
+    event.length = length;
+    return true;
+  }
+}
+
+// ============================================================================
+// SERIAL TAP
+// ============================================================================
+int TapSerialPort::read() {
+  int c = inner.read();
+  if (c >= 0 && tap) {
+    uint8_t b = (uint8_t)c;
+    tap(rxChannel, &b, 1, tapContext);
+  }
+  return c;
+}
+
+size_t TapSerialPort::write(const uint8_t* data, size_t length) {
+  if (tap) tap(txChannel, data, length, tapContext);
+  return inner.write(data, length);
+}
@@ -0,0 +1,175 @@
+#ifndef AGNI_TRACE_H
+#define AGNI_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <AgniHal.h>
+
+// ============================================================================
+// RAW I/O TRACE
+// ============================================================================
+// Timestamped raw bytes from the RS485 bus, the GPS UART and BLE command
+// writes, stored as numbered segment files on the card:
+//
+//   /trace/trace_<n>.bin
+//     header  "AGTR" u8 version u8 0 u16 0 u64 baseUs    (16 bytes, LE)
+//     record  u8 channel, varint deltaUs, u16 length LE, payload
+//
+// deltaUs is relative to the previous record in the same segment (the
+// first one to baseUs). Bytes on one channel that arrive within
+// TRACE_COALESCE_US of each other share a record, so per-byte UART
+// captures cost ~4 bytes of overhead per burst rather than per byte.
+// Only the newest segments that fit the ring budget are kept.
+
+#define TRACE_DIR            "/trace"
+#define TRACE_FILE_PREFIX    "trace_"
+#define TRACE_FILE_SUFFIX    ".bin"
+#define TRACE_VERSION        1
+#define TRACE_HEADER_BYTES   16
+#define TRACE_BUFFER_BYTES   4096   // per RAM buffer, two are used
+#define TRACE_MAX_PAYLOAD    512
+#define TRACE_COALESCE_US    5000   // ~2 characters at 4800 baud
+
+enum TraceChannel {
+  TRACE_RS485_RX = 1,
+  TRACE_RS485_TX = 2,
+  TRACE_GPS_RX = 3,
+  TRACE_BLE_COMMAND = 4
+};
+
+const char* traceChannelName(uint8_t channel);
+
+struct TraceStats {
+  uint32_t records = 0;
+  uint32_t droppedBytes = 0;    // RAM buffer was full
+  uint32_t writeFailures = 0;
+  uint32_t segmentsRemoved = 0;
+  uint64_t bytesWritten = 0;
+};
+
+/**
+ * @brief Double-buffered trace recorder.
+ *
+ * record() and swapBuffers() only touch RAM and must be serialised by the
+ * caller (the firmware wraps them in a critical section because they run
+ * on several tasks). flush() does the card I/O and runs on one task.
+ */
+class TraceWriter {
+public:
+  TraceWriter(HalFileSystem &fs, uint32_t budgetBytes, uint32_t segmentBytes);
+
+  /** @brief Creates TRACE_DIR and continues after the newest segment. */
+  bool begin();
+
+  bool record(uint8_t channel, uint64_t timestampUs, const uint8_t* data, size_t length);
+  /**
+   * @brief Hands the active buffer to flush().
+   * @return false if there is nothing new or the last swap isn't flushed yet
+   */
+  bool swapBuffers();
+  /** @brief Appends the swapped buffer to the current segment. */
+  bool flush();
+
+  uint32_t segmentNumber() const { return newestSegment; }
+  const TraceStats &stats() const { return counters; }
+
+private:
+  struct Buffer {
+    uint8_t data[TRACE_BUFFER_BYTES];
+    size_t length = 0;
+    uint64_t baseUs = 0;        // timestamp the first delta is relative to
+  };
+
+  bool openSegment(uint64_t baseUs);
+  void enforceBudget();
+
+  HalFileSystem &fs;
+  uint32_t segmentBytes;
+  uint32_t maxSegments;
+  uint32_t oldestSegment = 0;
+  uint32_t newestSegment = 0;
+  uint32_t segmentLength = 0;
+
+  Buffer buffers[2];
+  Buffer* active = &buffers[0];
+  Buffer* flushing = &buffers[1];
+  bool flushPending = false;
+  uint64_t lastRecordUs = 0;
+  uint64_t lastByteUs = 0;
+  size_t lastRecordOffset = 0;  // in active, of the record coalescing can extend
+  uint8_t lastChannel = 0;
+
+  TraceStats counters;
+};
+
+struct TraceEvent {
+  uint8_t channel;
+  uint64_t timestampUs;
+  uint16_t length;
+  uint8_t data[TRACE_MAX_PAYLOAD];
+};
+
+/**
+ * @brief Reads every segment in TRACE_DIR (oldest first) as one stream.
+ */
+class TraceReader {
+public:
+  TraceReader(HalFileSystem &fs, const char* dir = TRACE_DIR);
+
+  /** @brief Finds the segments. @return false if there are none. */
+  bool open();
+  bool next(TraceEvent &event);
+
+  size_t segmentCount() const { return segments.size(); }
+  /** @brief Records or segment headers that could not be decoded. */
+  uint32_t corruptCount() const { return corrupt; }
+
+private:
+  bool openNextSegment();
+  int readByte();
+  bool readBytes(uint8_t* out, size_t length);
+
+  HalFileSystem &fs;
+  char dirPath[48];
+  std::vector<uint32_t> segments;
+  size_t segmentIndex = 0;
+  std::unique_ptr<HalFile> file;
+  uint64_t lastUs = 0;
+  uint8_t buffer[512];
+  size_t bufferLength = 0;
+  size_t bufferPos = 0;
+  uint32_t corrupt = 0;
+};
+
+typedef void (*TraceTap)(uint8_t channel, const uint8_t* data, size_t length, void* context);
+
+/**
+ * @brief Serial port decorator that reports every byte read and written
+ * to a tap before passing it on.
+ */
+class TapSerialPort : public HalSerialPort {
+public:
+  TapSerialPort(HalSerialPort &inner, uint8_t rxChannel, uint8_t txChannel)
+    : inner(inner), rxChannel(rxChannel), txChannel(txChannel) {}
+
+  void setTap(TraceTap callback, void* context) { tap = callback; tapContext = context; }
+
+  void begin(uint32_t baud) override { inner.begin(baud); }
+  void end() override { inner.end(); }
+  uint32_t baud() override { return inner.baud(); }
+  int available() override { return inner.available(); }
+  int read() override;
+  size_t write(const uint8_t* data, size_t length) override;
+  void flush() override { inner.flush(); }
+  void setTransmit(bool enable) override { inner.setTransmit(enable); }
+
+private:
+  HalSerialPort &inner;
+  uint8_t rxChannel;
+  uint8_t txChannel;
+  TraceTap tap = nullptr;
+  void* tapContext = nullptr;
+};
+
+#endif
@@ -0,0 +1,636 @@
+#include "AgniTransfer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+bool TransferEngine::start(const char* path, uint8_t protocolVersion, TransferSource* fileSource) {
+  if (state != STATE_IDLE) return false;
+  abortRequested = false;
+  if (!fileSource) {
+    dir = fs.openDir(path);
+    if (!dir) return false;
+  }
+  source = fileSource;
+  strncpy(dirPath, path, sizeof(dirPath) - 1);
+  dirPath[sizeof(dirPath) - 1] = '\0';
+  pendingLength = 0;
+  pendingDataBytes = 0;
+  resendCount = 0;
+
+  // Sequenced chunks must all cover the same number of file bytes, so the
+  // size is fixed here from the link as negotiated when the client asked.
+  version = protocolVersion == PROTO_VERSION_SEQUENCED ? PROTO_VERSION_SEQUENCED : PROTO_VERSION_LEGACY;
+  size_t limit = chunkBytes;
+  size_t linkPayload = sink.maxPayload();
+  if (linkPayload > 0 && limit > linkPayload) limit = linkPayload;
+  if (version == PROTO_VERSION_SEQUENCED) limit = limit > PROTO_DATA_HEADER ? limit - PROTO_DATA_HEADER : 1;
+  dataBytes = limit;
+  compressActive = compressRequested && version == PROTO_VERSION_SEQUENCED;
+
+  tally = TransferProgress();
+  tally.startedMs = clock.millis();
+  if (source) {
+    tally.plannedFiles = source->plannedFiles();
+    tally.plannedBytes = source->plannedBytes();
+  }
+  planPending = source && version == PROTO_VERSION_SEQUENCED;
+
+  state = STATE_NEXT_FILE;
+  return true;
+}
+
+bool TransferEngine::requestResend(const char* name, const ChunkRange* ranges, size_t count) {
+  // Only a plain file name of the transfer's directory: "../" or a path
+  // would let a client read any file on the card
+  if (version != PROTO_VERSION_SEQUENCED || dirPath[0] == '\0' || count == 0 ||
+      resendCount >= TRANSFER_RESEND_QUEUE || name[0] == '\0' || strchr(name, '/') || strstr(name, "..")) {
+    counters->nacksRejected++;
+    return false;
+  }
+  ResendRequest &r = resendQueue[resendCount];
+  strncpy(r.name, name, sizeof(r.name) - 1);
+  r.name[sizeof(r.name) - 1] = '\0';
+  if (count > PROTO_MAX_NACK_RANGES) count = PROTO_MAX_NACK_RANGES;
+  memcpy(r.ranges, ranges, count * sizeof(ChunkRange));
+  r.count = (uint8_t)count;
+  resendCount++;
+  counters->nacks++;
+  return true;
+}
+
+void TransferEngine::setChunkSize(size_t bytes) {
+  if (bytes == 0) bytes = 1;
+  chunkBytes = bytes > TRANSFER_MAX_CHUNK ? TRANSFER_MAX_CHUNK : bytes;
+}
+
+void TransferEngine::setCompression(bool enabled, uint8_t dictionary) {
+  // An id this build doesn't know falls back to no dictionary, and FILE_START says so
+  size_t length = 0;
+  compressRequested = enabled;
+  compressDictionary = lzDictionary(dictionary, length) ? dictionary : LZ_DICTIONARY_NONE;
+}
+
+void TransferEngine::closeAll() {
+  if (file) {
+    file->close();
+    file.reset();
+  }
+  if (dir) {
+    dir->close();
+    dir.reset();
+  }
+  pendingLength = 0;
+  pendingDataBytes = 0;
+}
+
+bool TransferEngine::queueText(const char* text) {
+  size_t len = strlen(text);
+  if (len > sizeof(pending)) len = sizeof(pending);
+  memcpy(pending, text, len);
+  pendingLength = len;
+  pendingDataBytes = 0;
+  return flushPending();
+}
+
+/**
+ * @brief Offers the pending notification to the sink.
+ * @return true once it has been accepted
+ */
+bool TransferEngine::flushPending() {
+  if (pendingLength == 0) return true;
+  if (!sink.notify(pending, pendingLength)) {
+    counters->congested++;
+    return false;
+  }
+  uint32_t now = clock.millis();
+  counters->notifications++;
+  counters->bytes += pendingLength;
+  counters->byteRate.add(pendingLength, now);
+  counters->notifyRate.add(1, now);
+  bytesSent += pendingDataBytes;
+  pendingLength = 0;
+  pendingDataBytes = 0;
+  return true;
+}
+
+// ============================================================================
+// COMPRESSION
+// ============================================================================
+/** @brief Rewinds the open file and starts a fresh encoder over it. */
+void TransferEngine::restartCompression(uint32_t size) {
+  size_t dictionaryLength = 0;
+  const uint8_t* dictionary = lzDictionary(compressDictionary, dictionaryLength);
+  encoder.begin(dictionary, dictionaryLength);
+  compressSize = size;
+  rawRead = 0;
+  compressedOffset = 0;
+  if (file) file->seek(0);
+}
+
+/**
+ * @brief Fills out with up to max bytes of encoder output, reading the
+ * file straight into the encoder's window as needed.
+ * @return bytes produced; 0 with failed unset means the file is done
+ */
+size_t TransferEngine::readCompressed(uint8_t* out, size_t max, bool &failed) {
+  size_t total = 0;
+  failed = false;
+  while (total < max) {
+    total += encoder.read(out + total, max - total);
+    if (total == max || encoder.done()) break;
+    if (rawRead >= compressSize) {
+      encoder.finish();
+      continue;
+    }
+    size_t space;
+    uint8_t* in = encoder.inputBuffer(space);
+    if (space == 0) {
+      if (encoder.available() == 0) failed = true;
+      if (failed) break;
+      continue;
+    }
+    size_t want = compressSize - rawRead;
+    if (want > space) want = space;
+    size_t n = file->read(in, want);
+    if (n == 0) {
+      failed = true;
+      break;
+    }
+    if (crcPass) fileCrc = crc32_update(fileCrc, in, n);
+    encoder.commitInput(n);
+    rawRead += n;
+  }
+  compressedOffset += total;
+  return total;
+}
+
+// ============================================================================
+// SELECTIVE RETRANSMISSION
+// ============================================================================
+TransferEvent TransferEngine::beginResend() {
+  ResendRequest &r = resendQueue[0];
+  resumeState = state;
+  state = STATE_RESENDING;
+  resendRange = 0;
+  resendNext = r.ranges[0].first;
+
+  char path[sizeof(dirPath) + sizeof(r.name) + 1];
+  snprintf(path, sizeof(path), "%s/%s", dirPath, r.name);
+  file = fs.open(path, HAL_FILE_READ);
+  resendSize = file ? file->size() : 0;
+  if (!file) resendRange = r.count;   // answer with RESEND_END alone
+  else if (compressActive) {
+    crcPass = false;
+    restartCompression(resendSize);
+  }
+
+  char message[sizeof(r.name) + 16];
+  snprintf(message, sizeof(message), PROTO_RESEND_START "%s", r.name);
+  return queueText(message) ? TRANSFER_PROGRESS : TRANSFER_CONGESTED;
+}
+
+void TransferEngine::finishResend() {
+  if (file) {
+    file->close();
+    file.reset();
+  }
+  resendCount--;
+  memmove(&resendQueue[0], &resendQueue[1], resendCount * sizeof(ResendRequest));
+  state = resumeState;
+}
+
+TransferEvent TransferEngine::pumpResend() {
+  ResendRequest &r = resendQueue[0];
+  // Skip to the next chunk that exists in the file
+  while (resendRange < r.count &&
+         (resendNext > r.ranges[resendRange].last || (!compressActive && resendNext * dataBytes >= resendSize))) {
+    if (++resendRange < r.count) resendNext = r.ranges[resendRange].first;
+  }
+
+  if (resendRange >= r.count) {
+    char message[sizeof(r.name) + 16];
+    snprintf(message, sizeof(message), PROTO_RESEND_END "%s", r.name);
+    if (!queueText(message)) return TRANSFER_CONGESTED;
+    finishResend();
+    return TRANSFER_RESEND_DONE;
+  }
+
+  uint64_t readStartUs = clock.micros();
+  size_t bytesRead = 0;
+  uint32_t offset = resendNext * dataBytes;
+  if (compressActive) {
+    // Chunks are slices of the compressed stream: re-encode up to the offset
+    bool failed = false;
+    if (offset < compressedOffset) restartCompression(resendSize);
+    while (compressedOffset < offset && !failed) {
+      size_t skip = offset - compressedOffset;
+      if (skip > sizeof(pending)) skip = sizeof(pending);
+      if (readCompressed(pending, skip, failed) == 0) break;
+    }
+    if (compressedOffset == offset && !failed) {
+      bytesRead = readCompressed(pending + PROTO_DATA_HEADER, dataBytes, failed);
+    }
+  } else if (file->seek(offset)) {
+    bytesRead = file->read(pending + PROTO_DATA_HEADER, dataBytes);
+  }
+  counters->readUs.record((uint32_t)(clock.micros() - readStartUs));
+  uint16_t chunk = (uint16_t)resendNext++;
+  if (bytesRead == 0) {
+    // Past the end of the file; the client will NACK it again if it matters
+    if (compressActive) resendNext = r.ranges[resendRange].last + 1;
+    return TRANSFER_PROGRESS;
+  }
+
+  pending[0] = PROTO_DATA_MARKER;
+  pending[1] = (uint8_t)(chunk & 0xFF);
+  pending[2] = (uint8_t)(chunk >> 8);
+  pendingLength = PROTO_DATA_HEADER + bytesRead;
+  pendingDataBytes = 0;
+  counters->resentChunks++;
+  return flushPending() ? TRANSFER_PROGRESS : TRANSFER_CONGESTED;
+}
+
+// ============================================================================
+// PUMP
+// ============================================================================
+TransferEvent TransferEngine::pump() {
+  if (abortRequested) {
+    closeAll();
+    state = STATE_IDLE;
+    resendCount = 0;
+    abortRequested = false;
+    return TRANSFER_IDLE;
+  }
+
+  // A notification the link refused earlier goes first
+  if (pendingLength > 0) {
+    if (!flushPending()) return TRANSFER_CONGESTED;
+    if (state == STATE_FINISHING) {
+      state = STATE_IDLE;
+      return TRANSFER_COMPLETE;
+    }
+    if (state == STATE_RESENDING && resendRange >= resendQueue[0].count) {
+      finishResend();
+      return TRANSFER_RESEND_DONE;
+    }
+    return TRANSFER_PROGRESS;
+  }
+
+  // NACKs are served between files so chunks never interleave
+  if (resendCount > 0 && (state == STATE_IDLE || state == STATE_NEXT_FILE)) return beginResend();
+  if (state == STATE_IDLE) return TRANSFER_IDLE;
+
+  char message[TRANSFER_MAX_CHUNK];
+  switch (state) {
+    case STATE_NEXT_FILE: {
+      if (planPending) {
+        planPending = false;
+        snprintf(message, sizeof(message), PROTO_PLAN "%lu" PROTO_BYTES_SEPARATOR "%llu",
+          (unsigned long)tally.plannedFiles, (unsigned long long)tally.plannedBytes);
+        return queueText(message) ? TRANSFER_PROGRESS : TRANSFER_CONGESTED;
+      }
+
+      HalDirEntry entry;
+      bool found = false;
+      if (source) {
+        found = source->next(entry.name, sizeof(entry.name));
+      } else {
+        while (dir && dir->next(entry)) {
+          if (!entry.isDirectory) {
+            found = true;
+            break;
+          }
+        }
+      }
+      if (!found) {
+        // No more files
+        source = NULL;
+        closeAll();
+        state = STATE_FINISHING;
+        if (!queueText(PROTO_COMPLETE_MESSAGE)) return TRANSFER_CONGESTED;
+        state = STATE_IDLE;
+        return TRANSFER_COMPLETE;
+      }
+
+      char path[sizeof(dirPath) + sizeof(entry.name) + 1];
+      snprintf(path, sizeof(path), "%s/%s", dirPath, entry.name);
+      file = fs.open(path, HAL_FILE_READ);
+      if (!file) {
+        closeAll();
+        state = STATE_IDLE;
+        return TRANSFER_ERROR;
+      }
+      strncpy(fileName, entry.name, sizeof(fileName) - 1);
+      fileName[sizeof(fileName) - 1] = '\0';
+      fileSize = file->size();
+      bytesSent = 0;
+      sequence = 0;
+      fileCrc = 0;
+      state = STATE_STREAMING;
+      if (compressActive) {
+        crcPass = true;
+        restartCompression(fileSize);
+      }
+
+      if (compressActive) {
+        snprintf(message, sizeof(message), PROTO_FILE_START "%s" PROTO_SIZE_SEPARATOR "%lu" PROTO_CHUNK_SEPARATOR "%u"
+          PROTO_LZ_SEPARATOR "%u", fileName, (unsigned long)fileSize, (unsigned)dataBytes, (unsigned)compressDictionary);
+      } else if (version == PROTO_VERSION_SEQUENCED) {
+        snprintf(message, sizeof(message), PROTO_FILE_START "%s" PROTO_SIZE_SEPARATOR "%lu" PROTO_CHUNK_SEPARATOR "%u",
+          fileName, (unsigned long)fileSize, (unsigned)dataBytes);
+      } else {
+        snprintf(message, sizeof(message), PROTO_FILE_START "%s" PROTO_SIZE_SEPARATOR "%lu", fileName, (unsigned long)fileSize);
+      }
+      queueText(message);
+      return TRANSFER_FILE_STARTED;
+    }
+
+    case STATE_STREAMING: {
+      if (compressActive && !encoder.done()) {
+        uint32_t rawBefore = rawRead;
+        bool failed = false;
+        uint64_t readStartUs = clock.micros();
+        size_t produced = readCompressed(pending + PROTO_DATA_HEADER, dataBytes, failed);
+        counters->readUs.record((uint32_t)(clock.micros() - readStartUs));
+        if (failed) {
+          closeAll();
+          state = STATE_IDLE;
+          return TRANSFER_ERROR;
+        }
+        if (produced > 0) {
+          pending[0] = PROTO_DATA_MARKER;
+          pending[1] = (uint8_t)(sequence & 0xFF);
+          pending[2] = (uint8_t)(sequence >> 8);
+          sequence++;
+          pendingLength = PROTO_DATA_HEADER + produced;
+          pendingDataBytes = rawRead - rawBefore;
+          counters->rawBytes += pendingDataBytes;
+          counters->compressedBytes += produced;
+          return flushPending() ? TRANSFER_PROGRESS : TRANSFER_CONGESTED;
+        }
+        // Encoder drained: fall through to FILE_END
+      } else if (!compressActive && bytesSent < fileSize) {
+        size_t header = 0;
+        size_t readBytes = dataBytes;
+        if (version == PROTO_VERSION_SEQUENCED) {
+          header = PROTO_DATA_HEADER;
+        } else {
+          // Never hand the sink more than one notification can carry
+          readBytes = chunkBytes;
+          size_t linkPayload = sink.maxPayload();
+          if (linkPayload > 0 && readBytes > linkPayload) readBytes = linkPayload;
+        }
+        uint64_t readStartUs = clock.micros();
+        size_t bytesRead = file->read(pending + header, readBytes);
+        counters->readUs.record((uint32_t)(clock.micros() - readStartUs));
+        if (bytesRead == 0) {
+          closeAll();
+          state = STATE_IDLE;
+          return TRANSFER_ERROR;
+        }
+        if (header) {
+          pending[0] = PROTO_DATA_MARKER;
+          pending[1] = (uint8_t)(sequence & 0xFF);
+          pending[2] = (uint8_t)(sequence >> 8);
+          sequence++;
+        }
+        fileCrc = crc32_update(fileCrc, pending + header, bytesRead);
+        counters->rawBytes += bytesRead;
+        counters->compressedBytes += bytesRead;
+        pendingLength = header + bytesRead;
+        pendingDataBytes = bytesRead;
+        return flushPending() ? TRANSFER_PROGRESS : TRANSFER_CONGESTED;
+      }
+
+      // File transfer complete, move to next file
+      file->close();
+      file.reset();
+      counters->files++;
+      tally.files++;
+      tally.bytes += fileSize;
+      if (tally.files == 1) tally.firstFileMs = clock.millis() - tally.startedMs;
+      state = STATE_NEXT_FILE;
+      if (version == PROTO_VERSION_SEQUENCED) {
+        snprintf(message, sizeof(message), PROTO_FILE_END "%s" PROTO_CRC_SEPARATOR "%08lx" PROTO_CHUNKS_SEPARATOR "%u",
+          fileName, (unsigned long)fileCrc, (unsigned)sequence);
+      } else {
+        snprintf(message, sizeof(message), PROTO_FILE_END "%s", fileName);
+      }
+      queueText(message);
+      return TRANSFER_FILE_DONE;
+    }
+
+    case STATE_RESENDING:
+      return pumpResend();
+
+    default:
+      return TRANSFER_IDLE;
+  }
+}
+
+// ============================================================================
+// CONCURRENT SESSIONS
+// ============================================================================
+bool TransferSessions::add(TransferEngine &engine) {
+  if (count >= TRANSFER_MAX_SESSIONS) return false;
+  engine.useStats(shared);
+  sessions[count++].engine = &engine;
+  return true;
+}
+
+int TransferSessions::open(uint16_t connId) {
+  int existing = find(connId);
+  if (existing != TRANSFER_NO_SESSION) return existing;
+  for (size_t i = 0; i < count; i++) {
+    TransferSession &s = sessions[i];
+    if (s.open) continue;
+    s.open = true;
+    s.connId = connId;
+    s.openedMs = clock.millis();
+    s.dueMs = s.openedMs;
+    s.starts = 0;
+    s.files = 0;
+    return (int)i;
+  }
+  return TRANSFER_NO_SESSION;
+}
+
+void TransferSessions::close(uint16_t connId) {
+  int index = find(connId);
+  if (index == TRANSFER_NO_SESSION) return;
+  TransferSession &s = sessions[index];
+  // Same task as pump(), so the files can be closed right away
+  s.engine->abort();
+  s.engine->pump();
+  s.open = false;
+}
+
+int TransferSessions::find(uint16_t connId) const {
+  for (size_t i = 0; i < count; i++) {
+    if (sessions[i].open && sessions[i].connId == connId) return (int)i;
+  }
+  return TRANSFER_NO_SESSION;
+}
+
+bool TransferSessions::start(int session, const char* dir, uint8_t protocolVersion, TransferSource* source) {
+  if (session < 0 || (size_t)session >= count || !sessions[session].open) return false;
+  TransferSession &s = sessions[session];
+  if (!s.engine->start(dir, protocolVersion, source)) return false;
+  s.starts++;
+  s.dueMs = clock.millis();
+  return true;
+}
+
+void TransferSessions::abort(int session) {
+  if (session < 0 || (size_t)session >= count) return;
+  sessions[session].engine->abort();
+  sessions[session].engine->pump();
+}
+
+void TransferSessions::abortAll() {
+  for (size_t i = 0; i < count; i++) sessions[i].engine->abort();
+}
+
+size_t TransferSessions::openCount() const {
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) n += sessions[i].open ? 1 : 0;
+  return n;
+}
+
+size_t TransferSessions::activeCount() const {
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) n += sessions[i].engine->active() ? 1 : 0;
+  return n;
+}
+
+int TransferSessions::pump(TransferEvent &event) {
+  event = TRANSFER_IDLE;
+  uint32_t now = clock.millis();
+  for (size_t step = 1; step <= count; step++) {
+    size_t index = (lastServed + step) % count;
+    TransferSession &s = sessions[index];
+    if (!s.engine->active() || (int32_t)(s.dueMs - now) > 0) continue;
+    event = s.engine->pump();
+    lastServed = index;
+    if (event == TRANSFER_FILE_DONE) s.files++;
+    // Opening the next file sends nothing, its FILE_START can follow at once
+    s.dueMs = s.engine->betweenFiles() ? now : now + intervalMs;
+    return (int)index;
+  }
+  return TRANSFER_NO_SESSION;
+}
+
+uint32_t TransferSessions::msUntilDue() const {
+  uint32_t now = clock.millis();
+  uint32_t wait = UINT32_MAX;
+  for (size_t i = 0; i < count; i++) {
+    const TransferSession &s = sessions[i];
+    if (!s.engine->active()) continue;
+    int32_t left = (int32_t)(s.dueMs - now);
+    if (left <= 0) return 0;
+    if ((uint32_t)left < wait) wait = (uint32_t)left;
+  }
+  return wait;
+}
+
+// ============================================================================
+// ORDERED RECORD TRANSFERS
+// ============================================================================
+const char* transferOrderName(TransferOrder order) {
+  switch (order) {
+    case TRANSFER_ORDER_NEWEST:   return "newest";
+    case TRANSFER_ORDER_PRIORITY: return "priority";
+    case TRANSFER_ORDER_REQUEST:  return "request";
+    default:                      return "directory";
+  }
+}
+
+void RecordQueue::plan(TransferOrder order, const RecordRange* requested, size_t count) {
+  mode = order;
+  newest = store.recordCount();
+  cursor = newest;
+  pass = 0;
+  rangeIndex = 0;
+  batchCount = 0;
+  const RecordIndexSummary &summary = store.indexSummary();
+  flaggedLeft = summary.flagged;
+  if (mode != TRANSFER_ORDER_REQUEST) {
+    files = summary.records;
+    bytes = summary.bytes;
+    // Nothing flagged: skip straight to the plain newest-first pass
+    if (mode == TRANSFER_ORDER_PRIORITY && flaggedLeft == 0) pass = 1;
+    return;
+  }
+
+  rangeCount = count > PROTO_MAX_RECORD_RANGES ? PROTO_MAX_RECORD_RANGES : count;
+  if (rangeCount) memcpy(ranges, requested, rangeCount * sizeof(RecordRange));
+  files = 0;
+  bytes = 0;
+  for (size_t i = 0; i < rangeCount; i++) {
+    for (uint32_t n = ranges[i].first; n <= ranges[i].last && n <= (uint32_t)newest; n++) {
+      RecordIndexEntry entry;
+      if (!entryAt((int)n, true, entry) || !entry.present) continue;
+      files++;
+      bytes += entry.bytes;
+    }
+  }
+  cursor = rangeCount ? (int)ranges[0].first : 0;
+}
+
+/**
+ * @brief The index entry for one record number, through a batch read in
+ * the direction of the walk.
+ */
+bool RecordQueue::entryAt(int number, bool forward, RecordIndexEntry &entry) {
+  if (batchCount == 0 || number < batchFirst || number >= batchFirst + (int)batchCount) {
+    int first = forward ? number : number - RECORD_INDEX_BATCH + 1;
+    if (first < 1) first = 1;
+    batchFirst = first;
+    batchCount = store.readIndex(first, batch, RECORD_INDEX_BATCH);
+    if (number < batchFirst || number >= batchFirst + (int)batchCount) return false;
+  }
+  entry = batch[number - batchFirst];
+  return true;
+}
+
+bool RecordQueue::nextNumber(int &number) {
+  RecordIndexEntry entry;
+  if (mode == TRANSFER_ORDER_REQUEST) {
+    while (rangeIndex < rangeCount) {
+      const RecordRange &r = ranges[rangeIndex];
+      if (cursor < 1 || (uint32_t)cursor > r.last || cursor > newest) {
+        if (++rangeIndex < rangeCount) cursor = (int)ranges[rangeIndex].first;
+        continue;
+      }
+      number = cursor++;
+      if (entryAt(number, true, entry) && entry.present) return true;
+    }
+    return false;
+  }
+
+  while (pass < 2) {
+    if (cursor < 1 || (mode == TRANSFER_ORDER_PRIORITY && pass == 0 && flaggedLeft == 0)) {
+      if (mode != TRANSFER_ORDER_PRIORITY) return false;
+      pass++;
+      cursor = newest;
+      continue;
+    }
+    number = cursor--;
+    if (!entryAt(number, false, entry) || !entry.present) continue;
+    if (mode != TRANSFER_ORDER_PRIORITY) return true;
+    bool flagged = entry.priority != 0;
+    if (pass == 0 && flagged) {
+      flaggedLeft--;
+      return true;
+    }
+    if (pass == 1 && !flagged) return true;
+  }
+  return false;
+}
+
+bool RecordQueue::next(char* name, size_t capacity) {
+  int number;
+  if (!nextNumber(number)) return false;
+  snprintf(name, capacity, RECORD_FILE_PREFIX "%d" RECORD_FILE_SUFFIX, number);
+  return true;
+}
@@ -0,0 +1,332 @@
+#ifndef AGNI_TRANSFER_H
+#define AGNI_TRANSFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <AgniCompress.h>
+#include <AgniHal.h>
+#include <AgniMetrics.h>
+#include <AgniProtocol.h>
+#include <AgniStorage.h>
+
+// ============================================================================
+// BLE FILE TRANSFER ENGINE
+// ============================================================================
+// Streams every file of a directory as notifications, framed as described
+// in AgniProtocol.h. pump() sends at most one notification per call; the
+// caller paces it.
+#define TRANSFER_MAX_CHUNK      512
+#define TRANSFER_DEFAULT_CHUNK  256
+#define TRANSFER_RESEND_QUEUE   4      // NACKs held until the engine can serve them
+
+enum TransferEvent {
+  TRANSFER_IDLE,          // nothing to do
+  TRANSFER_PROGRESS,      // a data chunk went out
+  TRANSFER_FILE_STARTED,  // FILE_START sent
+  TRANSFER_FILE_DONE,     // FILE_END sent
+  TRANSFER_COMPLETE,      // TRANSFER_COMPLETE sent, engine is idle again
+  TRANSFER_CONGESTED,     // sink refused the notification, retry later
+  TRANSFER_ERROR,         // could not read the card, engine is idle again
+  TRANSFER_RESEND_DONE    // RESEND_END sent for one NACK
+};
+
+struct TransferStats {
+  uint32_t files = 0;
+  uint32_t notifications = 0;
+  uint32_t congested = 0;
+  uint32_t nacks = 0;          // NACKs accepted
+  uint32_t nacksRejected = 0;  // queue full, no sequenced transfer to repair, or not a plain file name
+  uint32_t resentChunks = 0;
+  uint64_t bytes = 0;
+  uint64_t rawBytes = 0;        // file content before compression
+  uint64_t compressedBytes = 0; // the same content on the air
+  LatencyHistogram readUs;   // one chunk read from the card
+  RateMeter byteRate;
+  RateMeter notifyRate;
+};
+
+/** @brief Where one transfer stands; planned totals are 0 when unknown (directory order). */
+struct TransferProgress {
+  uint32_t plannedFiles = 0;
+  uint64_t plannedBytes = 0;
+  uint32_t files = 0;            // finished, FILE_END sent
+  uint64_t bytes = 0;            // file bytes of those
+  uint32_t startedMs = 0;
+  uint32_t firstFileMs = 0;      // start to the first FILE_END, 0 until then
+};
+
+/**
+ * @brief Picks the files of a transfer and their order instead of the
+ * directory listing. Names are relative to the transfer's directory.
+ */
+class TransferSource {
+public:
+  virtual ~TransferSource() {}
+  /** @brief The next file to send; false once there are no more. */
+  virtual bool next(char* name, size_t capacity) = 0;
+  virtual uint32_t plannedFiles() const = 0;
+  virtual uint64_t plannedBytes() const = 0;
+};
+
+class TransferEngine {
+public:
+  TransferEngine(HalFileSystem &fs, HalNotifySink &sink, HalClock &clock)
+    : fs(fs), sink(sink), clock(clock) {}
+
+  /**
+   * @brief Begins streaming every file in dir, or the files source names
+   * in its order. A sequenced transfer with a source opens with
+   * TRANSFER_PLAN. The source must outlive the transfer.
+   * @param protocolVersion PROTO_VERSION_LEGACY or PROTO_VERSION_SEQUENCED
+   * @return false if a transfer is already running or dir can't be opened
+   */
+  bool start(const char* dir, uint8_t protocolVersion = PROTO_VERSION_LEGACY, TransferSource* source = NULL);
+
+  /**
+   * @brief Queues a NACK from the client. The chunks are re-read from the
+   * card and sent between files, or straight away once the engine is idle.
+   * Only the owning task may call this.
+   * @return false if the queue is full or the last transfer wasn't sequenced
+   */
+  bool requestResend(const char* name, const ChunkRange* ranges, size_t count);
+
+  /** @brief Does one unit of work (at most one notification). */
+  TransferEvent pump();
+
+  /**
+   * @brief Stops the transfer. Safe from another task: files are closed by
+   * the next pump() on the owning task.
+   */
+  void abort() { abortRequested = true; }
+
+  /** @brief True from start() until the engine is idle again, or while NACKs are queued. */
+  bool active() const { return state != STATE_IDLE || resendCount > 0; }
+  /** @brief True while the next pump() will open the next file. */
+  bool betweenFiles() const { return state == STATE_NEXT_FILE && pendingLength == 0; }
+
+  void setChunkSize(size_t bytes);
+  size_t chunkSize() const { return chunkBytes; }
+  /**
+   * @brief LZ-compresses file content from the next start() on. Needs
+   * PROTO_VERSION_SEQUENCED; ignored for legacy transfers.
+   */
+  void setCompression(bool enabled, uint8_t dictionary = LZ_DICTIONARY_RECORD);
+  bool compressing() const { return compressActive; }
+  uint8_t protocolVersion() const { return version; }
+
+  const char* currentFileName() const { return fileName; }
+  uint32_t currentFileSize() const { return fileSize; }
+  uint32_t currentBytesSent() const { return bytesSent; }
+  const TransferProgress &progress() const { return tally; }
+  const TransferStats &stats() const { return *counters; }
+  TransferStats &stats() { return *counters; }
+  /** @brief Counts into shared instead of this engine's own stats, see TransferSessions. */
+  void useStats(TransferStats &shared) { counters = &shared; }
+
+private:
+  enum State {
+    STATE_IDLE,
+    STATE_NEXT_FILE,
+    STATE_STREAMING,
+    STATE_FINISHING,
+    STATE_RESENDING
+  };
+
+  struct ResendRequest {
+    char name[PROTO_NAME_MAX];
+    ChunkRange ranges[PROTO_MAX_NACK_RANGES];
+    uint8_t count;
+  };
+
+  bool queueText(const char* text);
+  bool flushPending();
+  void closeAll();
+  TransferEvent beginResend();
+  TransferEvent pumpResend();
+  void finishResend();
+  void restartCompression(uint32_t size);
+  size_t readCompressed(uint8_t* out, size_t max, bool &failed);
+
+  HalFileSystem &fs;
+  HalNotifySink &sink;
+  HalClock &clock;
+
+  State state = STATE_IDLE;
+  volatile bool abortRequested = false;
+  std::unique_ptr<HalDir> dir;
+  TransferSource* source = NULL;
+  bool planPending = false;
+  TransferProgress tally;
+  std::unique_ptr<HalFile> file;
+  char dirPath[64] = {0};
+  char fileName[64] = {0};
+  uint32_t fileSize = 0;
+  uint32_t bytesSent = 0;
+  size_t chunkBytes = TRANSFER_DEFAULT_CHUNK;
+
+  // Version 2 framing
+  uint8_t version = PROTO_VERSION_LEGACY;
+  size_t dataBytes = 0;          // file bytes per chunk, fixed for the transfer
+  uint16_t sequence = 0;
+  uint32_t fileCrc = 0;
+
+  // Compression: the encoder restarts at every file so each one (and any
+  // resent chunk of it) decodes on its own
+  bool compressRequested = false;
+  uint8_t compressDictionary = LZ_DICTIONARY_RECORD;
+  bool compressActive = false;
+  LzEncoder encoder;
+  uint32_t compressSize = 0;     // of the file being encoded
+  uint32_t rawRead = 0;          // file bytes fed to the encoder
+  uint32_t compressedOffset = 0; // encoder output position
+  bool crcPass = false;          // first pass over the file, fold into fileCrc
+
+  // NACKs; resendQueue[0] is the one being served while STATE_RESENDING
+  ResendRequest resendQueue[TRANSFER_RESEND_QUEUE];
+  uint8_t resendCount = 0;
+  uint8_t resendRange = 0;
+  uint32_t resendNext = 0;
+  uint32_t resendSize = 0;
+  State resumeState = STATE_IDLE;
+
+  // The notification being sent; kept until the sink accepts it
+  uint8_t pending[TRANSFER_MAX_CHUNK];
+  size_t pendingLength = 0;
+  size_t pendingDataBytes = 0;   // file payload carried by pending
+
+  TransferStats ownStats;
+  TransferStats* counters = &ownStats;
+};
+
+// ============================================================================
+// CONCURRENT SESSIONS
+// ============================================================================
+// Each connected client gets an engine of its own, so its own directory
+// cursor, file handle, chunk window and NACK queue, sending through a sink
+// bound to that connection. TransferSessions is the one pump serving them:
+// pump() goes to the next session after the one served last whose pacing
+// interval has passed, so two phones syncing at once each get the rate of
+// their own link instead of queueing behind each other. All engines count
+// into one TransferStats.
+#define TRANSFER_MAX_SESSIONS   3
+#define TRANSFER_NO_SESSION     -1
+
+struct TransferSession {
+  bool open = false;
+  uint16_t connId = 0;
+  uint32_t openedMs = 0;
+  uint32_t dueMs = 0;            // next pump
+  uint32_t starts = 0;           // transfers started since open
+  uint32_t files = 0;            // files finished since open
+  TransferEngine* engine = NULL;
+};
+
+class TransferSessions {
+public:
+  explicit TransferSessions(HalClock &clock) : clock(clock) {}
+
+  /** @brief Adds an engine, with a sink of its own, to the pool; false once full. */
+  bool add(TransferEngine &engine);
+
+  /**
+   * @brief Binds a free engine to a new connection.
+   * @return the session, or TRANSFER_NO_SESSION if all are taken
+   */
+  int open(uint16_t connId);
+  /** @brief Stops the connection's transfer, closes its files and frees the engine. */
+  void close(uint16_t connId);
+  int find(uint16_t connId) const;
+
+  /** @brief TransferEngine::start() for one session. */
+  bool start(int session, const char* dir, uint8_t protocolVersion = PROTO_VERSION_LEGACY,
+             TransferSource* source = NULL);
+  /** @brief Stops one session's transfer and closes its files now; the connection stays open. */
+  void abort(int session);
+  /** @brief Stops every transfer; the files are closed by the next pump(). */
+  void abortAll();
+
+  TransferEngine &engine(int session) { return *sessions[session].engine; }
+  const TransferSession &session(int session) const { return sessions[session]; }
+  size_t capacity() const { return count; }
+  size_t openCount() const;
+  size_t activeCount() const;
+  bool active() const { return activeCount() > 0; }
+
+  /** @brief Minimum time between two notifications of one session. */
+  void setInterval(uint32_t ms) { intervalMs = ms; }
+  /**
+   * @brief Does one unit of work for the next session that is due.
+   * @return the session pumped, TRANSFER_NO_SESSION if none was due
+   */
+  int pump(TransferEvent &event);
+  /** @brief 0 if a session is due now, UINT32_MAX if none is active. */
+  uint32_t msUntilDue() const;
+
+  const TransferStats &stats() const { return shared; }
+  TransferStats &stats() { return shared; }
+
+private:
+  HalClock &clock;
+  TransferSession sessions[TRANSFER_MAX_SESSIONS];
+  size_t count = 0;
+  size_t lastServed = 0;
+  uint32_t intervalMs = 0;
+  TransferStats shared;
+};
+
+// ============================================================================
+// ORDERED RECORD TRANSFERS
+// ============================================================================
+// What a user notices of a sync is how long it takes until the reading they
+// care about is on the phone, not the total time. RecordQueue walks the
+// record index (AgniStorage.h) rather than the directory, newest first,
+// flagged records first, or the numbers the client asked for, reading the
+// index backwards a batch at a time. The plan totals come from the index
+// summary, so planning costs nothing for the whole-card orders.
+enum TransferOrder {
+  TRANSFER_ORDER_DIRECTORY,      // no queue, directory listing order
+  TRANSFER_ORDER_NEWEST,
+  TRANSFER_ORDER_PRIORITY,       // flagged newest first, then the rest newest first
+  TRANSFER_ORDER_REQUEST         // the client's ranges, in its order
+};
+
+/** @brief "directory", "newest", "priority" or "request". */
+const char* transferOrderName(TransferOrder order);
+
+class RecordQueue : public TransferSource {
+public:
+  explicit RecordQueue(RecordStore &store) : store(store) {}
+
+  /**
+   * @brief Plans the records that exist now; later appends wait for the
+   * next transfer. ranges are used by TRANSFER_ORDER_REQUEST only.
+   */
+  void plan(TransferOrder order, const RecordRange* ranges = NULL, size_t count = 0);
+  TransferOrder order() const { return mode; }
+
+  bool next(char* name, size_t capacity) override;
+  uint32_t plannedFiles() const override { return files; }
+  uint64_t plannedBytes() const override { return bytes; }
+
+private:
+  bool nextNumber(int &number);
+  bool entryAt(int number, bool forward, RecordIndexEntry &entry);
+
+  RecordStore &store;
+  TransferOrder mode = TRANSFER_ORDER_NEWEST;
+  int newest = 0;                // last record number when planned
+  int cursor = 0;                // next number to look at
+  uint8_t pass = 0;              // PRIORITY: 0 flagged, 1 the rest
+  uint32_t flaggedLeft = 0;
+  RecordRange ranges[PROTO_MAX_RECORD_RANGES];
+  size_t rangeCount = 0;
+  size_t rangeIndex = 0;
+  uint32_t files = 0;
+  uint64_t bytes = 0;
+
+  RecordIndexEntry batch[RECORD_INDEX_BATCH];
+  int batchFirst = 0;
+  size_t batchCount = 0;
+};
+
+#endif
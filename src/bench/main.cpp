@@ -0,0 +1,840 @@
+// ============================================================================
+// AGNI SOIL SENSOR - PIPELINE BENCHMARKS (host)
+// ============================================================================
+// End-to-end yardstick for the sample -> encode -> store -> transfer path:
+//
+//   pio run -e bench && .pio/build/bench/program --json bench_HEAD.json
+//   .pio/build/bench/program --compare bench_main.json
+//
+// encode    records/sec through encodeRecordJson()        (host wall clock)
+// store     RecordStore::append() latency percentiles     (host wall clock)
+// transfer  effective bytes/sec and notifications/record  (simulated link)
+//           for each MTU in --mtu-list at --conn-interval-ms, plain and
+//           with protocol 2 + LZ compression (".lz" metrics)
+// modbus    poll time per sample over the simulated bus, at the power-up
+//           rate and again after negotiating MODBUS_MAX_BAUD  (simulated wire)
+// bus       ModbusBus line time per cycle with 1, 2 and 4 probes at
+//           MODBUS_MAX_BAUD, the cycle rate that allows, and the cost of
+//           one dead probe once it is isolated            (simulated wire)
+// kernels   samples/sec of each AgniKernels backend over one column, after
+//           checking the backends agree bit for bit          (host wall clock)
+// rollup    rebuilding the rollup rings from archive blocks, checked
+//           against the incrementally built ones           (host wall clock)
+// placement each firmware task placement (core, priority, Modbus wait)
+//           on a two-core fixed-priority scheduler during a transfer:
+//           worst wake-up latency per task and share of transfer pump slots kept
+//           (simulated scheduler, modelled CPU costs below)
+//
+// Results are a flat {"metric": number} JSON object so two runs can be
+// diffed directly. --compare prints the change per metric and exits 1 if
+// any metric got worse by more than --tolerance percent.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <AgniSim.h>
+#include <AgniRecord.h>
+#include <AgniModbus.h>
+#include <AgniStorage.h>
+#include <AgniTransfer.h>
+#include <AgniArchive.h>
+#include <AgniKernels.h>
+#include <AgniRollup.h>
+#include <AgniBus.h>
+
+#define BENCH_SCHEMA            1
+#define MODBUS_ADDRESS          1
+#define MODBUS_BAUD             4800
+#define MODBUS_TIMEOUT          800
+#define MODBUS_MAX_BAUD         9600
+#define BUS_BENCH_PERIOD_MS     1000
+#define TRANSFER_CHUNK_INTERVAL 5
+
+// Placement model. Line times come from the simulated bus; CPU costs are
+// ESP32-S3 estimates, the same for every placement so only the layout differs.
+#define PLACEMENT_SIM_SECONDS   60
+#define PLACEMENT_STEP_US       10
+#define PLACEMENT_TICK_US       1000   // FreeRTOS tick: equal priorities time-slice here
+#define PLACEMENT_SENSOR_PERIOD_US 1000000  // sensor_period_ms at its minimum, for more samples
+#define PLACEMENT_BLE_PRIORITY  19     // Bluedroid BTC/BTU, pinned to Core 0
+#define PLACEMENT_BLE_EVENT_US  600    // host work per connection event, 4 notifications
+#define PLACEMENT_PUMP_US       400    // SD chunk read + notify from the transfer pump
+#define PLACEMENT_GPS_US        300    // NMEA parse per GPS poll
+#define PLACEMENT_SD_APPEND_US  6000   // record append: SPI writes and card busy-wait
+#define PLACEMENT_RENDER_US     1500   // one OLED frame drawn into the buffer
+#define PLACEMENT_I2C_PUSH_US   23000  // 1024 bytes at 400 kHz, blocked in the I2C driver
+#define PLACEMENT_LOG_DRAIN_US  200    // LogDrainTask pass into the UART driver
+#define PLACEMENT_MODBUS_CPU_US 250    // frame build + decode per poll
+
+struct BenchOptions {
+  std::string workDir = "bench_sd";
+  std::string jsonPath;
+  std::string comparePath;
+  std::string label;
+  int encodeRecords = 20000;
+  int storeRecords = 500;
+  int transferRecords = 100;
+  int modbusSamples = 200;
+  int kernelSamples = 1000000;
+  int rollupSamples = 20000;
+  uint32_t connectionIntervalUs = 30000;
+  uint8_t packetsPerEvent = 4;
+  std::vector<int> mtus = {23, 185, 247, 517};
+  double tolerancePct = 10.0;
+};
+
+// Ordered so the JSON output is stable across runs
+typedef std::vector<std::pair<std::string, double> > Results;
+
+// ============================================================================
+// HELPERS
+// ============================================================================
+/** @brief Exact percentile of an unsorted sample set (nearest rank). */
+double percentile(std::vector<double> samples, double pct) {
+  if (samples.empty()) return 0;
+  std::sort(samples.begin(), samples.end());
+  size_t rank = (size_t)(pct / 100.0 * (samples.size() - 1) + 0.5);
+  return samples[std::min(rank, samples.size() - 1)];
+}
+
+void addPercentiles(Results &results, const std::string &prefix, const std::vector<double> &samples) {
+  results.push_back({prefix + "_p50", percentile(samples, 50)});
+  results.push_back({prefix + "_p90", percentile(samples, 90)});
+  results.push_back({prefix + "_p99", percentile(samples, 99)});
+  results.push_back({prefix + "_max", percentile(samples, 100)});
+}
+
+/**
+ * @brief Deterministic, varied records: a walk across a field with
+ * changing readings, so the encoder sees realistic number widths.
+ */
+SoilRecord syntheticRecord(uint32_t i) {
+  SoilRecord record;
+  record.id = i + 1;
+  record.soil.moisture = 18.0f + (i % 250) / 10.0f;
+  record.soil.temperature = 21.5f + (i % 90) / 10.0f;
+  record.soil.conductivity = 200 + (i * 7) % 900;
+  record.soil.ph = 5.2f + (i % 40) / 10.0f;
+  record.soil.nitrogen = 20 + (i * 3) % 80;
+  record.soil.phosphorus = 10 + (i * 5) % 50;
+  record.soil.potassium = 90 + (i * 11) % 160;
+  record.soil.basicValid = true;
+  record.soil.npkValid = true;
+  GpsFix &fix = record.fix;
+  fix.valid = true;
+  fix.latitude = 21.1458f + i * 0.00001f;
+  fix.longitude = 79.0882f + i * 0.000006f;
+  fix.altitude = 312.0f;
+  fix.satellites = 7 + i % 5;
+  fix.speedKmh = 0.8;
+  fix.hdop = 1.2;
+  fix.year = 2026;
+  fix.month = 10;
+  fix.day = 17;
+  fix.hour = (4 + i / 3600) % 24;
+  fix.minute = (i / 60) % 60;
+  fix.second = i % 60;
+  return record;
+}
+
+bool prepareCard(RecordStore &store, int records) {
+  if (!store.begin()) return false;
+  store.wipe();
+  char json[RECORD_JSON_MAX];
+  for (int i = 0; i < records; i++) {
+    size_t length = encodeRecordJson(syntheticRecord(i), json, sizeof(json));
+    if (length == 0 || !store.append(json, length)) return false;
+  }
+  return true;
+}
+
+// ============================================================================
+// BENCHMARKS
+// ============================================================================
+bool benchEncode(const BenchOptions &opt, Results &results) {
+  HostClock clock;
+  std::vector<SoilRecord> records;
+  records.reserve(1024);
+  for (uint32_t i = 0; i < 1024; i++) records.push_back(syntheticRecord(i));
+
+  char json[RECORD_JSON_MAX];
+  uint64_t totalBytes = 0;
+  uint64_t startUs = clock.micros();
+  for (int i = 0; i < opt.encodeRecords; i++) {
+    size_t length = encodeRecordJson(records[i & 1023], json, sizeof(json));
+    if (length == 0) return false;
+    totalBytes += length;
+  }
+  double seconds = (clock.micros() - startUs) / 1e6;
+  if (seconds <= 0) seconds = 1e-6;
+  results.push_back({"encode.records_per_s", opt.encodeRecords / seconds});
+  results.push_back({"encode.bytes_per_record", (double)totalBytes / opt.encodeRecords});
+  return true;
+}
+
+bool benchStore(const BenchOptions &opt, Results &results) {
+  HostClock clock;
+  HostFileSystem fs(opt.workDir + "/store");
+  RecordStore store(fs, clock);
+  if (!store.begin()) return false;
+  store.wipe();
+
+  char json[RECORD_JSON_MAX];
+  std::vector<double> appendUs;
+  appendUs.reserve(opt.storeRecords);
+  for (int i = 0; i < opt.storeRecords; i++) {
+    size_t length = encodeRecordJson(syntheticRecord(i), json, sizeof(json));
+    uint64_t startUs = clock.micros();
+    if (!store.append(json, length)) return false;
+    appendUs.push_back((double)(clock.micros() - startUs));
+  }
+  addPercentiles(results, "store.append_us", appendUs);
+  store.wipe();
+  return true;
+}
+
+bool benchTransfer(const BenchOptions &opt, Results &results) {
+  // The card contents are shared by every MTU run
+  HostClock hostClock;
+  HostFileSystem fs(opt.workDir + "/transfer");
+  RecordStore store(fs, hostClock);
+  if (!prepareCard(store, opt.transferRecords)) return false;
+
+  uint64_t fileBytes = 0;
+  std::unique_ptr<HalDir> dir = fs.openDir(RECORD_DIR);
+  HalDirEntry entry;
+  while (dir && dir->next(entry)) fileBytes += entry.size;
+
+  for (int mtu : opt.mtus) for (int compressed = 0; compressed < 2; compressed++) {
+    SimClock clock;
+    SimBleConfig ble;
+    ble.mtu = (uint16_t)mtu;
+    ble.connectionIntervalUs = opt.connectionIntervalUs;
+    ble.packetsPerEvent = opt.packetsPerEvent;
+    SimBleSink sink(clock, ble);
+    TransferEngine engine(fs, sink, clock);
+    engine.setCompression(compressed != 0);
+
+    uint64_t cpuStartUs = hostClock.micros();
+    if (!engine.start(RECORD_DIR, compressed ? PROTO_VERSION_SEQUENCED : PROTO_VERSION_LEGACY)) return false;
+    while (engine.active()) {
+      if (engine.pump() == TRANSFER_ERROR) return false;
+      if (engine.active() && !engine.betweenFiles()) clock.sleepMs(TRANSFER_CHUNK_INTERVAL);
+    }
+    sink.drain();
+    double cpuUs = (double)(hostClock.micros() - cpuStartUs);
+
+    double seconds = sink.stats().lastDeliveryUs / 1e6;
+    if (seconds <= 0) seconds = 1e-6;
+    std::string prefix = "transfer.mtu" + std::to_string(mtu) + (compressed ? ".lz" : "");
+    results.push_back({prefix + ".bytes_per_s", fileBytes / seconds});
+    if (compressed) {
+      const TransferStats &st = engine.stats();
+      results.push_back({prefix + ".air_bytes_per_record", (double)sink.stats().bytes / opt.transferRecords});
+      results.push_back({prefix + ".compression_ratio",
+        st.compressedBytes ? (double)st.rawBytes / st.compressedBytes : 0.0});
+    }
+    results.push_back({prefix + ".notifications_per_record", (double)sink.stats().notifications / opt.transferRecords});
+    results.push_back({prefix + ".host_us_per_record", cpuUs / opt.transferRecords});
+  }
+  return true;
+}
+
+/**
+ * @brief A flaky probe (20% corrupted, 10% cut-off and 5% silent replies)
+ * polled at the default timeout, with the default retry policy or none.
+ * Reports the share of polls that delivered a reading and the mean line
+ * time per poll.
+ */
+bool benchModbusFaults(const BenchOptions &opt, Results &results, bool retry) {
+  SimClock clock;
+  SimModbusConfig config;
+  config.crcErrorRate = 0.2;
+  config.shortFrameRate = 0.1;
+  config.noResponseRate = 0.05;
+  SimModbusSlave sensor(clock, config);
+  ModbusClient modbus(sensor, clock, MODBUS_TIMEOUT);
+  sensor.begin(MODBUS_BAUD);
+  ModbusRetryPolicy policy;
+  if (!retry) policy.maxRetries = 0;
+  modbus.setRetryPolicy(policy);
+
+  int ok = 0;
+  uint64_t busyUs = 0;
+  for (int i = 0; i < opt.modbusSamples; i++) {
+    sensor.setReading(syntheticRecord(i).soil);
+    SensorData reading;
+    uint64_t startUs = clock.micros();
+    ok += readSoilSensor(modbus, MODBUS_ADDRESS, reading);
+    busyUs += clock.micros() - startUs;
+    clock.sleepMs(1000);
+  }
+  std::string prefix = retry ? "modbus.flaky.retry" : "modbus.flaky.noretry";
+  results.push_back({prefix + ".ok_pct", 100.0 * ok / opt.modbusSamples});
+  results.push_back({prefix + ".poll_ms", busyUs / 1000.0 / opt.modbusSamples});
+  return ok > 0;
+}
+
+bool benchModbus(const BenchOptions &opt, Results &results) {
+  SimClock clock;
+  SimModbusConfig config;
+  SimModbusSlave sensor(clock, config);
+  ModbusClient modbus(sensor, clock, MODBUS_TIMEOUT);
+  sensor.begin(MODBUS_BAUD);
+
+  auto poll = [&](const char* prefix) {
+    std::vector<double> pollUs;
+    pollUs.reserve(opt.modbusSamples);
+    for (int i = 0; i < opt.modbusSamples; i++) {
+      sensor.setReading(syntheticRecord(i).soil);
+      SensorData reading;
+      uint64_t startUs = clock.micros();
+      if (!readSoilSensor(modbus, MODBUS_ADDRESS, reading)) return false;
+      pollUs.push_back((double)(clock.micros() - startUs));
+      clock.sleepMs(1000);
+    }
+    addPercentiles(results, prefix, pollUs);
+    return true;
+  };
+  if (!poll("modbus.poll_us")) return false;
+
+  uint64_t startUs = clock.micros();
+  uint32_t baud = negotiateSensorBaud(modbus, MODBUS_ADDRESS, MODBUS_MAX_BAUD);
+  if (baud != MODBUS_MAX_BAUD) return false;
+  results.push_back({"modbus.negotiate_ms", (clock.micros() - startUs) / 1000.0});
+  if (!poll("modbus.negotiated.poll_us")) return false;
+  return benchModbusFaults(opt, results, false) && benchModbusFaults(opt, results, true);
+}
+
+/**
+ * @brief Polls `probes` ZTS-3002s (addresses 1..probes) sharing one line
+ * for `cycles` bus cycles; with deadLast nothing answers at the last one.
+ * @return mean line time per cycle in ms, -1 on a gap violation or a
+ *         failed poll of a live probe
+ */
+double busCycleMs(int probes, bool deadLast, int cycles) {
+  SimClock clock;
+  SimModbusBus line(clock);
+  std::vector<std::unique_ptr<SimModbusSlave>> slaves;
+  for (int d = 1; d <= probes; d++) {
+    if (deadLast && d == probes) continue;
+    SimModbusConfig config;
+    config.address = (uint8_t)d;
+    config.lineBaud = MODBUS_MAX_BAUD;
+    slaves.emplace_back(new SimModbusSlave(clock, config));
+    line.attach(*slaves.back());
+  }
+  ModbusClient modbus(line, clock, MODBUS_TIMEOUT);
+  line.begin(MODBUS_MAX_BAUD);
+  ModbusBus bus(modbus, clock);
+  for (int d = 1; d <= probes; d++) bus.addDevice({(uint8_t)d, &ZTS3002_MAP, BUS_BENCH_PERIOD_MS});
+
+  while (bus.stats().cycles < (uint32_t)cycles) {
+    clock.advanceTo(clock.micros() + (uint64_t)bus.msUntilDue() * 1000);
+    bus.poll();
+  }
+  int live = deadLast ? probes - 1 : probes;
+  for (int d = 0; d < live; d++) {
+    if (bus.deviceStats(d).failures) return -1;
+  }
+  if (line.stats().gapViolations) return -1;
+  return bus.stats().busyUs / 1000.0 / cycles;
+}
+
+bool benchBus(const BenchOptions &opt, Results &results) {
+  const int counts[] = {1, 2, 4};
+  double fourProbesMs = 0;
+  for (int probes : counts) {
+    double ms = busCycleMs(probes, false, opt.modbusSamples);
+    if (ms < 0) return false;
+    results.push_back({"bus.cycle_ms." + std::to_string(probes) + "probes", ms});
+    fourProbesMs = ms;
+  }
+  results.push_back({"bus.max_cycles_per_s.4probes", 1000.0 / fourProbesMs});
+  double deadMs = busCycleMs(4, true, opt.modbusSamples);
+  if (deadMs < 0) return false;
+  results.push_back({"bus.cycle_ms.4probes_1dead", deadMs});
+  return true;
+}
+
+/** @brief Runs fn until at least 50 ms have passed; returns calls per second. */
+template <typename Fn>
+double callsPerSecond(HostClock &clock, Fn fn) {
+  uint64_t startUs = clock.micros();
+  uint64_t calls = 0;
+  uint64_t elapsedUs;
+  do {
+    fn();
+    calls++;
+    elapsedUs = clock.micros() - startUs;
+  } while (elapsedUs < 50000);
+  return calls * 1e6 / elapsedUs;
+}
+
+bool benchKernels(const BenchOptions &opt, Results &results) {
+  HostClock clock;
+  // Moisture column with every seventh basic read missing
+  std::vector<int32_t> values(opt.kernelSamples);
+  std::vector<int32_t> flags(opt.kernelSamples);
+  for (int i = 0; i < opt.kernelSamples; i++) {
+    ArchiveSample sample;
+    archiveSampleFromRecord(syntheticRecord(i), sample);
+    values[i] = sample.values[ARCHIVE_MOISTURE];
+    flags[i] = i % 7 ? ARCHIVE_FLAG_BASIC : 0;
+  }
+  std::vector<int32_t> selected(values.size());
+  const size_t n = values.size();
+
+  // Identical integer results are part of the contract, not a tolerance
+  KernelMoments moments[2];
+  uint32_t bins[2][32] = {{0}};
+  size_t inRange[2];
+  size_t picked[2];
+  for (int b = 0; b < 2; b++) {
+    const KernelBackend &k = kernelBackend(b);
+    k.moments(values.data(), n, moments[b]);
+    k.histogram(values.data(), n, 150, 10, bins[b], 32);
+    inRange[b] = k.countInRange(values.data(), n, 200, 300);
+    picked[b] = k.select(values.data(), flags.data(), ARCHIVE_FLAG_BASIC, n, selected.data());
+  }
+  if (memcmp(&moments[0], &moments[1], sizeof(KernelMoments)) != 0 || memcmp(bins[0], bins[1], sizeof(bins[0])) != 0 ||
+      inRange[0] != inRange[1] || picked[0] != picked[1]) {
+    fprintf(stderr, "❌ Kernel backends disagree\n");
+    return false;
+  }
+
+  double momentsRate[2];
+  for (int b = 0; b < 2; b++) {
+    const KernelBackend &k = kernelBackend(b);
+    std::string prefix = std::string("kernels.") + k.name;
+    KernelMoments m;
+    uint32_t h[32] = {0};
+    volatile size_t sink = 0;
+    momentsRate[b] = n * callsPerSecond(clock, [&] { k.moments(values.data(), n, m); sink = sink + m.count; });
+    results.push_back({prefix + ".moments_samples_per_s", momentsRate[b]});
+    results.push_back({prefix + ".histogram_samples_per_s",
+      n * callsPerSecond(clock, [&] { k.histogram(values.data(), n, 150, 10, h, 32); })});
+    results.push_back({prefix + ".range_samples_per_s",
+      n * callsPerSecond(clock, [&] { sink = sink + k.countInRange(values.data(), n, 200, 300); })});
+    results.push_back({prefix + ".select_samples_per_s",
+      n * callsPerSecond(clock, [&] { sink = sink + k.select(values.data(), flags.data(), 1, n, selected.data()); })});
+  }
+  results.push_back({"kernels.moments_speedup_ratio", momentsRate[1] / momentsRate[0]});
+  return true;
+}
+
+/** @brief Every daily bucket of every field, as the BLE responses would show them. */
+std::string dailyRollups(RollupStore &store) {
+  std::string all;
+  char response[ROLLUP_RESPONSE_MAX];
+  for (int f = 0; f < ROLLUP_FIELDS; f++) {
+    RollupQuery query;
+    query.period = ROLLUP_DAY;
+    query.field = f;
+    query.count = 4;
+    for (uint32_t end = store.newestKey(ROLLUP_DAY); end > store.newestKey(ROLLUP_DAY) - ROLLUP_DAILY_SLOTS; end -= 4) {
+      query.endKey = end;
+      store.formatResponse(query, response, sizeof(response));
+      all += response;
+    }
+  }
+  return all;
+}
+
+bool benchRollup(const BenchOptions &opt, Results &results) {
+  HostClock clock;
+  HostFileSystem fs(opt.workDir + "/rollup");
+  RecordStore store(fs, clock);
+  ArchiveWriter archive(fs, clock);
+  RollupStore rollups(fs, clock, RECORD_IST_OFFSET_SECONDS);
+  if (!store.begin() || !store.wipe() || !archive.begin() || !rollups.begin()) return false;
+
+  // One sample every 15 minutes, so the history spans months
+  const uint32_t startTime = 1790000000;
+  for (int i = 0; i < opt.rollupSamples; i++) {
+    SoilRecord record = syntheticRecord(i);
+    unixTimeToFix(startTime + (uint32_t)i * 900, record.fix);
+    ArchiveSample sample;
+    archiveSampleFromRecord(record, sample);
+    if (!archive.add(sample)) return false;
+    rollups.add(sample);
+  }
+  std::string incremental = dailyRollups(rollups);
+
+  uint64_t startUs = clock.micros();
+  long rebuilt = rollups.rebuild(archive);
+  double seconds = (clock.micros() - startUs) / 1e6;
+  if (rebuilt != opt.rollupSamples || dailyRollups(rollups) != incremental) {
+    fprintf(stderr, "❌ Rebuilt rollups differ from the incremental ones\n");
+    return false;
+  }
+  if (seconds <= 0) seconds = 1e-6;
+  results.push_back({"rollup.rebuild_ms", seconds * 1000});
+  results.push_back({"rollup.rebuild_samples_per_s", rebuilt / seconds});
+  store.wipe();
+  return true;
+}
+
+// ============================================================================
+// TASK PLACEMENT
+// ============================================================================
+// One segment of a periodic activity: CPU work, then a blocked wait
+struct PlacementSegment {
+  uint32_t cpuUs;
+  uint32_t waitUs;
+};
+
+/**
+ * @brief Something a task does every periodUs. A release that finds the
+ * previous one unfinished is dropped, as the firmware's schedulers do.
+ */
+struct PlacementActivity {
+  const char* name;
+  uint32_t periodUs;
+  std::vector<PlacementSegment> segments;
+  // Run state
+  uint64_t nextReleaseUs = 0;
+  uint64_t releasedUs = 0;
+  bool pending = false;
+  size_t segment = 0;
+  uint32_t cpuLeftUs = 0;
+  uint64_t readySinceUs = 0;   // released or woken, not yet given the CPU
+  bool waitingForCpu = false;
+  uint32_t releases = 0;
+  uint32_t dropped = 0;
+  uint32_t latencyMaxUs = 0;
+};
+
+struct PlacementTask {
+  const char* name;
+  int core;
+  int priority;
+  std::vector<PlacementActivity> activities;
+  int current = -1;             // activity in progress
+  uint64_t blockedUntilUs = 0;
+  uint64_t lastRunUs = 0;
+};
+
+struct Placement {
+  const char* name;
+  int sensorCore;
+  int sensorPriority;
+  bool sensorBusyPolls;         // spins on the UART instead of sleeping between bytes
+  bool displayInLoop;           // OLED drawn and pushed by loopTask
+};
+
+/** @brief Runs the tasks for seconds of simulated time on two cores. */
+void runPlacement(std::vector<PlacementTask> &tasks, int seconds) {
+  int running[2] = {-1, -1};
+  uint32_t jitter = 12345;
+  const uint64_t endUs = (uint64_t)seconds * 1000000;
+  for (uint64_t now = 0; now < endUs; now += PLACEMENT_STEP_US) {
+    // Releases, and tasks picking up their next activity
+    for (PlacementTask &t : tasks) {
+      for (PlacementActivity &a : t.activities) {
+        if (now < a.nextReleaseUs) continue;
+        // Up to a tick of jitter so every phase between the tasks gets sampled
+        jitter = jitter * 1103515245 + 12345;
+        a.nextReleaseUs += a.periodUs + (jitter >> 16) % PLACEMENT_TICK_US;
+        a.releases++;
+        if (a.pending) {
+          a.dropped++;
+        } else {
+          a.pending = true;
+          a.releasedUs = now;
+        }
+      }
+      if (t.current < 0) {
+        for (size_t i = 0; i < t.activities.size(); i++) {
+          PlacementActivity &a = t.activities[i];
+          if (!a.pending) continue;
+          t.current = (int)i;
+          a.segment = 0;
+          a.cpuLeftUs = a.segments[0].cpuUs;
+          a.readySinceUs = a.releasedUs;
+          a.waitingForCpu = true;
+          break;
+        }
+      }
+    }
+
+    bool tick = now % PLACEMENT_TICK_US == 0;
+    for (int core = 0; core < 2; core++) {
+      int best = -1;
+      for (size_t i = 0; i < tasks.size(); i++) {
+        PlacementTask &t = tasks[i];
+        if (t.core != core || t.current < 0 || now < t.blockedUntilUs) continue;
+        if (best < 0 || t.priority > tasks[best].priority) { best = (int)i; continue; }
+        if (t.priority < tasks[best].priority) continue;
+        // Equal priority: the running task keeps the core until the tick,
+        // then the one that has waited longest gets it
+        bool bestIsRunning = best == running[core];
+        bool thisIsRunning = (int)i == running[core];
+        if (thisIsRunning && !tick) best = (int)i;
+        else if (!(bestIsRunning && !tick) && !thisIsRunning && t.lastRunUs < tasks[best].lastRunUs) best = (int)i;
+        else if (bestIsRunning && tick) best = (int)i;
+      }
+      running[core] = best;
+      if (best < 0) continue;
+
+      PlacementTask &t = tasks[best];
+      PlacementActivity &a = t.activities[t.current];
+      t.lastRunUs = now;
+      if (a.waitingForCpu) {
+        uint32_t late = (uint32_t)(now - a.readySinceUs);
+        if (late > a.latencyMaxUs) a.latencyMaxUs = late;
+        a.waitingForCpu = false;
+      }
+      a.cpuLeftUs = a.cpuLeftUs > PLACEMENT_STEP_US ? a.cpuLeftUs - PLACEMENT_STEP_US : 0;
+      if (a.cpuLeftUs > 0) continue;
+
+      // Segment done: block for its wait, then the next segment or the end
+      uint32_t waitUs = a.segments[a.segment].waitUs;
+      t.blockedUntilUs = now + PLACEMENT_STEP_US + waitUs;
+      if (++a.segment < a.segments.size()) {
+        a.cpuLeftUs = a.segments[a.segment].cpuUs;
+        a.readySinceUs = t.blockedUntilUs;
+        a.waitingForCpu = true;
+      } else {
+        a.pending = false;
+        t.current = -1;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Line time of one negotiated soil poll on the simulated bus, the
+ * wait the sensor task either sleeps through or spins through.
+ */
+uint32_t placementModbusLineUs() {
+  SimClock clock;
+  SimModbusConfig config;
+  config.lineBaud = MODBUS_MAX_BAUD;
+  SimModbusSlave sensor(clock, config);
+  ModbusClient modbus(sensor, clock, MODBUS_TIMEOUT);
+  sensor.begin(MODBUS_MAX_BAUD);
+  sensor.setReading(syntheticRecord(0).soil);
+  SensorData reading;
+  uint64_t startUs = clock.micros();
+  if (!readSoilSensor(modbus, MODBUS_ADDRESS, reading)) return 0;
+  return (uint32_t)(clock.micros() - startUs);
+}
+
+bool benchPlacement(const BenchOptions &opt, Results &results) {
+  uint32_t lineUs = placementModbusLineUs();
+  if (lineUs == 0) return false;
+  results.push_back({"placement.modbus_line_us", (double)lineUs});
+
+  // Core 0 is where Bluedroid is pinned; loopTask runs on Core 1
+  const Placement placements[] = {
+    {"sensor_c0p1_busy",  0, 1, true,  true},    // before the placement plan
+    {"sensor_c0p1",       0, 1, false, false},
+    {"sensor_c1p1",       1, 1, false, false},
+    {"sensor_c1p2",       1, 2, false, false},   // shipped default
+    {"sensor_c1p2_busy",  1, 2, true,  false},
+  };
+  for (const Placement &p : placements) {
+    std::vector<PlacementTask> tasks;
+    tasks.push_back({"ble", 0, PLACEMENT_BLE_PRIORITY, {}});
+    tasks.back().activities.push_back({"event", opt.connectionIntervalUs, {{PLACEMENT_BLE_EVENT_US, 0}}});
+    tasks.push_back({"log", 0, 1, {}});
+    tasks.back().activities.push_back({"drain", 20000, {{PLACEMENT_LOG_DRAIN_US, 0}}});
+
+    tasks.push_back({"sensor", p.sensorCore, p.sensorPriority, {}});
+    if (p.sensorBusyPolls) {
+      tasks.back().activities.push_back({"poll", PLACEMENT_SENSOR_PERIOD_US, {{lineUs + PLACEMENT_MODBUS_CPU_US, 0}}});
+    } else {
+      tasks.back().activities.push_back({"poll", PLACEMENT_SENSOR_PERIOD_US,
+        {{PLACEMENT_MODBUS_CPU_US / 2, lineUs}, {PLACEMENT_MODBUS_CPU_US / 2, 0}}});
+    }
+
+    tasks.push_back({"loop", 1, 1, {}});
+    PlacementTask &loop = tasks.back();
+    loop.activities.push_back({"pump", TRANSFER_CHUNK_INTERVAL * 1000, {{PLACEMENT_PUMP_US, 0}}});
+    loop.activities.push_back({"gps", 1000000, {{PLACEMENT_GPS_US, 0}}});
+    loop.activities.push_back({"append", 45000000, {{PLACEMENT_SD_APPEND_US, 0}}});
+    PlacementActivity display = {"display", 500000, {{PLACEMENT_RENDER_US, PLACEMENT_I2C_PUSH_US}, {10, 0}}};
+    if (p.displayInLoop) {
+      loop.activities.push_back(display);
+    } else {
+      tasks.push_back({"display", 1, 1, {}});
+      tasks.back().activities.push_back(display);
+    }
+
+    // Staggered so the activities don't all start on the same microsecond
+    uint64_t offsetUs = 0;
+    for (PlacementTask &t : tasks) for (PlacementActivity &a : t.activities) a.nextReleaseUs = (offsetUs += 1370);
+    runPlacement(tasks, PLACEMENT_SIM_SECONDS);
+
+    std::string prefix = std::string("placement.") + p.name;
+    for (const PlacementTask &t : tasks) {
+      uint32_t latencyMaxUs = 0;
+      for (const PlacementActivity &a : t.activities) latencyMaxUs = std::max(latencyMaxUs, a.latencyMaxUs);
+      results.push_back({prefix + "." + t.name + "_lat_max_us", (double)latencyMaxUs});
+    }
+    const PlacementActivity &pump = loop.activities[0];
+    results.push_back({prefix + ".pump_kept_ratio", pump.releases ? 1.0 - (double)pump.dropped / pump.releases : 0});
+  }
+  return true;
+}
+
+// ============================================================================
+// OUTPUT / COMPARISON
+// ============================================================================
+bool writeJson(const std::string &path, const BenchOptions &opt, const Results &results) {
+  FILE* f = path == "-" ? stdout : fopen(path.c_str(), "w");
+  if (!f) return false;
+  fprintf(f, "{\n  \"schema\": %d,\n  \"label\": \"%s\"", BENCH_SCHEMA, opt.label.c_str());
+  for (const auto &r : results) {
+    fprintf(f, ",\n  \"%s\": %.3f", r.first.c_str(), r.second);
+  }
+  fprintf(f, "\n}\n");
+  if (f != stdout) fclose(f);
+  return true;
+}
+
+/** @brief Reads the "key": number pairs back from a file written by writeJson(). */
+bool readJson(const std::string &path, std::map<std::string, double> &values) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (!f) return false;
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    char key[128];
+    double value;
+    if (sscanf(line, " \"%127[^\"]\": %lf", key, &value) == 2) values[key] = value;
+  }
+  fclose(f);
+  return true;
+}
+
+/** @brief Throughput and ratio metrics improve upwards, everything else downwards. */
+bool higherIsBetter(const std::string &key) {
+  return key.find("per_s") != std::string::npos || key.find("ratio") != std::string::npos;
+}
+
+int compareResults(const BenchOptions &opt, const Results &results) {
+  std::map<std::string, double> baseline;
+  if (!readJson(opt.comparePath, baseline)) {
+    fprintf(stderr, "❌ Cannot read baseline %s\n", opt.comparePath.c_str());
+    return 2;
+  }
+  int regressions = 0;
+  printf("\n%-44s %14s %14s %9s\n", "metric", "baseline", "current", "change");
+  for (const auto &r : results) {
+    auto it = baseline.find(r.first);
+    if (it == baseline.end() || r.first == "schema" || r.first == "encode.bytes_per_record") {
+      printf("%-44s %14s %14.1f\n", r.first.c_str(), it == baseline.end() ? "-" : "", r.second);
+      continue;
+    }
+    double change = it->second != 0 ? (r.second - it->second) / it->second * 100.0 : 0;
+    bool worse = higherIsBetter(r.first) ? change < -opt.tolerancePct : change > opt.tolerancePct;
+    if (worse) regressions++;
+    printf("%-44s %14.1f %14.1f %+8.1f%%%s\n", r.first.c_str(), it->second, r.second, change, worse ? "  ❌" : "");
+  }
+  printf("%s %d metric(s) regressed beyond %.0f%%\n", regressions ? "❌" : "✅", regressions, opt.tolerancePct);
+  return regressions ? 1 : 0;
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+void printUsage(const char* program) {
+  printf("Usage: %s [options]\n", program);
+  printf("  --json FILE              write results as JSON (\"-\" for stdout)\n");
+  printf("  --compare FILE           compare against an earlier --json output\n");
+  printf("  --tolerance PCT          allowed regression for --compare (10)\n");
+  printf("  --label TEXT             free-form run label, e.g. a commit hash\n");
+  printf("  --work-dir DIR           scratch directory for the simulated card (bench_sd)\n");
+  printf("  --encode-records N       records for the encode benchmark (20000)\n");
+  printf("  --store-records N        appends for the store benchmark (500)\n");
+  printf("  --transfer-records N     files on the card for the transfer benchmark (100)\n");
+  printf("  --modbus-samples N       polls for the Modbus benchmark (200)\n");
+  printf("  --kernel-samples N       column length for the kernel benchmark (1000000)\n");
+  printf("  --rollup-samples N       archived samples for the rollup rebuild benchmark (20000)\n");
+  printf("  --mtu-list A,B,...       MTUs to run the transfer benchmark at (23,185,247,517)\n");
+  printf("  --conn-interval-ms MS    BLE connection interval (30)\n");
+  printf("  --packets-per-event N    notifications per connection event (4)\n");
+}
+
+bool parseOptions(int argc, char** argv, BenchOptions &opt) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) return false;
+    if (i + 1 >= argc) {
+      fprintf(stderr, "❌ Missing value for %s\n", arg);
+      return false;
+    }
+    const char* value = argv[++i];
+    if (strcmp(arg, "--json") == 0) opt.jsonPath = value;
+    else if (strcmp(arg, "--compare") == 0) opt.comparePath = value;
+    else if (strcmp(arg, "--tolerance") == 0) opt.tolerancePct = atof(value);
+    else if (strcmp(arg, "--label") == 0) opt.label = value;
+    else if (strcmp(arg, "--work-dir") == 0) opt.workDir = value;
+    else if (strcmp(arg, "--encode-records") == 0) opt.encodeRecords = atoi(value);
+    else if (strcmp(arg, "--store-records") == 0) opt.storeRecords = atoi(value);
+    else if (strcmp(arg, "--transfer-records") == 0) opt.transferRecords = atoi(value);
+    else if (strcmp(arg, "--modbus-samples") == 0) opt.modbusSamples = atoi(value);
+    else if (strcmp(arg, "--kernel-samples") == 0) opt.kernelSamples = atoi(value);
+    else if (strcmp(arg, "--rollup-samples") == 0) opt.rollupSamples = atoi(value);
+    else if (strcmp(arg, "--conn-interval-ms") == 0) opt.connectionIntervalUs = (uint32_t)(atof(value) * 1000);
+    else if (strcmp(arg, "--packets-per-event") == 0) opt.packetsPerEvent = (uint8_t)atoi(value);
+    else if (strcmp(arg, "--mtu-list") == 0) {
+      opt.mtus.clear();
+      for (const char* p = value; *p; ) {
+        opt.mtus.push_back(atoi(p));
+        const char* comma = strchr(p, ',');
+        if (!comma) break;
+        p = comma + 1;
+      }
+    }
+    else {
+      fprintf(stderr, "❌ Unknown option %s\n", arg);
+      return false;
+    }
+  }
+  return opt.encodeRecords > 0 && opt.storeRecords > 0 && opt.transferRecords > 0 &&
+         opt.modbusSamples > 0 && opt.kernelSamples > 0 && opt.rollupSamples > 0 && !opt.mtus.empty();
+}
+
+int main(int argc, char** argv) {
+  BenchOptions opt;
+  if (!parseOptions(argc, argv, opt)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+
+  Results results;
+  struct { const char* name; bool (*run)(const BenchOptions&, Results&); } suites[] = {
+    {"encode", benchEncode},
+    {"store", benchStore},
+    {"transfer", benchTransfer},
+    {"modbus", benchModbus},
+    {"bus", benchBus},
+    {"kernels", benchKernels},
+    {"rollup", benchRollup},
+    {"placement", benchPlacement},
+  };
+  for (const auto &suite : suites) {
+    if (!suite.run(opt, results)) {
+      fprintf(stderr, "❌ Benchmark %s failed\n", suite.name);
+      return 1;
+    }
+  }
+
+  if (opt.comparePath.empty() && opt.jsonPath != "-") {
+    for (const auto &r : results) printf("%-44s %14.1f\n", r.first.c_str(), r.second);
+  }
+  if (!opt.jsonPath.empty() && !writeJson(opt.jsonPath, opt, results)) {
+    fprintf(stderr, "❌ Cannot write %s\n", opt.jsonPath.c_str());
+    return 1;
+  }
+  if (!opt.comparePath.empty()) return compareResults(opt, results);
+  return 0;
+}
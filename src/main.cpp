@@ -10,13 +10,33 @@
 #include <BLE2902.h>
 #include <ArduinoJson.h>
 #include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <esp_sleep.h>
+#include <esp_ota_ops.h>
 #include<time.h>
+#include <AgniMetrics.h>
+#include <AgniHalEsp32.h>
+#include <AgniRecord.h>
+#include <AgniModbus.h>
+#include <AgniStorage.h>
+#include <AgniTransfer.h>
+#include <AgniTrace.h>
+#include <AgniArchive.h>
+#include <AgniRollup.h>
+#include <AgniBeacon.h>
+#include <AgniConfig.h>
+#include <AgniBus.h>
+#include <AgniLive.h>
+#include <AgniSleep.h>
+#include <AgniLog.h>
 // ============================================================================
 // CONFIGURABLE SETTINGS
 // ============================================================================
-#define DATA_LOG_INTERVAL 45000  
+// Sampling, Modbus, transfer and reporting intervals are runtime settings
+// now (AgniConfig.h, CONFIG_GET / CONFIG_SET over BLE, kept in NVS).
 #define WATCHDOG_TIMEOUT 30      
 #define JSON_DOC_SIZE 1024
+#define BOOT_SERIAL_WAIT_MS 0    // raise to catch early boot logs on a monitor
 // ============================================================================
 // OLED CONFIGURATION
 // ============================================================================
@@ -34,7 +54,7 @@ Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
 #define SD_SCK  12
 #define SD_MISO 13
 bool sdOK = false;
-int fileCounter = 1;
+#define SD_MIN_FREE_BYTES (1024 * 1024)
 // ============================================================================
 // RS485 SOIL SENSOR CONFIGURATION (ZTS-3002)
 // ============================================================================
@@ -42,17 +62,18 @@ int fileCounter = 1;
 #define RS485_TX  17
 #define RS485_DE  18
 #define RS485_RE  19
-#define MODBUS_BAUD      4800
-#define MODBUS_ADDRESS   1
-#define MODBUS_TIMEOUT   800
-
-#define REG_MOISTURE       0x0000
-#define REG_TEMPERATURE    0x0001
-#define REG_CONDUCTIVITY   0x0002
-#define REG_PH             0x0003
-#define REG_NITROGEN       0x0006
-#define REG_PHOSPHORUS     0x0007
-#define REG_POTASSIUM      0x0008
+#define MODBUS_ADDRESS   1        // baud, timeout and link speed ceiling: config keys modbus_*
+// Every slave on the RS485 line. The first entry is the probe the record
+// "parameters", archive, rollups and broadcast come from; period 0 = the
+// sensor_period_ms setting. More probes or a weather transmitter go here,
+// e.g. {2, &ZTS3002_MAP, 0} or {10, &WEATHER_MAP, 60000}; records then
+// carry a "devices" array. With more than one device the line stays at
+// modbus_baud, since moving one slave would strand the others.
+const BusDeviceConfig BUS_DEVICES[] = {
+  {MODBUS_ADDRESS, &ZTS3002_MAP, 0},
+};
+#define BUS_DEVICE_COUNT (sizeof(BUS_DEVICES) / sizeof(BUS_DEVICES[0]))
+#define SENSOR_TASK_MAX_SLEEP_MS 5000   // wake at least this often to feed the watchdog
 // ============================================================================
 // GPS CONFIGURATION
 // ============================================================================
@@ -98,48 +119,67 @@ int countdownValue = 0;
 BLEServer* pServer = NULL;
 BLECharacteristic* pFileTransferCharacteristic = NULL;
 BLECharacteristic* pCommandCharacteristic = NULL;
-bool deviceConnected = false;
-bool oldDeviceConnected = false;
-bool transferInProgress = false;
-bool transferPending = false;
+bool deviceConnected = false;            // at least one client
+volatile uint8_t g_connections = 0;      // kept by the BLE callbacks
+bool oldDeviceConnected = false;         // a client left; advertising is restarted from loop()
+unsigned long disconnectTime = 0;
+// Connects and disconnects, BLE task -> main task, which owns the sessions
+struct ConnectionEvent {
+  uint16_t connId;
+  bool connected;
+};
+QueueHandle_t connectionEvents = NULL;
+#define ADVERTISING_RESTART_DELAY 500
 DisplayState previousStateBeforeTransfer = STATE_PLACE_SENSOR;
 #define SERVICE_UUID "12345678-1234-1234-1234-123456789abc"
 #define CHARACTERISTIC_UUID_TRANSFER "abcdef12-3456-7890-1234-567890abcdef"
 #define CHARACTERISTIC_UUID_COMMAND "abcdef13-3456-7890-1234-567890abcdef"
+#define CHARACTERISTIC_UUID_STATS "abcdef14-3456-7890-1234-567890abcdef"
+#define CHARACTERISTIC_UUID_LIVE "abcdef15-3456-7890-1234-567890abcdef"
+BLECharacteristic* pStatsCharacteristic = NULL;
+BLECharacteristic* pLiveCharacteristic = NULL;
+// BROADCAST_ON (config key "broadcast") puts the latest reading in the
+// advertising data (AgniBeacon.h)
+#define BLE_SHORT_NAME "AGNI-SOIL"   // scan response name while broadcasting
+ArchiveSample broadcastSample;
+bool broadcastSampleValid = false;
 
 // ============================================================================
 // NON-BLOCKING TRANSFER VARIABLES
 // ============================================================================
-File currentTransferFile;
-File transferRoot;
-String currentTransferFileName;
-size_t currentTransferBytesSent = 0;
-size_t currentTransferFileSize = 0;
-unsigned long lastTransferChunkTime = 0;
-const size_t TRANSFER_CHUNK_SIZE = 256;   // changed from 128 for faster transfer
-volatile int g_bleCommandToProcess = 0; // 0=None, 1=Start_Transfer, 2=Format, 3=Reset
+// Every command write is queued with the connection that wrote it, BLE
+// task -> main task, so two clients writing at once each get their own
+// command carried out and answered; the main loop parses them in order.
+#define BLE_COMMAND_MAX     256    // longest command kept, terminator included
+#define BLE_COMMAND_QUEUE   6
+struct BleCommand {
+  uint16_t connId;
+  uint16_t length;
+  char text[BLE_COMMAND_MAX];
+};
+QueueHandle_t bleCommands = NULL;
+uint32_t g_firstRecordMs = 0;   // start to the first file of the last ordered transfer
+// SNAPSHOT[:COMMIT] skips the main loop: the BLE task queues the request for
+// the sensor task, which hands it back with the reading it polls; the main
+// loop then answers every request once, on its own connection
+#define SNAPSHOT_QUEUE  4
+struct SnapshotRequest {
+  uint16_t connId;
+  bool commit;          // SNAPSHOT:COMMIT
+  uint32_t requestUs;   // written, for snap_us
+};
+QueueHandle_t snapshotRequests = NULL;
 // ============================================================================
 // ERROR RECOVERY VARIABLES
 // ============================================================================
-int soilSensorFailureCount = 0;
-const int MAX_SENSOR_FAILURES = 5;
-unsigned long lastSensorReset = 0;
-const unsigned long SENSOR_RESET_COOLDOWN = 10000;
+volatile uint32_t g_linkBaud = 0;   // RS485 rate the sensor task settled on, 0 = unknown
+uint32_t linkMaxBaud = 0;           // modbus_max_baud the link was last negotiated for
+uint32_t primaryIsolations = 0;     // soilBus isolations of the primary probe already handled
 
 // ============================================================================
 // DATA STRUCTURES
 // ============================================================================
-struct SensorData {
-  float moisture = 0;
-  float temperature = 0;
-  uint16_t conductivity = 0;
-  float ph = 0;
-  uint16_t nitrogen = 0;
-  uint16_t phosphorus = 0;
-  uint16_t potassium = 0;
-  bool basicValid = false;
-  bool npkValid = false;
-};
+// SensorData, GpsFix and SoilRecord live in AgniRecord.h
 struct SystemStatus {
   bool oledOK = false;
   bool sdOK = false;
@@ -159,10 +199,119 @@ struct SystemStatus {
   int second = 28;
 };
 
+// What the sensor task hands the main loop after a bus cycle
+struct SoilSnapshot {
+  SensorData soil;                 // primary probe
+  bool soilFresh = false;          // the primary was polled and answered
+  uint8_t requestCount = 0;        // SNAPSHOT requests this reading answers
+  SnapshotRequest requests[SNAPSHOT_QUEUE];
+  uint32_t takenMs = 0;
+  uint8_t deviceCount = 0;         // 0 on a single-sensor bus
+  DeviceReading devices[RECORD_MAX_DEVICES];
+};
+
 SensorData soilData;
+unsigned long soilDataTakenMs = 0;
+SoilSnapshot busSnapshot;          // main task's copy, for the records
 SystemStatus systemStatus;
 TaskHandle_t SoilSensorTask;
 QueueHandle_t soilDataQueue;
+
+// ============================================================================
+// HARDWARE ABSTRACTION
+// ============================================================================
+// The pipeline libraries only see these HAL objects (see AgniHal.h); the
+// native build swaps them for simulated peripherals.
+Esp32Clock halClock;
+ArduinoFileSystem sdFileSystem(SD);
+UartPort rs485Port(Serial1, RS485_RX, RS485_TX, RS485_DE, RS485_RE);
+TapSerialPort rs485Traced(rs485Port, TRACE_RS485_RX, TRACE_RS485_TX);
+NvsStore nvsStore(CONFIG_NVS_NAMESPACE);
+ConfigStore config(nvsStore);
+ModbusClient modbus(rs485Traced, halClock, configEntry(CONFIG_MODBUS_TIMEOUT_MS).defaultValue);
+ModbusBus soilBus(modbus, halClock);   // owned by the sensor task
+RecordStore recordStore(sdFileSystem, halClock);
+// One engine per connected client, each notifying only its own connection;
+// transferSessions pumps them (AgniTransfer.h). Main task only.
+struct TransferChannel {
+  BleNotifySink sink;
+  TransferEngine engine;
+  RecordQueue queue;   // the record order of an ordered transfer
+  // Each new reading, pushed if this client sent LIVE: (AgniLive.h). Sent on
+  // its own connection, so a congested link refuses the frame and it retries
+  BleNotifySink liveSink;
+  LiveStream live;
+  TransferChannel()
+    : sink(configEntry(CONFIG_CHUNK_BYTES).defaultValue), engine(sdFileSystem, sink, halClock), queue(recordStore),
+      liveSink(LIVE_FRAME_BYTES), live(liveSink, halClock) {}
+};
+TransferChannel transferChannels[TRANSFER_MAX_SESSIONS];
+TransferSessions transferSessions(halClock);
+// Hot paths log through the deferred rings (AgniLog.h), formatted onto
+// Serial by LogDrainTask. The rings live in .noinit so a panic or watchdog
+// reset leaves them readable for the next boot.
+__NOINIT_ATTR LogState logState;
+Logger logger(logState, halClock);
+#define LOG_E(...) AGNI_LOG(logger, xPortGetCoreID(), LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_W(...) AGNI_LOG(logger, xPortGetCoreID(), LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_I(...) AGNI_LOG(logger, xPortGetCoreID(), LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_D(...) AGNI_LOG(logger, xPortGetCoreID(), LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// ============================================================================
+// UNATTENDED CAPTURE
+// ============================================================================
+// Timer wakes from deep sleep with config key unattended on (AgniSleep.h).
+// The samples and the wake ledger live in RTC slow memory across sleeps.
+#define SENSOR_POWER_PIN          -1      // switches the probe's supply; -1 = always powered
+#define SENSOR_POWER_ON           HIGH
+#define WAKE_READING_GAP_MS       500     // between the readings averaged in one wake
+#define WINDOW_LINGER_MS          5000    // window over but a client connected: check again
+#define MIN_DEEP_SLEEP_MS         1000
+#define RTC_CLOCK_VALID_AFTER     1704067200UL   // 2024-01-01: the clock was set from GPS
+RTC_DATA_ATTR RtcState rtcState;
+RtcSampleBuffer rtcBuffer(rtcState);
+int64_t bootStartUs = 0;   // setup() entry, also the start of a wake's awake time
+int64_t bootReadyUs = 0;
+PowerModel powerModel;
+bool rtcClockSet = false;          // this boot set the system clock from GPS
+uint32_t windowStartMs = 0;        // the advertising window of this boot began
+
+// Every logged record is also staged into a columnar archive block; a
+// partly filled block is sealed after ARCHIVE_SEAL_INTERVAL at the latest.
+#define ARCHIVE_SEAL_INTERVAL (60UL * 60 * 1000)
+ArchiveWriter archiveWriter(sdFileSystem, halClock);
+// Hourly/daily summaries in IST, answered over BLE without a transfer
+RollupStore rollupStore(sdFileSystem, halClock, RECORD_IST_OFFSET_SECONDS);
+
+#define TRACE_CAPTURE_AT_BOOT 0                  // 1 = start capturing as soon as the SD card is up
+#define TRACE_BUDGET_BYTES   (8UL * 1024 * 1024)  // ring budget for /trace
+#define TRACE_SEGMENT_BYTES  (256UL * 1024)
+#define TRACE_FLUSH_MS       1000
+TraceWriter traceWriter(sdFileSystem, TRACE_BUDGET_BYTES, TRACE_SEGMENT_BYTES);
+portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+volatile bool traceEnabled = false;
+
+/**
+ * @brief Records raw bytes if capture is on. Callable from any task; only
+ * touches RAM, the card write happens in flushTrace() on the main task.
+ */
+void traceCapture(uint8_t channel, const uint8_t* data, size_t length) {
+  if (!traceEnabled || length == 0) return;
+  portENTER_CRITICAL(&traceMux);
+  traceWriter.record(channel, esp_timer_get_time(), data, length);
+  portEXIT_CRITICAL(&traceMux);
+}
+
+void traceTap(uint8_t channel, const uint8_t* data, size_t length, void* /*context*/) {
+  traceCapture(channel, data, length);
+}
+
+void flushTrace() {
+  portENTER_CRITICAL(&traceMux);
+  bool swapped = traceWriter.swapBuffers();
+  portEXIT_CRITICAL(&traceMux);
+  if (swapped) traceWriter.flush();
+}
 // ============================================================================
 // ANIMATION CODES
 // ============================================================================
@@ -189,10 +338,11 @@ const byte PROGMEM frames_leaf[][512] = {
 // FORWARD DECLARATIONS
 // ============================================================================
 void playIntroAnimation();
-void startDynamicFileTransfer();
+void startDynamicFileTransfer(int session, uint8_t protocolVersion = PROTO_VERSION_LEGACY, const char* dir = RECORD_DIR,
+                              TransferSource* source = NULL);
 void processTransferChunk();
 void formatSDCard();
-String generateJSONData();
+String generateJSONData(const SoilRecord &record);
 void logDataToSD();
 void changeState(DisplayState newState);
 bool isValidStateTransition(DisplayState from, DisplayState to);
@@ -207,35 +357,486 @@ void clearSDCardData();
 void resetToNormalOperation();
 void recoverFromSoilSensorFailure();
 bool checkSDHealth();
+bool transferActive();
 void monitorSystemHealth();
 void resetSoilSensor();
+void reportLinkBaud(uint32_t baud);
+void saveLinkBaud();
+void traceCapture(uint8_t channel, const uint8_t* data, size_t length);
+bool startTraceCapture();
+void stopTraceCapture();
 void findLastFileCounter();
+void openArchive();
+void sealArchive();
+void openRollups();
+long rebuildRollups();
+void applyAdvertisingData();
+void applyConfigChanges(uint32_t changed);
+void loadConfig();
+void startAdvertisingWindow();
+void setClockFromGps();
+String bootTimelineString();
+struct BleCommand;
+void replyTo(uint16_t connId, const uint8_t* data, size_t length);
+void replyTo(uint16_t connId, const char* text);
+void runBleCommand(const BleCommand &request);
+long dumpLog(char* path, size_t pathSize);
+// ============================================================================
+// TASK PLACEMENT
+// ============================================================================
+// Core and priority of every task this firmware owns. Override any value
+// with a -D build flag. The Bluedroid host/controller tasks are pinned by
+// sdkconfig and are only reported here.
+//
+// Role          Runs in           Default
+// BLE stack     BTC/BTU/btController  Core CONFIG_BT_BLUEDROID_PINNED_TO_CORE (fixed)
+// Sensor        SoilSensorTask    Core 1, prio 2
+// Display       DisplayTask       Core 1, prio 1
+// Log drain     LogDrainTask      Core 0, prio 1
+// GPS, storage,
+// transfer pump loopTask          Core ARDUINO_RUNNING_CORE, prio 1
+//
+// The defaults come from the bench's placement suite: a two-core scheduler
+// model driven by assumed costs (the PLACEMENT_*_US estimates behind
+// runPlacement() in src/bench/main.cpp), not from a unit. 93 ms negotiated
+// poll, transfer running; modelled worst wake-up in us:
+//
+// Placement                     sensor   loop  display  log  BLE  pump slots
+// Core 0 prio 1, busy, OLED in loop 530  24500     -   1550    0    96.2%
+// Core 0 prio 1                    530   4740    410    600    0   100%
+// Core 1 prio 1                    324   4740    410    600    0   100%
+// Core 1 prio 2 (default)            4   4740    410    600    0   100%
+// Core 1 prio 2, busy                0  93650  88410    600    0    91.1%
+//
+// In the model Bluedroid outranks every task, so no placement delays it. What
+// cost transfer slots was the OLED push inline in loopTask and the busy-polled
+// UART; with sleeping reads the sensor's core only sets its own latency,
+// least on Core 1 above loopTask. The printTaskReport() output of a real unit
+// is what confirms these defaults or retunes them.
+#ifndef SENSOR_TASK_CORE
+#define SENSOR_TASK_CORE        1
+#endif
+#ifndef SENSOR_TASK_PRIORITY
+#define SENSOR_TASK_PRIORITY    2
+#endif
+#ifndef DISPLAY_TASK_CORE
+#define DISPLAY_TASK_CORE       1
+#endif
+#ifndef DISPLAY_TASK_PRIORITY
+#define DISPLAY_TASK_PRIORITY   1
+#endif
+#ifndef MAIN_TASK_PRIORITY
+#define MAIN_TASK_PRIORITY      1
+#endif
+#ifndef LOG_TASK_CORE
+#define LOG_TASK_CORE           0
+#endif
+#ifndef LOG_TASK_PRIORITY
+#define LOG_TASK_PRIORITY       1
+#endif
+#define TASK_REPORT_MAX_TASKS   24
+
+/**
+ * @brief Self-measured CPU share and wake-up latency of one of our tasks.
+ * Each task updates its own entry; the report reads them under statsMux.
+ */
+struct TaskStats {
+  const char* name;
+  uint64_t busyUs;
+  uint64_t activeSinceUs;
+  uint32_t wakes;
+  uint32_t latencyMaxUs;
+  uint64_t latencySumUs;
+  uint32_t latencySamples;
+};
+
+TaskStats mainStats    = {"loopTask", 0, 0, 0, 0, 0, 0};
+TaskStats sensorStats  = {"SoilSensorTask", 0, 0, 0, 0, 0, 0};
+TaskStats displayStats = {"DisplayTask", 0, 0, 0, 0, 0, 0};
+TaskStats* ownedTaskStats[] = {&mainStats, &sensorStats, &displayStats};
+uint64_t taskStatsWindowStartUs = 0;
+portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Marks the start of a burst of work.
+ * @param expectedUs When the task wanted to run (0 = unknown, no latency sample)
+ */
+void taskStatsWake(TaskStats &st, uint64_t expectedUs) {
+  uint64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&statsMux);
+  st.activeSinceUs = now;
+  st.wakes++;
+  if (expectedUs > 0 && now > expectedUs) {
+    uint32_t late = (uint32_t)(now - expectedUs);
+    st.latencySumUs += late;
+    st.latencySamples++;
+    if (late > st.latencyMaxUs) st.latencyMaxUs = late;
+  }
+  portEXIT_CRITICAL(&statsMux);
+}
+
+void taskStatsSleep(TaskStats &st) {
+  uint64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&statsMux);
+  if (st.activeSinceUs > 0) {
+    st.busyUs += now - st.activeSinceUs;
+    st.activeSinceUs = 0;
+  }
+  portEXIT_CRITICAL(&statsMux);
+}
+
+/**
+ * @brief Prints core, priority, CPU share and scheduling latency per task,
+ * then starts a new measurement window.
+ */
+void printTaskReport() {
+  uint64_t now = esp_timer_get_time();
+  uint64_t windowUs = now - taskStatsWindowStartUs;
+  if (windowUs == 0) return;
+
+  Serial.printf("🧵 Task report (%.1f s window)\n", windowUs / 1e6);
+  Serial.println("   task            core prio   cpu%   wakes  lat_avg_us lat_max_us");
+  for (TaskStats* st : ownedTaskStats) {
+    TaskHandle_t handle = xTaskGetHandle(st->name);
+    portENTER_CRITICAL(&statsMux);
+    uint64_t busy = st->busyUs;
+    if (st->activeSinceUs > 0) busy += now - st->activeSinceUs;
+    TaskStats snap = *st;
+    st->busyUs = 0;
+    if (st->activeSinceUs > 0) st->activeSinceUs = now;
+    st->wakes = 0;
+    st->latencyMaxUs = 0;
+    st->latencySumUs = 0;
+    st->latencySamples = 0;
+    portEXIT_CRITICAL(&statsMux);
+
+    Serial.printf("   %-15s %4d %4u %6.2f %7u %11u %10u\n",
+      snap.name,
+      handle ? (int)xTaskGetAffinity(handle) : -1,
+      handle ? (unsigned)uxTaskPriorityGet(handle) : 0,
+      busy * 100.0 / windowUs,
+      snap.wakes,
+      snap.latencySamples ? (unsigned)(snap.latencySumUs / snap.latencySamples) : 0,
+      snap.latencyMaxUs);
+  }
+
+#if (configUSE_TRACE_FACILITY == 1) && (configGENERATE_RUN_TIME_STATS == 1)
+  // Kernel run-time counters also cover the Bluetooth and system tasks
+  static TaskStatus_t tasks[TASK_REPORT_MAX_TASKS];
+  uint32_t totalRunTime = 0;
+  UBaseType_t count = uxTaskGetSystemState(tasks, TASK_REPORT_MAX_TASKS, &totalRunTime);
+  if (totalRunTime > 0) {
+    Serial.println("   -- all tasks (since boot, % of one core) --");
+    for (UBaseType_t i = 0; i < count; i++) {
+      Serial.printf("   %-15s %4d %4u %6.2f\n",
+        tasks[i].pcTaskName,
+#ifdef CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        (int)tasks[i].xCoreID,
+#else
+        -1,
+#endif
+        (unsigned)tasks[i].uxCurrentPriority,
+        tasks[i].ulRunTimeCounter * 100.0 / totalRunTime);
+    }
+  }
+#endif
+  taskStatsWindowStartUs = now;
+}
+// ============================================================================
+// METRICS
+// ============================================================================
+// Fixed-bucket latency histograms (microseconds). Each metric has one
+// writer task; see AgniMetrics.h. Dumped to serial with the health
+// check and readable at any time from the stats characteristic.
+enum HistogramId {
+  HIST_LOOP_US,        // one main loop iteration
+  HIST_DISPLAY_US,     // render + I2C push of one screen
+  HIST_SNAPSHOT_US,    // SNAPSHOT written -> reply notified
+  HIST_COUNT
+};
+const char* histogramNames[HIST_COUNT] = {
+  "loop_us", "disp_us", "snap_us"
+};
+
+// Modbus, storage and transfer keep their own counters (ModbusStats,
+// StorageStats, TransferStats); the snapshot below gathers them.
+LatencyHistogram metricHistograms[HIST_COUNT];
+#define METRICS_SNAPSHOT_MAX 512   // fits one long GATT read
+
+inline void metricTime(HistogramId id, uint32_t startUs) {
+  metricHistograms[id].record(micros() - startUs);
+}
+
+// ============================================================================
+// MAIN SCHEDULER
+// ============================================================================
+// loop() blocks on an event group until a wake source fires or the earliest
+// registered deadline expires, instead of polling everything every 10 ms.
+#define EVT_SOIL_DATA       (1 << 0)   // sensor task pushed a new reading
+#define EVT_BLE_COMMAND     (1 << 1)   // command characteristic written
+#define EVT_BLE_CONNECTION  (1 << 2)   // client connected / disconnected
+#define EVT_GPS_DATA        (1 << 3)   // GPS UART received a burst
+#define EVT_RESCHEDULE      (1 << 4)   // another task moved a deadline
+#define EVT_ALL (EVT_SOIL_DATA | EVT_BLE_COMMAND | EVT_BLE_CONNECTION | EVT_GPS_DATA | EVT_RESCHEDULE)
+
+#define SCHED_MAX_IDLE_MS        1000  // upper bound so the watchdog is still fed
+#define GPS_POLL_FALLBACK_MS     1000
+#define DISPLAY_REFRESH_MS       500
+#define TASK_REPORT_INTERVAL     60000
+#define STATUS_PRINT_INTERVAL_TRANSFER 30000
+#define AUTO_TRANSFER_DELAY      5000
+#define STATE_RETRY_MS           1000
+
+enum SchedulerSlot {
+  SLOT_GPS,
+  SLOT_TRANSFER,
+  SLOT_STATE,
+  SLOT_TASK_REPORT,
+  SLOT_STATUS,
+  SLOT_AUTO_TRANSFER,
+  SLOT_HEALTH,
+  SLOT_ADVERTISING,
+  SLOT_TRACE_FLUSH,
+  SLOT_ARCHIVE,
+  SLOT_LIVE,
+  SLOT_SLEEP,
+  SLOT_COUNT
+};
+
+EventGroupHandle_t mainEvents = NULL;
+TaskHandle_t mainTaskHandle = NULL;
+unsigned long slotDeadline[SLOT_COUNT];
+bool slotArmed[SLOT_COUNT];
+portMUX_TYPE schedMux = portMUX_INITIALIZER_UNLOCKED;
+uint64_t firstSignalUs = 0;   // oldest unserviced signal, for wake latency
+
+/**
+ * @brief Wakes the main loop. Safe to call from any task.
+ */
+void signalMainTask(EventBits_t bits) {
+  if (mainEvents) {
+    portENTER_CRITICAL(&schedMux);
+    if (firstSignalUs == 0) firstSignalUs = esp_timer_get_time();
+    portEXIT_CRITICAL(&schedMux);
+    xEventGroupSetBits(mainEvents, bits);
+  }
+}
+
+/**
+ * @brief Arms a deadline for a subsystem, replacing any earlier one.
+ */
+void scheduleIn(SchedulerSlot slot, unsigned long delayMs) {
+  portENTER_CRITICAL(&schedMux);
+  slotDeadline[slot] = millis() + delayMs;
+  slotArmed[slot] = true;
+  portEXIT_CRITICAL(&schedMux);
+  // The main task recomputes its timeout on its own; others must wake it
+  if (xTaskGetCurrentTaskHandle() != mainTaskHandle) {
+    signalMainTask(EVT_RESCHEDULE);
+  }
+}
+
+void scheduleCancel(SchedulerSlot slot) {
+  portENTER_CRITICAL(&schedMux);
+  slotArmed[slot] = false;
+  portEXIT_CRITICAL(&schedMux);
+}
+
+/**
+ * @brief Returns true (and disarms the slot) once its deadline has passed.
+ */
+bool slotDue(SchedulerSlot slot) {
+  bool due = false;
+  portENTER_CRITICAL(&schedMux);
+  if (slotArmed[slot] && (long)(millis() - slotDeadline[slot]) >= 0) {
+    slotArmed[slot] = false;
+    due = true;
+  }
+  portEXIT_CRITICAL(&schedMux);
+  return due;
+}
+
+bool slotPending(SchedulerSlot slot) {
+  portENTER_CRITICAL(&schedMux);
+  bool armed = slotArmed[slot];
+  portEXIT_CRITICAL(&schedMux);
+  return armed;
+}
+
+void initScheduler() {
+  mainTaskHandle = xTaskGetCurrentTaskHandle();
+  mainEvents = xEventGroupCreate();
+  if (mainEvents == NULL) {
+    Serial.println("❌ Failed to create main event group!");
+  }
+  for (int i = 0; i < SLOT_COUNT; i++) {
+    slotArmed[i] = false;
+  }
+}
+
+/**
+ * @brief Blocks the main task until an event arrives or the nearest deadline.
+ * @return The event bits that woke the task (cleared on exit)
+ */
+EventBits_t waitForMainEvents() {
+  taskStatsSleep(mainStats);
+  unsigned long now = millis();
+  unsigned long waitMs = SCHED_MAX_IDLE_MS;
+
+  portENTER_CRITICAL(&schedMux);
+  for (int i = 0; i < SLOT_COUNT; i++) {
+    if (!slotArmed[i]) continue;
+    long remaining = (long)(slotDeadline[i] - now);
+    if (remaining <= 0) {
+      waitMs = 0;
+      break;
+    }
+    if ((unsigned long)remaining < waitMs) {
+      waitMs = remaining;
+    }
+  }
+  portEXIT_CRITICAL(&schedMux);
+
+  uint64_t deadlineUs = esp_timer_get_time() + (uint64_t)waitMs * 1000ULL;
+  EventBits_t events = 0;
+  if (mainEvents == NULL) {
+    delay(waitMs);
+  } else {
+    events = xEventGroupWaitBits(mainEvents, EVT_ALL, pdTRUE, pdFALSE, pdMS_TO_TICKS(waitMs)) & EVT_ALL;
+  }
+
+  // Latency: from the first signal if one woke us, else from the deadline
+  portENTER_CRITICAL(&schedMux);
+  uint64_t expectedUs = (events && firstSignalUs) ? firstSignalUs : deadlineUs;
+  firstSignalUs = 0;
+  portEXIT_CRITICAL(&schedMux);
+  taskStatsWake(mainStats, (events || waitMs < SCHED_MAX_IDLE_MS) ? expectedUs : 0);
+  return events;
+}
 // ============================================================================
 // BUZZER FUNCTIONS
 // ============================================================================
 /**
- * @brief The low-level helper function that plays any note.
+ * @brief One step of a buzzer sequence. A frequency of 0 is a rest.
  */
-void playNote(int frequency, int duration) {
-  ledcSetup(BUZZER_CHANNEL, frequency, BUZZER_RESOLUTION);
+struct ToneStep {
+  uint16_t frequency;
+  uint16_t duration;
+};
+
+#define TONE_QUEUE_LENGTH 32
+ToneStep toneQueue[TONE_QUEUE_LENGTH];
+uint8_t toneHead = 0;            // next free slot
+uint8_t toneTail = 0;            // next step to play
+bool tonePlaying = false;
+bool buzzerReady = false;
+esp_timer_handle_t toneTimer = NULL;
+portMUX_TYPE toneMux = portMUX_INITIALIZER_UNLOCKED;
+
+// --- Your chosen success sound (Pattern 4: C-E-G-C5) ---
+const ToneStep MELODY_SUCCESS[] = {
+  {NOTE_C4, 120}, {0, 40},
+  {NOTE_E4, 120}, {0, 40},
+  {NOTE_G4, 120}, {0, 40},
+  {NOTE_C5, 200}
+};
+
+/**
+ * @brief Plays the next queued step. Runs in the esp_timer task, so all
+ * LEDC writes after init happen from this one place.
+ */
+void toneTimerCallback(void* arg) {
+  ToneStep step;
+  bool haveStep = false;
+
+  portENTER_CRITICAL(&toneMux);
+  if (toneTail != toneHead) {
+    step = toneQueue[toneTail];
+    toneTail = (toneTail + 1) % TONE_QUEUE_LENGTH;
+    haveStep = true;
+  } else {
+    tonePlaying = false;
+  }
+  portEXIT_CRITICAL(&toneMux);
+
+  if (!haveStep) {
+    ledcWrite(BUZZER_CHANNEL, 0);
+    return;
+  }
+  if (step.frequency > 0) {
+    ledcChangeFrequency(BUZZER_CHANNEL, step.frequency, BUZZER_RESOLUTION);
+    ledcWrite(BUZZER_CHANNEL, BUZZER_VOLUME);
+  } else {
+    ledcWrite(BUZZER_CHANNEL, 0);
+  }
+  esp_timer_start_once(toneTimer, (uint64_t)step.duration * 1000ULL);
+}
+
+/**
+ * @brief One-time LEDC and timer setup for the buzzer.
+ */
+void initBuzzer() {
+  ledcSetup(BUZZER_CHANNEL, BUZZER_DEFAULT_FREQ, BUZZER_RESOLUTION);
   ledcAttachPin(BUZZER_PIN, BUZZER_CHANNEL);
-  ledcWrite(BUZZER_CHANNEL, BUZZER_VOLUME);
-  delay(duration);
   ledcWrite(BUZZER_CHANNEL, 0);
-  ledcDetachPin(BUZZER_PIN);
+
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = &toneTimerCallback;
+  timerArgs.dispatch_method = ESP_TIMER_TASK;
+  timerArgs.name = "tone";
+  if (esp_timer_create(&timerArgs, &toneTimer) != ESP_OK) {
+    Serial.println("❌ Buzzer timer creation failed");
+    return;
+  }
+  buzzerReady = true;
+}
+
+/**
+ * @brief Queues a sequence of notes and returns immediately.
+ * The whole sequence is dropped if it does not fit; feedback is best-effort
+ * and must never block the caller (BLE callbacks, sensor task, main loop).
+ * @return true if the sequence was queued
+ */
+bool queueTones(const ToneStep* steps, size_t count) {
+  if (!buzzerReady || count == 0) return false;
+  bool startTimer = false;
+
+  portENTER_CRITICAL(&toneMux);
+  size_t used = (toneHead + TONE_QUEUE_LENGTH - toneTail) % TONE_QUEUE_LENGTH;
+  if (used + count > TONE_QUEUE_LENGTH - 1) {
+    portEXIT_CRITICAL(&toneMux);
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    toneQueue[toneHead] = steps[i];
+    toneHead = (toneHead + 1) % TONE_QUEUE_LENGTH;
+  }
+  if (!tonePlaying) {
+    tonePlaying = true;
+    startTimer = true;
+  }
+  portEXIT_CRITICAL(&toneMux);
+
+  // Kick the timer rather than touching LEDC from the caller's context
+  if (startTimer) {
+    esp_timer_start_once(toneTimer, 1);
+  }
+  return true;
+}
+
+/**
+ * @brief The low-level helper function that plays any note (non-blocking).
+ */
+void playNote(int frequency, int duration) {
+  ToneStep step = {(uint16_t)frequency, (uint16_t)duration};
+  queueTones(&step, 1);
 }
 /**
  * @brief Your chosen success sound (Pattern 4: C-E-G-C5)
  */
 void playSuccessSound() {
   Serial.println("🔊 Playing Success Sound!");
-  playNote(NOTE_C4, 120);
-  delay(40);
-  playNote(NOTE_E4, 120);
-  delay(40);
-  playNote(NOTE_G4, 120);
-  delay(40);
-  playNote(NOTE_C5, 200);
+  queueTones(MELODY_SUCCESS, sizeof(MELODY_SUCCESS) / sizeof(MELODY_SUCCESS[0]));
 }
 /**
  * @brief A simple beep for all other notifications.
@@ -308,7 +909,7 @@ void showPlaceSensorScreen() {
 void showAnalyzingScreen() {
   if(!systemStatus.oledOK) return;
   unsigned long currentTime = millis();
-  int remainingTime = (DATA_LOG_INTERVAL / 1000) - ((currentTime - countdownStartTime) / 1000);
+  int remainingTime = (config.get(CONFIG_LOG_INTERVAL_MS) / 1000) - ((currentTime - countdownStartTime) / 1000);
   if (remainingTime < 0) remainingTime = 0;
   display.clearDisplay();
   display.setTextSize(1);
@@ -335,7 +936,7 @@ void showFileCreatedScreen() {
   display.println("FILE CREATION");
   display.println("SUCCESSFUL");
   display.println();
-  display.printf("Total Files: %d\n", fileCounter - 1);
+  display.printf("Total Files: %d\n", recordStore.recordCount());
   display.println();
   display.println("Data saved to SD card");
   display.display();
@@ -368,6 +969,7 @@ void updateDisplayState() {
     return;
   }
   lastUpdate = millis();
+  uint32_t drawStartUs = micros();
   switch(currentState) {
     case STATE_INITIAL:
       showInitialScreen();
@@ -388,6 +990,44 @@ void updateDisplayState() {
       showBLETransferScreen();
       break;
   }
+  metricTime(HIST_DISPLAY_US, drawStartUs);
+}
+/**
+ * @brief How long each state is shown before the state machine moves on.
+ * @return 0 for states that only leave on an external event
+ */
+unsigned long stateDuration(DisplayState state) {
+  switch (state) {
+    case STATE_INITIAL:         return 3000;
+    case STATE_COMPONENT_CHECK: return 3000;
+    case STATE_PLACE_SENSOR:    return 5000;
+    case STATE_ANALYZING:       return config.get(CONFIG_LOG_INTERVAL_MS);
+    case STATE_FILE_CREATED:    return 3000;
+    default:                    return 0;
+  }
+}
+/**
+ * @brief Owns the OLED after boot. A full-frame I2C push takes tens of ms,
+ * so it no longer runs inline with the transfer pump in loop().
+ */
+TaskHandle_t DisplayTask = NULL;
+
+void displayTaskLoop(void * pvParameters) {
+  for(;;) {
+    // Wake on a state change, or periodically for the countdown screens
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DISPLAY_REFRESH_MS));
+    taskStatsWake(displayStats, 0);
+    updateDisplayState();
+    taskStatsSleep(displayStats);
+  }
+}
+
+void requestDisplayUpdate() {
+  if (DisplayTask) {
+    xTaskNotifyGive(DisplayTask);
+  } else {
+    updateDisplayState();
+  }
 }
 bool isValidStateTransition(DisplayState from, DisplayState to) {
   switch (from) {
@@ -415,7 +1055,12 @@ void changeState(DisplayState newState) {
   currentState = newState;
   stateStartTime = millis();
   countdownStartTime = millis();
-  updateDisplayState();
+  requestDisplayUpdate();
+  if (stateDuration(newState) > 0) {
+    scheduleIn(SLOT_STATE, stateDuration(newState));
+  } else {
+    scheduleCancel(SLOT_STATE);
+  }
   
   Serial.printf("🔄 State changed to: %d\n", newState);
 }
@@ -486,21 +1131,16 @@ void initSDCard() {
     systemStatus.sdOK = false;
     return;
   }
-  uint8_t cardType = SD.cardType();
   uint64_t cardSize = SD.cardSize() / (1024 * 1024);
   Serial.printf("✅ SD Card initialized: %llu MB\n", cardSize);
   // clearSDCardData();
-  if(!SD.exists("/farmland_data")) {
-    SD.mkdir("/farmland_data");
-  }
   systemStatus.sdOK = true;
   findLastFileCounter();
 }
 bool checkSDHealth() {
   if (!systemStatus.sdOK) return false;
   
-  uint64_t freeBytes = SD.totalBytes() - SD.usedBytes();
-  if (freeBytes < 1024 * 1024) {
+  if (!recordStore.hasSpace(SD_MIN_FREE_BYTES)) {
     Serial.println("⚠️ SD card running low on space!");
     return false;
   }
@@ -508,121 +1148,80 @@ bool checkSDHealth() {
 }
 
 /**
- * @brief Scans the /farmland_data directory to find the highest file number.
- * Sets the global 'fileCounter' to the next available number.
+ * @brief Creates /farmland_data if needed and resumes numbering after the
+ * highest farmland_<n>.json already on the card.
  */
 void findLastFileCounter() {
   if (!systemStatus.sdOK) return;
 
-  File root = SD.open("/farmland_data");
-  if (!root) {
+  if (!recordStore.begin()) {
     Serial.println("❌ Failed to open /farmland_data to find last file.");
-    fileCounter = 1;
     return;
   }
+  Serial.printf("✅ SD Scan: Resuming from file number %d\n", recordStore.nextFileNumber());
+  openArchive();
+  openRollups();
+}
 
-  int maxFileNum = 0;
-  File file = root.openNextFile();
-  while (file) {
-    if (!file.isDirectory()) {
-      // file.name() returns the full path, e.g., /farmland_data/farmland_12.json
-      String fileName = file.name(); 
-      // Get just the filename part: farmland_12.json
-      String baseName = fileName.substring(fileName.lastIndexOf('/') + 1); 
-
-      if (baseName.startsWith("farmland_") && baseName.endsWith(".json")) {
-        // Extract the number part: "12"
-        String numStr = baseName.substring(
-          baseName.indexOf('_') + 1, 
-          baseName.lastIndexOf('.')
-        );
-
-        int fileNum = numStr.toInt();
-        if (fileNum > maxFileNum) {
-          maxFileNum = fileNum;
-        }
-      }
-    }
-    file.close();
-    file = root.openNextFile();
+/**
+ * @brief (Re)opens the archive after boot or a wipe and arms the seal timer
+ * for samples staged before a reboot.
+ */
+void openArchive() {
+  if (!archiveWriter.begin()) {
+    Serial.println("❌ Failed to open " ARCHIVE_DIR);
+    return;
   }
-  root.close();
-
-  fileCounter = maxFileNum + 1; // Start at the next number
-  Serial.printf("✅ SD Scan: Resuming from file number %d\n", fileCounter);
+  Serial.printf("🗄️  Archive: next block %lu, %u samples staged\n",
+    (unsigned long)archiveWriter.nextBlockNumber(), (unsigned)archiveWriter.staged());
+  if (archiveWriter.staged()) scheduleIn(SLOT_ARCHIVE, ARCHIVE_SEAL_INTERVAL);
 }
 
-
-// ============================================================================
-// TIME CONVERSION HELPER
-// ============================================================================
 /**
- * @brief Converts the current systemStatus UTC time to IST (UTC+5:30).
- * Handles all date, month, and year rollovers correctly.
- * @param ist_year Output for IST year
- * @param ist_month Output for IST month (1-12)
- * @param ist_day Output for IST day (1-31)
- * @param ist_hour Output for IST hour (0-23)
- * @param ist_minute Output for IST minute (0-59)
+ * @brief (Re)opens the rollup index after boot or a wipe.
  */
-void getISTDateTime(int &ist_year, int &ist_month, int &ist_day, int &ist_hour, int &ist_minute) {
-  // 1. Create a struct tm for the UTC time
-  struct tm utc_tm;
-  utc_tm.tm_year = systemStatus.year - 1900;  
-  utc_tm.tm_mon  = systemStatus.month - 1;
-  utc_tm.tm_mday = systemStatus.day;
-  utc_tm.tm_hour = systemStatus.hour;
-  utc_tm.tm_min  = systemStatus.minute;
-  utc_tm.tm_sec  = systemStatus.second;
-  utc_tm.tm_isdst = 0; 
-  // setenv("TZ", "UTC", 1);  suggesstion from chatGPT
-  // tzset();
-  time_t utc_time = mktime(&utc_tm);
-  // 2. Define the IST offset in seconds (5 hours * 3600s/hr) + (30 minutes * 60s/min)
-  const long IST_OFFSET_SECONDS = 19800; // (5 * 3600) + (30 * 60)
-  // 3. Add the offset to get the IST time
-  time_t ist_time = utc_time + IST_OFFSET_SECONDS;
-  // 4. Convert the IST timestamp back into a struct tm
-  struct tm ist_tm;
-  gmtime_r(&ist_time, &ist_tm);
-  // 5. Assign the correct values to the output variables
-  ist_year   = ist_tm.tm_year + 1900;
-  ist_month  = ist_tm.tm_mon + 1;
-  ist_day    = ist_tm.tm_mday;
-  ist_hour   = ist_tm.tm_hour;
-  ist_minute = ist_tm.tm_min;
+void openRollups() {
+  if (!rollupStore.begin()) {
+    Serial.println("❌ Failed to open " ROLLUP_DIR);
+    return;
+  }
+  // Ring files lost or never written but blocks present (e.g. a card from
+  // an older build): recompute rather than start from nothing
+  if (rollupStore.startedEmpty() && archiveWriter.nextBlockNumber() > 1) rebuildRollups();
+  Serial.printf("📅 Rollups: newest day %lu, hour %lu\n",
+    (unsigned long)rollupStore.newestKey(ROLLUP_DAY), (unsigned long)rollupStore.newestKey(ROLLUP_HOUR));
 }
 
 /**
- * @brief Recursively deletes all files and sub-folders from a given directory.
- * @param dir The directory File object to start from.
+ * @brief Recomputes the rollup rings from the archive.
+ * @return samples folded in, -1 on a write failure
  */
-void deleteRecursive(File dir) {
-  while(true) {
-    File entry = dir.openNextFile();
-    if (! entry) {
-      // no more files or directories in this directory
-      break;
-    }
-
-    String entryPath = entry.name();
-
-    if (entry.isDirectory()) {
-      // It's a directory. Recurse into it to delete its contents.
-      Serial.println("  Entering dir: " + entryPath);
-      File subDir = SD.open(entryPath);
-      deleteRecursive(subDir);
-      subDir.close();
+long rebuildRollups() {
+  unsigned long startMs = millis();
+  long samples = rollupStore.rebuild(archiveWriter);
+  if (samples < 0) {
+    Serial.println("❌ Rollup rebuild failed");
+  } else {
+    Serial.printf("📅 Rollups rebuilt from %ld samples in %lu ms\n", samples, millis() - startMs);
+  }
+  return samples;
+}
 
-      // Now that the directory is empty, remove it.
-      Serial.println("  Removing dir: " + entryPath);
-      SD.rmdir(entryPath);
-    } else {
-      // It's a file. Delete it.
-      Serial.println("  Deleting file: " + entryPath);
-      SD.remove(entryPath);
-    }
-    entry.close();
+/**
+ * @brief Seals the staged samples into a block once the interval is up.
+ */
+void sealArchive() {
+  if (archiveWriter.staged() == 0) return;
+  if (millis() - archiveWriter.stagedSinceMs() < ARCHIVE_SEAL_INTERVAL) {
+    scheduleIn(SLOT_ARCHIVE, ARCHIVE_SEAL_INTERVAL - (millis() - archiveWriter.stagedSinceMs()));
+    return;
+  }
+  uint32_t block = archiveWriter.nextBlockNumber();
+  if (archiveWriter.seal()) {
+    Serial.printf("🗄️  Archive block %lu sealed\n", (unsigned long)block);
+  } else {
+    Serial.println("❌ Failed to seal archive block");
+    scheduleIn(SLOT_ARCHIVE, ARCHIVE_SEAL_INTERVAL);
   }
 }
 
@@ -630,230 +1229,295 @@ void clearSDCardData() {
   if(!systemStatus.sdOK) return;
   Serial.println("🗑️  WIPING ENTIRE SD CARD (as requested on reset)...");
 
-  File root = SD.open("/");
-  if (root) {
-    deleteRecursive(root); // <-- Call the new helper
-    root.close();
-  } else {
-    Serial.println("❌ Failed to open root directory to wipe.");
+  if (!recordStore.wipe()) {
+    Serial.println("❌ Some files could not be removed while wiping.");
   }
-
-  fileCounter = 1;
+  openArchive();
+  openRollups();
   Serial.println("✅ SD Card Wiped!");
+}
 
-  // Re-create the data directory since we just deleted it
-  if(!SD.exists("/farmland_data")) {
-    SD.mkdir("/farmland_data");
-    Serial.println("✅ Re-created /farmland_data directory.");
+/**
+ * @brief Snapshot of the current reading and GPS state as a record.
+ */
+SoilRecord buildCurrentRecord() {
+  SoilRecord record;
+  record.id = recordStore.nextFileNumber();
+  record.soil = soilData;
+  // Device ages were taken when the snapshot was queued
+  uint32_t sinceSnapshotMs = millis() - busSnapshot.takenMs;
+  record.deviceCount = busSnapshot.deviceCount;
+  for (uint8_t d = 0; d < record.deviceCount; d++) {
+    record.devices[d] = busSnapshot.devices[d];
+    if (record.devices[d].validFields) record.devices[d].ageMs += sinceSnapshotMs;
   }
+  GpsFix &fix = record.fix;
+  fix.valid = systemStatus.gpsFix;
+  fix.latitude = systemStatus.latitude;
+  fix.longitude = systemStatus.longitude;
+  fix.altitude = systemStatus.altitude;
+  fix.satellites = systemStatus.satellites;
+  fix.speedKmh = gps.speed.kmph();
+  fix.hdop = gps.hdop.hdop();
+  fix.year = systemStatus.year;
+  fix.month = systemStatus.month;
+  fix.day = systemStatus.day;
+  fix.hour = systemStatus.hour;
+  fix.minute = systemStatus.minute;
+  fix.second = systemStatus.second;
+  return record;
 }
 
-String generateJSONData() {
-  JsonDocument doc;
-  doc["id"] = fileCounter;
-  
-  if(systemStatus.gpsFix) {
-    // --- Log UTC Data ---
-    char timestamp[30];
-    sprintf(timestamp, "%04d-%02d-%02dT%02d:%02d:%02dZ",
-      systemStatus.year, systemStatus.month, systemStatus.day,
-      systemStatus.hour, systemStatus.minute, systemStatus.second);
-    doc["timestamp"] = timestamp;
-    
-    char time_utc[10];
-    sprintf(time_utc, "%02d:%02d:%02d", systemStatus.hour, systemStatus.minute, systemStatus.second);
-    doc["time_utc"] = time_utc;
-    int ist_year, ist_month, ist_day, ist_hour, ist_minute;
-    getISTDateTime(ist_year, ist_month, ist_day, ist_hour, ist_minute);
-    char date_ist[12];
-    sprintf(date_ist, "%04d-%02d-%02d", ist_year, ist_month, ist_day);
-    doc["date_ist"] = date_ist;
-    char time_ist[20];
-    int ist_hour_12 = ist_hour % 12;
-    if (ist_hour_12 == 0) ist_hour_12 = 12;
-    
-    sprintf(time_ist, "%02d:%02d %s", ist_hour_12, ist_minute, ist_hour >= 12 ? "PM" : "AM");
-    doc["time_ist"] = time_ist;
+String generateJSONData(const SoilRecord &record) {
+  char json[RECORD_JSON_MAX];
+  size_t length = encodeRecordJson(record, json, sizeof(json));
+  json[length] = '\0';
+  return String(json);
+}
 
-  } else {
-    doc["timestamp"] = "0000-00-00T00:00:00Z";
-    doc["time_utc"] = "00:00:00";
-    doc["date_ist"] = "0000-00-00";
-    doc["time_ist"] = "00:00 AM";
-  }
-  JsonObject location = doc["location"].to<JsonObject>();
-  location["latitude"] = systemStatus.gpsFix ? systemStatus.latitude : 0.0;
-  location["longitude"] = systemStatus.gpsFix ? systemStatus.longitude : 0.0;
-  location["valid"] = systemStatus.gpsFix;
-  location["satellites"] = systemStatus.gpsFix ? systemStatus.satellites : 0;
-  location["altitude"] = systemStatus.gpsFix ? systemStatus.altitude : 0.0;
-  location["speed_kmh"] = systemStatus.gpsFix ? gps.speed.kmph() : 0.0;
-  location["hdop"] = systemStatus.gpsFix ? gps.hdop.hdop() : 0.0;
-  
-  if(soilData.ph < 5.5) doc["ph_category"] = "acidic";
-  else if(soilData.ph < 6.5) doc["ph_category"] = "slightly_acidic";
-  else if(soilData.ph < 7.5) doc["ph_category"] = "neutral";
-  else if(soilData.ph < 8.5) doc["ph_category"] = "slightly_alkaline";
-  else doc["ph_category"] = "alkaline";
-  
-  JsonObject params = doc["parameters"].to<JsonObject>();
-  params["ph_value"] = soilData.ph;
-  params["conductivity"] = soilData.conductivity;
-  params["nitrogen"] = soilData.nitrogen;
-  params["phosphorus"] = soilData.phosphorus;
-  params["potassium"] = soilData.potassium;
-  params["moisture"] = soilData.moisture;
-  params["temperature"] = soilData.temperature;
-  doc["sensor_valid"] = soilData.basicValid && soilData.npkValid;
-  String jsonString;
-  serializeJson(doc, jsonString);
-  return jsonString;
+/**
+ * @brief Logs a record as the next file and folds it into the archive,
+ * the rollups and the broadcast reading.
+ * @return false if the file could not be written
+ */
+bool commitRecord(const SoilRecord &record) {
+  String jsonData = generateJSONData(record);
+  if(!recordStore.append(jsonData.c_str(), jsonData.length(), fixToUnixTime(record.fix), recordPriority(record))) {
+    Serial.printf("❌ Failed to create JSON file: farmland_%lu.json\n", (unsigned long)record.id);
+    return false;
+  }
+  ArchiveSample sample;
+  archiveSampleFromRecord(record, sample);
+  bool firstStaged = archiveWriter.staged() == 0;
+  if (!archiveWriter.add(sample)) {
+    Serial.println("⚠️ Failed to archive the sample");
+  } else if (firstStaged && archiveWriter.staged()) {
+    scheduleIn(SLOT_ARCHIVE, ARCHIVE_SEAL_INTERVAL);
+  }
+  // Samples without GPS time are not bucketed; only a failed write is worth a message
+  uint32_t rollupFailures = rollupStore.stats().writeFailures;
+  rollupStore.add(sample);
+  if (rollupStore.stats().writeFailures != rollupFailures) {
+    Serial.println("⚠️ Failed to update the rollup index");
+  }
+  broadcastSample = sample;
+  broadcastSampleValid = true;
+  if (config.get(CONFIG_BROADCAST) && systemStatus.bleOK) applyAdvertisingData();
+  return true;
 }
 
 void logDataToSD() {
   if(!systemStatus.sdOK || !checkSDHealth()) return;
-  String filename = "/farmland_data/farmland_" + String(fileCounter) + ".json";
-  File file = SD.open(filename, FILE_WRITE);
-  if(!file) {
-    Serial.println("❌ Failed to create JSON file: " + filename);
-    return;
-  }
-  
-  String jsonData = generateJSONData();
-  file.print(jsonData);
-  file.close();
+  int fileNumber = recordStore.nextFileNumber();
+  if (!commitRecord(buildCurrentRecord())) return;
   playSuccessSound();
-  fileCounter++;
-  Serial.println("✅ JSON data logged to SD card: " + filename);
+  Serial.printf("✅ JSON data logged to SD card: /farmland_data/farmland_%d.json\n", fileNumber);
   changeState(STATE_FILE_CREATED);
 }
 
+/**
+ * @brief Main loop, when the on-demand poll arrives: notifies the reading
+ * and current fix (layout in AgniBeacon.h) to the requester, logging it
+ * first for SNAPSHOT:COMMIT. The state machine is left alone.
+ * @param logged the reading is already logged; set once it is, so several
+ *        COMMITs answered by one poll write one record
+ */
+void answerSnapshot(bool fresh, const SnapshotRequest &request, bool &logged) {
+  SoilRecord record = buildCurrentRecord();
+  uint8_t status = fresh ? SNAPSHOT_FRESH : 0;
+  if (fresh && request.commit && !logged && systemStatus.sdOK && commitRecord(record)) logged = true;
+  if (request.commit && logged) status |= SNAPSHOT_COMMITTED;
+  ArchiveSample sample;
+  archiveSampleFromRecord(record, sample);
+  uint32_t ageMs = soilData.basicValid ? millis() - soilDataTakenMs : UINT16_MAX;
+  uint8_t reply[SNAPSHOT_BYTES];
+  size_t length = encodeSnapshot(sample, status, ageMs, reply, sizeof(reply));
+  if (length) replyTo(request.connId, reply, length);
+  metricTime(HIST_SNAPSHOT_US, request.requestUs);
+  Serial.printf("📸 Snapshot %s%s in %lu ms\n", fresh ? "sent" : "sent (sensor failed, last values)",
+    (status & SNAPSHOT_COMMITTED) ? ", logged" : "", (unsigned long)((micros() - request.requestUs) / 1000));
+}
+
 // ============================================================================
 // MODBUS/RS485 FUNCTIONS
 // ============================================================================
-uint16_t crc16_modbus(uint8_t *buf, int len) {
-  uint16_t crc = 0xFFFF;
-  for (int i = 0; i < len; i++) {
-    crc ^= buf[i];
-    for (int j = 0; j < 8; j++) {
-      if (crc & 1) {
-        crc = (crc >> 1) ^ 0xA001;
-      } else {
-        crc >>= 1;
-      }
-    }
-  }
-  return crc;
-}
-
+// Frame handling, retries and the per-device breaker live in AgniModbus
+// and AgniBus; this is the device-side recovery policy.
 void resetSoilSensor() {
-  Serial1.end();
-  delay(100);
-  Serial1.begin(MODBUS_BAUD, SERIAL_8N1, RS485_RX, RS485_TX);
-  soilSensorFailureCount = 0;
+  rs485Port.end();
+  rs485Port.begin(config.get(CONFIG_MODBUS_BAUD));
+  // A swapped or power-cycled sensor may be listening at another rate;
+  // scan with the probe timeout so a dead sensor costs ~1 s, not 4 x 800 ms
+  uint32_t timeoutMs = modbus.timeout();
+  modbus.setTimeout(BUS_PROBE_TIMEOUT_MS);
+  reportLinkBaud(findSensorBaud(modbus, MODBUS_ADDRESS, config.get(CONFIG_MODBUS_BAUD)));
+  modbus.setTimeout(timeoutMs);
   Serial.println("🔄 Soil sensor reset");
 }
 
+/**
+ * @brief Sensor task, after a failed primary poll. Retries and backoff are
+ * the bus's job; the port is only reset (and the rate rescanned) once,
+ * when the primary's breaker opens.
+ */
 void recoverFromSoilSensorFailure() {
-  if (millis() - lastSensorReset < SENSOR_RESET_COOLDOWN) return;
-  soilSensorFailureCount++;
-  Serial.printf("⚠️ Soil sensor failure count: %d/%d\n", soilSensorFailureCount, MAX_SENSOR_FAILURES);
-  if (soilSensorFailureCount >= MAX_SENSOR_FAILURES) {
-    Serial.println("🔄 Attempting sensor recovery...");
-    resetSoilSensor();
-    lastSensorReset = millis();
-  }
-}
-
-bool modbusRead(uint8_t addr, uint16_t startReg, uint16_t regCount, uint16_t *result) {
-  uint8_t txBuf[8];
-  uint8_t rxBuf[256];
-  int pos = 0;
-  txBuf[pos++] = addr;
-  txBuf[pos++] = 0x03;
-  txBuf[pos++] = (startReg >> 8);
-  txBuf[pos++] = (startReg & 0xFF);
-  txBuf[pos++] = (regCount >> 8);
-  txBuf[pos++] = (regCount & 0xFF);
-  uint16_t crc = crc16_modbus(txBuf, pos);
-  txBuf[pos++] = (crc & 0xFF);
-  txBuf[pos++] = (crc >> 8);
-  while(Serial1.available()) Serial1.read();
-  digitalWrite(RS485_DE, HIGH);
-  digitalWrite(RS485_RE, HIGH);
-  delay(10); // FIX: Was 2
-  Serial1.write(txBuf, pos);
-  Serial1.flush();
-  digitalWrite(RS485_DE, LOW);
-  digitalWrite(RS485_RE, LOW);
-  delay(10);  // FIX: Was 2
-  unsigned long startTime = millis();
-  int rxLen = 0;
-  while(millis() - startTime < MODBUS_TIMEOUT && rxLen < sizeof(rxBuf)) {
-    if(Serial1.available()) {
-      rxBuf[rxLen++] = Serial1.read();
-      if(rxLen >= 5) {
-        uint8_t byteCount = rxBuf[2];
-        int expectedLen = 3 + byteCount + 2;
-        if(rxLen >= expectedLen) break;
-      }
+  const BusDeviceStats &stats = soilBus.deviceStats(0);
+  LOG_W("⚠️ Soil sensor %s, %u failed poll(s) in a row",
+    modbusErrorName(stats.lastError), (unsigned)soilBus.failureStreak(0));
+  if (stats.isolations == primaryIsolations) return;
+  primaryIsolations = stats.isolations;
+  Serial.println("🔄 Attempting sensor recovery...");
+  resetSoilSensor();
+}
+
+/**
+ * @brief Sensor task, at start: puts BUS_DEVICES on the bus.
+ */
+void initSoilBus() {
+  for (size_t i = 0; i < BUS_DEVICE_COUNT; i++) {
+    BusDeviceConfig device = BUS_DEVICES[i];
+    if (device.periodMs == 0) device.periodMs = config.get(CONFIG_SENSOR_PERIOD_MS);
+    if (soilBus.addDevice(device) < 0) {
+      Serial.printf("❌ RS485 device %u (%s) not added\n", device.address, device.map->type);
     }
   }
-  if(rxLen == 0) return false;
-  uint16_t receivedCrc = (rxBuf[rxLen-1] << 8) | rxBuf[rxLen-2];
-  uint16_t calculatedCrc = crc16_modbus(rxBuf, rxLen - 2);
-  if(receivedCrc != calculatedCrc) return false;
-  for(int i = 0; i < regCount; i++) {
-    result[i] = (rxBuf[3 + i*2] << 8) | rxBuf[4 + i*2];
+  Serial.printf("✅ RS485 bus: %u device(s)\n", (unsigned)soilBus.deviceCount());
+}
+
+/**
+ * @brief Sensor task: queues the primary probe's reading and, on a
+ * multi-drop bus, every device's latest values after a poll cycle.
+ * @param primaryPolled the primary probe was due in this cycle
+ * @param requests SNAPSHOTs this cycle answers, queued even if it failed
+ * @return requests handed over; the rest wait for the next cycle
+ */
+size_t publishSoilReadings(bool primaryPolled, const SnapshotRequest* requests, size_t count) {
+  SoilSnapshot snapshot;
+  // A reading the main loop hasn't taken yet keeps its requests: taken
+  // back and answered with this one, so neither is lost nor answered twice
+  SoilSnapshot queued;
+  if (xQueueReceive(soilDataQueue, &queued, 0) == pdPASS) {
+    memcpy(snapshot.requests, queued.requests, queued.requestCount * sizeof(SnapshotRequest));
+    snapshot.requestCount = queued.requestCount;
+  }
+  size_t taken = 0;
+  while (taken < count && snapshot.requestCount < SNAPSHOT_QUEUE) {
+    snapshot.requests[snapshot.requestCount++] = requests[taken++];
   }
-  return true;
+  if (primaryPolled) {
+    snapshot.soilFresh = soilFromReading(soilBus.reading(0), snapshot.soil) && snapshot.soil.basicValid;
+    if (snapshot.soilFresh) LOG_I("✅ (SoilSensorTask) Soil sensor data updated");
+    else LOG_W("⚠️  (SoilSensorTask) Soil sensor reading failed");
+  }
+  if (soilBus.deviceCount() > 1) snapshot.deviceCount = soilBus.readings(snapshot.devices, RECORD_MAX_DEVICES);
+  if (snapshot.soilFresh || snapshot.deviceCount || snapshot.requestCount) {
+    snapshot.takenMs = millis();
+    xQueueOverwrite(soilDataQueue, &snapshot);
+    signalMainTask(EVT_SOIL_DATA);
+  }
+  // After queueing, so a SNAPSHOT reply never waits for a port reset
+  if (primaryPolled && !snapshot.soilFresh) recoverFromSoilSensorFailure();
+  return taken;
 }
 
-bool readSoilSensor(SensorData &soilData) {
-  uint16_t regs[4];
-  if(!modbusRead(MODBUS_ADDRESS, REG_MOISTURE, 4, regs)) {
-    soilData.basicValid = false;
-    recoverFromSoilSensorFailure();
-    return false;
+/**
+ * @brief Sensor task: hands the rate the link ended up at to the main
+ * loop, which saves it as modbus_baud for the next boot.
+ */
+void reportLinkBaud(uint32_t baud) {
+  if (baud == 0) {
+    Serial.println("❌ Soil sensor silent at every baud rate");
+    return;
   }
-  
-  soilData.moisture = regs[0] / 10.0f;
-  int16_t tempRaw = (int16_t)regs[1];
-  soilData.temperature = tempRaw / 10.0f;
-  soilData.conductivity = regs[2];
-  soilData.ph = regs[3] / 10.0f;
-  soilData.basicValid = true;
-  
-  uint16_t npkRegs[3];
-  if(modbusRead(MODBUS_ADDRESS, REG_NITROGEN, 3, npkRegs)) {
-    soilData.nitrogen = npkRegs[0];
-    soilData.phosphorus = npkRegs[1];
-    soilData.potassium = npkRegs[2];
-    soilData.npkValid = true;
-  } else {
-    soilData.npkValid = false;
+  if (baud != g_linkBaud) Serial.printf("🔌 RS485 link at %lu baud\n", (unsigned long)baud);
+  g_linkBaud = baud;
+}
+
+/**
+ * @brief Sensor task, at start: finds the sensor at the saved rate (or
+ * any other) and moves it up to modbus_max_baud if it accepts that.
+ */
+void linkSoilSensor() {
+  uint32_t baud = findSensorBaud(modbus, MODBUS_ADDRESS, config.get(CONFIG_MODBUS_BAUD));
+  uint32_t maxBaud = config.get(CONFIG_MODBUS_MAX_BAUD);
+  if (baud && baud < maxBaud && BUS_DEVICE_COUNT == 1) baud = negotiateSensorBaud(modbus, MODBUS_ADDRESS, maxBaud);
+  linkMaxBaud = maxBaud;
+  reportLinkBaud(baud);
+}
+
+/**
+ * @brief Picks up a changed baud rate, ceiling, timeout or sensor period;
+ * sensor task only. With a single sensor a new modbus_baud reprograms it
+ * rather than just the UART.
+ */
+void applyModbusConfig() {
+  modbus.setTimeout(config.get(CONFIG_MODBUS_TIMEOUT_MS));
+  for (size_t i = 0; i < BUS_DEVICE_COUNT && i < soilBus.deviceCount(); i++) {
+    if (BUS_DEVICES[i].periodMs == 0) soilBus.setPeriod(i, config.get(CONFIG_SENSOR_PERIOD_MS));
   }
-  soilSensorFailureCount = 0;
-  return soilData.basicValid;
+  uint32_t baud = config.get(CONFIG_MODBUS_BAUD);
+  uint32_t maxBaud = config.get(CONFIG_MODBUS_MAX_BAUD);
+  if (BUS_DEVICE_COUNT > 1) {
+    if (rs485Port.baud() != baud) {
+      rs485Port.end();
+      rs485Port.begin(baud);
+      Serial.printf("🔧 RS485 now at %lu baud\n", (unsigned long)baud);
+    }
+  } else if (rs485Port.baud() != baud) {
+    reportLinkBaud(moveSensorBaud(modbus, MODBUS_ADDRESS, baud));
+  } else if (maxBaud != linkMaxBaud && baud < maxBaud) {
+    reportLinkBaud(negotiateSensorBaud(modbus, MODBUS_ADDRESS, maxBaud));
+  }
+  linkMaxBaud = maxBaud;
+}
+
+/**
+ * @brief Main loop: saves the link rate the sensor task settled on.
+ */
+void saveLinkBaud() {
+  uint32_t baud = g_linkBaud;
+  if (baud && baud != config.get(CONFIG_MODBUS_BAUD)) config.set(CONFIG_MODBUS_BAUD, baud);
 }
 
 /**
- * @brief This is the dedicated task that runs on Core 0
+ * @brief This is the dedicated task that runs on SENSOR_TASK_CORE
  * to read the soil sensor without blocking the main loop.
  */
 void soilSensorTaskLoop(void * pvParameters) {
-  Serial.println("✅ Soil Sensor Task started on Core 0");
-  SensorData localSensorData;
+  Serial.printf("✅ Soil Sensor Task started on Core %d\n", xPortGetCoreID());
+  uint64_t expectedUs = 0;
+  initSoilBus();
+  linkSoilSensor();
+  uint32_t configSeen = config.generation();
+  SnapshotRequest snapshots[SNAPSHOT_QUEUE];
+  size_t pendingSnapshots = 0;
   for(;;) {
+    taskStatsWake(sensorStats, expectedUs);
     esp_task_wdt_reset(); // Reset watchdog timer
-    bool readOK = readSoilSensor(localSensorData);
-    if(readOK) {
-      Serial.println("✅ (Core 0) Soil sensor data updated");
-      xQueueOverwrite(soilDataQueue, &localSensorData);
-    } else {
-      Serial.println("⚠️  (Core 0) Soil sensor reading failed");
+    // This task owns the bus, so Modbus settings are applied here
+    if (config.generation() != configSeen) {
+      configSeen = config.generation();
+      applyModbusConfig();
+    }
+    // A SNAPSHOT makes the primary due now
+    while (pendingSnapshots < SNAPSHOT_QUEUE
+           && xQueueReceive(snapshotRequests, &snapshots[pendingSnapshots], 0) == pdPASS) pendingSnapshots++;
+    if (pendingSnapshots) soilBus.requestPoll(0);
+    // Every device that is due, back to back; then sleep until the next one
+    uint32_t primaryPolls = soilBus.deviceStats(0).polls;
+    if (soilBus.poll()) {
+      size_t taken = publishSoilReadings(soilBus.deviceStats(0).polls != primaryPolls, snapshots, pendingSnapshots);
+      pendingSnapshots -= taken;
+      memmove(snapshots, snapshots + taken, pendingSnapshots * sizeof(SnapshotRequest));
     }
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
+    taskStatsSleep(sensorStats);
+    uint32_t waitMs = pendingSnapshots ? 0 : soilBus.msUntilDue();
+    if (waitMs > SENSOR_TASK_MAX_SLEEP_MS) waitMs = SENSOR_TASK_MAX_SLEEP_MS;
+    TickType_t ticks = pdMS_TO_TICKS(waitMs);
+    if (ticks == 0) ticks = 1;
+    expectedUs = esp_timer_get_time() + (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+    // A SNAPSHOT request notifies the task and cuts the sleep short
+    if (ulTaskNotifyTake(pdTRUE, ticks)) expectedUs = 0;
   }
 }
 
@@ -861,14 +1525,22 @@ void soilSensorTaskLoop(void * pvParameters) {
 // GPS FUNCTIONS
 // ============================================================================
 void updateGPS() {
+  uint8_t traceChunk[64];
+  size_t traceLength = 0;
   while(GPS_SERIAL.available()) {
     char c = GPS_SERIAL.read();
+    traceChunk[traceLength++] = (uint8_t)c;
+    if (traceLength == sizeof(traceChunk)) {
+      traceCapture(TRACE_GPS_RX, traceChunk, traceLength);
+      traceLength = 0;
+    }
     gps.encode(c);
     gpsCharsProcessed++;
     if (gpsCharsProcessed > 10000) {
       gpsCharsProcessed = 100;
     }
   }
+  traceCapture(TRACE_GPS_RX, traceChunk, traceLength);
   
   systemStatus.gpsOK = (gpsCharsProcessed > 10);
   
@@ -893,199 +1565,440 @@ void updateGPS() {
       systemStatus.minute = gps.time.minute();
       systemStatus.second = gps.time.second();
     }
+
+    // Unattended wakes stamp their samples from the system clock, which
+    // keeps running through deep sleep
+    if (!rtcClockSet && gps.date.isValid() && gps.time.isValid()) setClockFromGps();
   } else {
     systemStatus.gpsFix = false;
   }
 }
+
+void setClockFromGps() {
+  GpsFix fix;
+  fix.year = systemStatus.year;
+  fix.month = systemStatus.month;
+  fix.day = systemStatus.day;
+  fix.hour = systemStatus.hour;
+  fix.minute = systemStatus.minute;
+  fix.second = systemStatus.second;
+  uint32_t seconds = fixToUnixTime(fix);
+  if (seconds < RTC_CLOCK_VALID_AFTER) return;
+  struct timeval now = {(time_t)seconds, 0};
+  settimeofday(&now, NULL);
+  rtcClockSet = true;
+  Serial.printf("🕒 Clock set from GPS: %lu\n", (unsigned long)seconds);
+}
+
 // ============================================================================
-// BLE CALLBACKS
+// UNATTENDED CAPTURE
 // ============================================================================
-class MyServerCallbacks : public BLEServerCallbacks {
-  void onConnect(BLEServer* pServer) {
-    deviceConnected = true;
-    Serial.println("\n🔵 BLE Client connected!");
+// Wake: probe on, warm-up in light sleep, wake_readings readings averaged
+// into one sample, appended to the RTC buffer; the card is only mounted once
+// rtc_flush_at samples are waiting. Every advertise_every-th wake (and any
+// other boot while unattended is on) boots fully and advertises for
+// advertise_window_s before going back to sleep.
+
+/**
+ * @brief Light sleep with the timer as the only wake source.
+ */
+void lightSleepFor(uint32_t ms, WakePhases &phases) {
+  if (ms == 0) return;
+  Serial.flush();
+  uint64_t startUs = esp_timer_get_time();
+  esp_sleep_enable_timer_wakeup((uint64_t)ms * 1000);
+  esp_light_sleep_start();
+  phases.lightSleepMs += (uint32_t)((esp_timer_get_time() - startUs) / 1000);
+  esp_task_wdt_reset();
+}
+
+void setSensorPower(bool on) {
+  if (SENSOR_POWER_PIN < 0) return;
+  pinMode(SENSOR_POWER_PIN, OUTPUT);
+  digitalWrite(SENSOR_POWER_PIN, on ? SENSOR_POWER_ON : !SENSOR_POWER_ON);
+}
+
+/**
+ * @brief Writes the samples buffered in RTC memory out as records, oldest
+ * first; whatever could not be written stays buffered for the next try.
+ * @return samples written
+ */
+size_t flushRtcBuffer() {
+  size_t buffered = rtcBuffer.count();
+  if (buffered == 0) return 0;
+  WakeLedger &ledger = rtcBuffer.ledger();
+  size_t written = 0;
+  if (systemStatus.sdOK && checkSDHealth()) {
+    for (; written < buffered; written++) {
+      SoilRecord record;
+      archiveSampleToRecord(rtcBuffer.sample(written), record);
+      record.id = recordStore.nextFileNumber();
+      if (!commitRecord(record)) break;
+    }
+  }
+  rtcBuffer.drop(written);
+  if (written == buffered) ledger.flushes++;
+  else ledger.flushFailures++;
+  rtcBuffer.seal();
+  if (written) Serial.printf("🌙 %u buffered sample(s) written to SD\n", (unsigned)written);
+  if (written < buffered) Serial.printf("❌ %u buffered sample(s) could not be written\n", (unsigned)(buffered - written));
+  return written;
+}
+
+/**
+ * @brief Polls the primary probe wake_readings times and averages the
+ * readings into one sample stamped with the clock and the last known fix.
+ * Runs before the sensor task exists, so the bus is used directly.
+ * @return false if the probe never answered
+ */
+bool captureWakeSample(ArchiveSample &sample, WakePhases &phases) {
+  uint64_t startUs = esp_timer_get_time();
+  setSensorPower(true);
+  rs485Port.begin(config.get(CONFIG_MODBUS_BAUD));
+  modbus.setTimeout(config.get(CONFIG_MODBUS_TIMEOUT_MS));
+  if (soilBus.deviceCount() == 0) initSoilBus();
+  lightSleepFor(config.get(CONFIG_SENSOR_WARMUP_MS), phases);
+
+  ArchiveSample readings[10];
+  size_t taken = 0;
+  uint32_t wanted = config.get(CONFIG_WAKE_READINGS);
+  for (uint32_t i = 0; i < wanted && i < 10; i++) {
+    if (i) lightSleepFor(WAKE_READING_GAP_MS, phases);
+    esp_task_wdt_reset();
+    soilBus.requestPoll(0);
+    soilBus.poll();
+    SoilRecord record;
+    if (!soilFromReading(soilBus.reading(0), record.soil) || !record.soil.basicValid) continue;
+    archiveSampleFromRecord(record, readings[taken++]);
+  }
+  rs485Port.end();
+  setSensorPower(false);
+  phases.sensorMs += (uint32_t)((esp_timer_get_time() - startUs) / 1000);
+  if (!averageSamples(readings, taken, sample)) return false;
+
+  const WakeLedger &ledger = rtcBuffer.ledger();
+  time_t now = time(NULL);
+  int32_t* v = sample.values;
+  if (ledger.fixValid && (uint32_t)now >= RTC_CLOCK_VALID_AFTER) {
+    v[ARCHIVE_TIME] = (int32_t)now;
+    v[ARCHIVE_FLAGS] |= ARCHIVE_FLAG_FIX;
+    v[ARCHIVE_LATITUDE] = ledger.fix[0];
+    v[ARCHIVE_LONGITUDE] = ledger.fix[1];
+    v[ARCHIVE_ALTITUDE] = ledger.fix[2];
+  }
+  Serial.printf("🌱 %u/%lu reading(s) averaged\n", (unsigned)taken, (unsigned long)wanted);
+  return true;
+}
+
+/**
+ * @brief Books this wake into the ledger and deep-sleeps until the next
+ * one is due, counted from when this one started. Does not return.
+ */
+void enterDeepSleep(WakePhases &phases) {
+  WakeLedger &ledger = rtcBuffer.ledger();
+  // The unit stays put: remember where the last window saw it
+  if (systemStatus.gpsFix) {
+    ledger.fix[0] = (int32_t)lround(systemStatus.latitude * 1e7);
+    ledger.fix[1] = (int32_t)lround(systemStatus.longitude * 1e7);
+    ledger.fix[2] = (int32_t)lround(systemStatus.altitude * 10);
+    ledger.fixValid = 1;
+  }
+  phases.awakeMs = (uint32_t)((esp_timer_get_time() - bootStartUs) / 1000);
+  uint32_t intervalMs = config.get(CONFIG_WAKE_INTERVAL_S) * 1000;
+  uint32_t sleepMs = phases.awakeMs + MIN_DEEP_SLEEP_MS < intervalMs ? intervalMs - phases.awakeMs : MIN_DEEP_SLEEP_MS;
+  uint64_t wakeNah = wakeChargeNah(phases, powerModel);
+  ledger.awakeMs += phases.awakeMs;
+  ledger.sleptMs += sleepMs;
+  ledger.chargeNah += wakeNah + sleepChargeNah(sleepMs, powerModel);
+  ledger.lastWakeMs = phases.awakeMs;
+  ledger.lastWakeNah = (uint32_t)wakeNah;
+  rtcBuffer.seal();
+
+  Serial.printf("🌙 Wake %lu: %u/%u buffered, awake %lu ms (sensor %lu, card %lu, radio %lu), ~%lu.%lu uAh; "
+                "%lu uAh since the buffer was reset; sleeping %lu s\n",
+    (unsigned long)ledger.wakes, (unsigned)rtcBuffer.count(), (unsigned)RTC_BUFFER_SAMPLES,
+    (unsigned long)phases.awakeMs, (unsigned long)phases.sensorMs, (unsigned long)phases.storageMs,
+    (unsigned long)phases.radioMs, (unsigned long)(wakeNah / 1000), (unsigned long)(wakeNah % 1000 / 100),
+    (unsigned long)(ledger.chargeNah / 1000), (unsigned long)(sleepMs / 1000));
+  Serial.flush();
+  if (systemStatus.bleOK) BLEDevice::deinit(false);
+  esp_sleep_enable_timer_wakeup((uint64_t)sleepMs * 1000);
+  esp_deep_sleep_start();
+}
+
+/**
+ * @brief setup(), on a timer wake that does not advertise: one sample into
+ * the RTC buffer, the card only if the buffer is due, then back to sleep.
+ */
+void runUnattendedWake() {
+  WakePhases phases;
+  WakeLedger &ledger = rtcBuffer.ledger();
+  ArchiveSample sample;
+  if (!captureWakeSample(sample, phases)) {
+    ledger.failedReadings++;
+    Serial.println("⚠️ Soil sensor did not answer this wake");
+  } else if (!rtcBuffer.add(sample)) {
+    ledger.lost++;
+    Serial.println("❌ RTC buffer full, sample lost");
+  }
+  if (rtcBuffer.count() >= config.get(CONFIG_RTC_FLUSH_AT)) {
+    uint64_t startUs = esp_timer_get_time();
+    initSDCard();
+    flushRtcBuffer();
+    if (systemStatus.sdOK) SD.end();
+    phases.storageMs = (uint32_t)((esp_timer_get_time() - startUs) / 1000);
+  }
+  enterDeepSleep(phases);
+}
+
+/**
+ * @brief Main loop: arms the end of this boot's advertising window.
+ */
+void startAdvertisingWindow() {
+  windowStartMs = millis();
+  rtcBuffer.ledger().windows++;
+  rtcBuffer.seal();
+  scheduleIn(SLOT_SLEEP, config.get(CONFIG_ADVERTISE_WINDOW_S) * 1000);
+  Serial.printf("📡 Unattended: advertising for %lu s, then deep sleep\n",
+    (unsigned long)config.get(CONFIG_ADVERTISE_WINDOW_S));
+}
+
+/**
+ * @brief Main loop, when the window is over: sleeps unless a client is
+ * still connected or a transfer is running.
+ */
+void endAdvertisingWindow() {
+  if (deviceConnected || transferActive()) {
+    scheduleIn(SLOT_SLEEP, WINDOW_LINGER_MS);
+    return;
+  }
+  flushRtcBuffer();
+  WakePhases phases;
+  phases.radioMs = systemStatus.bleOK ? millis() - windowStartMs : 0;
+  if (SoilSensorTask) vTaskSuspend(SoilSensorTask);
+  if (systemStatus.sdOK) SD.end();
+  enterDeepSleep(phases);
+}
+
+// ============================================================================
+// BLE CALLBACKS
+// ============================================================================
+class MyServerCallbacks : public BLEServerCallbacks {
+  void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+    uint8_t connections = ++g_connections;
+    deviceConnected = true;
+    ConnectionEvent event = {param->connect.conn_id, true};
+    xQueueSend(connectionEvents, &event, 0);
+    Serial.printf("\n🔵 BLE Client connected! (%u of %lu)\n", connections,
+      (unsigned long)config.get(CONFIG_MAX_CONNECTIONS));
     beep(200);
-    BLEDevice::stopAdvertising();
+    // The stack stops advertising on every connection; keep it up while
+    // another client can still join
+    if (connections < config.get(CONFIG_MAX_CONNECTIONS)) BLEDevice::startAdvertising();
+    else BLEDevice::stopAdvertising();
+    signalMainTask(EVT_BLE_CONNECTION);
   }
   
-  void onDisconnect(BLEServer* pServer) {
-    deviceConnected = false;
-    transferInProgress = false;
-    transferPending = false;
+  void onDisconnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+    if (g_connections > 0) g_connections--;
+    deviceConnected = g_connections > 0;
+    oldDeviceConnected = true;
+    // loop() closes the client's transfer session
+    ConnectionEvent event = {param->disconnect.conn_id, false};
+    xQueueSend(connectionEvents, &event, 0);
+    disconnectTime = millis();
     Serial.println("🔴 BLE Client disconnected");
-    delay(500);
-    BLEDevice::startAdvertising();
-    Serial.println("📡 BLE Advertising restarted\n");
-    
-    if (currentState == STATE_BLE_TRANSFER) {
-      resetToNormalOperation();
-    }
+    // Advertising is restarted from loop() once the stack has settled
+    signalMainTask(EVT_BLE_CONNECTION);
+  }
+};
+
+String metricsSnapshotString();
+
+class StatsCallbacks : public BLECharacteristicCallbacks {
+  void onRead(BLECharacteristic* pCharacteristic) {
+    String snapshot = metricsSnapshotString();
+    pCharacteristic->setValue(snapshot.c_str());
   }
 };
 
+/**
+ * @brief Answers a command on the connection that wrote it only. The value
+ * is also stored so a reply longer than the peer's MTU can be read back.
+ */
+void replyTo(uint16_t connId, const uint8_t* data, size_t length) {
+  if (!pCommandCharacteristic || !pServer) return;
+  pCommandCharacteristic->setValue((uint8_t*)data, length);
+  uint16_t mtu = pServer->getPeerMTU(connId);
+  if (mtu > 3 && length > (size_t)(mtu - 3)) length = mtu - 3;
+  if (esp_ble_gatts_send_indicate(pServer->getGattsIf(), connId, pCommandCharacteristic->getHandle(),
+                                  length, (uint8_t*)data, false) != ESP_OK) {
+    LOG_W("⚠️ Reply to conn %u not sent", (unsigned)connId);
+  }
+}
+
+void replyTo(uint16_t connId, const char* text) {
+  replyTo(connId, (const uint8_t*)text, strlen(text));
+}
+
 class CommandCallbacks : public BLECharacteristicCallbacks {
-  void onWrite(BLECharacteristic* pCharacteristic) {
+  void onWrite(BLECharacteristic* pCharacteristic, esp_ble_gatts_cb_param_t* param) {
     std::string value = pCharacteristic->getValue();
-    if (value.length() > 0) {
-      String command = String(value.c_str());
-      Serial.println("📬 BLE Command received: " + command);
-      // Set a flag instead of calling function directly
-      if (command == "START_TRANSFER") {
-        g_bleCommandToProcess = 1;
-      } else if (command == "FORMAT_SD") {
-        g_bleCommandToProcess = 2;
-      } else if (command == "RESET_SYSTEM") {
-        g_bleCommandToProcess = 3;
+    if (value.length() == 0) return;
+    traceCapture(TRACE_BLE_COMMAND, (const uint8_t*)value.data(), value.length());
+    LOG_I("📬 BLE Command received: %s", logCopy(value.c_str()));
+    if (value == SNAPSHOT_COMMAND || value == SNAPSHOT_COMMIT) {
+      SnapshotRequest request = {param->write.conn_id, value == SNAPSHOT_COMMIT, (uint32_t)micros()};
+      if (!snapshotRequests || xQueueSend(snapshotRequests, &request, 0) != pdTRUE) {
+        LOG_W("⚠️ SNAPSHOT dropped (%d already waiting)", SNAPSHOT_QUEUE);
+        return;
       }
+      if (SoilSensorTask) xTaskNotifyGive(SoilSensorTask);
+      return;
+    }
+    // Queued for the main loop, tagged with the writer's connection
+    BleCommand command;
+    command.connId = param->write.conn_id;
+    command.length = value.length() < BLE_COMMAND_MAX ? value.length() : BLE_COMMAND_MAX - 1;
+    memcpy(command.text, value.data(), command.length);
+    command.text[command.length] = '\0';
+    if (!bleCommands || xQueueSend(bleCommands, &command, 0) != pdTRUE) {
+      LOG_W("⚠️ BLE command queue full, dropped: %s", logCopy(command.text));
+      return;
     }
+    signalMainTask(EVT_BLE_COMMAND);
   }
 };
 // ============================================================================
 // BLE FILE TRANSFER (NON-BLOCKING)
 // ============================================================================
-void startDynamicFileTransfer() {
-  if (!systemStatus.sdOK || !deviceConnected) return;
-  if (transferInProgress || transferPending) {
-    Serial.println("⚠️  Transfer already in progress");
+/**
+ * @brief True while any session's transfer is running or still closing its files.
+ */
+bool transferActive() {
+  return transferSessions.active();
+}
+
+void startDynamicFileTransfer(int session, uint8_t protocolVersion, const char* dir, TransferSource* source) {
+  if (!systemStatus.sdOK || session == TRANSFER_NO_SESSION) return;
+  if (transferSessions.engine(session).active()) {
+    Serial.printf("⚠️  Transfer already in progress (session %d)\n", session);
     return;
   }
-  transferRoot = SD.open("/farmland_data");
-  if (!transferRoot){
-    Serial.println("❌ Failed to open /farmland_data directory");
+  // Chunks are sized per client, from the MTU its link negotiated
+  size_t payload = config.get(CONFIG_CHUNK_BYTES);
+  uint16_t mtu = pServer ? pServer->getPeerMTU(transferSessions.session(session).connId) : 0;
+  if (mtu > 3 && (size_t)(mtu - 3) < payload) payload = mtu - 3;
+  transferChannels[session].sink.setMaxPayload(payload);
+  transferSessions.engine(session).setChunkSize(config.get(CONFIG_CHUNK_BYTES));
+  if (!transferSessions.start(session, dir, protocolVersion, source)) {
+    Serial.printf("❌ Failed to open %s directory\n", dir);
     return;
   }
 
-  previousStateBeforeTransfer = currentState;
-  transferPending = true;
-  Serial.println("\n🚀 STARTING BLE FILE TRANSFER...");
+  Serial.printf("\n🚀 STARTING BLE FILE TRANSFER (session %d, protocol v%u, %u-byte chunks)...\n",
+    session, protocolVersion, (unsigned)payload);
+  if (source) {
+    const TransferProgress &plan = transferSessions.engine(session).progress();
+    Serial.printf("📋 [%d] %s first: %lu records, %llu bytes\n", session,
+      transferOrderName(transferChannels[session].queue.order()), (unsigned long)plan.plannedFiles,
+      (unsigned long long)plan.plannedBytes);
+  }
   beep(150);
-  changeState(STATE_BLE_TRANSFER);
+  if (currentState != STATE_BLE_TRANSFER) {
+    previousStateBeforeTransfer = currentState;
+    changeState(STATE_BLE_TRANSFER);
+  }
 }
 
+/**
+ * @brief One notification for whichever session is due next; every
+ * session is paced by chunk_interval_ms on its own.
+ */
 void processTransferChunk() {
-  if (!transferInProgress && transferPending) {
-    if(currentTransferFile) {
-      currentTransferFile.close();
-    }
-    // Start new transfer
-    transferInProgress = true;
-    transferPending = false;
-    if (transferRoot) {
-      File file = transferRoot.openNextFile();
-      if (file && !file.isDirectory()) {
-        currentTransferFile = file;
-        currentTransferFileName = file.name();
-        currentTransferFileSize = file.size();
-        currentTransferBytesSent = 0;
-        
-        String fileHeader = "FILE_START:" + currentTransferFileName + "|SIZE:" + String(currentTransferFileSize);
-        pFileTransferCharacteristic->setValue(fileHeader.c_str());
-        pFileTransferCharacteristic->notify();
-        Serial.println("📤 Starting transfer: " + currentTransferFileName);
-      } else {
-        // No more files
-        transferInProgress = false;
-        if(transferRoot) transferRoot.close();
-        String completeMsg = "TRANSFER_COMPLETE|All files transferred!";
-        pFileTransferCharacteristic->setValue(completeMsg.c_str());
-        pFileTransferCharacteristic->notify();
-        Serial.println("🎉 ALL FILES TRANSFERRED SUCCESSFULLY!");
-        playSuccessSound();
-        resetToNormalOperation();
+  transferSessions.setInterval(config.get(CONFIG_CHUNK_INTERVAL_MS));
+  TransferEvent event;
+  int session = transferSessions.pump(event);
+  if (session == TRANSFER_NO_SESSION) return;
+  TransferEngine &engine = transferSessions.engine(session);
+
+  switch (event) {
+    case TRANSFER_FILE_STARTED:
+      LOG_I("📤 [%d] Starting transfer: %s", session, logCopy(engine.currentFileName()));
+      break;
+    case TRANSFER_PROGRESS: {
+      uint32_t size = engine.currentFileSize();
+      if (size > 0) {
+        int progress = (int)(((uint64_t)engine.currentBytesSent() * 100) / size);
+        if (progress % 20 == 0) {
+          LOG_D("[%d] %s %d%%", session, logCopy(engine.currentFileName()), progress);
+        }
       }
-    } else {
-      Serial.println("❌ Transfer error: transferRoot is not open!");
-      transferInProgress = false;
-      resetToNormalOperation();
+      break;
     }
-    lastTransferChunkTime = millis();
-    return;
-  }
-
-  if (!transferInProgress || !currentTransferFile) return;
-
-  if (millis() - lastTransferChunkTime < 5) return; // Throttle transfers
-  
-  if (currentTransferBytesSent < currentTransferFileSize) {
-    uint8_t buffer[TRANSFER_CHUNK_SIZE];
-    size_t bytesRead = currentTransferFile.read(buffer, TRANSFER_CHUNK_SIZE);
-    if (bytesRead > 0) {
-      pFileTransferCharacteristic->setValue(buffer, bytesRead);
-      pFileTransferCharacteristic->notify();
-      currentTransferBytesSent += bytesRead;
-      
-      int progress = (int)((currentTransferBytesSent * 100) / currentTransferFileSize);
-      if (progress % 20 == 0) {
-        Serial.println(String(currentTransferFileName) + " " + String(progress) + "%");
+    case TRANSFER_FILE_DONE: {
+      const TransferProgress &progress = engine.progress();
+      if (progress.plannedFiles) {
+        LOG_I("✅ [%d] Transferred: %s (%lu/%lu)", session, logCopy(engine.currentFileName()),
+          (unsigned long)progress.files, (unsigned long)progress.plannedFiles);
+        if (progress.files == 1) g_firstRecordMs = progress.firstFileMs;
+      } else {
+        LOG_I("✅ [%d] Transferred: %s", session, logCopy(engine.currentFileName()));
       }
+      break;
     }
-  } else {
-    // File transfer complete
-    currentTransferFile.close();
-    String fileEnd = "FILE_END:" + currentTransferFileName;
-    pFileTransferCharacteristic->setValue(fileEnd.c_str());
-    pFileTransferCharacteristic->notify();
-    Serial.println("✅ Transferred: " + currentTransferFileName);
-    
-    // Move to next file
-    transferInProgress = false;
-    transferPending = true; 
+    case TRANSFER_COMPLETE:
+      Serial.printf("🎉 [%d] ALL FILES TRANSFERRED SUCCESSFULLY! %lu files, %llu bytes\n", session,
+        (unsigned long)engine.progress().files, (unsigned long long)engine.progress().bytes);
+      playSuccessSound();
+      if (!transferActive()) resetToNormalOperation();
+      break;
+    case TRANSFER_ERROR:
+      Serial.printf("❌ [%d] Transfer error: could not read from SD card!\n", session);
+      if (!transferActive()) resetToNormalOperation();
+      break;
+    case TRANSFER_RESEND_DONE:
+      LOG_I("🔁 [%d] NACK served, %lu chunks resent so far", session,
+        (unsigned long)transferSessions.stats().resentChunks);
+      break;
+    default:
+      break;
   }
-  
-  lastTransferChunkTime = millis();
 }
 
+/**
+ * @brief Starts the default transfer for every client that has been
+ * connected AUTO_TRANSFER_DELAY without asking for one.
+ */
 void autoStartTransfer() {
-  static bool transferStarted = false;
-  static unsigned long connectionTime = 0;
-
-  if (deviceConnected && !transferStarted && !transferInProgress && !transferPending) {
-    if (connectionTime == 0) {
-      connectionTime = millis();
-      Serial.println("⏱️  Auto-transfer will start in 5 seconds...");
-    }
-    if (millis() - connectionTime >= 5000) {
-      transferStarted = true;
-      startDynamicFileTransfer();
-    }
-  }
-  if (!deviceConnected) {
-    transferStarted = false;
-    connectionTime = 0;
+  uint32_t now = millis();
+  uint32_t waitMs = UINT32_MAX;
+  for (size_t i = 0; i < transferSessions.capacity(); i++) {
+    const TransferSession &session = transferSessions.session(i);
+    if (!session.open || session.starts > 0 || session.engine->active()) continue;
+    uint32_t connectedMs = now - session.openedMs;
+    if (connectedMs >= AUTO_TRANSFER_DELAY) startDynamicFileTransfer((int)i);
+    else if (AUTO_TRANSFER_DELAY - connectedMs < waitMs) waitMs = AUTO_TRANSFER_DELAY - connectedMs;
   }
+  if (waitMs != UINT32_MAX) scheduleIn(SLOT_AUTO_TRANSFER, waitMs);
 }
 
 void formatSDCard() {
   if(!systemStatus.sdOK) return;
   Serial.println("🔄 Formatting SD card...");
-  File root = SD.open("/");
-  if (root) {
-    deleteRecursive(root); // <-- Call the new helper
-    root.close();
-  } else {
-    Serial.println("❌ Failed to open root directory to format.");
+  if (!recordStore.wipe()) {
+    Serial.println("❌ Some files could not be removed while formatting.");
   }
+  openArchive();
+  openRollups();
 
   Serial.println("✅ SD Card formatted successfully!");
-  fileCounter = 1;
   beep(300);
-
-  // Re-create the data directory since we just deleted it
-  if(!SD.exists("/farmland_data")) {
-    SD.mkdir("/farmland_data");
-    Serial.println("✅ Re-created /farmland_data directory.");
-  }
 }
 
 void resetToNormalOperation() {
-  transferInProgress = false;
-  transferPending = false;
-  if (currentTransferFile) {
-    currentTransferFile.close();
-  }
-  if (transferRoot){
-    transferRoot.close();
-  }
+  // The transfer pump closes the files on its next pass
+  transferSessions.abortAll();
   changeState(STATE_PLACE_SENSOR);
   Serial.println("🔄 System reset to normal operation");
 }
@@ -1094,6 +2007,8 @@ void initializeBLE() {
   Serial.println("📡 Initializing BLE...");
   BLEDevice::init("AGNI-SOIL-SENSOR");
   BLEDevice::setPower(ESP_PWR_LVL_P9);
+  connectionEvents = xQueueCreate(TRANSFER_MAX_SESSIONS * 2, sizeof(ConnectionEvent));
+  bleCommands = xQueueCreate(BLE_COMMAND_QUEUE, sizeof(BleCommand));
   pServer = BLEDevice::createServer();
   pServer->setCallbacks(new MyServerCallbacks());
   BLEService *pService = pServer->createService(SERVICE_UUID);
@@ -1102,6 +2017,10 @@ void initializeBLE() {
     BLECharacteristic::PROPERTY_NOTIFY
   );
   pFileTransferCharacteristic->addDescriptor(new BLE2902());
+  for (TransferChannel &channel : transferChannels) {
+    channel.sink.attach(pServer, pFileTransferCharacteristic);
+    transferSessions.add(channel.engine);
+  }
 
   pCommandCharacteristic = pService->createCharacteristic(
     CHARACTERISTIC_UUID_COMMAND,
@@ -1110,13 +2029,24 @@ void initializeBLE() {
   pCommandCharacteristic->addDescriptor(new BLE2902());
   pCommandCharacteristic->setCallbacks(new CommandCallbacks());
 
+  pStatsCharacteristic = pService->createCharacteristic(
+    CHARACTERISTIC_UUID_STATS,
+    BLECharacteristic::PROPERTY_READ
+  );
+  pStatsCharacteristic->setCallbacks(new StatsCallbacks());
+
+  pLiveCharacteristic = pService->createCharacteristic(
+    CHARACTERISTIC_UUID_LIVE,
+    BLECharacteristic::PROPERTY_NOTIFY
+  );
+  pLiveCharacteristic->addDescriptor(new BLE2902());
+  for (TransferChannel &channel : transferChannels) channel.liveSink.attach(pServer, pLiveCharacteristic);
+
   pService->start();
 
   BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
-  pAdvertising->addServiceUUID(SERVICE_UUID);
   pAdvertising->setScanResponse(true);
-  pAdvertising->setMinPreferred(0x06);
-  pAdvertising->setMinPreferred(0x12);
+  applyAdvertisingData();
 
   BLEDevice::startAdvertising();
 
@@ -1125,14 +2055,191 @@ void initializeBLE() {
   Serial.println("📡 Advertising as: AGNI-SOIL-SENSOR\n");
 }
 
+/**
+ * @brief Sets the advertising and scan response packets. Normally the
+ * service UUID is advertised and the name sent in the scan response; while
+ * broadcasting the advertisement carries the latest reading instead and
+ * the UUID and a short name move to the scan response. The stack applies
+ * new data to an advertisement already running, so this is called on
+ * every committed record.
+ */
+void applyAdvertisingData() {
+  BLEAdvertisementData advert;
+  BLEAdvertisementData scanResponse;
+  advert.setFlags(ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT);
+  if (config.get(CONFIG_BROADCAST) && broadcastSampleValid) {
+    uint8_t beacon[BEACON_BYTES];
+    size_t length = encodeBeacon(broadcastSample, beacon, sizeof(beacon));
+    advert.setManufacturerData(std::string((const char*)beacon, length));
+    scanResponse.setCompleteServices(BLEUUID(SERVICE_UUID));
+    scanResponse.setName(BLE_SHORT_NAME);
+  } else {
+    advert.setCompleteServices(BLEUUID(SERVICE_UUID));
+    scanResponse.setName("AGNI-SOIL-SENSOR");
+  }
+  BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+  pAdvertising->setAdvertisementData(advert);
+  pAdvertising->setScanResponseData(scanResponse);
+}
+
+// ============================================================================
+// RUNTIME CONFIGURATION
+// ============================================================================
+void loadConfig() {
+  if (!nvsStore.begin()) {
+    Serial.println("⚠️ NVS unavailable, using default settings");
+    return;
+  }
+  if (config.begin()) {
+    Serial.println("⚙️  Settings loaded from NVS");
+  } else {
+    Serial.println("⚙️  No saved settings, using defaults");
+  }
+}
+
+/**
+ * @brief Makes changed settings take effect without a reboot. Modbus
+ * settings are picked up by the sensor task itself, the sensor period and
+ * log interval on their next cycle, the chunk size with the next transfer.
+ */
+void applyConfigChanges(uint32_t changed) {
+  char values[CONFIG_RESPONSE_MAX];
+  config.formatValues(changed, values, sizeof(values));
+  Serial.printf("⚙️  %s\n", values);
+  if (changed & (1UL << CONFIG_STATUS_INTERVAL_MS)) scheduleIn(SLOT_STATUS, config.get(CONFIG_STATUS_INTERVAL_MS));
+  if (changed & (1UL << CONFIG_HEALTH_INTERVAL_MS)) scheduleIn(SLOT_HEALTH, config.get(CONFIG_HEALTH_INTERVAL_MS));
+  if (changed & (1UL << CONFIG_BROADCAST)) applyAdvertisingData();
+  if (changed & (1UL << CONFIG_UNATTENDED)) {
+    if (config.get(CONFIG_UNATTENDED)) startAdvertisingWindow();
+    else scheduleCancel(SLOT_SLEEP);
+  }
+  if ((changed & (1UL << CONFIG_MAX_CONNECTIONS)) && systemStatus.bleOK && deviceConnected) {
+    // Disconnected, advertising runs anyway
+    if (g_connections < config.get(CONFIG_MAX_CONNECTIONS)) BLEDevice::startAdvertising();
+    else BLEDevice::stopAdvertising();
+  }
+}
+
 // ============================================================================
 // SYSTEM HEALTH MONITORING
 // ============================================================================
+/**
+ * @brief Compact one-line metrics snapshot, e.g.
+ * v1;up=120;heap=183000;heap_min=171000;...;mb_us=24,41000,52000,60000,61234;...
+ * Histograms are name=count,p50,p90,p99,max in microseconds.
+ */
+String metricsSnapshotString() {
+  char buf[METRICS_SNAPSHOT_MAX];
+  size_t len = 0;
+  unsigned long now = millis();
+  TransferStats &transferStats = transferSessions.stats();
+
+  len += snprintf(buf + len, sizeof(buf) - len,
+    "v1;up=%lu;heap=%u;heap_min=%u;gps_ok=%lu;gps_bad=%lu;gps_fix=%lu;tx_Bps=%lu;tx_nps=%lu;tx_Bps_peak=%lu",
+    now / 1000,
+    (unsigned)esp_get_free_heap_size(),
+    (unsigned)esp_get_minimum_free_heap_size(),
+    (unsigned long)gps.passedChecksum(),
+    (unsigned long)gps.failedChecksum(),
+    (unsigned long)gps.sentencesWithFix(),
+    (unsigned long)transferStats.byteRate.ratePerSecond(now),
+    (unsigned long)transferStats.notifyRate.ratePerSecond(now),
+    (unsigned long)transferStats.byteRate.peakPerSecond());
+
+  const ModbusStats &mb = modbus.stats();
+  const StorageStats &sd = recordStore.stats();
+  if (len < sizeof(buf) - 1) {
+    len += snprintf(buf + len, sizeof(buf) - len,
+      ";mb_ok=%lu;mb_noresp=%lu;mb_short=%lu;mb_crc=%lu;sd_fail=%lu;tx_files=%lu;tx_congested=%lu;tx_nacks=%lu;tx_resent=%lu",
+      (unsigned long)mb.ok, (unsigned long)mb.noResponse, (unsigned long)mb.shortFrame,
+      (unsigned long)mb.crcError, (unsigned long)sd.appendFailures,
+      (unsigned long)transferStats.files, (unsigned long)transferStats.congested,
+      (unsigned long)transferStats.nacks, (unsigned long)transferStats.resentChunks);
+  }
+  if (len < sizeof(buf) - 1) {
+    unsigned isolatedDevices = 0;
+    for (size_t d = 0; d < soilBus.deviceCount(); d++) isolatedDevices += soilBus.isolated(d);
+    len += snprintf(buf + len, sizeof(buf) - len, ";bus_util_pm=%u;bus_isolated=%u",
+      (unsigned)(soilBus.utilization() * 1000), isolatedDevices);
+  }
+  if (len < sizeof(buf) - 1) {
+    len += snprintf(buf + len, sizeof(buf) - len, ";mb_exc=%lu;mb_wrong=%lu;mb_retry=%lu;mb_retry_ok=%lu",
+      (unsigned long)mb.exceptions,
+      (unsigned long)(mb.wrongSlave + mb.wrongFunction + mb.badLength + mb.writeRejected),
+      (unsigned long)mb.retries, (unsigned long)mb.recovered);
+  }
+  if (len < sizeof(buf) - 1) {
+    uint32_t liveFrames = 0, liveMerged = 0;
+    for (TransferChannel &channel : transferChannels) {
+      liveFrames += channel.live.stats().frames;
+      liveMerged += channel.live.stats().coalesced;
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, ";live_tx=%lu;live_merged=%lu",
+      (unsigned long)liveFrames, (unsigned long)liveMerged);
+  }
+  if (len < sizeof(buf) - 1) {
+    len += snprintf(buf + len, sizeof(buf) - len, ";ble_conn=%u;tx_sess=%u",
+      (unsigned)g_connections, (unsigned)transferSessions.activeCount());
+  }
+  if (len < sizeof(buf) - 1) {
+    const WakeLedger &ledger = rtcBuffer.ledger();
+    len += snprintf(buf + len, sizeof(buf) - len, ";lp_wakes=%lu;lp_buffered=%u;lp_lost=%lu;lp_nah_wake=%lu",
+      (unsigned long)ledger.wakes, (unsigned)rtcBuffer.count(), (unsigned long)ledger.lost,
+      (unsigned long)ledger.lastWakeNah);
+  }
+  if (len < sizeof(buf) - 1) {
+    len += snprintf(buf + len, sizeof(buf) - len, ";log_w=%lu;log_drop=%lu",
+      (unsigned long)logger.written(), (unsigned long)logger.stats().dropped);
+  }
+  if (len < sizeof(buf) - 1) {
+    len += snprintf(buf + len, sizeof(buf) - len, ";rec_flag=%lu;tx_first_ms=%lu",
+      (unsigned long)recordStore.indexSummary().flagged, (unsigned long)g_firstRecordMs);
+  }
+
+  const LatencyHistogram* histograms[] = {
+    &mb.transactionUs, &sd.appendUs, &transferStats.readUs,
+    &metricHistograms[HIST_LOOP_US], &metricHistograms[HIST_DISPLAY_US]
+  };
+  const char* names[] = {"mb_us", "sd_app_us", "sd_rd_us", histogramNames[HIST_LOOP_US], histogramNames[HIST_DISPLAY_US]};
+  for (size_t i = 0; i < sizeof(histograms) / sizeof(histograms[0]) && len < sizeof(buf) - 2; i++) {
+    buf[len++] = ';';
+    len += formatHistogram(buf + len, sizeof(buf) - len, names[i], *histograms[i]);
+  }
+  if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+  buf[len] = '\0';
+  return String(buf);
+}
+
+void printMetrics() {
+  Serial.println("📈 " + metricsSnapshotString());
+  for (size_t d = 0; d < soilBus.deviceCount(); d++) {
+    const BusDeviceStats &ds = soilBus.deviceStats(d);
+    char causes[160];
+    size_t n = 0;
+    causes[0] = '\0';
+    for (int e = MODBUS_OK + 1; e < MODBUS_ERROR_COUNT && n < sizeof(causes) - 1; e++) {
+      if (ds.errors[e] == 0) continue;
+      n += snprintf(causes + n, sizeof(causes) - n, " %s=%lu", modbusErrorName((ModbusError)e), (unsigned long)ds.errors[e]);
+    }
+    Serial.printf("🔌 RS485 %u (%s): %lu/%lu ok, timeout %lu ms%s%s\n",
+      soilBus.device(d).address, soilBus.device(d).map->type,
+      (unsigned long)ds.ok, (unsigned long)ds.polls, (unsigned long)ds.timeoutMs,
+      soilBus.isolated(d) ? ", isolated" : "", causes);
+  }
+  if (traceEnabled) {
+    const TraceStats &ts = traceWriter.stats();
+    Serial.printf("🎞️  Capture: segment %lu, %lu records, %llu bytes, %lu dropped, %lu write failures\n",
+      (unsigned long)traceWriter.segmentNumber(), (unsigned long)ts.records,
+      (unsigned long long)ts.bytesWritten, (unsigned long)ts.droppedBytes, (unsigned long)ts.writeFailures);
+  }
+}
+
 void monitorSystemHealth() {
   static unsigned long lastHealthCheck = 0;
-  if (millis() - lastHealthCheck < 30000) return;
+  if (millis() - lastHealthCheck < config.get(CONFIG_HEALTH_INTERVAL_MS)) return;
   
   Serial.printf("📊 Free heap: %d bytes\n", esp_get_free_heap_size());
+  printMetrics();
   
   if (!checkSDHealth()) {
     Serial.println("⚠️  SD Card health check failed!");
@@ -1141,251 +2248,813 @@ void monitorSystemHealth() {
   lastHealthCheck = millis();
 }
 
+/** @brief Main task: at least one client has a live stream running. */
+bool liveSubscribed() {
+  for (TransferChannel &channel : transferChannels) {
+    if (channel.live.active()) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Sends each client's waiting live sample if its interval allows and
+ * arms SLOT_LIVE for the soonest next attempt. A running transfer keeps priority.
+ */
+void pumpLiveStream() {
+  bool bulkActive = transferActive();
+  uint32_t waitMs = UINT32_MAX;
+  for (TransferChannel &channel : transferChannels) {
+    channel.live.pump(bulkActive);
+    uint32_t due = channel.live.msUntilDue(bulkActive);
+    if (due < waitMs) waitMs = due;
+  }
+  if (waitMs == UINT32_MAX) scheduleCancel(SLOT_LIVE);
+  else scheduleIn(SLOT_LIVE, waitMs);
+}
+
 /**
- * @brief Checks the FreeRTOS queue for new sensor data from Core 0.
+ * @brief Restarts advertising after a disconnect without blocking the BLE task.
+ */
+void handleBleConnectionChanges() {
+  ConnectionEvent event;
+  while (connectionEvents && xQueueReceive(connectionEvents, &event, 0) == pdTRUE) {
+    if (event.connected) {
+      int session = transferSessions.open(event.connId);
+      if (session == TRANSFER_NO_SESSION) {
+        Serial.printf("⚠️  No transfer session free for connection %u\n", (unsigned)event.connId);
+        continue;
+      }
+      transferChannels[session].sink.setConnection(event.connId);
+      transferChannels[session].liveSink.setConnection(event.connId);
+      scheduleIn(SLOT_AUTO_TRANSFER, AUTO_TRANSFER_DELAY);
+      Serial.printf("⏱️  Auto-transfer for session %d will start in 5 seconds...\n", session);
+    } else {
+      int session = transferSessions.find(event.connId);
+      if (session == TRANSFER_NO_SESSION) continue;
+      // The next client on this channel has to ask for the live stream again
+      LiveStream &live = transferChannels[session].live;
+      if (live.active()) {
+        live.setInterval(0);
+        pumpLiveStream();
+        Serial.printf("📈 Live stream stopped (connection %u closed)\n", (unsigned)event.connId);
+      }
+      transferSessions.close(event.connId);
+      if (currentState == STATE_BLE_TRANSFER && !transferActive()) resetToNormalOperation();
+    }
+  }
+  if (!oldDeviceConnected) return;
+  unsigned long elapsed = millis() - disconnectTime;
+  if (elapsed < ADVERTISING_RESTART_DELAY) {
+    scheduleIn(SLOT_ADVERTISING, ADVERTISING_RESTART_DELAY - elapsed);
+    return;
+  }
+  oldDeviceConnected = false;
+  if (g_connections >= config.get(CONFIG_MAX_CONNECTIONS)) return;
+  BLEDevice::startAdvertising();
+  Serial.println("📡 BLE Advertising restarted\n");
+}
+
+/**
+ * @brief Checks the FreeRTOS queue for new sensor data from the sensor task.
  * This is non-blocking and 100% thread-safe.
  */
 void checkSoilSensorQueue() {
-  SensorData newData;
   // Check if there is data in the queue (non-blocking)
-  if (xQueueReceive(soilDataQueue, &newData, 0) == pdPASS) {
-    soilData = newData; // This is a safe copy on Core 1
-    systemStatus.soilSensorOK = soilData.basicValid;
-    Serial.println("✅ (Core 1) Received new soil data from queue.");
+  if (xQueueReceive(soilDataQueue, &busSnapshot, 0) == pdPASS) {
+    if (busSnapshot.soilFresh) {
+      soilData = busSnapshot.soil; // This is a safe copy on the main task
+      soilDataTakenMs = busSnapshot.takenMs;
+      systemStatus.soilSensorOK = soilData.basicValid;
+      LOG_I("✅ (loopTask) Received new soil data from queue.");
+    }
+    if (busSnapshot.soilFresh && liveSubscribed()) {
+      ArchiveSample sample;
+      archiveSampleFromRecord(buildCurrentRecord(), sample);
+      for (TransferChannel &channel : transferChannels) {
+        if (channel.live.active()) channel.live.offer(sample);
+      }
+      pumpLiveStream();
+    }
+    bool logged = false;
+    for (uint8_t i = 0; i < busSnapshot.requestCount; i++) answerSnapshot(busSnapshot.soilFresh, busSnapshot.requests[i], logged);
   }
 }
 
 /**
- * @brief Safely handles commands from the BLE task in the main loop.
+ * @brief 0=None, 1=Start_Transfer, 2=Format, 3=Reset, 4=Boot_Report,
+ * 5=Capture_On, 6=Capture_Off, 7=Nack, 8=Rollup, 9=Rollup_Rebuild,
+ * 10=Broadcast_On, 11=Broadcast_Off, 12=Config, 13=Live, 14=Log_Dump
+ */
+int bleCommandId(const String &command) {
+  if (command == "START_TRANSFER" || command.startsWith("START_TRANSFER:2")) return 1;
+  if (command.startsWith(PROTO_NACK)) return 7;
+  if (command.startsWith("CONFIG_")) return 12;
+  if (command == "ROLLUP_REBUILD") return 9;
+  if (command.startsWith(ROLLUP_COMMAND)) return 8;
+  if (command.startsWith(LIVE_COMMAND)) return 13;
+  if (command == LOG_DUMP_COMMAND) return 14;
+  if (command == "FORMAT_SD") return 2;
+  if (command == "RESET_SYSTEM") return 3;
+  if (command == "BOOT_REPORT") return 4;
+  if (command == "BROADCAST_ON") return 10;
+  if (command == "BROADCAST_OFF") return 11;
+  if (command == "CAPTURE_ON") return 5;
+  if (command == "CAPTURE_OFF") return 6;
+  return 0;
+}
+
+/**
+ * @brief Safely handles commands from the BLE task in the main loop, each
+ * for the connection that wrote it.
  */
 void handleBleCommands() {
-  if (g_bleCommandToProcess == 0) return; // No command
+  BleCommand queued;
+  while (bleCommands && xQueueReceive(bleCommands, &queued, 0) == pdTRUE) {
+    runBleCommand(queued);
+  }
+}
 
-  // Safely copy the command and clear the flag
-  int command = g_bleCommandToProcess;
-  g_bleCommandToProcess = 0;
+void runBleCommand(const BleCommand &request) {
+  String text = String(request.text);
+  int command = bleCommandId(text);
+  if (command == 0) return;
 
-  Serial.printf("⚡ Executing BLE command: %d\n", command);
+  LOG_I("⚡ Executing BLE command: %d (conn %u)", command, (unsigned)request.connId);
 
   switch (command) {
-    case 1: // START_TRANSFER
-      if (!transferInProgress && !transferPending) {
-        startDynamicFileTransfer();
+    case 1: { // START_TRANSFER / START_TRANSFER:2[|LZ:<id>][|ARCHIVE|LOGS][|ORDER:<order>|RECORDS:<ranges>]
+      // Only the asking client's session; others keep going
+      int session = transferSessions.find(request.connId);
+      if (session == TRANSFER_NO_SESSION || transferSessions.engine(session).active()) break;
+      uint8_t protocolVersion = PROTO_VERSION_LEGACY;
+      int dictionary = -1;
+      const char* dir = RECORD_DIR;
+      TransferOrder order = TRANSFER_ORDER_DIRECTORY;
+      RecordRange ranges[PROTO_MAX_RECORD_RANGES];
+      size_t rangeCount = 0;
+      if (text.startsWith("START_TRANSFER:2")) {
+        protocolVersion = PROTO_VERSION_SEQUENCED;
+        int lz = text.indexOf(PROTO_LZ_SEPARATOR);
+        if (lz >= 0) dictionary = text.substring(lz + strlen(PROTO_LZ_SEPARATOR)).toInt();
+        if (text.indexOf(PROTO_LOG_OPTION) >= 0) dir = LOG_DIR;
+        else if (text.indexOf(PROTO_ARCHIVE_OPTION) >= 0) dir = ARCHIVE_DIR;
+        int records = text.indexOf(PROTO_RECORDS_OPTION);
+        int orderField = text.indexOf(PROTO_ORDER_OPTION);
+        if (records >= 0) {
+          size_t offset = records + strlen(PROTO_RECORDS_OPTION);
+          if (parseRecordRanges(request.text + offset, request.length - offset, ranges, PROTO_MAX_RECORD_RANGES,
+                                rangeCount)) {
+            order = TRANSFER_ORDER_REQUEST;
+          }
+        } else if (orderField >= 0) {
+          String name = text.substring(orderField + strlen(PROTO_ORDER_OPTION));
+          if (name.startsWith(PROTO_ORDER_NEWEST)) order = TRANSFER_ORDER_NEWEST;
+          else if (name.startsWith(PROTO_ORDER_PRIORITY)) order = TRANSFER_ORDER_PRIORITY;
+        }
+      }
+      transferSessions.engine(session).setCompression(dictionary >= 0, (uint8_t)dictionary);
+      TransferSource* source = NULL;
+      if (order != TRANSFER_ORDER_DIRECTORY && strcmp(dir, RECORD_DIR) == 0) {
+        transferChannels[session].queue.plan(order, ranges, rangeCount);
+        source = &transferChannels[session].queue;
       }
+      startDynamicFileTransfer(session, protocolVersion, dir, source);
       break;
+    }
     case 2: // FORMAT_SD
       formatSDCard();
-      if(pCommandCharacteristic) {
-        pCommandCharacteristic->setValue("SD_FORMATTED");
-        pCommandCharacteristic->notify();
+      replyTo(request.connId, "SD_FORMATTED");
+      break;
+    case 3: { // RESET_SYSTEM
+      // Stops the asking client's transfer; other clients keep theirs
+      transferSessions.abort(transferSessions.find(request.connId));
+      if (!transferActive()) resetToNormalOperation();
+      replyTo(request.connId, "SYSTEM_RESET");
+      break;
+    }
+    case 4: // BOOT_REPORT
+      replyTo(request.connId, bootTimelineString().c_str());
+      break;
+    case 5: { // CAPTURE_ON
+      bool started = startTraceCapture();
+      replyTo(request.connId, started ? "CAPTURE_STARTED" : "CAPTURE_FAILED");
+      break;
+    }
+    case 6: // CAPTURE_OFF
+      stopTraceCapture();
+      replyTo(request.connId, "CAPTURE_STOPPED");
+      break;
+    case 7: { // NACK:<file>|<ranges>
+      char name[PROTO_NAME_MAX];
+      ChunkRange ranges[PROTO_MAX_NACK_RANGES];
+      size_t count = 0;
+      int session = transferSessions.find(request.connId);
+      bool queued = session != TRANSFER_NO_SESSION &&
+                    parseNack(request.text, request.length, name, sizeof(name), ranges, PROTO_MAX_NACK_RANGES, count) &&
+                    transferSessions.engine(session).requestResend(name, ranges, count);
+      if (queued) {
+        Serial.printf("🔁 Resending %u range(s) of %s\n", (unsigned)count, name);
+      } else {
+        replyTo(request.connId, "NACK_REJECTED");
+      }
+      break;
+    }
+    case 8: { // ROLLUP:<H|D>|<field>|<count>[|<end key>]
+      RollupQuery query;
+      bool valid = parseRollupQuery(request.text, request.length, query);
+
+      // Longer than one notification at small MTUs; the phone then reads the value
+      char response[ROLLUP_RESPONSE_MAX];
+      size_t length = valid ? rollupStore.formatResponse(query, response, sizeof(response)) : 0;
+      replyTo(request.connId, length ? response : "ROLLUP_REJECTED");
+      break;
+    }
+    case 9: { // ROLLUP_REBUILD
+      long samples = rebuildRollups();
+      String reply = samples < 0 ? String("ROLLUP_REBUILD_FAILED") : "ROLLUP_REBUILT:" + String(samples);
+      replyTo(request.connId, reply.c_str());
+      break;
+    }
+    case 10: // BROADCAST_ON
+    case 11: // BROADCAST_OFF
+      config.set(CONFIG_BROADCAST, command == 10);
+      applyAdvertisingData();
+      Serial.printf("📡 Reading broadcast %s\n", command == 10 ? "on" : "off");
+      replyTo(request.connId, command == 10 ? "BROADCAST_ON" : "BROADCAST_OFF");
+      break;
+    case 12: { // CONFIG_GET[:<name>] / CONFIG_SET:<name>=<value>,... / CONFIG_RESET
+      size_t length = request.length < CONFIG_COMMAND_MAX ? request.length : CONFIG_COMMAND_MAX;
+      char response[CONFIG_RESPONSE_MAX];
+      uint32_t changed = 0;
+      uint32_t saveFailures = config.stats().saveFailures;
+      size_t responseLength = config.handleCommand(request.text, length, response, sizeof(response), changed);
+      if (config.stats().saveFailures != saveFailures) {
+        Serial.println("⚠️ Config applied but not saved to NVS");
       }
+      if (changed) applyConfigChanges(changed);
+      replyTo(request.connId, responseLength ? response : CONFIG_REJECTED);
       break;
-    case 3: // RESET_SYSTEM
-      resetToNormalOperation();
-      if(pCommandCharacteristic) {
-        pCommandCharacteristic->setValue("SYSTEM_RESET");
-        pCommandCharacteristic->notify();
+    }
+    case 13: { // LIVE:<min interval ms>, LIVE:0 stops; only the writer's stream
+      int session = transferSessions.find(request.connId);
+      if (session == TRANSFER_NO_SESSION) {
+        replyTo(request.connId, "LIVE_OFF");
+        break;
       }
+      LiveStream &live = transferChannels[session].live;
+      live.setInterval((uint32_t)text.substring(strlen(LIVE_COMMAND)).toInt());
+      pumpLiveStream();
+      String reply = live.active() ? "LIVE_ON:" + String(live.interval()) : String("LIVE_OFF");
+      Serial.printf("📈 Live stream %s (connection %u)\n", reply.c_str(), (unsigned)request.connId);
+      replyTo(request.connId, reply.c_str());
+      break;
+    }
+    case 14: { // LOG_DUMP
+      char path[40];
+      long records = dumpLog(path, sizeof(path));
+      String reply = records >= 0 ? "LOG_DUMP:" + String(path) + "," + String(records) : String("LOG_DUMP_FAILED");
+      Serial.printf("🧾 %s\n", reply.c_str());
+      replyTo(request.connId, reply.c_str());
       break;
+    }
+  }
+}
+
+// ============================================================================
+// RAW I/O CAPTURE
+// ============================================================================
+// Optional trace of the raw RS485, GPS UART and BLE command bytes to
+// /trace on the card (format in AgniTrace.h), for reproducing field
+// problems with the replay tool (src/replay). Toggled with CAPTURE_ON /
+// CAPTURE_OFF; the oldest segments are deleted to stay within the budget.
+bool startTraceCapture() {
+  if (traceEnabled) return true;
+  if (!systemStatus.sdOK || !traceWriter.begin()) {
+    Serial.println("❌ Capture: cannot create /trace on the SD card");
+    return false;
   }
+  rs485Traced.setTap(traceTap, NULL);
+  traceEnabled = true;
+  scheduleIn(SLOT_TRACE_FLUSH, TRACE_FLUSH_MS);
+  Serial.printf("🎞️  Capture started (budget %lu KB)\n", (unsigned long)(TRACE_BUDGET_BYTES / 1024));
+  return true;
+}
+
+void stopTraceCapture() {
+  if (!traceEnabled) return;
+  traceEnabled = false;
+  // One pass for the buffer that was being filled, one for a late record
+  flushTrace();
+  flushTrace();
+  scheduleCancel(SLOT_TRACE_FLUSH);
+  Serial.printf("🎞️  Capture stopped: %lu records, %llu bytes\n",
+    (unsigned long)traceWriter.stats().records, (unsigned long long)traceWriter.stats().bytesWritten);
 }
 
 // ============================================================================
 // SYSTEM STATUS DISPLAY
 // ============================================================================
 void printSystemStatus() {
-  Serial.println("\n╔═══════════════════════════════════════════════════════════════╗");
-  Serial.println("║               🌱 AGNI SOIL SENSOR - SYSTEM STATUS              ║");
-  Serial.println("╠═══════════════════════════════════════════════════════════════╣");
+  LOG_I("\n╔═══════════════════════════════════════════════════════════════╗");
+  LOG_I("║               🌱 AGNI SOIL SENSOR - SYSTEM STATUS              ║");
+  LOG_I("╠═══════════════════════════════════════════════════════════════╣");
   
-  Serial.printf("║ 📊 OLED: %s  SD: %s  Soil: %s  GPS: %s              ║\n",
+  LOG_I("║ 📊 OLED: %s  SD: %s  Soil: %s  GPS: %s              ║",
     systemStatus.oledOK ? "✅" : "❌",
     systemStatus.sdOK ? "✅" : "❌", 
     systemStatus.soilSensorOK ? "✅" : "❌",
     systemStatus.gpsOK ? "✅" : "❌");
   
-  Serial.printf("║ 🔵 BLE: %s  🛰️  Fix: %s  📡 Satellites: %2d                            ║\n",
+  LOG_I("║ 🔵 BLE: %s  🛰️  Fix: %s  📡 Satellites: %2d                            ║",
     deviceConnected ? "🔗 Connected" : "📡 Advertising",
     systemStatus.gpsFix ? "✅" : "❌",
     systemStatus.satellites);
   
   if(soilData.basicValid) {
-    Serial.printf("║ 🌍 Soil - Moisture: %.1f%%  Temp: %.1f°C  pH: %.1f  EC: %duS/cm       ║\n",
+    LOG_I("║ 🌍 Soil - Moisture: %.1f%%  Temp: %.1f°C  pH: %.1f  EC: %duS/cm       ║",
       soilData.moisture, soilData.temperature, soilData.ph, soilData.conductivity);
     
     if(soilData.npkValid) {
-      Serial.printf("║ 🧪 NPK - N:%d  P:%d  K:%d mg/kg                                     ║\n",
+      LOG_I("║ 🧪 NPK - N:%d  P:%d  K:%d mg/kg                                     ║",
         soilData.nitrogen, soilData.phosphorus, soilData.potassium);
     }
   }
   
   if(systemStatus.gpsFix) {
-    Serial.printf("║ 📍 Location - Lat: %.6f  Lon: %.6f  Alt: %.1fm                        ║\n",
+    LOG_I("║ 📍 Location - Lat: %.6f  Lon: %.6f  Alt: %.1fm                        ║",
       systemStatus.latitude, systemStatus.longitude, systemStatus.altitude);
     
-    char timestamp[25];
-    sprintf(timestamp, "%04d-%02d-%02d %02d:%02d:%02d UTC",
+    LOG_I("║ ⏰ Timestamp: %04d-%02d-%02d %02d:%02d:%02d UTC                    ║",
       systemStatus.year, systemStatus.month, systemStatus.day,
       systemStatus.hour, systemStatus.minute, systemStatus.second);
-    Serial.printf("║ ⏰ Timestamp: %s                    ║\n", timestamp);
   }
   
-  Serial.printf("║ 💾 Files Logged: %d                                                     ║\n", fileCounter - 1);
-  Serial.printf("║ 🔄 Transfer State: %s                                                   ║\n", 
-    transferInProgress ? "IN PROGRESS" : (transferPending ? "PENDING" : "IDLE"));
-  Serial.printf("║ 📊 Heap: %d bytes  Failures: %d                                         ║\n", 
-    esp_get_free_heap_size(), soilSensorFailureCount);
-  Serial.println("╚═══════════════════════════════════════════════════════════════╝\n");
+  LOG_I("║ 💾 Files Logged: %d                                                     ║", recordStore.recordCount());
+  LOG_I("║ 🔄 Transfer State: %s  Sessions: %u/%u                                   ║",
+    transferActive() ? "IN PROGRESS" : "IDLE", (unsigned)transferSessions.activeCount(),
+    (unsigned)transferSessions.openCount());
+  LOG_I("║ 📊 Heap: %d bytes  Failures: %d                                         ║", 
+    esp_get_free_heap_size(), soilBus.deviceCount() ? soilBus.failureStreak(0) : 0);
+  LOG_I("╚═══════════════════════════════════════════════════════════════╝");
 }
 
 // ============================================================================
-// MAIN SETUP
+// LOG DRAIN AND DUMPS
 // ============================================================================
-void setup() {
-  Serial.begin(115200);
-  delay(2000);
-  
-  Serial.println("\n╔═══════════════════════════════════════════════════════════════╗");
-  Serial.println("║          🌱 AGNI SOIL SENSOR - COMPLETE INTEGRATED SYSTEM      ║");
-  Serial.println("║                  With Enhanced Reliability                     ║");
-  Serial.println("╚═════════════════════════════════════════════════════=══════════╝\n");
-  
-  // Initialize watchdog timer
-  esp_task_wdt_init(WATCHDOG_TIMEOUT, true);
-  esp_task_wdt_add(NULL);
+#define LOG_DRAIN_MS            20
+#define LOG_DUMP_KEEP           8       // dumps kept on the card, by boot
+
+TaskHandle_t LogDrainTask = NULL;
+
+/**
+ * @brief Formats the log rings onto Serial. This is the only task that
+ * waits for the UART, and it runs at the lowest priority, so a slow or
+ * absent console costs dropped records instead of stalled hot paths.
+ */
+void logDrainTaskLoop(void * pvParameters) {
+  char line[LOG_LINE_MAX + 1];
+  LogRecord record;
+  uint32_t droppedReported = 0;
+  for (;;) {
+    while (logger.next(record)) {
+      size_t length = formatLogRecord(record, line, LOG_LINE_MAX);
+      line[length++] = '\n';
+      Serial.write((const uint8_t*)line, length);
+    }
+    uint32_t dropped = logger.stats().dropped;
+    if (dropped != droppedReported) {
+      Serial.printf("⚠️ %lu log records dropped\n", (unsigned long)(dropped - droppedReported));
+      droppedReported = dropped;
+    }
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+  }
+}
+
+/** @brief The first bytes of the image's ELF hash; a new build starts a fresh log. */
+uint32_t firmwareBuildId() {
+  const uint8_t* sha = esp_ota_get_app_description()->app_elf_sha256;
+  return (uint32_t)sha[0] | ((uint32_t)sha[1] << 8) | ((uint32_t)sha[2] << 16) | ((uint32_t)sha[3] << 24);
+}
+
+bool isFaultReset(esp_reset_reason_t reason) {
+  return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+         reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT;
+}
 
-  // Buzzer init
+/**
+ * @brief Writes every record still in the rings, earlier boots' included,
+ * to /logs/log_<boot>.agl for START_TRANSFER:2|LOGS, and deletes the dump
+ * LOG_DUMP_KEEP boots older.
+ * @return records written, -1 on failure
+ */
+long dumpLog(char* path, size_t pathSize) {
+  if (!systemStatus.sdOK) return -1;
+  // 14 KB, only while dumping
+  std::unique_ptr<LogRecord[]> records(new (std::nothrow) LogRecord[LOG_CORES * LOG_RING_RECORDS]);
+  if (!records) return -1;
+  size_t count = logger.history(records.get(), LOG_CORES * LOG_RING_RECORDS);
+
+  if (!sdFileSystem.exists(LOG_DIR) && !sdFileSystem.mkdir(LOG_DIR)) return -1;
+  uint32_t boot = logger.boot();
+  snprintf(path, pathSize, LOG_DIR "/" LOG_FILE_PREFIX "%lu" LOG_FILE_SUFFIX, (unsigned long)boot);
+  std::unique_ptr<HalFile> file = sdFileSystem.open(path, HAL_FILE_WRITE);
+  if (!file) return -1;
+  bool written = writeLogDump(*file, records.get(), count, boot, logger.stats().dropped);
+  file->close();
+  if (!written) return -1;
+
+  if (boot > LOG_DUMP_KEEP) {
+    char old[40];
+    snprintf(old, sizeof(old), LOG_DIR "/" LOG_FILE_PREFIX "%lu" LOG_FILE_SUFFIX,
+             (unsigned long)(boot - LOG_DUMP_KEEP));
+    if (sdFileSystem.exists(old)) sdFileSystem.remove(old);
+  }
+  return (long)count;
+}
+
+// ============================================================================
+// BOOT SEQUENCE
+// ============================================================================
+// Boot is a small dependency graph. Stages marked parallel run in their own
+// short-lived task (SD mount/scan and BLE bring-up overlap the intro
+// animation); the others run inline on the boot task. Every stage records
+// its start/end time for the boot profiler.
+enum BootStageId {
+  BOOT_BUZZER,
+  BOOT_OLED,
+  BOOT_ANIMATION,
+  BOOT_SD,
+  BOOT_SOIL_SENSOR,
+  BOOT_GPS,
+  BOOT_BLE,
+  BOOT_STAGE_COUNT
+};
+#define BOOT_BIT(id) (1UL << (id))
+#define BOOT_ALL_STAGES (BOOT_BIT(BOOT_STAGE_COUNT) - 1)
+
+struct BootStage {
+  const char* name;
+  void (*run)();
+  uint32_t deps;        // BOOT_BIT mask of stages that must finish first
+  bool parallel;        // run in a worker task
+  uint32_t stackSize;
+  int64_t startUs = 0;  // set by runBootStage()
+  int64_t endUs = 0;
+};
+
+EventGroupHandle_t bootEvents = NULL;
+
+void bootStageBuzzer() {
   Serial.println("🔊 Initializing Buzzer...");
+  initBuzzer();
   beep(100);
-  Serial.println("🔧 Initializing components...\n");
+}
 
-  // OLED - Initialize FIRST
+void bootStageOled() {
   initOLED();
+}
+
+void bootStageAnimation() {
   if (systemStatus.oledOK) {
     Serial.println("▶️  Playing intro animation...");
     playIntroAnimation();
   }
+}
 
-  // Start with initial display state
-  // changeState(STATE_INITIAL);
-
-  // SD Card
-  initSDCard();
-
-  // RS485 Soil Sensor
-  pinMode(RS485_DE, OUTPUT);
-  pinMode(RS485_RE, OUTPUT);
-  digitalWrite(RS485_DE, LOW);
-  digitalWrite(RS485_RE, LOW);
-  Serial1.begin(MODBUS_BAUD, SERIAL_8N1, RS485_RX, RS485_TX);
+void bootStageSoilSensor() {
+  rs485Port.begin(config.get(CONFIG_MODBUS_BAUD));
+  modbus.setTimeout(config.get(CONFIG_MODBUS_TIMEOUT_MS));
   Serial.println("✅ RS485 Modbus initialized");
-  // Create a queue to safely pass sensor data from Core 0 to Core 1
-soilDataQueue = xQueueCreate(1, sizeof(SensorData));
-if (soilDataQueue == NULL) {
-  Serial.println("❌ Failed to create soilDataQueue!");
-} else {
+  // Create a queue to safely pass sensor data from the sensor task to the main task
+  soilDataQueue = xQueueCreate(1, sizeof(SoilSnapshot));
+  snapshotRequests = xQueueCreate(SNAPSHOT_QUEUE, sizeof(SnapshotRequest));
+  if (soilDataQueue == NULL || snapshotRequests == NULL) {
+    Serial.println("❌ Failed to create soilDataQueue!");
+    return;
+  }
   Serial.println("✅ soilDataQueue created successfully");
-}
   // Create the dedicated task for the blocking sensor
   xTaskCreatePinnedToCore(
       soilSensorTaskLoop,   /* Function to implement the task */
       "SoilSensorTask",     /* Name of the task */
       4096,                 /* Stack size in words */
       NULL,                 /* Task input parameter */
-      1,                    /* Priority of the task */
+      SENSOR_TASK_PRIORITY, /* Priority of the task */
       &SoilSensorTask,      /* Task handle. */
-      0);   
-    if (SoilSensorTask) {
-      esp_task_wdt_add(SoilSensorTask); // <-- ADD THIS LINE
-      }                 
-  delay(500); // Give the task a moment to start
-  // GPS
+      SENSOR_TASK_CORE);
+  if (SoilSensorTask) {
+    esp_task_wdt_add(SoilSensorTask);
+  }
+}
+
+void bootStageGps() {
   GPS_SERIAL.begin(9600, SERIAL_8N1, GPS_RX_PIN, GPS_TX_PIN);
+  // Wake the main task at the end of each NMEA burst
+  GPS_SERIAL.onReceive([]() { signalMainTask(EVT_GPS_DATA); }, true);
   Serial.println("✅ GPS module initialized");
-  // BLE
-  initializeBLE();
+}
+
+BootStage bootStages[BOOT_STAGE_COUNT] = {
+  // name          run                  deps                   parallel stack
+  {"buzzer",       bootStageBuzzer,     0,                     false,   0},
+  {"oled",         bootStageOled,       0,                     false,   0},
+  {"animation",    bootStageAnimation,  BOOT_BIT(BOOT_OLED),   false,   0},
+  {"sd",           initSDCard,          0,                     true,    6144},
+  {"soil_sensor",  bootStageSoilSensor, 0,                     false,   0},
+  {"gps",          bootStageGps,        0,                     false,   0},
+  {"ble",          initializeBLE,       0,                     true,    8192},
+};
+
+void runBootStage(BootStage &stage) {
+  stage.startUs = esp_timer_get_time();
+  stage.run();
+  stage.endUs = esp_timer_get_time();
+}
+
+void bootWorker(void * pvParameters) {
+  int id = (int)(intptr_t)pvParameters;
+  runBootStage(bootStages[id]);
+  xEventGroupSetBits(bootEvents, BOOT_BIT(id));
+  vTaskDelete(NULL);
+}
+
+/**
+ * @brief Runs every boot stage once its dependencies are done, overlapping
+ * worker stages with inline ones. Returns when the whole graph is complete.
+ */
+void runBootGraph() {
+  uint32_t started = 0;
+  uint32_t done = 0;
+  bootEvents = xEventGroupCreate();
+
+  while (done != BOOT_ALL_STAGES) {
+    bool progressed = false;
+
+    // Launch ready workers first so they overlap the next inline stage
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+      BootStage &stage = bootStages[i];
+      if ((started & BOOT_BIT(i)) || (stage.deps & ~done) || !stage.parallel) continue;
+      started |= BOOT_BIT(i);
+      progressed = true;
+      if (bootEvents == NULL ||
+          xTaskCreate(bootWorker, stage.name, stage.stackSize, (void*)(intptr_t)i, 1, NULL) != pdPASS) {
+        Serial.printf("⚠️ Boot stage '%s' running inline\n", stage.name);
+        runBootStage(stage);
+        done |= BOOT_BIT(i);
+      }
+    }
+
+    // Then one inline stage, and go round again for anything it unblocked
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+      BootStage &stage = bootStages[i];
+      if ((started & BOOT_BIT(i)) || (stage.deps & ~done) || stage.parallel) continue;
+      started |= BOOT_BIT(i);
+      runBootStage(stage);
+      done |= BOOT_BIT(i);
+      progressed = true;
+      break;
+    }
+
+    uint32_t outstanding = started & ~done;
+    if (bootEvents && outstanding) {
+      EventBits_t finished = xEventGroupWaitBits(bootEvents, outstanding, pdTRUE, pdFALSE,
+                                                 progressed ? 0 : pdMS_TO_TICKS(1000));
+      done |= (finished & outstanding);
+    }
+    esp_task_wdt_reset();
+  }
+
+  if (bootEvents) {
+    vEventGroupDelete(bootEvents);
+    bootEvents = NULL;
+  }
+}
+
+/**
+ * @brief Prints each stage's offset and duration from the start of setup().
+ */
+void printBootTimeline() {
+  Serial.println("⏱️  Boot timeline (ms from setup):");
+  for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+    BootStage &stage = bootStages[i];
+    Serial.printf("   %-12s %6lld -> %6lld  (%lld ms)%s\n",
+      stage.name,
+      (stage.startUs - bootStartUs) / 1000,
+      (stage.endUs - bootStartUs) / 1000,
+      (stage.endUs - stage.startUs) / 1000,
+      stage.parallel ? "  [parallel]" : "");
+  }
+  Serial.printf("   ready in %lld ms\n", (bootReadyUs - bootStartUs) / 1000);
+}
+
+/**
+ * @brief Compact boot timeline for the BLE command channel:
+ * BOOT|total=<ms>|<stage>=<start>+<duration>|...
+ */
+String bootTimelineString() {
+  String out = "BOOT|total=" + String((long)((bootReadyUs - bootStartUs) / 1000));
+  for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+    BootStage &stage = bootStages[i];
+    out += "|" + String(stage.name) + "=" + String((long)((stage.startUs - bootStartUs) / 1000)) +
+           "+" + String((long)((stage.endUs - stage.startUs) / 1000));
+  }
+  return out;
+}
+
+// ============================================================================
+// MAIN SETUP
+// ============================================================================
+void setup() {
+  bootStartUs = esp_timer_get_time();
+  Serial.begin(115200);
+  if (BOOT_SERIAL_WAIT_MS > 0) {
+    delay(BOOT_SERIAL_WAIT_MS);
+  }
+  
+  Serial.println("\n╔═══════════════════════════════════════════════════════════════╗");
+  Serial.println("║          🌱 AGNI SOIL SENSOR - COMPLETE INTEGRATED SYSTEM      ║");
+  Serial.println("║                  With Enhanced Reliability                     ║");
+  Serial.println("╚═════════════════════════════════════════════════════=══════════╝\n");
+
+  // First, so every later stage can log; the rings may hold the records
+  // leading up to the reset
+  bool logKept = logger.begin(firmwareBuildId());
+  xTaskCreatePinnedToCore(logDrainTaskLoop, "LogDrainTask", 3072, NULL,
+                          LOG_TASK_PRIORITY, &LogDrainTask, LOG_TASK_CORE);
+  
+  // Initialize watchdog timer
+  esp_task_wdt_init(WATCHDOG_TIMEOUT, true);
+  esp_task_wdt_add(NULL);
+  vTaskPrioritySet(NULL, MAIN_TASK_PRIORITY);
+  taskStatsWindowStartUs = esp_timer_get_time();
+
+  // Event group must exist before any task or callback can signal it
+  initScheduler();
+  // Before any stage reads a setting
+  loadConfig();
+
+  // Samples buffered before a deep sleep (or a reset) survive in RTC memory
+  if (!rtcBuffer.begin()) Serial.println("🌙 RTC buffer initialized");
+  bool unattended = config.get(CONFIG_UNATTENDED);
+  if (unattended && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER) {
+    uint32_t wakes = ++rtcBuffer.ledger().wakes;
+    uint32_t every = config.get(CONFIG_ADVERTISE_EVERY);
+    if (every == 0 || wakes % every != 0) runUnattendedWake();   // sleeps again, does not return
+    // An advertising wake takes its sample too, then boots fully
+    WakePhases phases;
+    ArchiveSample sample;
+    if (!captureWakeSample(sample, phases)) rtcBuffer.ledger().failedReadings++;
+    else if (!rtcBuffer.add(sample)) rtcBuffer.ledger().lost++;
+    soilBus.clearDevices();
+    rtcBuffer.seal();
+  }
+
+  Serial.println("🔧 Initializing components...\n");
+  runBootGraph();
+  bootReadyUs = esp_timer_get_time();
+  flushRtcBuffer();
+  esp_reset_reason_t resetReason = esp_reset_reason();
+  if (logKept && isFaultReset(resetReason)) {
+    char path[40];
+    long records = dumpLog(path, sizeof(path));
+    if (records >= 0) Serial.printf("🧯 Reset by fault %d: %ld log records saved to %s\n", (int)resetReason, records, path);
+    else Serial.printf("❌ Reset by fault %d: log dump failed\n", (int)resetReason);
+  }
+
   playSuccessSound();
   Serial.println("✅ All systems initialized successfully!");
+  printBootTimeline();
   Serial.println("🚀 System ready - Starting sensor readings...\n");
   setenv("TZ", "UTC", 1);
   tzset(); // added suggestion from chatGPT
-  updateDisplayState();
+
+  // Hand the OLED over to its own task now that the boot animation is done
+  if (systemStatus.oledOK) {
+    xTaskCreatePinnedToCore(displayTaskLoop, "DisplayTask", 4096, NULL,
+                            DISPLAY_TASK_PRIORITY, &DisplayTask, DISPLAY_TASK_CORE);
+  }
+  requestDisplayUpdate();
+
+  scheduleIn(SLOT_STATE, stateDuration(currentState));
+  scheduleIn(SLOT_GPS, 0);
+  scheduleIn(SLOT_STATUS, config.get(CONFIG_STATUS_INTERVAL_MS));
+  scheduleIn(SLOT_HEALTH, config.get(CONFIG_HEALTH_INTERVAL_MS));
+  scheduleIn(SLOT_TASK_REPORT, TASK_REPORT_INTERVAL);
+  if (TRACE_CAPTURE_AT_BOOT) {
+    startTraceCapture();
+  }
+  if (unattended) startAdvertisingWindow();
 }
 // ============================================================================
 // MAIN LOOP
 // ============================================================================
+/**
+ * @brief Advances the display state machine once its state timer expires.
+ */
+void runStateMachine() {
+  unsigned long duration = stateDuration(currentState);
+  if (duration == 0 || millis() - stateStartTime < duration) return;
+
+  DisplayState before = currentState;
+  switch(currentState) {
+    case STATE_INITIAL:
+      changeState(STATE_COMPONENT_CHECK);
+      break;
+    case STATE_COMPONENT_CHECK:
+      changeState(STATE_PLACE_SENSOR);
+      break;
+    case STATE_PLACE_SENSOR:
+      changeState(STATE_ANALYZING);
+      break;
+    case STATE_ANALYZING:
+      logDataToSD();
+      break;
+    case STATE_FILE_CREATED:
+      changeState(STATE_PLACE_SENSOR);
+      break;
+    case STATE_BLE_TRANSFER:
+      break;
+  }
+  // e.g. logging failed: try again shortly instead of spinning
+  if (currentState == before) {
+    scheduleIn(SLOT_STATE, STATE_RETRY_MS);
+  }
+}
+
 void loop() {
+  EventBits_t events = waitForMainEvents();
+  uint32_t loopStartUs = micros();
   esp_task_wdt_reset();
-  static unsigned long lastSoilRead = 0;
-  static unsigned long lastStatusDisplay = 0;
-  static unsigned long lastDataLog = 0;
-  static unsigned long lastOLEDUpdate = 0;
-  static bool initialReadDone = false;
-  updateGPS();
-  checkSoilSensorQueue();
+
+  if ((events & EVT_GPS_DATA) || slotDue(SLOT_GPS)) {
+    updateGPS();
+    scheduleIn(SLOT_GPS, GPS_POLL_FALLBACK_MS);
+  }
+  if (events & EVT_SOIL_DATA) {
+    checkSoilSensorQueue();
+    saveLinkBaud();
+  }
+  // Sessions first, so a command from a client that just connected finds its own
+  if ((events & EVT_BLE_CONNECTION) || slotDue(SLOT_ADVERTISING)) {
+    handleBleConnectionChanges();
+  }
   // Below line is added for non freez of BLE transfer
-  handleBleCommands();
-  
-  // Handle BLE file transfer (non-blocking)
-  if (transferInProgress || transferPending) {
-    processTransferChunk();
+  if (events & EVT_BLE_COMMAND) {
+    handleBleCommands();
   }
-  
-  // Handle state transitions - ONLY if not transferring files
-  if (!transferInProgress && !transferPending) {
-    unsigned long currentTime = millis();
-    
-    switch(currentState) {
-      case STATE_INITIAL:
-        if (currentTime - stateStartTime >= 3000) {
-          changeState(STATE_COMPONENT_CHECK);
-        }
-        break;
-        
-      case STATE_COMPONENT_CHECK:
-        if (currentTime - stateStartTime >= 3000) {
-          changeState(STATE_PLACE_SENSOR);
-        }
-        break;
-        
-      case STATE_PLACE_SENSOR:
-        if (currentTime - stateStartTime >= 5000) {
-          changeState(STATE_ANALYZING);
-        }
-        break;
-        
-      case STATE_ANALYZING:
-        if (currentTime - stateStartTime >= DATA_LOG_INTERVAL) { //45000
-          logDataToSD();
-        }
-        break;
-        
-      case STATE_FILE_CREATED:
-        if (currentTime - stateStartTime >= 3000) {
-          changeState(STATE_PLACE_SENSOR);
-        }
-        break;
-        
-      case STATE_BLE_TRANSFER:
-        break;
+  // Auto BLE transfer
+  if ((events & EVT_BLE_CONNECTION) || slotDue(SLOT_AUTO_TRANSFER)) {
+    autoStartTransfer();
+  }
+
+  // Handle BLE file transfer (non-blocking)
+  if (transferActive()) {
+    if (slotDue(SLOT_TRANSFER) || !slotPending(SLOT_TRANSFER)) {
+      processTransferChunk();
+      // Wake for whichever session is due first
+      uint32_t waitMs = transferSessions.msUntilDue();
+      if (waitMs != UINT32_MAX) scheduleIn(SLOT_TRANSFER, waitMs);
     }
+  } else {
+    scheduleCancel(SLOT_TRANSFER);
   }
-  // Update display
-  if(millis() - lastOLEDUpdate >= 500) {
-    updateDisplayState();
-    lastOLEDUpdate = millis();
+
+  // Handle state transitions - ONLY if not transferring files
+  if (!transferActive() && slotDue(SLOT_STATE)) {
+    runStateMachine();
   }
-  
+
   // System status display
-  if(millis() - lastStatusDisplay >= 10000) {
-    if (!transferInProgress || (millis() - lastStatusDisplay >= 30000)) {
-      printSystemStatus();
-      lastStatusDisplay = millis();
-    }
+  if (slotDue(SLOT_STATUS)) {
+    printSystemStatus();
+    scheduleIn(SLOT_STATUS, transferActive() ? STATUS_PRINT_INTERVAL_TRANSFER : config.get(CONFIG_STATUS_INTERVAL_MS));
   }
-  // Auto BLE transfer and health monitoring
-  autoStartTransfer();
-  monitorSystemHealth();
-  
-  delay(10);
-}
\ No newline at end of file
+
+  // Health monitoring
+  if (slotDue(SLOT_HEALTH)) {
+    monitorSystemHealth();
+    scheduleIn(SLOT_HEALTH, config.get(CONFIG_HEALTH_INTERVAL_MS));
+  }
+
+  // Per-task CPU share and scheduling latency
+  if (slotDue(SLOT_TASK_REPORT)) {
+    printTaskReport();
+    scheduleIn(SLOT_TASK_REPORT, TASK_REPORT_INTERVAL);
+  }
+
+  // Raw I/O capture buffers go to the card off the sampling path
+  if (slotDue(SLOT_TRACE_FLUSH)) {
+    flushTrace();
+    if (traceEnabled) scheduleIn(SLOT_TRACE_FLUSH, TRACE_FLUSH_MS);
+  }
+
+  // A partly filled archive block is sealed once it is old enough, but
+  // not while /archive may be listed by a transfer
+  if (slotDue(SLOT_ARCHIVE)) {
+    if (transferActive()) scheduleIn(SLOT_ARCHIVE, STATE_RETRY_MS);
+    else sealArchive();
+  }
+  if (slotDue(SLOT_LIVE)) pumpLiveStream();
+  if (slotDue(SLOT_SLEEP)) endAdvertisingWindow();
+  metricTime(HIST_LOOP_US, loopStartUs);
+}
@@ -0,0 +1,1010 @@
+// ============================================================================
+// AGNI SOIL SENSOR - NATIVE HOST RUNNER
+// ============================================================================
+// Runs the firmware pipeline (sample -> encode -> store -> BLE transfer)
+// against the simulated peripherals in lib/AgniSim:
+//
+//   pio run -e native && .pio/build/native/program --records 50 --transfer
+//
+// SD card   -> a host directory (--sd, default ./sim_sd)
+// RS485     -> scripted ZTS-3002 with --modbus-* latency / error injection
+// GPS UART  -> NMEA log replayed at 9600 baud (--nmea)
+// BLE       -> notification sink limited by --mtu / --conn-interval-ms /
+//              --packets-per-event, optionally captured with --capture
+//
+// --trace records the raw RS485/GPS bytes to <sd>/trace like CAPTURE_ON
+// does on the device, so the replay tool can be tried without hardware.
+//
+// --protocol 2 --data-loss 0.05 runs a sequenced transfer over a lossy
+// link with an AgniReceiver on the far end writing NACKs back, the way the
+// phone app repairs files. --clients N connects N phones, each on a link
+// of its own, and serves them concurrently through TransferSessions.
+// --order newest|priority|<ranges> sends the records through the record
+// index in that order, like START_TRANSFER:2|ORDER: / |RECORDS:, and
+// reports how long the first record took to arrive. --dry-every N makes
+// every Nth reading dry soil, so priority order has records to put first.
+//
+// --archive also stages every sample into the columnar archive
+// (lib/AgniArchive), seals it, decodes the blocks back and compares them
+// with what was stored; --transfer-archive then streams the blocks
+// instead of the JSON records.
+//
+// --rollup keeps the hourly/daily rollup index up to date on every sample
+// and prints the BLE responses to ROLLUP: queries; with --wipe the
+// buckets are checked against sums recomputed from the samples.
+// --rollup-rebuild then recomputes the rings from the archive blocks with
+// the batch kernels and checks them again.
+//
+// --broadcast packs every committed sample into the advertising payload
+// the firmware sends with BROADCAST_ON, decodes it back as a scanning
+// gateway would and prints the last one as hex.
+//
+// --live MS streams every reading as the LIVE:<MS> subscriber would get
+// it, over a second simulated link, and checks the frames decode in order.
+//
+// --unattended runs the duty-cycled capture instead: --records timer wakes
+// wake_interval_s apart, each averaging wake_readings readings into the
+// RTC buffer, which is written to the card every rtc_flush_at samples. The
+// energy per wake is estimated with the firmware's PowerModel.
+//
+// --snapshots sends a SNAPSHOT request midway between every two samples:
+// the primary is polled out of turn, the reply is encoded and decoded
+// back, and the poll-to-reply time is reported (BLE air time not included).
+//
+// The NVS settings live in --nvs (default ./sim_nvs); --config runs a
+// CONFIG_GET / CONFIG_SET / CONFIG_RESET command against them first, and
+// the run then uses the stored sensor period, Modbus baud and timeout and
+// transfer pacing like the firmware does.
+//
+// Like the firmware at boot, the runner first finds the sensor (at the
+// saved modbus_baud or by scanning) and moves it up to modbus_max_baud;
+// --modbus-sensor-baud starts the simulated sensor at another rate and
+// --modbus-max-baud caps what it accepts. The rate it ends at is saved.
+//
+// Sampling goes through the same ModbusBus scheduler as the firmware.
+// --bus-device ADDR:TYPE:PERIOD_MS hangs another device (zts3002 or
+// weather) on the simulated line, polled at its own period between the
+// samples; with a ":dead" suffix nothing answers at that address, to
+// watch it get isolated. Records then carry a "devices" array.
+//
+// All timing is virtual (SimClock), so runs are repeatable for a seed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <AgniSim.h>
+#include <AgniRecord.h>
+#include <AgniModbus.h>
+#include <AgniStorage.h>
+#include <AgniTransfer.h>
+#include <AgniTrace.h>
+#include <AgniReceiver.h>
+#include <AgniArchive.h>
+#include <AgniRollup.h>
+#include <AgniBeacon.h>
+#include <AgniLive.h>
+#include <AgniConfig.h>
+#include <AgniBus.h>
+#include <AgniSleep.h>
+
+#define MODBUS_ADDRESS          1
+#define GPS_BAUD                9600
+#define NACK_ROUNDS_MAX         8      // per file, before the receiver gives up
+#define WAKE_READING_GAP_MS     500    // as in the firmware
+#define SIM_CARD_MOUNT_MS       150    // SD.begin() and the scans, which the host directory doesn't cost
+
+struct SimBusDevice {
+  BusDeviceConfig config;
+  bool dead;
+};
+
+struct RunOptions {
+  std::string sdDir = "sim_sd";
+  std::string nvsDir = "sim_nvs";
+  std::vector<std::string> configCommands;
+  std::string nmeaPath = "sim/field_walk.nmea";
+  std::string capturePath;
+  int records = 10;
+  uint32_t sampleIntervalMs = 0;     // 0 = the sensor_period_ms setting
+  bool wipe = false;
+  bool transfer = false;
+  bool trace = false;
+  uint8_t protocol = PROTO_VERSION_LEGACY;
+  bool compress = false;
+  bool archive = false;
+  bool transferArchive = false;
+  bool rollup = false;
+  bool rollupRebuild = false;
+  bool broadcast = false;
+  bool snapshots = false;
+  bool unattended = false;
+  uint32_t liveMs = 0;
+  int clients = 1;
+  TransferOrder order = TRANSFER_ORDER_DIRECTORY;
+  int dryEvery = 0;
+  std::vector<RecordRange> orderRanges;
+  std::vector<std::string> rollupQueries;
+  std::vector<SimBusDevice> busDevices;
+  SimModbusConfig modbus;
+  SimBleConfig ble;
+};
+
+void printUsage(const char* program) {
+  printf("Usage: %s [options]\n", program);
+  printf("  --sd DIR                 host directory used as the SD card (sim_sd)\n");
+  printf("  --nmea FILE              NMEA log replayed on the GPS UART (sim/field_walk.nmea)\n");
+  printf("  --records N              samples to take (10)\n");
+  printf("  --interval-ms MS         time between samples (sensor_period_ms setting)\n");
+  printf("  --nvs DIR                host directory used as NVS (sim_nvs)\n");
+  printf("  --config TEXT            run a CONFIG_GET/CONFIG_SET/CONFIG_RESET command first\n");
+  printf("  --wipe                   clear the card before sampling\n");
+  printf("  --transfer               stream every record over BLE afterwards\n");
+  printf("  --capture FILE           write delivered notifications to FILE\n");
+  printf("  --trace                  record raw RS485/GPS bytes to <sd>" TRACE_DIR "\n");
+  printf("  --mtu BYTES              negotiated ATT MTU (247)\n");
+  printf("  --conn-interval-ms MS    BLE connection interval (30)\n");
+  printf("  --packets-per-event N    notifications per connection event (4)\n");
+  printf("  --queue-depth N          controller buffers before congestion (12)\n");
+  printf("  --protocol N             transfer protocol version, 1 or 2 (1)\n");
+  printf("  --data-loss RATE         0..1 probability a version 2 data chunk is lost\n");
+  printf("  --compress               LZ-compress files with the record dictionary (implies --protocol 2)\n");
+  printf("  --archive                also write columnar archive blocks and verify them\n");
+  printf("  --transfer-archive       transfer " ARCHIVE_DIR " instead of " RECORD_DIR " (implies --archive)\n");
+  printf("  --rollup                 maintain the rollup index (" ROLLUP_DIR ")\n");
+  printf("  --rollup-rebuild         rebuild the rollups from the archive afterwards (implies --archive --rollup)\n");
+  printf("  --broadcast              encode each sample as the advertised reading and check it decodes\n");
+  printf("  --snapshots              answer a SNAPSHOT request between every two samples\n");
+  printf("  --live MS                stream readings to a LIVE:<MS> subscriber\n");
+  printf("  --clients N              phones transferring at once, 1 to %d (1)\n", TRANSFER_MAX_SESSIONS);
+  printf("  --order ORDER            newest, priority or record ranges like 30-40,5 (directory order)\n");
+  printf("  --dry-every N            every Nth reading is dry soil (a priority record)\n");
+  printf("  --unattended             --records duty-cycled wakes through the RTC buffer (wake_* settings)\n");
+  printf("  --rollup-query TEXT      answer a ROLLUP:<H|D>|<field>|<count> query afterwards (implies --rollup)\n");
+  printf("  --modbus-turnaround-ms MS  sensor response delay (20)\n");
+  printf("  --modbus-noresp RATE     0..1 probability of no response\n");
+  printf("  --modbus-crc RATE        0..1 probability of a corrupted frame\n");
+  printf("  --modbus-short RATE      0..1 probability of a truncated frame\n");
+  printf("  --modbus-sensor-baud N   rate the sensor listens at on power-up (4800)\n");
+  printf("  --modbus-max-baud N      fastest rate the sensor accepts (9600)\n");
+  printf("  --modbus-needs-restart   sensor applies a new rate only after a power cycle\n");
+  printf("  --bus-device A:TYPE:MS[:dead]  another zts3002/weather device on the RS485 line\n");
+  printf("  --seed N                 error-injection seed (1)\n");
+}
+
+/** @brief "ADDR:TYPE:PERIOD_MS[:dead]", e.g. "2:zts3002:5000". */
+bool parseBusDevice(const char* text, std::vector<SimBusDevice> &devices) {
+  char type[16];
+  char dead[8] = "";
+  unsigned address;
+  unsigned long periodMs;
+  if (sscanf(text, "%u:%15[^:]:%lu:%7s", &address, type, &periodMs, dead) < 3) return false;
+  const RegisterMap* map = registerMapByType(type);
+  if (!map || address == 0 || address > 247 || address == MODBUS_ADDRESS || periodMs == 0) return false;
+  if (dead[0] && strcmp(dead, "dead") != 0) return false;
+  devices.push_back({{(uint8_t)address, map, (uint32_t)periodMs}, dead[0] != 0});
+  return true;
+}
+
+bool parseOptions(int argc, char** argv, RunOptions &opt) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    bool takesValue = true;
+    if (strcmp(arg, "--wipe") == 0) { opt.wipe = true; takesValue = false; }
+    else if (strcmp(arg, "--transfer") == 0) { opt.transfer = true; takesValue = false; }
+    else if (strcmp(arg, "--trace") == 0) { opt.trace = true; takesValue = false; }
+    else if (strcmp(arg, "--compress") == 0) { opt.compress = true; opt.protocol = PROTO_VERSION_SEQUENCED; takesValue = false; }
+    else if (strcmp(arg, "--archive") == 0) { opt.archive = true; takesValue = false; }
+    else if (strcmp(arg, "--transfer-archive") == 0) { opt.archive = opt.transferArchive = true; takesValue = false; }
+    else if (strcmp(arg, "--rollup") == 0) { opt.rollup = true; takesValue = false; }
+    else if (strcmp(arg, "--rollup-rebuild") == 0) { opt.rollup = opt.rollupRebuild = opt.archive = true; takesValue = false; }
+    else if (strcmp(arg, "--broadcast") == 0) { opt.broadcast = true; takesValue = false; }
+    else if (strcmp(arg, "--snapshots") == 0) { opt.snapshots = true; takesValue = false; }
+    else if (strcmp(arg, "--unattended") == 0) { opt.unattended = true; takesValue = false; }
+    else if (strcmp(arg, "--modbus-needs-restart") == 0) { opt.modbus.baudNeedsRestart = true; takesValue = false; }
+    else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) return false;
+    else if (!value) { fprintf(stderr, "❌ Missing value for %s\n", arg); return false; }
+    else if (strcmp(arg, "--sd") == 0) opt.sdDir = value;
+    else if (strcmp(arg, "--nvs") == 0) opt.nvsDir = value;
+    else if (strcmp(arg, "--config") == 0) opt.configCommands.push_back(value);
+    else if (strcmp(arg, "--nmea") == 0) opt.nmeaPath = value;
+    else if (strcmp(arg, "--capture") == 0) opt.capturePath = value;
+    else if (strcmp(arg, "--rollup-query") == 0) { opt.rollup = true; opt.rollupQueries.push_back(value); }
+    else if (strcmp(arg, "--records") == 0) opt.records = atoi(value);
+    else if (strcmp(arg, "--interval-ms") == 0) opt.sampleIntervalMs = (uint32_t)atol(value);
+    else if (strcmp(arg, "--mtu") == 0) opt.ble.mtu = (uint16_t)atoi(value);
+    else if (strcmp(arg, "--conn-interval-ms") == 0) opt.ble.connectionIntervalUs = (uint32_t)(atof(value) * 1000);
+    else if (strcmp(arg, "--packets-per-event") == 0) opt.ble.packetsPerEvent = (uint8_t)atoi(value);
+    else if (strcmp(arg, "--queue-depth") == 0) opt.ble.queueDepth = (uint16_t)atoi(value);
+    else if (strcmp(arg, "--protocol") == 0) opt.protocol = (uint8_t)atoi(value);
+    else if (strcmp(arg, "--data-loss") == 0) opt.ble.dataLossRate = atof(value);
+    else if (strcmp(arg, "--modbus-turnaround-ms") == 0) opt.modbus.turnaroundUs = (uint32_t)(atof(value) * 1000);
+    else if (strcmp(arg, "--modbus-noresp") == 0) opt.modbus.noResponseRate = atof(value);
+    else if (strcmp(arg, "--modbus-crc") == 0) opt.modbus.crcErrorRate = atof(value);
+    else if (strcmp(arg, "--modbus-short") == 0) opt.modbus.shortFrameRate = atof(value);
+    else if (strcmp(arg, "--modbus-sensor-baud") == 0) opt.modbus.lineBaud = (uint32_t)atol(value);
+    else if (strcmp(arg, "--modbus-max-baud") == 0) opt.modbus.maxBaud = (uint32_t)atol(value);
+    else if (strcmp(arg, "--bus-device") == 0) {
+      if (!parseBusDevice(value, opt.busDevices)) { fprintf(stderr, "❌ Bad device %s\n", value); return false; }
+    }
+    else if (strcmp(arg, "--live") == 0) opt.liveMs = (uint32_t)atol(value);
+    else if (strcmp(arg, "--clients") == 0) opt.clients = atoi(value);
+    else if (strcmp(arg, "--dry-every") == 0) opt.dryEvery = atoi(value);
+    else if (strcmp(arg, "--order") == 0) {
+      RecordRange ranges[PROTO_MAX_RECORD_RANGES];
+      size_t count = 0;
+      if (strcmp(value, "newest") == 0) opt.order = TRANSFER_ORDER_NEWEST;
+      else if (strcmp(value, "priority") == 0) opt.order = TRANSFER_ORDER_PRIORITY;
+      else if (parseRecordRanges(value, strlen(value), ranges, PROTO_MAX_RECORD_RANGES, count)) {
+        opt.order = TRANSFER_ORDER_REQUEST;
+        opt.orderRanges.assign(ranges, ranges + count);
+      } else { fprintf(stderr, "❌ Bad order %s\n", value); return false; }
+    }
+    else if (strcmp(arg, "--seed") == 0) opt.modbus.seed = opt.ble.seed = (uint32_t)atol(value);
+    else { fprintf(stderr, "❌ Unknown option %s\n", arg); return false; }
+    if (takesValue) i++;
+  }
+  return opt.clients >= 1 && opt.clients <= TRANSFER_MAX_SESSIONS;
+}
+
+struct TraceContext {
+  TraceWriter* writer;
+  SimClock* clock;
+};
+
+void traceTap(uint8_t channel, const uint8_t* data, size_t length, void* context) {
+  TraceContext* ctx = (TraceContext*)context;
+  ctx->writer->record(channel, ctx->clock->micros(), data, length);
+}
+
+/**
+ * @brief The phone: reassembles what the link delivers and queues a NACK
+ * for every file that ends with holes. NACKs are handed to the engine
+ * after pump() returns, as the BLE command path would.
+ */
+struct PhoneContext {
+  TransferReceiver receiver;
+  std::vector<std::string> nacks;
+  std::map<std::string, int> rounds;
+  uint32_t gaveUp = 0;
+  size_t commandCapacity = 20;
+};
+
+void phoneReceive(const uint8_t* data, size_t length, void* context) {
+  PhoneContext* phone = (PhoneContext*)context;
+  if (phone->receiver.push(data, length) != RECEIVER_FILE_INCOMPLETE) return;
+  const std::string &name = phone->receiver.lastIncomplete();
+  if (++phone->rounds[name] > NACK_ROUNDS_MAX) {
+    phone->gaveUp++;
+    return;
+  }
+  char nack[512];
+  size_t capacity = phone->commandCapacity < sizeof(nack) ? phone->commandCapacity : sizeof(nack);
+  size_t nackLength = phone->receiver.buildNack(name, nack, capacity);
+  if (nackLength) phone->nacks.push_back(std::string(nack, nackLength));
+}
+
+/**
+ * @brief The live subscriber: decodes each frame and checks it against
+ * the sample offered with that sequence number.
+ */
+struct LiveClientContext {
+  std::map<uint16_t, ArchiveSample> offered;
+  uint32_t frames = 0;
+  uint32_t bad = 0;          // undecodable, out of order or wrong values
+  int lastSequence = -1;
+};
+
+void liveReceive(const uint8_t* data, size_t length, void* context) {
+  LiveClientContext* client = (LiveClientContext*)context;
+  ArchiveSample heard;
+  uint16_t sequence = 0;
+  uint16_t ageMs = 0;
+  client->frames++;
+  auto sent = client->offered.end();
+  if (decodeLiveFrame(data, length, heard, sequence, ageMs)) sent = client->offered.find(sequence);
+  if (sent == client->offered.end() || (int)sequence <= client->lastSequence ||
+      memcmp(&heard.values[ARCHIVE_PH], &sent->second.values[ARCHIVE_PH], BEACON_FIELDS * sizeof(int32_t)) != 0) {
+    client->bad++;
+    return;
+  }
+  client->lastSequence = sequence;
+}
+
+void sendNacks(PhoneContext &phone, TransferEngine &engine) {
+  for (const std::string &text : phone.nacks) {
+    char name[PROTO_NAME_MAX];
+    ChunkRange ranges[PROTO_MAX_NACK_RANGES];
+    size_t count;
+    if (parseNack(text.c_str(), text.size(), name, sizeof(name), ranges, PROTO_MAX_NACK_RANGES, count)) {
+      engine.requestResend(name, ranges, count);
+    }
+  }
+  phone.nacks.clear();
+}
+
+/**
+ * @brief Decodes every sealed block and checks the samples added this run
+ * came back unchanged. Returns the number of mismatches.
+ */
+size_t verifyArchive(HalFileSystem &fs, const std::map<uint32_t, ArchiveSample> &added, size_t &found) {
+  size_t mismatches = 0;
+  found = 0;
+  std::vector<ArchiveSample> samples(ARCHIVE_BLOCK_SAMPLES);
+  std::unique_ptr<HalDir> dir = fs.openDir(ARCHIVE_DIR);
+  HalDirEntry entry;
+  while (dir && dir->next(entry)) {
+    uint32_t number = ArchiveWriter::parseBlockNumber(entry.name);
+    if (!number) continue;
+    char path[ARCHIVE_PATH_MAX];
+    ArchiveWriter::blockPath(number, path, sizeof(path));
+    std::unique_ptr<HalFile> file = fs.open(path, HAL_FILE_READ);
+    if (!file) continue;
+    std::vector<uint8_t> block(file->size());
+    bool read = file->read(block.data(), block.size()) == block.size();
+    file->close();
+    size_t count = read ? decodeArchiveBlock(block.data(), block.size(), samples.data(), samples.size()) : 0;
+    if (count == 0) {
+      printf("❌ Archive block %s is corrupt\n", entry.name);
+      mismatches++;
+      continue;
+    }
+    for (size_t i = 0; i < count; i++) {
+      auto it = added.find((uint32_t)samples[i].values[ARCHIVE_ID]);
+      if (it == added.end()) continue;
+      found++;
+      if (memcmp(&it->second, &samples[i], sizeof(ArchiveSample)) != 0) mismatches++;
+    }
+  }
+  if (dir) dir->close();
+  return mismatches;
+}
+
+/**
+ * @brief Recomputes every bucket from the samples and compares it with the
+ * store. Only meaningful on a freshly wiped card.
+ */
+size_t verifyRollups(RollupStore &store, const std::vector<ArchiveSample> &samples, size_t &buckets) {
+  std::map<uint32_t, RollupBucket> expected[ROLLUP_PERIODS];
+  for (const ArchiveSample &sample : samples) {
+    uint32_t time = (uint32_t)sample.values[ARCHIVE_TIME];
+    if (time == 0) continue;
+    for (int p = 0; p < ROLLUP_PERIODS; p++) {
+      uint32_t key = store.keyFor((RollupPeriod)p, time);
+      RollupBucket &b = expected[p][key];
+      b.key = key;
+      for (int f = 0; f < ROLLUP_FIELDS; f++) {
+        bool npk = f == ROLLUP_NITROGEN || f == ROLLUP_PHOSPHORUS || f == ROLLUP_POTASSIUM;
+        if (sample.values[ARCHIVE_FLAGS] & (npk ? ARCHIVE_FLAG_NPK : ARCHIVE_FLAG_BASIC)) {
+          kernelAccumulate(b.fields[f], sample.values[ROLLUP_FIRST_COLUMN + f]);
+        }
+      }
+    }
+  }
+  size_t mismatches = 0;
+  buckets = 0;
+  for (int p = 0; p < ROLLUP_PERIODS; p++) {
+    for (const auto &entry : expected[p]) {
+      RollupBucket stored;
+      buckets++;
+      if (!store.bucket((RollupPeriod)p, entry.first, stored)) {
+        mismatches++;
+        continue;
+      }
+      for (int f = 0; f < ROLLUP_FIELDS; f++) {
+        const RollupAccumulator &a = stored.fields[f];
+        const RollupAccumulator &b = entry.second.fields[f];
+        if (a.count != b.count || a.sum != b.sum || a.sumSquares != b.sumSquares ||
+            (a.count && (a.minimum != b.minimum || a.maximum != b.maximum))) {
+          mismatches++;
+          break;
+        }
+      }
+    }
+  }
+  return mismatches;
+}
+
+void printHistogram(const char* name, const LatencyHistogram &h) {
+  char line[160];
+  formatHistogram(line, sizeof(line), name, h);
+  printf("   %s\n", line);
+}
+
+int main(int argc, char** argv) {
+  RunOptions opt;
+  if (!parseOptions(argc, argv, opt)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+
+  SimClock clock;
+  HostFileSystem sdFileSystem(opt.sdDir);
+  SimModbusSlave sensor(clock, opt.modbus);
+  SimModbusBus rs485(clock);
+  rs485.attach(sensor);
+  std::vector<std::unique_ptr<SimModbusSlave>> otherSlaves;
+  for (const SimBusDevice &device : opt.busDevices) {
+    if (device.dead) continue;
+    SimModbusConfig slaveConfig = opt.modbus;
+    slaveConfig.address = device.config.address;
+    slaveConfig.seed = opt.modbus.seed + device.config.address;
+    otherSlaves.emplace_back(new SimModbusSlave(clock, slaveConfig));
+    if (device.config.map == &WEATHER_MAP) {
+      otherSlaves.back()->setRegister(0, 652);     // 65.2 %RH
+      otherSlaves.back()->setRegister(1, 287);     // 28.7 C
+      otherSlaves.back()->setRegister(2, 10089);   // 1008.9 hPa
+    }
+    rs485.attach(*otherSlaves.back());
+  }
+  NmeaReplayPort gpsPort(clock, opt.nmeaPath);
+  SimBleSink bleSink(clock, opt.ble);
+  NmeaParser gps;
+  TapSerialPort sensorBus(rs485, TRACE_RS485_RX, TRACE_RS485_TX);
+  TraceWriter traceWriter(sdFileSystem, 8UL * 1024 * 1024, 256UL * 1024);
+  TraceContext traceContext = {&traceWriter, &clock};
+
+  HostKeyValueStore nvs(opt.nvsDir);
+  ConfigStore config(nvs);
+  config.begin();
+  for (const std::string &text : opt.configCommands) {
+    char response[CONFIG_RESPONSE_MAX];
+    uint32_t changed = 0;
+    size_t length = config.handleCommand(text.c_str(), text.size(), response, sizeof(response), changed);
+    printf("⚙️  %s -> %s\n", text.c_str(), length ? response : CONFIG_REJECTED);
+  }
+  uint32_t sampleIntervalMs = opt.sampleIntervalMs ? opt.sampleIntervalMs : config.get(CONFIG_SENSOR_PERIOD_MS);
+  if (opt.unattended && !opt.sampleIntervalMs) sampleIntervalMs = config.get(CONFIG_WAKE_INTERVAL_S) * 1000;
+
+  ModbusClient modbus(sensorBus, clock, config.get(CONFIG_MODBUS_TIMEOUT_MS));
+  RecordStore recordStore(sdFileSystem, clock);
+  ArchiveWriter archiveWriter(sdFileSystem, clock);
+  RollupStore rollupStore(sdFileSystem, clock, RECORD_IST_OFFSET_SECONDS);
+  // Client 0 is on bleSink (and the capture); the others get links of their own
+  TransferSessions transferSessions(clock);
+  std::vector<std::unique_ptr<SimBleSink> > otherLinks;
+  std::vector<std::unique_ptr<TransferEngine> > engines;
+  for (int i = 0; i < opt.clients; i++) {
+    SimBleConfig link = opt.ble;
+    link.seed += i;
+    if (i > 0) otherLinks.emplace_back(new SimBleSink(clock, link));
+    engines.emplace_back(new TransferEngine(sdFileSystem, i > 0 ? (HalNotifySink&)*otherLinks.back() : bleSink, clock));
+    transferSessions.add(*engines.back());
+  }
+
+  if (!gpsPort.loaded()) {
+    printf("⚠️  NMEA log %s not found, records will have no fix\n", opt.nmeaPath.c_str());
+  }
+  if (!opt.capturePath.empty() && !bleSink.openCapture(opt.capturePath)) {
+    fprintf(stderr, "❌ Cannot open capture file %s\n", opt.capturePath.c_str());
+    return 1;
+  }
+
+  rs485.begin(config.get(CONFIG_MODBUS_BAUD));
+  uint32_t savedBaud = config.get(CONFIG_MODBUS_BAUD);
+  uint32_t linkBaud = findSensorBaud(modbus, MODBUS_ADDRESS, savedBaud);
+  // Moving one device would strand the others on a shared line
+  if (linkBaud && linkBaud < config.get(CONFIG_MODBUS_MAX_BAUD) && opt.busDevices.empty()) {
+    linkBaud = negotiateSensorBaud(modbus, MODBUS_ADDRESS, config.get(CONFIG_MODBUS_MAX_BAUD));
+  }
+  if (linkBaud) {
+    printf("🔌 RS485 link: %lu -> %lu baud\n", (unsigned long)savedBaud, (unsigned long)linkBaud);
+    if (linkBaud != savedBaud) config.set(CONFIG_MODBUS_BAUD, linkBaud);
+  } else {
+    printf("❌ Soil sensor silent at every baud rate\n");
+  }
+  gpsPort.begin(GPS_BAUD);
+  if (!recordStore.begin()) {
+    fprintf(stderr, "❌ Cannot create %s%s\n", opt.sdDir.c_str(), RECORD_DIR);
+    return 1;
+  }
+  if (opt.wipe) recordStore.wipe();
+  if (opt.archive && !archiveWriter.begin()) {
+    fprintf(stderr, "❌ Cannot create %s%s\n", opt.sdDir.c_str(), ARCHIVE_DIR);
+    return 1;
+  }
+  if (opt.rollup && !rollupStore.begin()) {
+    fprintf(stderr, "❌ Cannot create %s%s\n", opt.sdDir.c_str(), ROLLUP_DIR);
+    return 1;
+  }
+  if (opt.trace) {
+    if (!traceWriter.begin()) {
+      fprintf(stderr, "❌ Cannot create %s%s\n", opt.sdDir.c_str(), TRACE_DIR);
+      return 1;
+    }
+    sensorBus.setTap(traceTap, &traceContext);
+  }
+  printf("✅ Simulated SD at %s, resuming from file number %d\n", opt.sdDir.c_str(), recordStore.nextFileNumber());
+
+  ModbusBus bus(modbus, clock);
+  bus.addDevice({MODBUS_ADDRESS, &ZTS3002_MAP, sampleIntervalMs});
+  for (const SimBusDevice &device : opt.busDevices) {
+    if (bus.addDevice(device.config) < 0) {
+      fprintf(stderr, "❌ Too many bus devices (max %d)\n", BUS_MAX_DEVICES);
+      return 1;
+    }
+  }
+  bus.resetStats();
+
+  // --- Sampling: same order as the firmware's sensor task + logDataToSD ---
+  int sensorFailures = 0;
+  uint64_t jsonBytes = 0;
+  std::map<uint32_t, ArchiveSample> archived;
+  std::vector<ArchiveSample> rolledUp;
+  uint8_t beacon[BEACON_BYTES];
+  size_t beaconBytes = 0;
+  size_t broadcasts = 0;
+  size_t beaconMismatches = 0;
+  // SNAPSHOT: the primary out of turn, answered like answerSnapshot()
+  LatencyHistogram snapshotUs;
+  size_t snapshots = 0;
+  size_t snapshotsFresh = 0;
+  size_t snapshotMismatches = 0;
+  uint8_t reply[SNAPSHOT_BYTES];
+  size_t replyBytes = 0;
+  auto takeSnapshot = [&]() {
+    uint64_t startUs = clock.micros();
+    bus.requestPoll(0);
+    bus.poll();
+    SoilRecord record;
+    record.id = recordStore.nextFileNumber();
+    record.fix = gps.fix();
+    DeviceReading primary = bus.reading(0);
+    bool fresh = soilFromReading(primary, record.soil) && record.soil.basicValid;
+    ArchiveSample sample;
+    archiveSampleFromRecord(record, sample);
+    replyBytes = encodeSnapshot(sample, fresh ? SNAPSHOT_FRESH : 0, primary.ageMs, reply, sizeof(reply));
+    snapshotUs.record((uint32_t)(clock.micros() - startUs));
+
+    ArchiveSample heard;
+    uint8_t status = 0;
+    uint16_t ageMs = 0;
+    bool match = decodeSnapshot(reply, replyBytes, heard, status, ageMs) && status == (fresh ? SNAPSHOT_FRESH : 0);
+    for (int c = 0; c < ARCHIVE_COLUMNS && match; c++) {
+      if (c != ARCHIVE_SPEED && heard.values[c] != sample.values[c]) match = false;
+    }
+    snapshots++;
+    snapshotsFresh += fresh;
+    if (!match) snapshotMismatches++;
+  };
+
+  // LIVE: every fresh reading is offered; frames go out when the interval allows
+  SimBleSink liveSink(clock, opt.ble);
+  LiveStream live(liveSink, clock);
+  LiveClientContext liveClient;
+  liveSink.setReceiver(liveReceive, &liveClient);
+  live.setInterval(opt.liveMs);
+  uint16_t liveSequence = 0;
+
+  // Unattended: one wake as runUnattendedWake() does it, the RTC memory a plain struct
+  RtcState rtcState;
+  RtcSampleBuffer rtcBuffer(rtcState);
+  rtcBuffer.begin();
+  PowerModel powerModel;
+  size_t cardMounts = 0;
+  size_t flushedSamples = 0;
+  size_t flushMismatches = 0;
+  LatencyHistogram wakeUs;
+  uint64_t sensorMsTotal = 0;
+  uint64_t storageMsTotal = 0;
+  auto runWake = [&]() {
+    uint64_t startUs = clock.micros();
+    WakeLedger &ledger = rtcBuffer.ledger();
+    WakePhases phases;
+    ledger.wakes++;
+    clock.sleepMs(config.get(CONFIG_SENSOR_WARMUP_MS));
+    phases.lightSleepMs += config.get(CONFIG_SENSOR_WARMUP_MS);
+    ArchiveSample readings[10];
+    size_t taken = 0;
+    for (uint32_t r = 0; r < config.get(CONFIG_WAKE_READINGS) && r < 10; r++) {
+      if (r) {
+        clock.sleepMs(WAKE_READING_GAP_MS);
+        phases.lightSleepMs += WAKE_READING_GAP_MS;
+      }
+      bus.requestPoll(0);
+      bus.poll();
+      SoilRecord record;
+      if (!soilFromReading(bus.reading(0), record.soil) || !record.soil.basicValid) continue;
+      record.fix = gps.fix();
+      archiveSampleFromRecord(record, readings[taken++]);
+    }
+    phases.sensorMs = (uint32_t)((clock.micros() - startUs) / 1000);
+    ArchiveSample sample;
+    if (!averageSamples(readings, taken, sample)) {
+      ledger.failedReadings++;
+      sensorFailures++;
+    } else if (!rtcBuffer.add(sample)) {
+      ledger.lost++;
+    }
+    if (rtcBuffer.count() >= config.get(CONFIG_RTC_FLUSH_AT)) {
+      uint64_t storageStartUs = clock.micros();
+      clock.sleepMs(SIM_CARD_MOUNT_MS);
+      cardMounts++;
+      size_t written = 0;
+      for (; written < rtcBuffer.count(); written++) {
+        SoilRecord record;
+        archiveSampleToRecord(rtcBuffer.sample(written), record);
+        record.id = recordStore.nextFileNumber();
+        char json[RECORD_JSON_MAX];
+        size_t length = encodeRecordJson(record, json, sizeof(json));
+        if (length == 0 || !recordStore.append(json, length, fixToUnixTime(record.fix), recordPriority(record))) break;
+        // What lands on the card must be what was buffered
+        ArchiveSample stored;
+        archiveSampleFromRecord(record, stored);
+        if (memcmp(&stored.values[ARCHIVE_TIME], &rtcBuffer.sample(written).values[ARCHIVE_TIME],
+                   (ARCHIVE_COLUMNS - ARCHIVE_TIME) * sizeof(int32_t)) != 0) flushMismatches++;
+        jsonBytes += length;
+      }
+      rtcBuffer.drop(written);
+      flushedSamples += written;
+      if (written) ledger.flushes++;
+      phases.storageMs = (uint32_t)((clock.micros() - storageStartUs) / 1000);
+    }
+    phases.awakeMs = (uint32_t)((clock.micros() - startUs) / 1000);
+    uint32_t sleepMs = sampleIntervalMs > phases.awakeMs ? sampleIntervalMs - phases.awakeMs : 0;
+    uint64_t wakeNah = wakeChargeNah(phases, powerModel);
+    ledger.awakeMs += phases.awakeMs;
+    ledger.sleptMs += sleepMs;
+    ledger.chargeNah += wakeNah + sleepChargeNah(sleepMs, powerModel);
+    ledger.lastWakeMs = phases.awakeMs;
+    ledger.lastWakeNah = (uint32_t)wakeNah;
+    rtcBuffer.seal();
+    wakeUs.record((uint32_t)(clock.micros() - startUs));
+    sensorMsTotal += phases.sensorMs;
+    storageMsTotal += phases.storageMs;
+  };
+
+  uint64_t nextSampleUs = clock.micros();
+  for (int i = 0; i < opt.records; i++) {
+    // Between wakes nothing runs but the GPS, whose fix the sample takes
+    if (opt.unattended) {
+      clock.advanceTo(nextSampleUs);
+      nextSampleUs += (uint64_t)sampleIntervalMs * 1000;
+      while (gpsPort.available()) gps.encode((char)gpsPort.read());
+      runWake();
+      continue;
+    }
+    // The other devices' polls that fall between two samples, and a SNAPSHOT midway
+    uint64_t snapshotAtUs = opt.snapshots && i > 0 ? nextSampleUs - (uint64_t)sampleIntervalMs * 500 : UINT64_MAX;
+    for (;;) {
+      uint64_t dueUs = clock.micros() + (uint64_t)bus.msUntilDue() * 1000;
+      uint32_t liveWaitMs = live.msUntilDue(false);
+      uint64_t liveAtUs = liveWaitMs == UINT32_MAX ? UINT64_MAX : clock.micros() + (uint64_t)liveWaitMs * 1000;
+      if (liveAtUs < nextSampleUs && liveAtUs <= dueUs && liveAtUs <= snapshotAtUs) {
+        clock.advanceTo(liveAtUs);
+        live.pump(false);
+        continue;
+      }
+      if (snapshotAtUs <= dueUs && snapshotAtUs < nextSampleUs) {
+        clock.advanceTo(snapshotAtUs);
+        snapshotAtUs = UINT64_MAX;
+        takeSnapshot();
+        continue;
+      }
+      if (dueUs >= nextSampleUs) break;
+      clock.advanceTo(dueUs);
+      bus.poll();
+    }
+    clock.advanceTo(nextSampleUs);
+    nextSampleUs += (uint64_t)sampleIntervalMs * 1000;
+    while (gpsPort.available()) {
+      uint8_t c = (uint8_t)gpsPort.read();
+      if (opt.trace) traceTap(TRACE_GPS_RX, &c, 1, &traceContext);
+      gps.encode((char)c);
+    }
+
+    if (opt.dryEvery > 0) {
+      // 6.0 % instead of the default 31.4 %
+      sensor.setRegister(REG_MOISTURE, (i + 1) % opt.dryEvery == 0 ? 60 : 314);
+    }
+    bus.poll();
+    SoilRecord record;
+    record.id = recordStore.nextFileNumber();
+    if (!soilFromReading(bus.reading(0), record.soil) || !record.soil.basicValid) {
+      sensorFailures++;
+      continue;
+    }
+    if (bus.deviceCount() > 1) record.deviceCount = bus.readings(record.devices, RECORD_MAX_DEVICES);
+    record.fix = gps.fix();
+    if (live.active()) {
+      ArchiveSample sample;
+      archiveSampleFromRecord(record, sample);
+      liveClient.offered[++liveSequence] = sample;
+      live.offer(sample);
+      live.pump(false);
+    }
+
+    char json[RECORD_JSON_MAX];
+    size_t length = encodeRecordJson(record, json, sizeof(json));
+    if (length == 0 || !recordStore.append(json, length, fixToUnixTime(record.fix), recordPriority(record))) {
+      printf("❌ Failed to store record %lu\n", (unsigned long)record.id);
+    } else if (opt.archive || opt.rollup || opt.broadcast) {
+      ArchiveSample sample;
+      archiveSampleFromRecord(record, sample);
+      if (opt.archive && archiveWriter.add(sample)) archived[record.id] = sample;
+      if (opt.rollup) {
+        rollupStore.add(sample);
+        rolledUp.push_back(sample);
+      }
+      if (opt.broadcast) {
+        ArchiveSample heard;
+        beaconBytes = encodeBeacon(sample, beacon, sizeof(beacon));
+        bool match = decodeBeacon(beacon, beaconBytes, heard) && heard.values[ARCHIVE_ID] == (int32_t)(record.id & 0xFFFF) &&
+                     memcmp(&heard.values[ARCHIVE_PH], &sample.values[ARCHIVE_PH], BEACON_FIELDS * sizeof(int32_t)) == 0;
+        if (!match) beaconMismatches++;
+        broadcasts++;
+      }
+      jsonBytes += length;
+    }
+    if (opt.trace && traceWriter.swapBuffers()) traceWriter.flush();
+  }
+  if (opt.trace) {
+    if (traceWriter.swapBuffers()) traceWriter.flush();
+    printf("🎞️  Trace: %lu records, %llu bytes, %lu dropped\n", (unsigned long)traceWriter.stats().records,
+      (unsigned long long)traceWriter.stats().bytesWritten, (unsigned long)traceWriter.stats().droppedBytes);
+  }
+  printf("💾 Stored %lu records (%d sensor failures), card now holds %d\n",
+    (unsigned long)recordStore.stats().appends, sensorFailures, recordStore.recordCount());
+  const StorageStats &sd = recordStore.stats();
+  printf("🗂️  Index: %lu records, %lu flagged, %llu bytes (%lu rebuilds, %lu failures)\n",
+    (unsigned long)recordStore.indexSummary().records, (unsigned long)recordStore.indexSummary().flagged,
+    (unsigned long long)recordStore.indexSummary().bytes, (unsigned long)sd.indexRebuilds,
+    (unsigned long)sd.indexFailures);
+
+  if (opt.unattended) {
+    const WakeLedger &ledger = rtcBuffer.ledger();
+    bool intact = flushMismatches == 0 && flushedSamples + rtcBuffer.count() == ledger.samples;
+    double wakes = ledger.wakes ? ledger.wakes : 1;
+    double perDay = 86400000.0 / sampleIntervalMs;
+    double awakeShare = ledger.awakeMs / (double)(ledger.awakeMs + ledger.sleptMs);
+    double alwaysOnMah = (powerModel.activeMa + powerModel.sensorMa) * 24.0;
+    printf("%s Unattended: %lu wakes every %lu s, %lu samples buffered (%lu failed, %lu lost), %lu card mounts for %lu samples, %lu still buffered, %lu/%lu written intact\n",
+      intact ? "🌙" : "❌", (unsigned long)ledger.wakes, (unsigned long)(sampleIntervalMs / 1000),
+      (unsigned long)ledger.samples, (unsigned long)ledger.failedReadings, (unsigned long)ledger.lost,
+      (unsigned long)cardMounts, (unsigned long)flushedSamples, (unsigned long)rtcBuffer.count(),
+      (unsigned long)(flushedSamples - flushMismatches), (unsigned long)flushedSamples);
+    printf("🔋 Per wake: %.0f ms awake (sensor %.0f ms, card %.0f ms), ~%.1f uAh; %.2f%% awake, ~%.1f mAh/day (always on ~%.0f mAh/day)\n",
+      ledger.awakeMs / wakes, sensorMsTotal / wakes, storageMsTotal / wakes,
+      (ledger.chargeNah - sleepChargeNah(ledger.sleptMs, powerModel)) / 1000.0 / wakes, awakeShare * 100.0,
+      ledger.chargeNah / 1e6 / wakes * perDay, alwaysOnMah);
+    printHistogram("wake_us", wakeUs);
+    if (!intact) return 1;
+  }
+
+  if (opt.broadcast) {
+    printf("%s Broadcast: %lu/%lu advertised readings decoded intact, last:", beaconMismatches ? "❌" : "📡",
+      (unsigned long)(broadcasts - beaconMismatches), (unsigned long)broadcasts);
+    for (size_t i = 0; i < beaconBytes; i++) printf(" %02X", beacon[i]);
+    printf("\n");
+    if (beaconMismatches) return 1;
+  }
+
+  if (live.active()) {
+    liveSink.drain();
+    const LiveStats &ls = live.stats();
+    bool intact = liveClient.bad == 0 && liveClient.frames == ls.frames;
+    printf("%s Live every %lu ms: %lu samples, %lu frames (%lu coalesced, %lu refused), %lu/%lu decoded in order, delay p50 %.1f ms max %.1f ms\n",
+      intact ? "📈" : "❌", (unsigned long)live.interval(), (unsigned long)ls.samples, (unsigned long)ls.frames,
+      (unsigned long)ls.coalesced, (unsigned long)ls.rejected, (unsigned long)(liveClient.frames - liveClient.bad),
+      (unsigned long)liveClient.frames, ls.delayUs.percentile(50) / 1000.0, ls.delayUs.maximum() / 1000.0);
+    if (!intact) return 1;
+  }
+
+  if (opt.snapshots) {
+    printf("%s Snapshots: %lu/%lu fresh, %lu/%lu decoded intact, poll to reply p50 %.1f ms p99 %.1f ms\n",
+      snapshotMismatches ? "❌" : "📸", (unsigned long)snapshotsFresh, (unsigned long)snapshots,
+      (unsigned long)(snapshots - snapshotMismatches), (unsigned long)snapshots,
+      snapshotUs.percentile(50) / 1000.0, snapshotUs.percentile(99) / 1000.0);
+    printf("   last:");
+    for (size_t i = 0; i < replyBytes; i++) printf(" %02X", reply[i]);
+    printf("\n");
+    if (snapshotMismatches) return 1;
+  }
+
+  if (opt.archive) {
+    archiveWriter.seal();
+    const ArchiveStats &as = archiveWriter.stats();
+    size_t found = 0;
+    size_t mismatches = verifyArchive(sdFileSystem, archived, found);
+    bool intact = mismatches == 0 && found == archived.size();
+    printf("%s Archive: %lu samples in %lu blocks, %llu JSON bytes -> %llu archive bytes (%.1fx), %lu/%lu verified\n",
+      intact ? "🗄️ " : "❌", (unsigned long)as.samples, (unsigned long)as.blocks, (unsigned long long)jsonBytes,
+      (unsigned long long)as.blockBytes, as.blockBytes ? (double)jsonBytes / as.blockBytes : 0.0,
+      (unsigned long)(found - mismatches), (unsigned long)archived.size());
+    if (!intact) return 1;
+  }
+
+  if (opt.rollup) {
+    const RollupStats &rs = rollupStore.stats();
+    printf("📅 Rollups: %lu samples (%lu without time, %lu stale), newest hour %lu day %lu\n",
+      (unsigned long)rs.samples, (unsigned long)rs.untimed, (unsigned long)rs.stale,
+      (unsigned long)rollupStore.newestKey(ROLLUP_HOUR), (unsigned long)rollupStore.newestKey(ROLLUP_DAY));
+    if (opt.wipe) {
+      size_t buckets = 0;
+      size_t mismatches = verifyRollups(rollupStore, rolledUp, buckets);
+      printf("%s Rollups: %lu/%lu buckets match a recomputation from the samples\n", mismatches ? "❌" : "✅",
+        (unsigned long)(buckets - mismatches), (unsigned long)buckets);
+      if (mismatches) return 1;
+    }
+    if (opt.rollupRebuild) {
+      long rebuilt = rollupStore.rebuild(archiveWriter);
+      size_t buckets = 0;
+      size_t mismatches = opt.wipe ? verifyRollups(rollupStore, rolledUp, buckets) : 0;
+      printf("%s Rollups rebuilt from %ld archived samples%s", rebuilt >= 0 && !mismatches ? "✅" : "❌", rebuilt,
+        opt.wipe ? "" : "\n");
+      if (opt.wipe) printf(", %lu/%lu buckets match\n", (unsigned long)(buckets - mismatches), (unsigned long)buckets);
+      if (rebuilt < 0 || mismatches) return 1;
+    }
+    for (const std::string &text : opt.rollupQueries) {
+      RollupQuery query;
+      char response[ROLLUP_RESPONSE_MAX];
+      if (!parseRollupQuery(text.c_str(), text.size(), query)) {
+        printf("❌ Bad rollup query %s\n", text.c_str());
+        continue;
+      }
+      size_t length = rollupStore.formatResponse(query, response, sizeof(response));
+      printf("   %s -> (%lu bytes) %s\n", text.c_str(), (unsigned long)length, response);
+    }
+  }
+
+  // --- Transfer: the main loop's processTransferChunk() pacing ---
+  if (opt.transfer) {
+    std::vector<SimBleSink*> links(1, &bleSink);
+    for (auto &link : otherLinks) links.push_back(link.get());
+    std::vector<PhoneContext> phones(opt.clients);
+    bool sequenced = opt.protocol == PROTO_VERSION_SEQUENCED;
+
+    uint64_t transferStartUs = clock.micros();
+    const char* transferDir = opt.transferArchive ? ARCHIVE_DIR : RECORD_DIR;
+    bool ordered = opt.order != TRANSFER_ORDER_DIRECTORY && !opt.transferArchive;
+    std::vector<std::unique_ptr<RecordQueue> > queues;
+    std::vector<std::string> firstFiles(opt.clients);
+    transferSessions.setInterval(config.get(CONFIG_CHUNK_INTERVAL_MS));
+    for (int i = 0; i < opt.clients; i++) {
+      phones[i].commandCapacity = opt.ble.mtu - 3;   // one write to the command characteristic
+      if (sequenced) links[i]->setReceiver(phoneReceive, &phones[i]);
+      int session = transferSessions.open((uint16_t)i);
+      transferSessions.engine(session).setCompression(opt.compress);
+      transferSessions.engine(session).setChunkSize(config.get(CONFIG_CHUNK_BYTES));
+      queues.emplace_back(new RecordQueue(recordStore));
+      if (ordered) queues.back()->plan(opt.order, opt.orderRanges.data(), opt.orderRanges.size());
+      if (!transferSessions.start(session, transferDir, opt.protocol, ordered ? queues.back().get() : NULL)) {
+        fprintf(stderr, "❌ Failed to open %s\n", transferDir);
+        return 1;
+      }
+    }
+    bool ok = true;
+    for (;;) {
+      while (transferSessions.active()) {
+        TransferEvent event;
+        int session = transferSessions.pump(event);
+        if (session != TRANSFER_NO_SESSION) {
+          if (event == TRANSFER_ERROR) ok = false;
+          if (event == TRANSFER_FILE_STARTED && firstFiles[session].empty()) {
+            firstFiles[session] = transferSessions.engine(session).currentFileName();
+          }
+          sendNacks(phones[session], transferSessions.engine(session));
+        }
+        uint32_t waitMs = transferSessions.msUntilDue();
+        if (waitMs != UINT32_MAX && waitMs > 0) clock.sleepMs(waitMs);
+      }
+      // The last files' trailers are still in flight; their NACKs restart the engines
+      for (int i = 0; i < opt.clients; i++) {
+        links[i]->drain();
+        sendNacks(phones[i], transferSessions.engine(i));
+      }
+      if (!transferSessions.active()) break;
+    }
+    const TransferStats &st = transferSessions.stats();
+    uint32_t notifications = 0;
+    uint64_t bytes = 0;
+    uint64_t lastDeliveryUs = transferStartUs;
+    uint32_t lost = 0;
+    for (SimBleSink* link : links) {
+      notifications += link->stats().notifications;
+      bytes += link->stats().bytes;
+      lost += link->stats().lost;
+      if (link->stats().lastDeliveryUs > lastDeliveryUs) lastDeliveryUs = link->stats().lastDeliveryUs;
+    }
+    double seconds = (lastDeliveryUs - transferStartUs) / 1e6;
+    printf("%s Transfer: %lu files, %lu notifications, %llu bytes in %.2f s (%.0f B/s), %lu congested\n",
+      ok ? "📡" : "❌", (unsigned long)st.files, (unsigned long)notifications,
+      (unsigned long long)bytes, seconds, seconds > 0 ? bytes / seconds : 0.0, (unsigned long)st.congested);
+    for (int i = 0; i < opt.clients; i++) {
+      const TransferProgress &progress = transferSessions.engine(i).progress();
+      printf("⏱️  Client %d (%s order): first record %s after %lu ms, %lu records, %llu bytes", i,
+        transferOrderName(ordered ? opt.order : TRANSFER_ORDER_DIRECTORY), firstFiles[i].c_str(),
+        (unsigned long)progress.firstFileMs, (unsigned long)progress.files, (unsigned long long)progress.bytes);
+      if (ordered) {
+        printf(" of %lu, %llu planned", (unsigned long)progress.plannedFiles, (unsigned long long)progress.plannedBytes);
+      }
+      printf("\n");
+      if (ordered && sequenced && phones[i].receiver.plannedFiles() != progress.plannedFiles) ok = false;
+    }
+    for (int i = 0; i < opt.clients && opt.clients > 1; i++) {
+      const SimBleStats &link = links[i]->stats();
+      double clientSeconds = (link.lastDeliveryUs - transferStartUs) / 1e6;
+      printf("   📱 Client %d: %lu files, %llu bytes in %.2f s (%.0f B/s)\n", i,
+        (unsigned long)transferSessions.session(i).files, (unsigned long long)link.bytes, clientSeconds,
+        clientSeconds > 0 ? link.bytes / clientSeconds : 0.0);
+    }
+    if (sequenced) {
+      uint32_t received = 0;
+      uint32_t repaired = 0;
+      uint32_t gaveUp = 0;
+      bool intact = true;
+      for (int i = 0; i < opt.clients; i++) {
+        const ReceiverStats &rx = phones[i].receiver.stats();
+        received += rx.files;
+        repaired += rx.repairedFiles;
+        gaveUp += phones[i].gaveUp;
+        intact = intact && rx.files == transferSessions.session(i).files && phones[i].receiver.pendingRepairs() == 0;
+      }
+      printf("%s Phone%s: %lu/%lu files verified, %lu chunks lost, %lu NACKs, %lu chunks resent, %lu repaired, %lu given up\n",
+        intact ? "✅" : "❌", opt.clients > 1 ? "s" : "", (unsigned long)received, (unsigned long)st.files,
+        (unsigned long)lost, (unsigned long)st.nacks, (unsigned long)st.resentChunks, (unsigned long)repaired,
+        (unsigned long)gaveUp);
+      ok = ok && intact;
+    }
+    if (opt.compress) {
+      uint64_t expanded = 0;
+      uint32_t decodeErrors = 0;
+      for (const PhoneContext &phone : phones) {
+        expanded += phone.receiver.stats().expandedBytes;
+        decodeErrors += phone.receiver.stats().decompressErrors;
+      }
+      printf("🗜️  LZ: %llu -> %llu bytes (%.2fx), receiver expanded %llu bytes, %lu decode errors\n",
+        (unsigned long long)st.rawBytes, (unsigned long long)st.compressedBytes,
+        st.compressedBytes ? (double)st.rawBytes / st.compressedBytes : 0.0,
+        (unsigned long long)expanded, (unsigned long)decodeErrors);
+    }
+    if (!ok) return 1;
+  }
+
+  // --- Summary ---
+  const ModbusStats &mb = modbus.stats();
+  const SimModbusSlaveStats &slave = sensor.stats();
+  printf("📊 Modbus: ok=%lu noresp=%lu short=%lu crc=%lu (injected noresp=%lu crc=%lu short=%lu)\n",
+    (unsigned long)mb.ok, (unsigned long)mb.noResponse, (unsigned long)mb.shortFrame, (unsigned long)mb.crcError,
+    (unsigned long)slave.injectedNoResponse, (unsigned long)slave.injectedCrcErrors, (unsigned long)slave.injectedShortFrames);
+  printf("📊 Modbus faults: wrong_slave=%lu wrong_function=%lu bad_length=%lu exception=%lu bad_echo=%lu retries=%lu recovered=%lu\n",
+    (unsigned long)mb.wrongSlave, (unsigned long)mb.wrongFunction, (unsigned long)mb.badLength,
+    (unsigned long)mb.exceptions, (unsigned long)mb.writeRejected, (unsigned long)mb.retries, (unsigned long)mb.recovered);
+  printf("📊 RS485 link: %lu baud probes=%lu changes=%lu fallbacks=%lu exceptions=%lu garbled=%lu\n",
+    (unsigned long)sensor.sensorBaud(), (unsigned long)mb.baudProbes, (unsigned long)mb.baudChanges,
+    (unsigned long)mb.baudFallbacks, (unsigned long)mb.exceptions, (unsigned long)slave.garbled);
+  const BusStats &bs = bus.stats();
+  printf("📊 RS485 bus: %lu devices, %.1f%% busy, %lu reads in %lu cycles, %lu gap violations\n",
+    (unsigned long)bus.deviceCount(), bus.utilization() * 100.0, (unsigned long)bs.reads,
+    (unsigned long)bs.cycles, (unsigned long)rs485.stats().gapViolations);
+  for (size_t d = 0; d < bus.deviceCount(); d++) {
+    const BusDeviceStats &ds = bus.deviceStats(d);
+    printf("   %3u %-8s every %6lu ms: polls=%lu ok=%lu failed=%lu isolated=%lu probes=%lu overruns=%lu busy=%.1f ms%s\n",
+      bus.device(d).address, bus.device(d).map->type, (unsigned long)bus.device(d).periodMs,
+      (unsigned long)ds.polls, (unsigned long)ds.ok, (unsigned long)ds.failures, (unsigned long)ds.isolations,
+      (unsigned long)ds.probes, (unsigned long)ds.overruns, ds.busyUs / 1000.0, bus.isolated(d) ? " (isolated)" : "");
+    printf("       timeout %lu ms, failed reads:", (unsigned long)ds.timeoutMs);
+    bool anyFailed = false;
+    for (int e = MODBUS_OK + 1; e < MODBUS_ERROR_COUNT; e++) {
+      if (ds.errors[e] == 0) continue;
+      printf(" %s=%lu", modbusErrorName((ModbusError)e), (unsigned long)ds.errors[e]);
+      anyFailed = true;
+    }
+    printf("%s\n", anyFailed ? "" : " none");
+  }
+  printf("📊 GPS: fix=%s sentences ok=%lu bad=%lu\n", gps.fix().valid ? "yes" : "no",
+    (unsigned long)gps.passedChecksum(), (unsigned long)gps.failedChecksum());
+  printHistogram("mb_us", mb.transactionUs);
+  printHistogram("mb_reply_us", mb.replyUs);
+  printHistogram("sd_app_us", recordStore.stats().appendUs);
+  printHistogram("sd_rd_us", transferSessions.stats().readUs);
+  if (opt.archive) printHistogram("arc_seal_us", archiveWriter.stats().sealUs);
+  if (opt.rollup) printHistogram("rollup_us", rollupStore.stats().updateUs);
+  if (opt.rollupRebuild) printHistogram("rollup_rebuild_us", rollupStore.stats().rebuildUs);
+  return 0;
+}
@@ -0,0 +1,391 @@
+// ============================================================================
+// AGNI SOIL SENSOR - TRANSFER RECEIVER CLI (host)
+// ============================================================================
+// Reference consumer of the BLE transfer stream, built on lib/AgniReceiver:
+//
+//   pio run -e receiver
+//   .pio/build/receiver/program decode --capture cap.bin --csv out.csv
+//   .pio/build/receiver/program bench --records 100000 --mtu 247
+//
+// decode  reads a notification capture (<u16 length LE><payload> per
+//         notification, as written by the native runner's --capture),
+//         reassembles and verifies the files, and writes the records as
+//         CSV and/or JSON Lines. Version 2 captures taken with chunk loss
+//         include the retransmissions, so repaired files decode normally.
+//         Archive blocks (block_<n>.agb) expand to one row per sample.
+//         Log dumps (log_<n>.agl, START_TRANSFER:2|LOGS) are printed as
+//         text instead, one line per record.
+//         Exit code 1 if anything failed to verify.
+// beacon  decodes advertised readings (manufacturer data from a scan,
+//         as hex starting at the company id) to CSV rows on stdout, the
+//         way a gateway harvesting BROADCAST_ON units would. SNAPSHOT
+//         replies (hex of the notification) decode the same way, with
+//         their position.
+// bench   frames a synthetic history at the given MTU in memory and
+//         measures reassembly and decode throughput.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <AgniReceiver.h>
+#include <AgniArchive.h>
+#include <AgniBeacon.h>
+#include <AgniLog.h>
+
+struct ReceiverOptions {
+  std::string mode;
+  std::string capturePath;
+  std::string outDir;
+  std::string csvPath;
+  std::string jsonlPath;
+  std::string jsonPath;
+  std::vector<std::string> beacons;
+  bool verbose = false;
+  int records = 100000;
+  int mtu = 247;
+};
+
+static uint64_t nowUs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void printUsage(const char* program) {
+  printf("Usage: %s decode --capture FILE [--out-dir DIR] [--csv FILE] [--jsonl FILE] [--verbose]\n", program);
+  printf("       %s beacon --hex HEX [--hex HEX ...]\n", program);
+  printf("       %s bench [--records N] [--mtu BYTES] [--json FILE]\n", program);
+}
+
+bool parseOptions(int argc, char** argv, ReceiverOptions &opt) {
+  if (argc < 2) return false;
+  opt.mode = argv[1];
+  if (opt.mode != "decode" && opt.mode != "beacon" && opt.mode != "bench") return false;
+  for (int i = 2; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0 || strcmp(arg, "-v") == 0) { opt.verbose = true; continue; }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "❌ Missing value for %s\n", arg);
+      return false;
+    }
+    const char* value = argv[++i];
+    if (strcmp(arg, "--capture") == 0) opt.capturePath = value;
+    else if (strcmp(arg, "--out-dir") == 0) opt.outDir = value;
+    else if (strcmp(arg, "--csv") == 0) opt.csvPath = value;
+    else if (strcmp(arg, "--jsonl") == 0) opt.jsonlPath = value;
+    else if (strcmp(arg, "--json") == 0) opt.jsonPath = value;
+    else if (strcmp(arg, "--hex") == 0) opt.beacons.push_back(value);
+    else if (strcmp(arg, "--records") == 0) opt.records = atoi(value);
+    else if (strcmp(arg, "--mtu") == 0) opt.mtu = atoi(value);
+    else {
+      fprintf(stderr, "❌ Unknown option %s\n", arg);
+      return false;
+    }
+  }
+  if (opt.mode == "decode" && opt.capturePath.empty()) return false;
+  if (opt.mode == "beacon" && opt.beacons.empty()) return false;
+  return opt.records > 0 && opt.mtu >= 23;
+}
+
+// ============================================================================
+// DECODE
+// ============================================================================
+/**
+ * @brief Expands an archive block into records via the firmware's own JSON
+ * encoder, so its rows match the farmland_<n>.json ones exactly.
+ * @return false if the block does not verify
+ */
+bool decodeArchiveFile(const ReceivedFile &file, std::vector<DecodedRecord> &records) {
+  std::vector<ArchiveSample> samples(ARCHIVE_BLOCK_SAMPLES);
+  size_t count = decodeArchiveBlock(file.data.data(), file.data.size(), samples.data(), samples.size());
+  if (count == 0) return false;
+  char json[RECORD_JSON_MAX];
+  for (size_t i = 0; i < count; i++) {
+    SoilRecord soil;
+    DecodedRecord record;
+    archiveSampleToRecord(samples[i], soil);
+    size_t length = encodeRecordJson(soil, json, sizeof(json));
+    if (length == 0 || !decodeRecordJson(json, length, record)) return false;
+    records.push_back(record);
+  }
+  return true;
+}
+
+static bool hasSuffix(const std::string &name, const char* suffix) {
+  const size_t suffixLen = strlen(suffix);
+  return name.size() > suffixLen && name.compare(name.size() - suffixLen, suffixLen, suffix) == 0;
+}
+
+int runDecode(const ReceiverOptions &opt) {
+  FILE* capture = fopen(opt.capturePath.c_str(), "rb");
+  if (!capture) {
+    fprintf(stderr, "❌ Cannot open %s\n", opt.capturePath.c_str());
+    return 2;
+  }
+  FILE* csv = opt.csvPath.empty() ? NULL : fopen(opt.csvPath.c_str(), "w");
+  FILE* jsonl = opt.jsonlPath.empty() ? NULL : fopen(opt.jsonlPath.c_str(), "w");
+  if (csv) fprintf(csv, "%s\n", recordCsvHeader());
+
+  TransferReceiver receiver;
+  uint32_t decodeFailures = 0;
+  uint32_t records = 0;
+  uint32_t archiveBlocks = 0;
+  uint8_t payload[65536];
+  uint8_t header[2];
+  char line[1024];
+
+  while (fread(header, 1, 2, capture) == 2) {
+    size_t length = header[0] | (header[1] << 8);
+    if (fread(payload, 1, length, capture) != length) {
+      fprintf(stderr, "⚠️  Capture ends mid-notification\n");
+      break;
+    }
+    ReceiverEvent event = receiver.push(payload, length);
+    if (event == RECEIVER_PROTOCOL_ERROR) {
+      printf("❌ Protocol error: %s\n", receiver.lastError().c_str());
+    } else if (event == RECEIVER_FILE_INCOMPLETE && opt.verbose) {
+      char nack[256];
+      if (receiver.buildNack(receiver.lastIncomplete(), nack, sizeof(nack))) printf("🔁 %s\n", nack);
+    } else if (event == RECEIVER_PLAN && opt.verbose) {
+      printf("📋 Plan: %lu records, %llu bytes\n", (unsigned long)receiver.plannedFiles(),
+             (unsigned long long)receiver.plannedBytes());
+    } else if (event == RECEIVER_TRANSFER_COMPLETE && opt.verbose) {
+      printf("🎉 Transfer complete\n");
+    }
+    if (event != RECEIVER_FILE_DONE) continue;
+
+    const ReceivedFile &file = receiver.file();
+    if (opt.verbose && file.version == PROTO_VERSION_SEQUENCED) {
+      printf("%s %s: %lu bytes in %lu chunks, crc32 %08lx (trailer %08lx)\n", file.crcOk ? "✅" : "❌", file.name.c_str(),
+        (unsigned long)file.data.size(), (unsigned long)file.chunks.size(), (unsigned long)file.crc32,
+        (unsigned long)file.expectedCrc);
+    } else if (opt.verbose || !file.sizeOk) {
+      printf("%s %s: %lu/%lu bytes, crc32 %08lx\n", file.sizeOk ? "✅" : "❌", file.name.c_str(),
+        (unsigned long)file.data.size(), (unsigned long)file.declaredSize, (unsigned long)file.crc32);
+    }
+    if (!opt.outDir.empty()) {
+      std::string path = opt.outDir + "/" + file.name;
+      FILE* out = fopen(path.c_str(), "wb");
+      if (out) {
+        fwrite(file.data.data(), 1, file.data.size(), out);
+        fclose(out);
+      }
+    }
+
+    if (hasSuffix(file.name, LOG_FILE_SUFFIX)) {
+      std::vector<std::string> lines;
+      bool valid = decodeLogDump(file.data.data(), file.data.size(), lines);
+      printf("%s %s: %lu log records\n", valid ? "🧾" : "❌", file.name.c_str(), (unsigned long)lines.size());
+      for (const std::string &text : lines) printf("   %s\n", text.c_str());
+      if (!valid) decodeFailures++;
+      continue;
+    }
+
+    std::vector<DecodedRecord> decoded(1);
+    bool valid;
+    if (hasSuffix(file.name, ARCHIVE_FILE_SUFFIX)) {
+      decoded.clear();
+      valid = decodeArchiveFile(file, decoded);
+      if (valid) archiveBlocks++;
+    } else {
+      valid = decodeRecordJson((const char*)file.data.data(), file.data.size(), decoded[0]);
+    }
+    if (!valid) {
+      decodeFailures++;
+      printf("❌ %s: not a valid record\n", file.name.c_str());
+      continue;
+    }
+    for (const DecodedRecord &record : decoded) {
+      records++;
+      if (csv && formatRecordCsv(record, line, sizeof(line))) fprintf(csv, "%s\n", line);
+      if (jsonl && formatRecordJson(record, line, sizeof(line))) fprintf(jsonl, "%s\n", line);
+    }
+  }
+  fclose(capture);
+  if (csv) fclose(csv);
+  if (jsonl) fclose(jsonl);
+
+  const ReceiverStats &st = receiver.stats();
+  bool ok = st.sizeMismatches == 0 && st.protocolErrors == 0 && decodeFailures == 0 && !receiver.receivingFile() &&
+            receiver.pendingRepairs() == 0;
+  printf("%s %lu files, %lu records, %llu payload bytes in %llu notifications; "
+         "size mismatches=%lu protocol errors=%lu decode failures=%lu transfers=%lu\n",
+    ok ? "✅" : "❌", (unsigned long)st.files, (unsigned long)records,
+    (unsigned long long)st.payloadBytes, (unsigned long long)st.notifications,
+    (unsigned long)st.sizeMismatches, (unsigned long)st.protocolErrors,
+    (unsigned long)decodeFailures, (unsigned long)st.transfers);
+  if (archiveBlocks) printf("🗄️  %lu archive blocks expanded\n", (unsigned long)archiveBlocks);
+  if (st.compressedFiles) {
+    printf("🗜️  %lu LZ files: %llu -> %llu bytes (%.2fx), %lu decode errors\n", (unsigned long)st.compressedFiles,
+      (unsigned long long)st.compressedBytes, (unsigned long long)st.expandedBytes,
+      (double)st.expandedBytes / st.compressedBytes, (unsigned long)st.decompressErrors);
+  }
+  if (st.repairedFiles || st.incompleteFiles || receiver.pendingRepairs()) {
+    printf("🔁 repaired=%lu incomplete trailers=%lu crc mismatches=%lu duplicate chunks=%lu still missing chunks: %lu files\n",
+      (unsigned long)st.repairedFiles, (unsigned long)st.incompleteFiles, (unsigned long)st.crcMismatches,
+      (unsigned long)st.duplicateChunks, (unsigned long)receiver.pendingRepairs());
+  }
+  return ok ? 0 : 1;
+}
+
+// ============================================================================
+// BEACON
+// ============================================================================
+static bool parseHex(const std::string &text, std::vector<uint8_t> &out) {
+  std::string digits;
+  for (char c : text) {
+    if (isxdigit((unsigned char)c)) digits += c;
+    else if (c != ' ' && c != ':' && c != '-') return false;
+  }
+  if (digits.size() % 2) return false;
+  for (size_t i = 0; i < digits.size(); i += 2) out.push_back((uint8_t)strtoul(digits.substr(i, 2).c_str(), NULL, 16));
+  return true;
+}
+
+int runBeacon(const ReceiverOptions &opt) {
+  printf("%s\n", recordCsvHeader());
+  bool ok = true;
+  char json[RECORD_JSON_MAX];
+  char row[1024];
+  for (const std::string &text : opt.beacons) {
+    std::vector<uint8_t> data;
+    ArchiveSample sample;
+    uint8_t status = 0;
+    uint16_t ageMs = 0;
+    if (!parseHex(text, data)) data.clear();
+    if (!data.empty() && data[0] == SNAPSHOT_MARKER && decodeSnapshot(data.data(), data.size(), sample, status, ageMs)) {
+      if (!(status & SNAPSHOT_FRESH)) fprintf(stderr, "⚠️  Snapshot %s: sensor failed, values %u ms old\n", text.c_str(), ageMs);
+    } else if (decodeBeacon(data.data(), data.size(), sample)) {
+      // No position or time is broadcast, so the row has none either
+      sample.values[ARCHIVE_FLAGS] &= ~ARCHIVE_FLAG_FIX;
+    } else {
+      fprintf(stderr, "❌ Not an advertised reading or snapshot: %s\n", text.c_str());
+      ok = false;
+      continue;
+    }
+    SoilRecord soil;
+    DecodedRecord record;
+    archiveSampleToRecord(sample, soil);
+    size_t length = encodeRecordJson(soil, json, sizeof(json));
+    if (length == 0 || !decodeRecordJson(json, length, record)) return 1;
+    formatRecordCsv(record, row, sizeof(row));
+    printf("%s\n", row);
+  }
+  return ok ? 0 : 1;
+}
+
+// ============================================================================
+// BENCH
+// ============================================================================
+DecodedRecord syntheticRecord(uint32_t i) {
+  DecodedRecord r;
+  r.id = i + 1;
+  snprintf(r.timestamp, sizeof(r.timestamp), "2026-10-17T%02u:%02u:%02uZ", (4 + i / 3600) % 24, (i / 60) % 60, i % 60);
+  snprintf(r.timeUtc, sizeof(r.timeUtc), "%02u:%02u:%02u", (4 + i / 3600) % 24, (i / 60) % 60, i % 60);
+  strcpy(r.dateIst, "2026-10-17");
+  snprintf(r.timeIst, sizeof(r.timeIst), "%02u:%02u AM", (9 + i / 3600) % 12 + 1, (30 + i / 60) % 60);
+  r.latitude = 21.1458 + i * 0.00001;
+  r.longitude = 79.0882 + i * 0.000006;
+  r.locationValid = true;
+  r.satellites = 7 + i % 5;
+  r.altitude = 312.0;
+  r.speedKmh = 0.8;
+  r.hdop = 1.2;
+  r.ph = 5.2 + (i % 40) / 10.0;
+  strcpy(r.phCategory, r.ph < 5.5 ? "acidic" : r.ph < 6.5 ? "slightly_acidic" : r.ph < 7.5 ? "neutral" : "slightly_alkaline");
+  r.conductivity = 200 + (i * 7) % 900;
+  r.nitrogen = 20 + (i * 3) % 80;
+  r.phosphorus = 10 + (i * 5) % 50;
+  r.potassium = 90 + (i * 11) % 160;
+  r.moisture = 18.0 + (i % 250) / 10.0;
+  r.temperature = 21.5 + (i % 90) / 10.0;
+  r.sensorValid = true;
+  return r;
+}
+
+int runBench(const ReceiverOptions &opt) {
+  // Frame the whole history exactly as TransferEngine would
+  size_t chunk = (size_t)opt.mtu - 3;
+  std::vector<uint8_t> stream;
+  std::vector<std::pair<size_t, size_t> > notifications;
+  char json[1024];
+  char message[160];
+  uint64_t payloadBytes = 0;
+  auto emit = [&](const void* data, size_t length) {
+    notifications.push_back(std::make_pair(stream.size(), length));
+    stream.insert(stream.end(), (const uint8_t*)data, (const uint8_t*)data + length);
+  };
+  for (int i = 0; i < opt.records; i++) {
+    size_t length = formatRecordJson(syntheticRecord(i), json, sizeof(json));
+    char name[32];
+    snprintf(name, sizeof(name), "farmland_%d.json", i + 1);
+    emit(message, snprintf(message, sizeof(message), PROTO_FILE_START "%s" PROTO_SIZE_SEPARATOR "%lu", name, (unsigned long)length));
+    for (size_t off = 0; off < length; off += chunk) emit(json + off, length - off < chunk ? length - off : chunk);
+    emit(message, snprintf(message, sizeof(message), PROTO_FILE_END "%s", name));
+    payloadBytes += length;
+  }
+  emit(PROTO_COMPLETE_MESSAGE, strlen(PROTO_COMPLETE_MESSAGE));
+
+  // Pass 1: reassembly only
+  TransferReceiver reassemble;
+  uint64_t start = nowUs();
+  for (const auto &n : notifications) reassemble.push(stream.data() + n.first, n.second);
+  double reassemblySeconds = (nowUs() - start) / 1e6;
+
+  // Pass 2: reassembly + decode + CSV formatting
+  TransferReceiver receiver;
+  char line[1024];
+  uint64_t csvBytes = 0;
+  uint32_t decoded = 0;
+  start = nowUs();
+  for (const auto &n : notifications) {
+    if (receiver.push(stream.data() + n.first, n.second) != RECEIVER_FILE_DONE) continue;
+    DecodedRecord record;
+    const ReceivedFile &file = receiver.file();
+    if (decodeRecordJson((const char*)file.data.data(), file.data.size(), record)) {
+      decoded++;
+      csvBytes += formatRecordCsv(record, line, sizeof(line));
+    }
+  }
+  double decodeSeconds = (nowUs() - start) / 1e6;
+  if (reassemblySeconds <= 0) reassemblySeconds = 1e-6;
+  if (decodeSeconds <= 0) decodeSeconds = 1e-6;
+
+  bool ok = decoded == (uint32_t)opt.records && reassemble.stats().files == (uint32_t)opt.records &&
+            reassemble.stats().sizeMismatches == 0;
+  struct { const char* key; double value; } results[] = {
+    {"receiver.records", (double)opt.records},
+    {"receiver.mtu", (double)opt.mtu},
+    {"receiver.notifications", (double)notifications.size()},
+    {"receiver.reassembly_mb_per_s", payloadBytes / reassemblySeconds / 1e6},
+    {"receiver.reassembly_notifications_per_s", notifications.size() / reassemblySeconds},
+    {"receiver.decode_records_per_s", decoded / decodeSeconds},
+    {"receiver.decode_mb_per_s", payloadBytes / decodeSeconds / 1e6},
+    {"receiver.csv_bytes_per_record", decoded ? (double)csvBytes / decoded : 0.0},
+  };
+  for (const auto &r : results) printf("%-42s %14.1f\n", r.key, r.value);
+  if (!opt.jsonPath.empty()) {
+    FILE* f = fopen(opt.jsonPath.c_str(), "w");
+    if (!f) return 2;
+    fprintf(f, "{\n  \"schema\": 1");
+    for (const auto &r : results) fprintf(f, ",\n  \"%s\": %.3f", r.key, r.value);
+    fprintf(f, "\n}\n");
+    fclose(f);
+  }
+  if (!ok) fprintf(stderr, "❌ Round trip failed: %lu of %d records decoded\n", (unsigned long)decoded, opt.records);
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  ReceiverOptions opt;
+  if (!parseOptions(argc, argv, opt)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  if (opt.mode == "beacon") return runBeacon(opt);
+  return opt.mode == "decode" ? runDecode(opt) : runBench(opt);
+}
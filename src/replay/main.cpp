@@ -0,0 +1,214 @@
+// ============================================================================
+// AGNI SOIL SENSOR - RAW I/O TRACE REPLAY (host)
+// ============================================================================
+// Feeds a capture taken with CAPTURE_ON (the /trace folder from the card)
+// back through the same decoders the firmware uses:
+//
+//   pio run -e replay && .pio/build/replay/program --card /media/sdcard --speed 0
+//
+// RS485   request/response pairs are re-validated with checkModbusResponse()
+//         (no response / short frame / CRC error, with a hex dump on failure)
+// GPS     bytes go through the NMEA decoder; fix losses are reported
+// BLE     command writes are listed in order
+//
+// --speed 1 replays in real time, 10 ten times faster, 0 (default) as fast
+// as possible. A capture started after a reboot shows up as a new session.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <AgniSim.h>
+#include <AgniModbus.h>
+#include <AgniTrace.h>
+
+struct ReplayOptions {
+  std::string cardDir = "sim_sd";
+  double speed = 0;
+  bool verbose = false;
+  int maxFailureDumps = 20;
+};
+
+struct ModbusReplay {
+  bool open = false;
+  uint64_t requestUs = 0;
+  uint64_t firstByteUs = 0;
+  std::vector<uint8_t> request;
+  std::vector<uint8_t> response;
+  uint32_t results[4] = {0, 0, 0, 0};
+  uint64_t latencyTotalUs = 0;
+  uint32_t latencySamples = 0;
+  int dumps = 0;
+};
+
+struct GpsReplay {
+  NmeaParser parser;
+  bool hadFix = false;
+  uint64_t lostAtUs = 0;
+  uint32_t fixLosses = 0;
+  uint64_t longestOutageUs = 0;
+};
+
+const char* frameStatusName(ModbusFrameStatus status) {
+  switch (status) {
+    case MODBUS_FRAME_OK: return "ok";
+    case MODBUS_FRAME_NO_RESPONSE: return "no response";
+    case MODBUS_FRAME_SHORT: return "short frame";
+    case MODBUS_FRAME_CRC_ERROR: return "CRC error";
+  }
+  return "?";
+}
+
+void printHex(const char* label, const std::vector<uint8_t> &bytes) {
+  printf("      %s:", label);
+  for (size_t i = 0; i < bytes.size(); i++) printf(" %02X", bytes[i]);
+  printf("\n");
+}
+
+/** @brief Classifies the response collected since the last request. */
+void finishTransaction(ModbusReplay &mb, const ReplayOptions &opt) {
+  if (!mb.open) return;
+  ModbusFrameStatus status = checkModbusResponse(mb.response.data(), mb.response.size());
+  mb.results[status]++;
+  if (!mb.response.empty()) {
+    mb.latencyTotalUs += mb.firstByteUs - mb.requestUs;
+    mb.latencySamples++;
+  }
+  if (status != MODBUS_FRAME_OK && mb.dumps < opt.maxFailureDumps) {
+    mb.dumps++;
+    printf("   ❌ %10.3f s  RS485 %s\n", mb.requestUs / 1e6, frameStatusName(status));
+    printHex("request ", mb.request);
+    printHex("response", mb.response);
+  } else if (opt.verbose) {
+    printf("   %10.3f s  RS485 %s (%u bytes)\n", mb.requestUs / 1e6, frameStatusName(status), (unsigned)mb.response.size());
+  }
+  mb.open = false;
+}
+
+void replayGps(GpsReplay &gps, const TraceEvent &event) {
+  for (uint16_t i = 0; i < event.length; i++) {
+    if (!gps.parser.encode((char)event.data[i])) continue;
+    bool fix = gps.parser.fix().valid;
+    if (gps.hadFix && !fix) {
+      gps.lostAtUs = event.timestampUs;
+      gps.fixLosses++;
+      printf("   ⚠️  %10.3f s  GPS fix lost\n", event.timestampUs / 1e6);
+    } else if (!gps.hadFix && fix && gps.lostAtUs) {
+      uint64_t outage = event.timestampUs - gps.lostAtUs;
+      if (outage > gps.longestOutageUs) gps.longestOutageUs = outage;
+      printf("   🛰️  %10.3f s  GPS fix back after %.1f s\n", event.timestampUs / 1e6, outage / 1e6);
+    }
+    gps.hadFix = fix;
+  }
+}
+
+bool parseOptions(int argc, char** argv, ReplayOptions &opt) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0 || strcmp(arg, "-v") == 0) { opt.verbose = true; continue; }
+    if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) return false;
+    if (i + 1 >= argc) {
+      fprintf(stderr, "❌ Missing value for %s\n", arg);
+      return false;
+    }
+    const char* value = argv[++i];
+    if (strcmp(arg, "--card") == 0) opt.cardDir = value;
+    else if (strcmp(arg, "--speed") == 0) opt.speed = atof(value);
+    else if (strcmp(arg, "--max-dumps") == 0) opt.maxFailureDumps = atoi(value);
+    else {
+      fprintf(stderr, "❌ Unknown option %s\n", arg);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  ReplayOptions opt;
+  if (!parseOptions(argc, argv, opt)) {
+    printf("Usage: %s [--card DIR] [--speed X] [--verbose] [--max-dumps N]\n", argv[0]);
+    printf("  --card DIR   card root (or copy) holding " TRACE_DIR "/ (sim_sd)\n");
+    printf("  --speed X    1 = real time, 10 = 10x, 0 = as fast as possible (0)\n");
+    return 2;
+  }
+
+  HostFileSystem card(opt.cardDir);
+  TraceReader reader(card);
+  if (!reader.open()) {
+    fprintf(stderr, "❌ No trace segments in %s%s\n", opt.cardDir.c_str(), TRACE_DIR);
+    return 1;
+  }
+  printf("🎞️  Replaying %u segment(s) from %s%s\n", (unsigned)reader.segmentCount(), opt.cardDir.c_str(), TRACE_DIR);
+
+  HostClock wall;
+  ModbusReplay mb;
+  GpsReplay gps;
+  uint32_t events = 0;
+  uint32_t commands = 0;
+  uint32_t sessions = 0;
+  uint64_t sessionStartUs = 0;
+  uint64_t sessionWallUs = 0;
+  uint64_t lastUs = 0;
+  uint64_t capturedUs = 0;
+  TraceEvent event;
+
+  while (reader.next(event)) {
+    if (events == 0 || event.timestampUs < lastUs) {
+      // First event, or the clock went backwards: a capture from a later boot
+      finishTransaction(mb, opt);
+      if (events) capturedUs += lastUs - sessionStartUs;
+      sessions++;
+      sessionStartUs = event.timestampUs;
+      sessionWallUs = wall.micros();
+      printf("── session %u ──\n", sessions);
+    }
+    lastUs = event.timestampUs;
+    events++;
+
+    if (opt.speed > 0) {
+      uint64_t dueUs = sessionWallUs + (uint64_t)((event.timestampUs - sessionStartUs) / opt.speed);
+      uint64_t now = wall.micros();
+      if (dueUs > now) wall.sleepMs((uint32_t)((dueUs - now) / 1000));
+    }
+
+    switch (event.channel) {
+      case TRACE_RS485_TX:
+        finishTransaction(mb, opt);
+        mb.open = true;
+        mb.requestUs = event.timestampUs;
+        mb.request.assign(event.data, event.data + event.length);
+        mb.response.clear();
+        break;
+      case TRACE_RS485_RX:
+        if (!mb.open) break;   // bytes before the first request of the capture
+        if (mb.response.empty()) mb.firstByteUs = event.timestampUs;
+        mb.response.insert(mb.response.end(), event.data, event.data + event.length);
+        break;
+      case TRACE_GPS_RX:
+        replayGps(gps, event);
+        break;
+      case TRACE_BLE_COMMAND:
+        commands++;
+        printf("   📬 %10.3f s  BLE command: %.*s\n", event.timestampUs / 1e6, (int)event.length, (const char*)event.data);
+        break;
+      default:
+        break;
+    }
+  }
+  finishTransaction(mb, opt);
+  if (events) capturedUs += lastUs - sessionStartUs;
+
+  double wallSeconds = wall.micros() / 1e6;
+  printf("\n📊 %u events, %.1f s captured, replayed in %.3f s (%.0fx)\n", events, capturedUs / 1e6,
+    wallSeconds, wallSeconds > 0 ? capturedUs / 1e6 / wallSeconds : 0.0);
+  printf("📊 RS485: ok=%u noresp=%u short=%u crc=%u, mean first-byte latency %.1f ms\n",
+    mb.results[MODBUS_FRAME_OK], mb.results[MODBUS_FRAME_NO_RESPONSE], mb.results[MODBUS_FRAME_SHORT],
+    mb.results[MODBUS_FRAME_CRC_ERROR], mb.latencySamples ? mb.latencyTotalUs / 1e3 / mb.latencySamples : 0.0);
+  printf("📊 GPS: sentences ok=%u bad=%u, fix losses=%u, longest outage %.1f s\n",
+    gps.parser.passedChecksum(), gps.parser.failedChecksum(), gps.fixLosses, gps.longestOutageUs / 1e6);
+  printf("📊 BLE commands: %u\n", commands);
+  if (reader.corruptCount()) printf("⚠️  %u corrupt record(s) skipped\n", reader.corruptCount());
+  return 0;
+}
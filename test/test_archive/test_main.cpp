@@ -0,0 +1,130 @@
+// ============================================================================
+// AGNI SOIL SENSOR - ARCHIVE BLOCK TESTS (native)
+// ============================================================================
+// Columnar block encode/decode, header checks and the record <-> sample
+// conversion at the sensor's resolution.
+
+#include <string.h>
+#include <unity.h>
+
+#include <AgniArchive.h>
+
+void setUp() {}
+void tearDown() {}
+
+/** @brief A field walk: one sample every 15 minutes, readings drifting. */
+ArchiveSample walkSample(uint32_t i) {
+  SoilRecord record;
+  record.id = 1000 + i;
+  record.soil.moisture = 18.0f + (i % 250) / 10.0f;
+  record.soil.temperature = 21.5f - (i % 90) / 10.0f;
+  record.soil.conductivity = 200 + (i * 7) % 900;
+  record.soil.ph = 5.2f + (i % 40) / 10.0f;
+  record.soil.nitrogen = 20 + (i * 3) % 80;
+  record.soil.phosphorus = 10 + (i * 5) % 50;
+  record.soil.potassium = 90 + (i * 11) % 160;
+  record.soil.basicValid = true;
+  record.soil.npkValid = i % 5 != 0;
+  GpsFix &fix = record.fix;
+  fix.valid = i % 9 != 0;
+  fix.latitude = 21.1458f + i * 0.00001f;
+  fix.longitude = 79.0882f - i * 0.000006f;
+  fix.altitude = 312.0f;
+  fix.satellites = 7 + i % 5;
+  fix.speedKmh = 0.8;
+  fix.hdop = 1.2;
+  if (fix.valid) unixTimeToFix(1790000000 + i * 900, fix);
+  ArchiveSample sample;
+  archiveSampleFromRecord(record, sample);
+  return sample;
+}
+
+void test_full_block_round_trips() {
+  static ArchiveSample samples[ARCHIVE_BLOCK_SAMPLES];
+  static ArchiveSample decoded[ARCHIVE_BLOCK_SAMPLES];
+  static uint8_t block[ARCHIVE_BLOCK_MAX_BYTES];
+  for (uint32_t i = 0; i < ARCHIVE_BLOCK_SAMPLES; i++) samples[i] = walkSample(i);
+
+  size_t length = encodeArchiveBlock(samples, ARCHIVE_BLOCK_SAMPLES, block, sizeof(block));
+  TEST_ASSERT_GREATER_THAN_UINT(ARCHIVE_HEADER_BYTES, length);
+  // Columnar deltas beat the raw rows several times over
+  TEST_ASSERT_LESS_THAN_UINT(sizeof(samples) / 2, length);
+  TEST_ASSERT_EQUAL_UINT(ARCHIVE_BLOCK_SAMPLES, decodeArchiveBlock(block, length, decoded, ARCHIVE_BLOCK_SAMPLES));
+  TEST_ASSERT_EQUAL_MEMORY(samples, decoded, sizeof(samples));
+}
+
+void test_header_describes_the_block() {
+  ArchiveSample samples[10];
+  for (uint32_t i = 0; i < 10; i++) samples[i] = walkSample(i + 1);   // i + 1: the first has a fix
+  uint8_t block[ARCHIVE_BLOCK_MAX_BYTES];
+  size_t length = encodeArchiveBlock(samples, 10, block, sizeof(block));
+  TEST_ASSERT_EQUAL_MEMORY(ARCHIVE_MAGIC, block, 4);
+
+  ArchiveBlockInfo info;
+  TEST_ASSERT_TRUE(readArchiveHeader(block, length, info));
+  TEST_ASSERT_EQUAL_UINT16(10, info.count);
+  TEST_ASSERT_EQUAL_UINT32(samples[0].values[ARCHIVE_ID], info.firstId);
+  TEST_ASSERT_EQUAL_UINT32(samples[0].values[ARCHIVE_TIME], info.firstTime);
+  TEST_ASSERT_EQUAL_UINT32(samples[9].values[ARCHIVE_TIME], info.lastTime);
+}
+
+void test_columns_match_rows() {
+  ArchiveSample samples[40];
+  for (uint32_t i = 0; i < 40; i++) samples[i] = walkSample(i);
+  uint8_t block[ARCHIVE_BLOCK_MAX_BYTES];
+  size_t length = encodeArchiveBlock(samples, 40, block, sizeof(block));
+  static ArchiveColumns columns;
+  TEST_ASSERT_EQUAL_UINT(40, decodeArchiveColumns(block, length, columns));
+  for (int c = 0; c < ARCHIVE_COLUMNS; c++) {
+    for (int i = 0; i < 40; i++) TEST_ASSERT_EQUAL_INT32(samples[i].values[c], columns.values[c][i]);
+  }
+}
+
+void test_damaged_blocks_are_rejected() {
+  ArchiveSample samples[20];
+  for (uint32_t i = 0; i < 20; i++) samples[i] = walkSample(i);
+  uint8_t block[ARCHIVE_BLOCK_MAX_BYTES];
+  size_t length = encodeArchiveBlock(samples, 20, block, sizeof(block));
+  ArchiveSample decoded[20];
+  ArchiveBlockInfo info;
+
+  block[length / 2] ^= 0x10;   // payload bit flip: CRC
+  TEST_ASSERT_FALSE(readArchiveHeader(block, length, info));
+  TEST_ASSERT_EQUAL_UINT(0, decodeArchiveBlock(block, length, decoded, 20));
+  block[length / 2] ^= 0x10;
+
+  TEST_ASSERT_EQUAL_UINT(0, decodeArchiveBlock(block, length - 1, decoded, 20));   // truncated
+  TEST_ASSERT_EQUAL_UINT(0, decodeArchiveBlock(block, length, decoded, 19));       // no room
+  block[4] = ARCHIVE_VERSION + 1;
+  TEST_ASSERT_FALSE(readArchiveHeader(block, length, info));
+}
+
+void test_encode_needs_room() {
+  ArchiveSample samples[4];
+  for (uint32_t i = 0; i < 4; i++) samples[i] = walkSample(i);
+  uint8_t block[ARCHIVE_HEADER_BYTES + 8];
+  TEST_ASSERT_EQUAL_UINT(0, encodeArchiveBlock(samples, 4, block, sizeof(block)));
+}
+
+void test_sample_keeps_sensor_resolution() {
+  ArchiveSample sample = walkSample(1);
+  SoilRecord record;
+  archiveSampleToRecord(sample, record);
+  ArchiveSample again;
+  archiveSampleFromRecord(record, again);
+  TEST_ASSERT_EQUAL_MEMORY(&sample, &again, sizeof(sample));
+  TEST_ASSERT_EQUAL_UINT32(1001, record.id);
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, 18.1f, record.soil.moisture);
+  TEST_ASSERT_FLOAT_WITHIN(0.005f, 5.3f, record.soil.ph);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_full_block_round_trips);
+  RUN_TEST(test_header_describes_the_block);
+  RUN_TEST(test_columns_match_rows);
+  RUN_TEST(test_damaged_blocks_are_rejected);
+  RUN_TEST(test_encode_needs_room);
+  RUN_TEST(test_sample_keeps_sensor_resolution);
+  return UNITY_END();
+}
@@ -0,0 +1,143 @@
+// ============================================================================
+// AGNI SOIL SENSOR - LZ COMPRESSION TESTS (native)
+// ============================================================================
+// LzEncoder -> lzDecompress round trips with and without the record
+// dictionary, and the decoder's handling of damaged streams.
+
+#include <string.h>
+#include <unity.h>
+#include <string>
+#include <vector>
+
+#include <AgniCompress.h>
+#include <AgniRecord.h>
+
+void setUp() {}
+void tearDown() {}
+
+/** @brief Feeds input in pieces of at most step bytes, as the transfer engine does. */
+std::vector<uint8_t> compress(const uint8_t* data, size_t length, uint8_t dictionaryId, size_t step) {
+  static LzEncoder encoder;   // ~5 KB of state
+  size_t dictionaryLength = 0;
+  const uint8_t* dictionary = lzDictionary(dictionaryId, dictionaryLength);
+  encoder.begin(dictionary, dictionaryLength);
+  std::vector<uint8_t> out;
+  uint8_t buffer[64];
+  size_t offset = 0;
+  while (offset < length) {
+    size_t space = 0;
+    uint8_t* in = encoder.inputBuffer(space);
+    size_t n = length - offset;
+    if (n > space) n = space;
+    if (n > step) n = step;
+    memcpy(in, data + offset, n);
+    encoder.commitInput(n);
+    offset += n;
+    size_t got;
+    while ((got = encoder.read(buffer, sizeof(buffer))) > 0) out.insert(out.end(), buffer, buffer + got);
+  }
+  encoder.finish();
+  while (!encoder.done()) {
+    size_t got = encoder.read(buffer, sizeof(buffer));
+    out.insert(out.end(), buffer, buffer + got);
+  }
+  TEST_ASSERT_EQUAL_UINT32(length, encoder.inputBytes());
+  TEST_ASSERT_EQUAL_UINT32(out.size(), encoder.outputBytes());
+  return out;
+}
+
+void assertRoundTrip(const uint8_t* data, size_t length, uint8_t dictionaryId, size_t step) {
+  std::vector<uint8_t> packed = compress(data, length, dictionaryId, step);
+  size_t dictionaryLength = 0;
+  const uint8_t* dictionary = lzDictionary(dictionaryId, dictionaryLength);
+  std::vector<uint8_t> unpacked(length + 1);
+  size_t produced = lzDecompress(packed.data(), packed.size(), dictionary, dictionaryLength,
+                                 unpacked.data(), unpacked.size());
+  TEST_ASSERT_EQUAL_UINT(length, produced);
+  if (length) TEST_ASSERT_EQUAL_MEMORY(data, unpacked.data(), length);
+}
+
+std::string recordJson(uint32_t id) {
+  SoilRecord record;
+  record.id = id;
+  record.soil.moisture = 21.5f;
+  record.soil.temperature = 24.0f;
+  record.soil.ph = 6.8f;
+  record.soil.basicValid = true;
+  record.fix.valid = true;
+  record.fix.latitude = 21.1458f;
+  record.fix.longitude = 79.0882f;
+  char json[RECORD_JSON_MAX];
+  size_t length = encodeRecordJson(record, json, sizeof(json));
+  return std::string(json, length);
+}
+
+void test_record_round_trips_with_and_without_dictionary() {
+  std::string json = recordJson(42);
+  const uint8_t* data = (const uint8_t*)json.data();
+  assertRoundTrip(data, json.size(), LZ_DICTIONARY_NONE, json.size());
+  assertRoundTrip(data, json.size(), LZ_DICTIONARY_RECORD, json.size());
+  assertRoundTrip(data, json.size(), LZ_DICTIONARY_RECORD, 7);
+}
+
+void test_dictionary_shrinks_a_record() {
+  std::string json = recordJson(7);
+  size_t plain = compress((const uint8_t*)json.data(), json.size(), LZ_DICTIONARY_NONE, json.size()).size();
+  size_t primed = compress((const uint8_t*)json.data(), json.size(), LZ_DICTIONARY_RECORD, json.size()).size();
+  TEST_ASSERT_LESS_THAN_UINT(json.size(), primed);
+  TEST_ASSERT_LESS_THAN_UINT(plain, primed);
+}
+
+void test_long_and_incompressible_inputs_round_trip() {
+  // Several windows of repetitive text, then pseudo-random bytes
+  std::vector<uint8_t> data;
+  for (uint32_t id = 1; data.size() < 6 * LZ_WINDOW; id++) {
+    std::string json = recordJson(id);
+    data.insert(data.end(), json.begin(), json.end());
+  }
+  uint32_t seed = 1;
+  for (int i = 0; i < 3000; i++) {
+    seed = seed * 1103515245 + 12345;
+    data.push_back((uint8_t)(seed >> 16));
+  }
+  assertRoundTrip(data.data(), data.size(), LZ_DICTIONARY_NONE, 200);
+  assertRoundTrip(data.data(), data.size(), LZ_DICTIONARY_RECORD, 512);
+}
+
+void test_empty_input_round_trips() {
+  assertRoundTrip(NULL, 0, LZ_DICTIONARY_NONE, 1);
+}
+
+void test_unknown_dictionary_is_none() {
+  size_t length = 1;
+  TEST_ASSERT_NULL(lzDictionary(LZ_DICTIONARY_NONE, length));
+  TEST_ASSERT_EQUAL_UINT(0, length);
+  length = 1;
+  TEST_ASSERT_NULL(lzDictionary(200, length));
+  TEST_ASSERT_EQUAL_UINT(0, length);
+  TEST_ASSERT_NOT_NULL(lzDictionary(LZ_DICTIONARY_RECORD, length));
+  TEST_ASSERT_GREATER_THAN_UINT(0, length);
+}
+
+void test_damaged_streams_are_rejected() {
+  std::string json = recordJson(3) + recordJson(4);
+  std::vector<uint8_t> packed = compress((const uint8_t*)json.data(), json.size(), LZ_DICTIONARY_NONE, json.size());
+  std::vector<uint8_t> out(json.size());
+
+  // Too small an output buffer
+  TEST_ASSERT_EQUAL_UINT((size_t)-1, lzDecompress(packed.data(), packed.size(), NULL, 0, out.data(), json.size() / 2));
+  // A match reaching back before the start: decoded without the dictionary it was built with
+  std::vector<uint8_t> primed = compress((const uint8_t*)json.data(), json.size(), LZ_DICTIONARY_RECORD, json.size());
+  TEST_ASSERT_EQUAL_UINT((size_t)-1, lzDecompress(primed.data(), primed.size(), NULL, 0, out.data(), out.size()));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_record_round_trips_with_and_without_dictionary);
+  RUN_TEST(test_dictionary_shrinks_a_record);
+  RUN_TEST(test_long_and_incompressible_inputs_round_trip);
+  RUN_TEST(test_empty_input_round_trips);
+  RUN_TEST(test_unknown_dictionary_is_none);
+  RUN_TEST(test_damaged_streams_are_rejected);
+  return UNITY_END();
+}
@@ -0,0 +1,122 @@
+// ============================================================================
+// AGNI SOIL SENSOR - CONFIG STORE TESTS (native)
+// ============================================================================
+// Values saved through ConfigStore come back after a "reboot" (a new store
+// on the same NVS), and bad blobs or commands leave the defaults alone.
+
+#include <string.h>
+#include <unity.h>
+
+#include <AgniSim.h>
+#include <AgniConfig.h>
+
+#define TEST_NVS_DIR "test_config_nvs"
+
+HostKeyValueStore nvs(TEST_NVS_DIR);
+
+void setUp() { nvs.erase(CONFIG_NVS_KEY); }
+void tearDown() {}
+
+size_t command(ConfigStore &config, const char* text, char* out, uint32_t &changed) {
+  return config.handleCommand(text, strlen(text), out, CONFIG_RESPONSE_MAX, changed);
+}
+
+void test_defaults_without_a_blob() {
+  ConfigStore config(nvs);
+  TEST_ASSERT_FALSE(config.begin());
+  TEST_ASSERT_EQUAL_UINT32(1, config.stats().defaultsLoaded);
+  for (int k = 0; k < CONFIG_KEYS; k++) {
+    TEST_ASSERT_EQUAL_UINT32(configEntry(k).defaultValue, config.get((ConfigKey)k));
+  }
+}
+
+void test_set_survives_a_reboot() {
+  {
+    ConfigStore config(nvs);
+    config.begin();
+    TEST_ASSERT_TRUE(config.set(CONFIG_CHUNK_BYTES, 180));
+    TEST_ASSERT_TRUE(config.set(CONFIG_MODBUS_BAUD, 9600));
+    TEST_ASSERT_EQUAL_UINT32(2, config.stats().saves);
+  }
+  ConfigStore rebooted(nvs);
+  TEST_ASSERT_TRUE(rebooted.begin());
+  TEST_ASSERT_EQUAL_UINT32(180, rebooted.get(CONFIG_CHUNK_BYTES));
+  TEST_ASSERT_EQUAL_UINT32(9600, rebooted.get(CONFIG_MODBUS_BAUD));
+  TEST_ASSERT_EQUAL_UINT32(configEntry(CONFIG_LOG_INTERVAL_MS).defaultValue, rebooted.get(CONFIG_LOG_INTERVAL_MS));
+}
+
+void test_out_of_range_is_refused() {
+  ConfigStore config(nvs);
+  config.begin();
+  uint32_t generation = config.generation();
+  TEST_ASSERT_FALSE(config.set(CONFIG_CHUNK_BYTES, configEntry(CONFIG_CHUNK_BYTES).maximum + 1));
+  TEST_ASSERT_FALSE(config.set(CONFIG_CHUNK_BYTES, configEntry(CONFIG_CHUNK_BYTES).minimum - 1));
+  TEST_ASSERT_EQUAL_UINT32(configEntry(CONFIG_CHUNK_BYTES).defaultValue, config.get(CONFIG_CHUNK_BYTES));
+  TEST_ASSERT_EQUAL_UINT32(generation, config.generation());
+  TEST_ASSERT_EQUAL_UINT32(0, config.stats().saves);
+}
+
+void test_corrupt_blob_falls_back_to_defaults() {
+  {
+    ConfigStore config(nvs);
+    config.begin();
+    config.set(CONFIG_CHUNK_BYTES, 100);
+  }
+  uint8_t blob[256];
+  size_t length = nvs.read(CONFIG_NVS_KEY, blob, sizeof(blob));
+  TEST_ASSERT_GREATER_THAN_UINT(8, length);
+  blob[6] ^= 0x01;   // a value byte: the CRC no longer matches
+  TEST_ASSERT_TRUE(nvs.write(CONFIG_NVS_KEY, blob, length));
+
+  ConfigStore rebooted(nvs);
+  TEST_ASSERT_FALSE(rebooted.begin());
+  TEST_ASSERT_EQUAL_UINT32(configEntry(CONFIG_CHUNK_BYTES).defaultValue, rebooted.get(CONFIG_CHUNK_BYTES));
+}
+
+void test_commands_round_trip_through_nvs() {
+  char out[CONFIG_RESPONSE_MAX];
+  uint32_t changed = 0;
+  {
+    ConfigStore config(nvs);
+    config.begin();
+    command(config, "CONFIG_SET:chunk_bytes=200,chunk_interval_ms=10", out, changed);
+    TEST_ASSERT_EQUAL_STRING("CONFIG:chunk_bytes=200,chunk_interval_ms=10", out);
+    TEST_ASSERT_EQUAL_UINT32((1UL << CONFIG_CHUNK_BYTES) | (1UL << CONFIG_CHUNK_INTERVAL_MS), changed);
+
+    // All or nothing: one bad pair rejects the whole command
+    command(config, "CONFIG_SET:chunk_bytes=300,no_such_key=1", out, changed);
+    TEST_ASSERT_EQUAL_STRING(CONFIG_REJECTED ":no_such_key", out);
+    TEST_ASSERT_EQUAL_UINT32(0, changed);
+    TEST_ASSERT_EQUAL_UINT32(200, config.get(CONFIG_CHUNK_BYTES));
+  }
+  ConfigStore rebooted(nvs);
+  TEST_ASSERT_TRUE(rebooted.begin());
+  command(rebooted, "CONFIG_GET:chunk_bytes", out, changed);
+  TEST_ASSERT_EQUAL_STRING("CONFIG:chunk_bytes=200", out);
+
+  command(rebooted, "CONFIG_RESET", out, changed);
+  TEST_ASSERT_EQUAL_UINT32((1UL << CONFIG_CHUNK_BYTES) | (1UL << CONFIG_CHUNK_INTERVAL_MS), changed);
+  ConfigStore reset(nvs);
+  TEST_ASSERT_TRUE(reset.begin());
+  TEST_ASSERT_EQUAL_UINT32(configEntry(CONFIG_CHUNK_BYTES).defaultValue, reset.get(CONFIG_CHUNK_BYTES));
+}
+
+void test_unknown_text_is_not_a_command() {
+  ConfigStore config(nvs);
+  config.begin();
+  char out[CONFIG_RESPONSE_MAX];
+  uint32_t changed = 0;
+  TEST_ASSERT_EQUAL_UINT(0, command(config, "CONFIG_GETX", out, changed));
+  TEST_ASSERT_EQUAL_UINT(0, command(config, "START_TRANSFER", out, changed));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_defaults_without_a_blob);
+  RUN_TEST(test_set_survives_a_reboot);
+  RUN_TEST(test_out_of_range_is_refused);
+  RUN_TEST(test_corrupt_blob_falls_back_to_defaults);
+  RUN_TEST(test_commands_round_trip_through_nvs);
+  RUN_TEST(test_unknown_text_is_not_a_command);
+  return UNITY_END();
+}
@@ -0,0 +1,170 @@
+// ============================================================================
+// AGNI SOIL SENSOR - DEFERRED LOG TESTS (native)
+// ============================================================================
+// The per-core rings: drop accounting when a ring laps the drain, the
+// begin() keep/reset rule, both cores merged in time order, and a dump
+// formatting back into the same lines the drain would print.
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unity.h>
+
+#include <AgniSim.h>
+#include <AgniLog.h>
+
+#define TEST_SD_DIR  "test_log_sd"
+#define TEST_BUILD   0x1234
+
+static LogState state;
+
+/** @brief A state as random as .noinit after power-up. */
+void setUp() { memset((void*)&state, 0xA5, sizeof(state)); }
+void tearDown() {}
+
+void test_begin_resets_a_foreign_state() {
+  SimClock clock;
+  Logger logger(state, clock);
+  TEST_ASSERT_FALSE(logger.begin(TEST_BUILD));
+  TEST_ASSERT_EQUAL_UINT32(1, logger.boot());
+  TEST_ASSERT_EQUAL_UINT32(0, logger.written());
+  TEST_ASSERT_EQUAL_UINT32(0, logger.backlog());
+  LogRecord record;
+  TEST_ASSERT_FALSE(logger.next(record));
+  LogRecord history[4];
+  TEST_ASSERT_EQUAL_UINT(0, logger.history(history, 4));
+}
+
+void test_begin_keeps_the_same_build_only() {
+  SimClock clock;
+  {
+    Logger logger(state, clock);
+    logger.begin(TEST_BUILD);
+    for (int i = 0; i < 3; i++) logger.log(0, LOG_LEVEL_INFO, "before reset %d", i);
+  }
+  // Same build after a reset: the records stay readable but are not drained again
+  Logger logger(state, clock);
+  TEST_ASSERT_TRUE(logger.begin(TEST_BUILD));
+  TEST_ASSERT_EQUAL_UINT32(2, logger.boot());
+  TEST_ASSERT_EQUAL_UINT32(0, logger.written());
+  LogRecord record;
+  TEST_ASSERT_FALSE(logger.next(record));
+  LogRecord history[4];
+  TEST_ASSERT_EQUAL_UINT(3, logger.history(history, 4));
+  TEST_ASSERT_EQUAL_UINT(1, history[0].boot);
+  logger.log(1, LOG_LEVEL_WARN, "after reset");
+  TEST_ASSERT_TRUE(logger.next(record));
+  TEST_ASSERT_EQUAL_UINT(2, record.boot);
+
+  // A new build can't interpret the old format addresses
+  Logger flashed(state, clock);
+  TEST_ASSERT_FALSE(flashed.begin(TEST_BUILD + 1));
+  TEST_ASSERT_EQUAL_UINT32(1, flashed.boot());
+  TEST_ASSERT_EQUAL_UINT(0, flashed.history(history, 4));
+}
+
+void test_lapped_records_count_as_dropped() {
+  SimClock clock;
+  Logger logger(state, clock);
+  logger.begin(TEST_BUILD);
+  for (uint32_t i = 0; i < 5; i++) logger.log(0, LOG_LEVEL_INFO, "n=%u", i);
+  LogRecord record;
+  TEST_ASSERT_TRUE(logger.next(record));
+  TEST_ASSERT_TRUE(logger.next(record));
+  // The ring laps the drain: records 2-4 are overwritten before it gets there
+  for (uint32_t i = 5; i < 5 + LOG_RING_RECORDS; i++) logger.log(0, LOG_LEVEL_INFO, "n=%u", i);
+  TEST_ASSERT_EQUAL_UINT32(LOG_RING_RECORDS + 3, logger.backlog());
+  uint32_t expected = 5;
+  while (logger.next(record)) {
+    TEST_ASSERT_EQUAL_UINT32(expected, record.args[0].u);
+    expected++;
+  }
+  TEST_ASSERT_EQUAL_UINT32(5 + LOG_RING_RECORDS, expected);
+  TEST_ASSERT_EQUAL_UINT32(3, logger.stats().dropped);
+  TEST_ASSERT_EQUAL_UINT32(2 + LOG_RING_RECORDS, logger.stats().drained);
+  TEST_ASSERT_EQUAL_UINT32(0, logger.backlog());
+  TEST_ASSERT_EQUAL_UINT32(5 + LOG_RING_RECORDS, logger.written());
+}
+
+void test_cores_merge_in_time_order() {
+  SimClock clock;
+  Logger logger(state, clock);
+  logger.begin(TEST_BUILD);
+  // Bursts on one core, then the other, as the two tasks actually log
+  const uint8_t cores[] = {0, 0, 1, 1, 1, 0, 1, 0};
+  for (uint32_t i = 0; i < sizeof(cores); i++) {
+    clock.advanceUs(1500);
+    logger.log(cores[i], LOG_LEVEL_DEBUG, "step %u", i);
+  }
+  LogRecord record;
+  for (uint32_t i = 0; i < sizeof(cores); i++) {
+    TEST_ASSERT_TRUE(logger.next(record));
+    TEST_ASSERT_EQUAL_UINT32(i, record.args[0].u);
+    TEST_ASSERT_EQUAL_UINT(cores[i], record.core);
+  }
+  TEST_ASSERT_FALSE(logger.next(record));
+  TEST_ASSERT_EQUAL_UINT32(0, logger.stats().dropped);
+}
+
+void test_dump_decodes_to_the_drained_lines() {
+  SimClock clock;
+  Logger logger(state, clock);
+  logger.begin(TEST_BUILD);
+  char name[32] = "farmland_12.json";
+  clock.advanceUs(2000000);
+  logger.log(0, LOG_LEVEL_INFO, "📤 %s: %u bytes in %lld us", logCopy(name), 4096u, 123456789012LL);
+  strcpy(name, "overwritten");
+  clock.advanceUs(1250);
+  logger.log(1, LOG_LEVEL_WARN, "sensor %s %.1f%% (%d)", "moisture", 23.5f, -3);
+  clock.advanceUs(1000);
+  logger.log(1, LOG_LEVEL_ERROR, "no arguments, 100%% literal");
+  clock.advanceUs(1000);
+  logger.log(0, LOG_LEVEL_INFO, "sensor %s again", "moisture");
+
+  LogRecord records[8];
+  size_t count = logger.history(records, 8);
+  TEST_ASSERT_EQUAL_UINT(4, count);
+  std::vector<std::string> expected;
+  char line[LOG_LINE_MAX];
+  for (size_t i = 0; i < count; i++) {
+    int prefix = snprintf(line, sizeof(line), "#%u ", (unsigned)records[i].boot);
+    formatLogRecord(records[i], line + prefix, sizeof(line) - prefix);
+    expected.push_back(line);
+  }
+  TEST_ASSERT_EQUAL_STRING("#1 [   2.000] I 📤 farmland_12.json: 4096 bytes in 123456789012 us", expected[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("#1 [   2.001] W sensor moisture 23.5% (-3)", expected[1].c_str());
+
+  HostFileSystem fs(TEST_SD_DIR);
+  {
+    std::unique_ptr<HalFile> file = fs.open("/log_1.agl", HAL_FILE_WRITE);
+    TEST_ASSERT_NOT_NULL(file.get());
+    TEST_ASSERT_TRUE(writeLogDump(*file, records, count, logger.boot(), 7));
+    file->close();
+  }
+  std::unique_ptr<HalFile> file = fs.open("/log_1.agl", HAL_FILE_READ);
+  TEST_ASSERT_NOT_NULL(file.get());
+  std::vector<uint8_t> dump(file->size());
+  TEST_ASSERT_EQUAL_UINT(dump.size(), file->read(dump.data(), dump.size()));
+  file->close();
+  fs.remove("/log_1.agl");
+
+  std::vector<std::string> lines;
+  TEST_ASSERT_TRUE(decodeLogDump(dump.data(), dump.size(), lines));
+  TEST_ASSERT_EQUAL_UINT(count, lines.size());
+  for (size_t i = 0; i < count; i++) TEST_ASSERT_EQUAL_STRING(expected[i].c_str(), lines[i].c_str());
+
+  // A cut-off dump is refused rather than half decoded
+  lines.clear();
+  TEST_ASSERT_FALSE(decodeLogDump(dump.data(), dump.size() - 3, lines));
+  TEST_ASSERT_FALSE(decodeLogDump(dump.data(), LOG_DUMP_HEADER_BYTES - 1, lines));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_resets_a_foreign_state);
+  RUN_TEST(test_begin_keeps_the_same_build_only);
+  RUN_TEST(test_lapped_records_count_as_dropped);
+  RUN_TEST(test_cores_merge_in_time_order);
+  RUN_TEST(test_dump_decodes_to_the_drained_lines);
+  return UNITY_END();
+}
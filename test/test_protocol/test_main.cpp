@@ -0,0 +1,159 @@
+// ============================================================================
+// AGNI SOIL SENSOR - PROTOCOL TESTS (native)
+// ============================================================================
+// NACK and record-range parsing, and the transfer engine's checks on the
+// file a NACK names. Run with `pio test -e native`.
+
+#include <string.h>
+#include <unity.h>
+
+#include <AgniSim.h>
+#include <AgniProtocol.h>
+#include <AgniRecord.h>
+#include <AgniStorage.h>
+#include <AgniTransfer.h>
+
+void setUp() {}
+void tearDown() {}
+
+void test_nack_parses_name_and_ranges() {
+  const char* text = "NACK:farmland_3.json|0-2,5,9-12";
+  char name[PROTO_NAME_MAX];
+  ChunkRange ranges[PROTO_MAX_NACK_RANGES];
+  size_t count = 0;
+  TEST_ASSERT_TRUE(parseNack(text, strlen(text), name, sizeof(name), ranges, PROTO_MAX_NACK_RANGES, count));
+  TEST_ASSERT_EQUAL_STRING("farmland_3.json", name);
+  TEST_ASSERT_EQUAL_UINT(3, count);
+  TEST_ASSERT_EQUAL_UINT16(0, ranges[0].first);
+  TEST_ASSERT_EQUAL_UINT16(2, ranges[0].last);
+  TEST_ASSERT_EQUAL_UINT16(5, ranges[1].first);
+  TEST_ASSERT_EQUAL_UINT16(5, ranges[1].last);
+  TEST_ASSERT_EQUAL_UINT16(9, ranges[2].first);
+  TEST_ASSERT_EQUAL_UINT16(12, ranges[2].last);
+}
+
+void test_nack_rejects_malformed_text() {
+  char name[PROTO_NAME_MAX];
+  ChunkRange ranges[PROTO_MAX_NACK_RANGES];
+  size_t count = 0;
+  const char* bad[] = {
+    "NACK:",                       // nothing after the prefix
+    "NACK:farmland_3.json",        // no ranges
+    "NACK:|1-2",                   // no name
+    "NACK:farmland_3.json|x",      // not a number
+    "NACK:farmland_3.json|5-2",    // backwards range
+    "NACK:farmland_3.json|70000",  // beyond a chunk index
+    "START_TRANSFER",
+  };
+  for (const char* text : bad) {
+    TEST_ASSERT_FALSE_MESSAGE(parseNack(text, strlen(text), name, sizeof(name), ranges, PROTO_MAX_NACK_RANGES, count),
+                              text);
+  }
+  // A name that does not fit the caller's buffer
+  const char* text = "NACK:farmland_123456.json|1";
+  TEST_ASSERT_FALSE(parseNack(text, strlen(text), name, 8, ranges, PROTO_MAX_NACK_RANGES, count));
+}
+
+void test_nack_stops_at_max_ranges() {
+  const char* text = "NACK:f|1,2,3,4";
+  char name[PROTO_NAME_MAX];
+  ChunkRange ranges[2];
+  size_t count = 0;
+  TEST_ASSERT_TRUE(parseNack(text, strlen(text), name, sizeof(name), ranges, 2, count));
+  TEST_ASSERT_EQUAL_UINT(2, count);
+  TEST_ASSERT_EQUAL_UINT16(2, ranges[1].first);
+}
+
+void test_nack_format_round_trips() {
+  const ChunkRange ranges[] = {{0, 0}, {4, 7}, {65535, 65535}};
+  char text[PROTO_NAME_MAX + 64];
+  size_t length = formatNack(text, sizeof(text), "farmland_9.json", ranges, 3);
+  TEST_ASSERT_EQUAL_STRING("NACK:farmland_9.json|0,4-7,65535", text);
+  TEST_ASSERT_EQUAL_UINT(strlen(text), length);
+
+  char name[PROTO_NAME_MAX];
+  ChunkRange parsed[PROTO_MAX_NACK_RANGES];
+  size_t count = 0;
+  TEST_ASSERT_TRUE(parseNack(text, length, name, sizeof(name), parsed, PROTO_MAX_NACK_RANGES, count));
+  TEST_ASSERT_EQUAL_STRING("farmland_9.json", name);
+  TEST_ASSERT_EQUAL_UINT(3, count);
+  TEST_ASSERT_EQUAL_MEMORY(ranges, parsed, sizeof(ranges));
+}
+
+void test_nack_format_drops_ranges_that_do_not_fit() {
+  const ChunkRange ranges[] = {{1, 2}, {10, 20}, {300, 400}};
+  char text[24];   // "NACK:f.json|" + "1-2,10-20" fits, ",300-400" doesn't
+  size_t length = formatNack(text, sizeof(text), "f.json", ranges, 3);
+  TEST_ASSERT_EQUAL_STRING("NACK:f.json|1-2,10-20", text);
+  TEST_ASSERT_EQUAL_UINT(strlen(text), length);
+
+  char tiny[14];   // not even the first range
+  TEST_ASSERT_EQUAL_UINT(0, formatNack(tiny, sizeof(tiny), "f.json", ranges, 3));
+}
+
+void test_record_ranges_parse_until_the_next_option() {
+  const char* text = "1-3,7,10-12|LZ:1";
+  RecordRange ranges[PROTO_MAX_RECORD_RANGES];
+  size_t count = 0;
+  TEST_ASSERT_TRUE(parseRecordRanges(text, strlen(text), ranges, PROTO_MAX_RECORD_RANGES, count));
+  TEST_ASSERT_EQUAL_UINT(3, count);
+  TEST_ASSERT_EQUAL_UINT32(1, ranges[0].first);
+  TEST_ASSERT_EQUAL_UINT32(3, ranges[0].last);
+  TEST_ASSERT_EQUAL_UINT32(7, ranges[1].first);
+  TEST_ASSERT_EQUAL_UINT32(7, ranges[1].last);
+  TEST_ASSERT_EQUAL_UINT32(12, ranges[2].last);
+}
+
+void test_record_ranges_reject_invalid_lists() {
+  RecordRange ranges[PROTO_MAX_RECORD_RANGES];
+  size_t count = 0;
+  const char* bad[] = {"", "0", "0-4", "5-2", "abc", "|1-2"};
+  for (const char* text : bad) {
+    TEST_ASSERT_FALSE_MESSAGE(parseRecordRanges(text, strlen(text), ranges, PROTO_MAX_RECORD_RANGES, count), text);
+  }
+  // The valid prefix of a list is kept
+  const char* text = "4,9-x";
+  TEST_ASSERT_TRUE(parseRecordRanges(text, strlen(text), ranges, PROTO_MAX_RECORD_RANGES, count));
+  TEST_ASSERT_EQUAL_UINT(1, count);
+  TEST_ASSERT_EQUAL_UINT32(4, ranges[0].first);
+}
+
+void test_resend_accepts_only_plain_file_names() {
+  SimClock clock;
+  HostFileSystem fs("test_protocol_sd");
+  RecordStore store(fs, clock);
+  TEST_ASSERT_TRUE(store.begin());
+  store.wipe();
+  const char json[] = "{\"id\":1}";
+  TEST_ASSERT_TRUE(store.append(json, sizeof(json) - 1));
+
+  SimBleConfig ble;
+  SimBleSink sink(clock, ble);
+  TransferEngine engine(fs, sink, clock);
+  TEST_ASSERT_TRUE(engine.start(RECORD_DIR, PROTO_VERSION_SEQUENCED));
+
+  const ChunkRange range = {0, 0};
+  const char* escapes[] = {"../config", "..", "sub/farmland_1.json", "/etc/passwd", ""};
+  for (const char* name : escapes) {
+    TEST_ASSERT_FALSE_MESSAGE(engine.requestResend(name, &range, 1), name);
+  }
+  TEST_ASSERT_EQUAL_UINT32(5, engine.stats().nacksRejected);
+  TEST_ASSERT_TRUE(engine.requestResend("farmland_1.json", &range, 1));
+
+  engine.abort();
+  engine.pump();
+  store.wipe();
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_nack_parses_name_and_ranges);
+  RUN_TEST(test_nack_rejects_malformed_text);
+  RUN_TEST(test_nack_stops_at_max_ranges);
+  RUN_TEST(test_nack_format_round_trips);
+  RUN_TEST(test_nack_format_drops_ranges_that_do_not_fit);
+  RUN_TEST(test_record_ranges_parse_until_the_next_option);
+  RUN_TEST(test_record_ranges_reject_invalid_lists);
+  RUN_TEST(test_resend_accepts_only_plain_file_names);
+  return UNITY_END();
+}